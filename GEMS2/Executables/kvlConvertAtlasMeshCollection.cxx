@@ -0,0 +1,50 @@
+#include "kvlAtlasMeshCollection.h"
+
+#include <string>
+
+
+int main( int argc, char** argv )   
+{
+  // Sanity check on input
+  if ( ( argc < 3 ) || ( argc > 4 ) )
+    {
+    std::cerr << "Usage: "<< argv[ 0 ] << " inputMeshCollection outputMeshCollection [binary|text]" << std::endl;
+    std::cerr << "   inputMeshCollection can be in either format (the format is detected automatically)" << std::endl;
+    std::cerr << "   the output is written in the binary format unless \"text\" is given, " << std::endl;
+    std::cerr << "   in which case \".gz\" is appended to outputMeshCollection" << std::endl;
+    return -1;
+    }
+
+  std::string  format = "binary";
+  if ( argc > 3 )
+    {
+    format = argv[ 3 ];
+    }
+  if ( ( format != "binary" ) && ( format != "text" ) )
+    {
+    std::cerr << "Unknown format: " << format << std::endl;
+    return -1;
+    }
+
+
+  // Read mesh collection from file
+  kvl::AtlasMeshCollection::Pointer  collection =  kvl::AtlasMeshCollection::New();
+  if ( !collection->Read( argv[ 1 ] ) )
+    {
+    std::cerr << "Couldn't read mesh collection from file " << argv[ 1 ] << std::endl;
+    return -1;
+    }
+
+  // Write it out again
+  const bool  success = ( format == "binary" ) ? collection->WriteBinary( argv[ 2 ] ) : 
+                                                 collection->Write( argv[ 2 ] );
+  if ( !success )
+    {
+    std::cerr << "Couldn't write mesh collection to file " << argv[ 2 ] << std::endl;
+    return -1;
+    }
+
+  std::cout << "Wrote " << format << " mesh collection to " << argv[ 2 ] << std::endl;
+
+  return 0;
+}
@@ -6,6 +6,9 @@
 
 #include "kvlAtlasMesh.h"
 #include "kvlAtlasMeshAlphaDrawer.h"
+#include "kvlAtlasMeshAlphaDrawerCPU.h"
+#include "kvlAtlasMeshMultiAlphaDrawer.h"
+#include "kvlAtlasMeshMultiAlphaDrawerCPU.h"
 #include "atlasmeshalphadrawer.hpp"
 #include "atlasmeshalphadrawercpuwrapper.hpp"
 
@@ -139,6 +142,26 @@ BOOST_DATA_TEST_CASE( ContainedLargeCube,  boost::unit_test::data::xrange(nAlpha
   SingleConstantTetrahedronContainedCube( &ad, classNumber, nAlphas, 23 );
 }
 
+BOOST_DATA_TEST_CASE( ContainedUnitCubeCPU,  boost::unit_test::data::xrange(nAlphas), classNumber )
+{
+  for( bool useAVX2 : { false, true } ) {
+    kvl::AtlasMeshAlphaDrawerCPU::Pointer ad = kvl::AtlasMeshAlphaDrawerCPU::New();
+    ad->SetUseAVX2( useAVX2 );
+
+    SingleConstantTetrahedronContainedCube( ad.GetPointer(), classNumber, nAlphas, 2 );
+  }
+}
+
+BOOST_DATA_TEST_CASE( ContainedLargeCubeCPU,  boost::unit_test::data::xrange(nAlphas), classNumber )
+{
+  for( bool useAVX2 : { false, true } ) {
+    kvl::AtlasMeshAlphaDrawerCPU::Pointer ad = kvl::AtlasMeshAlphaDrawerCPU::New();
+    ad->SetUseAVX2( useAVX2 );
+
+    SingleConstantTetrahedronContainedCube( ad.GetPointer(), classNumber, nAlphas, 23 );
+  }
+}
+
 #ifdef CUDA_FOUND
 BOOST_DATA_TEST_CASE( ContainedUnitCubeGPU,  boost::unit_test::data::xrange(nAlphas), classNumber )
 {
@@ -181,6 +204,60 @@ BOOST_AUTO_TEST_CASE( ReferenceImpl )
   BOOST_TEST_MESSAGE( "Interpolate Time (repeat) : " << ad.tInterpolate );
 }
 
+BOOST_AUTO_TEST_CASE( CPUImpl )
+{
+  const int classNumber = 1;
+
+  // The CPU implementation must match the reference exactly,
+  // with and without AVX2
+  const float percentTolerance = 0;
+
+  for( bool useAVX2 : { false, true } ) {
+    kvl::AtlasMeshAlphaDrawerCPU::Pointer ad = kvl::AtlasMeshAlphaDrawerCPU::New();
+    ad->SetUseAVX2( useAVX2 );
+    BOOST_TEST_MESSAGE( "Using AVX2 : " << ad->GetUseAVX2() );
+
+    // Note that image and mesh are supplied by TestFileLoader
+    CheckAlphaDrawer( ad.GetPointer(), image, mesh, classNumber, percentTolerance );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( MultiCPUImpl )
+{
+  // The CPU implementation interpolates the alphas from the baricentric coordinates of each
+  // voxel rather than incrementally, so it only matches the reference up to rounding. The
+  // voxels visited must be exactly the same
+  const float absoluteTolerance = 1e-5;
+
+  kvl::AtlasMeshMultiAlphaDrawer::Pointer  originalAD = kvl::AtlasMeshMultiAlphaDrawer::New();
+  originalAD->SetRegions( image->GetLargestPossibleRegion() );
+  originalAD->Rasterize( mesh );
+
+  for( bool useAVX2 : { false, true } ) {
+    kvl::AtlasMeshMultiAlphaDrawerCPU::Pointer ad = kvl::AtlasMeshMultiAlphaDrawerCPU::New();
+    ad->SetUseAVX2( useAVX2 );
+    BOOST_TEST_MESSAGE( "Using AVX2 : " << ad->GetUseAVX2() );
+
+    ad->SetRegions( image->GetLargestPossibleRegion() );
+    ad->Rasterize( mesh );
+
+    itk::ImageRegionConstIteratorWithIndex<kvl::AtlasMeshMultiAlphaDrawerCPU::ImageType>
+      it( ad->GetImage(), ad->GetImage()->GetBufferedRegion() );
+    itk::ImageRegionConstIteratorWithIndex<kvl::AtlasMeshMultiAlphaDrawer::ImageType>
+      itOrig( originalAD->GetImage(), originalAD->GetImage()->GetBufferedRegion() );
+
+    for( ; !it.IsAtEnd(); ++it, ++itOrig ) {
+      BOOST_TEST_CONTEXT( "Voxel Index: " << it.GetIndex() ) {
+        BOOST_REQUIRE_EQUAL( it.Value().Size(), itOrig.Value().Size() );
+        BOOST_CHECK_EQUAL( it.Value().sum() == 0, itOrig.Value().sum() == 0 );
+        for( unsigned int classNumber = 0; classNumber < it.Value().Size(); classNumber++ ) {
+          BOOST_CHECK_SMALL( it.Value()[ classNumber ] - itOrig.Value()[ classNumber ], absoluteTolerance );
+        }
+      }
+    }
+  }
+}
+
 #ifdef CUDA_FOUND
 BOOST_AUTO_TEST_CASE( CudaImpl )
 {
@@ -0,0 +1,91 @@
+#include <boost/test/unit_test.hpp>
+
+#include "kvlAtlasMeshCollection.h"
+
+#include "testfileloader.hpp"
+
+
+// Check that two collections hold exactly the same points, cells, alphas and positions
+void CheckCollectionsEqual( const kvl::AtlasMeshCollection* expected,
+                            const kvl::AtlasMeshCollection* actual )
+{
+  BOOST_CHECK_EQUAL( expected->GetK(), actual->GetK() );
+  BOOST_REQUIRE_EQUAL( expected->GetNumberOfMeshes(), actual->GetNumberOfMeshes() );
+  BOOST_REQUIRE_EQUAL( expected->GetReferencePosition()->Size(), actual->GetReferencePosition()->Size() );
+  BOOST_REQUIRE_EQUAL( expected->GetCells()->Size(), actual->GetCells()->Size() );
+  BOOST_REQUIRE_EQUAL( expected->GetPointParameters()->Size(), actual->GetPointParameters()->Size() );
+
+  for( auto pointIt = expected->GetReferencePosition()->Begin();
+       pointIt != expected->GetReferencePosition()->End();
+       ++pointIt ) {
+    const auto id = pointIt.Index();
+    for( int i=0; i<3; i++ ) {
+      BOOST_CHECK_EQUAL( pointIt.Value()[i], actual->GetReferencePosition()->ElementAt(id)[i] );
+      for( unsigned int meshNumber=0; meshNumber<expected->GetNumberOfMeshes(); meshNumber++ ) {
+        BOOST_CHECK_EQUAL( expected->GetPositions()[meshNumber]->ElementAt(id)[i],
+                           actual->GetPositions()[meshNumber]->ElementAt(id)[i] );
+      }
+    }
+
+    const kvl::PointParameters& expectedParameters = expected->GetPointParameters()->ElementAt(id);
+    const kvl::PointParameters& actualParameters = actual->GetPointParameters()->ElementAt(id);
+    BOOST_REQUIRE_EQUAL( expectedParameters.m_Alphas.size(), actualParameters.m_Alphas.size() );
+    for( unsigned int i=0; i<expectedParameters.m_Alphas.size(); i++ ) {
+      BOOST_CHECK_EQUAL( expectedParameters.m_Alphas[i], actualParameters.m_Alphas[i] );
+    }
+    BOOST_CHECK_EQUAL( expectedParameters.m_CanChangeAlphas, actualParameters.m_CanChangeAlphas );
+    BOOST_CHECK_EQUAL( expectedParameters.m_CanMoveX, actualParameters.m_CanMoveX );
+    BOOST_CHECK_EQUAL( expectedParameters.m_CanMoveY, actualParameters.m_CanMoveY );
+    BOOST_CHECK_EQUAL( expectedParameters.m_CanMoveZ, actualParameters.m_CanMoveZ );
+  }
+
+  for( auto cellIt = expected->GetCells()->Begin();
+       cellIt != expected->GetCells()->End();
+       ++cellIt ) {
+    const kvl::AtlasMesh::CellType* expectedCell = cellIt.Value();
+    const kvl::AtlasMesh::CellType* actualCell = actual->GetCells()->ElementAt( cellIt.Index() );
+    BOOST_REQUIRE_EQUAL( expectedCell->GetType(), actualCell->GetType() );
+    BOOST_REQUIRE_EQUAL( expectedCell->GetNumberOfPoints(), actualCell->GetNumberOfPoints() );
+    for( unsigned int i=0; i<expectedCell->GetNumberOfPoints(); i++ ) {
+      BOOST_CHECK_EQUAL( expectedCell->GetPointIds()[i], actualCell->GetPointIds()[i] );
+    }
+  }
+}
+
+// ==========================================
+
+BOOST_AUTO_TEST_SUITE( AtlasMeshCollection )
+
+BOOST_FIXTURE_TEST_SUITE( ActualImage, TestFileLoader )
+
+BOOST_AUTO_TEST_CASE( BinaryRoundTrip )
+{
+  // Note that meshCollection is supplied by TestFileLoader
+  BOOST_REQUIRE( meshCollection->WriteBinary( "test.bin" ) );
+
+  kvl::AtlasMeshCollection::Pointer binaryCollection = kvl::AtlasMeshCollection::New();
+  BOOST_REQUIRE( binaryCollection->Read( "test.bin" ) );
+
+  CheckCollectionsEqual( meshCollection, binaryCollection );
+}
+
+BOOST_AUTO_TEST_CASE( TextFromBinary )
+{
+  // Going through the binary format shouldn't change what ends up in a text file
+  BOOST_REQUIRE( meshCollection->Write( "testDirect.txt" ) );
+  kvl::AtlasMeshCollection::Pointer directCollection = kvl::AtlasMeshCollection::New();
+  BOOST_REQUIRE( directCollection->Read( "testDirect.txt" ) );
+
+  BOOST_REQUIRE( meshCollection->WriteBinary( "test.bin" ) );
+  kvl::AtlasMeshCollection::Pointer binaryCollection = kvl::AtlasMeshCollection::New();
+  BOOST_REQUIRE( binaryCollection->Read( "test.bin" ) );
+  BOOST_REQUIRE( binaryCollection->Write( "testFromBinary.txt" ) );
+  kvl::AtlasMeshCollection::Pointer textCollection = kvl::AtlasMeshCollection::New();
+  BOOST_REQUIRE( textCollection->Read( "testFromBinary.txt" ) );
+
+  CheckCollectionsEqual( directCollection, textCollection );
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -13,6 +13,7 @@
 #include "kvlAtlasMesh.h"
 #include "atlasmeshvisitcounter.hpp"
 #include "atlasmeshvisitcountercpuwrapper.hpp"
+#include "kvlAtlasMeshVisitCounterCPU.h"
 #ifdef CUDA_FOUND
 #include "cudaimage.hpp"
 #include "atlasmeshvisitcountercuda.hpp"
@@ -525,6 +526,30 @@ BOOST_AUTO_TEST_CASE( AutoCornersLargeImageLargeTetrahedronCPU )
   AutoCorners( &visitCounter, 4, 4  );
 }
 
+BOOST_DATA_TEST_CASE( ExactCornersSIMD, boost::unit_test::data::xrange(2), useAVX2 )
+{
+  kvl::AtlasMeshVisitCounterCPU::Pointer visitCounter = kvl::AtlasMeshVisitCounterCPU::New();
+  visitCounter->SetUseAVX2( useAVX2 );
+
+  LowerCorner( visitCounter.GetPointer() );
+  OriginOnly( visitCounter.GetPointer() );
+  XAxisOnly( visitCounter.GetPointer() );
+  FarCornerOnly( visitCounter.GetPointer() );
+  UpperCornerOnly( visitCounter.GetPointer() );
+  NoVertices( visitCounter.GetPointer() );
+  LowerCornerExact( visitCounter.GetPointer() );
+  UpperCornerExact( visitCounter.GetPointer() );
+}
+
+BOOST_DATA_TEST_CASE( AutoCornersSIMD, boost::unit_test::data::xrange(2), useAVX2 )
+{
+  kvl::AtlasMeshVisitCounterCPU::Pointer visitCounter = kvl::AtlasMeshVisitCounterCPU::New();
+  visitCounter->SetUseAVX2( useAVX2 );
+
+  AutoCorners( visitCounter.GetPointer(), 1, 1 );
+  AutoCorners( visitCounter.GetPointer(), 4, 4 );
+}
+
 #ifdef CUDA_FOUND
 BOOST_AUTO_TEST_CASE_TEMPLATE( LowerCornerGPUSimple, ImplType, CUDAImplTypes  )
 {
@@ -661,6 +686,16 @@ BOOST_AUTO_TEST_CASE( ReferenceImpl )
   BOOST_TEST_MESSAGE( "VisitCounter Time: " << visitCounter.tVisitCount );
 }
 
+BOOST_DATA_TEST_CASE( SIMDImpl, boost::unit_test::data::xrange(2), useAVX2 )
+{
+  kvl::AtlasMeshVisitCounterCPU::Pointer visitCounter = kvl::AtlasMeshVisitCounterCPU::New();
+  visitCounter->SetUseAVX2( useAVX2 );
+  BOOST_TEST_MESSAGE( "Using AVX2 : " << visitCounter->GetUseAVX2() );
+
+  // Note that image and mesh are supplied by TestFileLoader
+  CheckVisitCounter( visitCounter.GetPointer(), image, mesh );
+}
+
 #ifdef CUDA_FOUND
 BOOST_AUTO_TEST_CASE_TEMPLATE( SimpleCUDAImpl, ImplType, CUDAImplTypes )
 {
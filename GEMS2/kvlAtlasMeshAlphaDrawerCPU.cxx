@@ -0,0 +1,104 @@
+#include "kvlAtlasMeshAlphaDrawerCPU.h"
+
+#include "kvlTetrahedronInteriorScanner.h"
+
+
+namespace kvl
+{
+
+//
+// What AtlasMeshAlphaDrawer does with each voxel inside a tetrahedron
+//
+struct AlphaDrawerOperation
+{
+  void operator()( float& pixel, double alpha, const double* ) const
+    {
+    pixel = alpha;
+    }
+};
+
+
+//
+//
+//
+AtlasMeshAlphaDrawerCPU
+::AtlasMeshAlphaDrawerCPU()
+{
+  m_ClassNumber = 0;
+  m_UseAVX2 = TetrahedronInteriorScanner< ImageType::PixelType >::CanUseAVX2();
+  m_Image = 0; 
+}  
+
+
+
+//
+//
+//
+AtlasMeshAlphaDrawerCPU
+::~AtlasMeshAlphaDrawerCPU()
+{
+
+  
+}  
+
+
+//
+//
+//
+void
+AtlasMeshAlphaDrawerCPU
+::SetUseAVX2( bool useAVX2 )
+{
+  m_UseAVX2 = useAVX2 && TetrahedronInteriorScanner< ImageType::PixelType >::CanUseAVX2();
+}
+
+ 
+//
+//
+//
+bool
+AtlasMeshAlphaDrawerCPU
+::RasterizeTetrahedron( const AtlasMesh* mesh, 
+                        AtlasMesh::CellIdentifier tetrahedronId,
+                        int threadNumber )
+{
+  // Retrieve everything we need to know 
+  AtlasMesh::CellAutoPointer  cell;
+  mesh->GetCell( tetrahedronId, cell );
+
+  AtlasMesh::CellType::PointIdIterator  pit = cell->PointIdsBegin();
+  const AtlasMesh::PointIdentifier  id0 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id1 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id2 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id3 = *pit;
+  
+  AtlasMesh::PointType p0;
+  AtlasMesh::PointType p1;
+  AtlasMesh::PointType p2;
+  AtlasMesh::PointType p3;
+  mesh->GetPoint( id0, &p0 );
+  mesh->GetPoint( id1, &p1 );
+  mesh->GetPoint( id2, &p2 );
+  mesh->GetPoint( id3, &p3 );
+  
+  const float alphaInVertex0 = ( mesh->GetPointData()->ElementAt( id0 ).m_Alphas )[ m_ClassNumber ];
+  const float alphaInVertex1 = ( mesh->GetPointData()->ElementAt( id1 ).m_Alphas )[ m_ClassNumber ];
+  const float alphaInVertex2 = ( mesh->GetPointData()->ElementAt( id2 ).m_Alphas )[ m_ClassNumber ];
+  const float alphaInVertex3 = ( mesh->GetPointData()->ElementAt( id3 ).m_Alphas )[ m_ClassNumber ];
+
+  
+  // Loop over all voxels within the tetrahedron and do The Right Thing  
+  TetrahedronInteriorScanner< ImageType::PixelType >  scanner( m_Image, p0, p1, p2, p3 );
+  scanner.SetAlphas( alphaInVertex0, alphaInVertex1, alphaInVertex2, alphaInVertex3 );
+  AlphaDrawerOperation  op;
+  scanner.Scan( op, m_UseAVX2 );
+    
+  return true;
+}
+
+
+  
+} // End namespace kvl
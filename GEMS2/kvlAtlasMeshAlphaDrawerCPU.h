@@ -0,0 +1,94 @@
+#ifndef __kvlAtlasMeshAlphaDrawerCPU_h
+#define __kvlAtlasMeshAlphaDrawerCPU_h
+
+#include "kvlAtlasMeshRasterizor.h"
+#include "atlasmeshalphadrawer.hpp"
+#include "itkImage.h"
+
+
+namespace kvl
+{
+
+
+/**
+ *
+ * CPU implementation of interfaces::AtlasMeshAlphaDrawer. It draws exactly the same image as
+ * AtlasMeshAlphaDrawer, but walks each tetrahedron with a TetrahedronInteriorScanner, using 
+ * AVX2 instructions if the CPU has them (unless switched off with SetUseAVX2( false ) ).
+ *
+ */
+class AtlasMeshAlphaDrawerCPU: public AtlasMeshRasterizor, public interfaces::AtlasMeshAlphaDrawer
+{
+public :
+  
+  /** Standard class typedefs */
+  typedef AtlasMeshAlphaDrawerCPU  Self;
+  typedef AtlasMeshRasterizor Superclass;
+  typedef itk::SmartPointer< Self >  Pointer;
+  typedef itk::SmartPointer< const Self >  ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro( Self );
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro( AtlasMeshAlphaDrawerCPU, itk::Object );
+
+  /** Some typedefs */
+  typedef interfaces::AtlasMeshAlphaDrawer::ImageType  ImageType;
+
+  /** */
+  virtual void SetClassNumber( const int classNumber ) override
+    {
+    m_ClassNumber = classNumber;
+    }
+    
+  /** */
+  virtual void SetRegions( const ImageType::RegionType&  region ) override
+    {
+    m_Image = ImageType::New();
+    m_Image->SetRegions( region );
+    m_Image->Allocate();
+    m_Image->FillBuffer( 0 );
+    }
+  
+  /** */
+  virtual void Interpolate( const AtlasMesh* mesh ) override
+    {
+    this->Rasterize( mesh );
+    }
+
+  /** */
+  virtual const ImageType*  GetImage() const override
+    { return m_Image; }
+    
+  /** */
+  void SetUseAVX2( bool useAVX2 );
+
+  /** */
+  bool GetUseAVX2() const
+    { return m_UseAVX2; }
+
+protected:
+  AtlasMeshAlphaDrawerCPU();
+  virtual ~AtlasMeshAlphaDrawerCPU();
+  
+  //
+  bool RasterizeTetrahedron( const AtlasMesh* mesh, 
+                             AtlasMesh::CellIdentifier tetrahedronId,
+                             int threadNumber );
+
+private:
+  AtlasMeshAlphaDrawerCPU(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+  
+  //
+  int  m_ClassNumber;
+  bool  m_UseAVX2;
+  ImageType::Pointer  m_Image;
+  
+};
+
+
+} // end namespace kvl
+
+#endif
@@ -2,6 +2,8 @@
 
 #include <gzstream.h>
 #include <fstream>
+#include <stdint.h>
+#include <algorithm>
 
 #include "vnl/vnl_inverse.h"
 #include "vnl/vnl_matrix_fixed.h"
@@ -482,6 +484,209 @@ AtlasMeshCollection
 }
 
 
+//
+// The binary format is laid out so that every array can be read (or mapped) in one go:
+//
+//   char      magic[ 8 ]                                   "KVLMESHB"
+//   uint32    version                                      1
+//   uint32    byteOrderMark                                0x01020304 in the writer's byte order
+//   uint64    numberOfPoints, numberOfCells, numberOfLabels, numberOfMeshes, numberOfCellPointIds
+//   double    K
+//   uint64    pointIds[ numberOfPoints ]
+//   double    referencePosition[ numberOfPoints ][ 3 ]
+//   double    positions[ numberOfMeshes ][ numberOfPoints ][ 3 ]
+//   uint64    cellIds[ numberOfCells ]
+//   uint64    cellPointIds[ numberOfCellPointIds ]
+//   float     alphas[ numberOfPoints ][ numberOfLabels ]
+//   uint8     cellNumberOfPoints[ numberOfCells ]           1 (vertex), 2 (line), 3 (triangle) or 4 (tetrahedron)
+//   uint8     flags[ numberOfPoints ][ 4 ]                  canChangeAlphas, canMoveX, canMoveY, canMoveZ
+//
+// Positions, alphas and flags are stored in the order of pointIds, and the point ids of
+// each cell follow each other in cellPointIds. Values are stored exactly, so converting a text
+// file to binary loses nothing, and converting back writes the same numbers Write() would have.
+//
+static const char  binaryMagic[ 8 ] = { 'K', 'V', 'L', 'M', 'E', 'S', 'H', 'B' };
+static const uint32_t  binaryVersion = 1;
+static const uint32_t  binaryByteOrderMark = 0x01020304;
+
+struct BinaryHeader
+{
+  char  m_Magic[ 8 ];
+  uint32_t  m_Version;
+  uint32_t  m_ByteOrderMark;
+  uint64_t  m_NumberOfPoints;
+  uint64_t  m_NumberOfCells;
+  uint64_t  m_NumberOfLabels;
+  uint64_t  m_NumberOfMeshes;
+  uint64_t  m_NumberOfCellPointIds;
+  double  m_K;
+};
+
+
+//
+//
+//
+template< class T >
+static void WriteArray( std::ostream& out, const std::vector< T >& values )
+{
+  if ( values.size() )
+    {
+    out.write( reinterpret_cast< const char* >( &( values[ 0 ] ) ), values.size() * sizeof( T ) );
+    }
+}
+
+
+//
+//
+//
+template< class T >
+static bool ReadArray( std::istream& in, std::vector< T >& values, uint64_t numberOfValues )
+{
+  values.resize( numberOfValues );
+  if ( numberOfValues )
+    {
+    in.read( reinterpret_cast< char* >( &( values[ 0 ] ) ), numberOfValues * sizeof( T ) );
+    }
+  return !in.fail();
+}
+
+
+
+//
+//
+// 
+bool
+AtlasMeshCollection
+::WriteBinary( const char* fileName ) const
+{
+
+  // Only write if all fields are set
+  if ( ( !m_PointParameters ) || ( !m_Cells ) || ( !m_ReferencePosition ) ||
+       ( !m_Positions.size() ) )
+    {
+    std::cerr << "Not a complete mesh collection" << std::endl;
+    return false;
+    }
+    
+  // Flatten everything into arrays, in the order of the reference position
+  const uint64_t  numberOfPoints = m_ReferencePosition->Size();
+  const uint64_t  numberOfLabels = m_PointParameters->Begin().Value().m_Alphas.size();
+  std::vector< uint64_t >  pointIds;
+  std::vector< double >  referencePosition;
+  std::vector< float >  alphas;
+  std::vector< uint8_t >  flags;
+  pointIds.reserve( numberOfPoints );
+  referencePosition.reserve( 3 * numberOfPoints );
+  alphas.reserve( numberOfLabels * numberOfPoints );
+  flags.reserve( 4 * numberOfPoints );
+  for ( PointsContainerType::ConstIterator  pointIt = m_ReferencePosition->Begin();
+        pointIt != m_ReferencePosition->End();
+        ++pointIt )
+    {
+    pointIds.push_back( pointIt.Index() );
+    for ( int i = 0; i < 3; i++ )
+      {
+      referencePosition.push_back( pointIt.Value()[ i ] );
+      }
+      
+    const PointParameters&  pointParameters = m_PointParameters->ElementAt( pointIt.Index() );
+    if ( pointParameters.m_Alphas.size() != numberOfLabels )
+      {
+      std::cerr << "Not all points have the same number of labels" << std::endl;
+      return false;
+      }
+    for ( unsigned int i = 0; i < numberOfLabels; i++ )
+      {
+      alphas.push_back( pointParameters.m_Alphas[ i ] );
+      }
+    flags.push_back( pointParameters.m_CanChangeAlphas );
+    flags.push_back( pointParameters.m_CanMoveX );
+    flags.push_back( pointParameters.m_CanMoveY );
+    flags.push_back( pointParameters.m_CanMoveZ );
+    }
+    
+  std::vector< uint64_t >  cellIds;
+  std::vector< uint64_t >  cellPointIds;
+  std::vector< uint8_t >  cellNumberOfPoints;
+  cellIds.reserve( m_Cells->Size() );
+  cellNumberOfPoints.reserve( m_Cells->Size() );
+  for ( CellsContainerType::ConstIterator  cellIt = m_Cells->Begin(); 
+        cellIt != m_Cells->End(); 
+        ++cellIt )
+    {
+    AtlasMesh::CellType*  cell = cellIt.Value();
+    if ( ( cell->GetType() != AtlasMesh::CellType::VERTEX_CELL ) &&
+         ( cell->GetType() != AtlasMesh::CellType::LINE_CELL ) &&
+         ( cell->GetType() != AtlasMesh::CellType::TRIANGLE_CELL ) &&
+         ( cell->GetType() != AtlasMesh::CellType::TETRAHEDRON_CELL ) )
+      {
+      itkExceptionMacro( "Mesh collection may only contain vertices, lines, triangles, and tetrahedra." );
+      }
+      
+    cellIds.push_back( cellIt.Index() );
+    cellNumberOfPoints.push_back( cell->GetNumberOfPoints() );
+    for ( AtlasMesh::CellType::PointIdIterator  pit = cell->PointIdsBegin();
+          pit != cell->PointIdsEnd(); 
+          ++pit )
+      {
+      cellPointIds.push_back( *pit );
+      }
+    }
+
+  // Open the file name
+  std::ofstream  out( fileName, std::ios::binary );
+  if ( !out.is_open() )
+    {
+    std::cerr << "Can't open " << fileName << " for writing." << std::endl;
+    return false;
+    }
+    
+  // Write the header
+  BinaryHeader  header;
+  std::copy( binaryMagic, binaryMagic + 8, header.m_Magic );
+  header.m_Version = binaryVersion;
+  header.m_ByteOrderMark = binaryByteOrderMark;
+  header.m_NumberOfPoints = numberOfPoints;
+  header.m_NumberOfCells = cellIds.size();
+  header.m_NumberOfLabels = numberOfLabels;
+  header.m_NumberOfMeshes = m_Positions.size();
+  header.m_NumberOfCellPointIds = cellPointIds.size();
+  header.m_K = m_K;
+  out.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+  
+  // Write the arrays
+  WriteArray( out, pointIds );
+  WriteArray( out, referencePosition );
+  std::vector< double >  position( 3 * numberOfPoints );
+  for ( unsigned int positionNumber = 0; positionNumber < m_Positions.size(); positionNumber++ )
+    {
+    for ( uint64_t pointNumber = 0; pointNumber < numberOfPoints; pointNumber++ )
+      {
+      const AtlasMesh::PointType&  point = m_Positions[ positionNumber ]->ElementAt( pointIds[ pointNumber ] );
+      for ( int i = 0; i < 3; i++ )
+        {
+        position[ 3 * pointNumber + i ] = point[ i ];
+        }
+      }
+    WriteArray( out, position );
+    }
+  WriteArray( out, cellIds );
+  WriteArray( out, cellPointIds );
+  WriteArray( out, alphas );
+  WriteArray( out, cellNumberOfPoints );
+  WriteArray( out, flags );
+
+  if ( out.fail() )
+    {
+    std::cerr << "Couldn't write " << fileName << std::endl;
+    return false;
+    }
+    
+  return true;
+    
+}
+
+
 //
 //
 //
@@ -514,6 +719,17 @@ AtlasMeshCollection
   m_Meshes.clear();
   m_CellLinks = 0;
 
+  // Files in the binary format start with a magic string
+  {
+  std::ifstream  binaryIn( fileName, std::ios::binary );
+  char  magic[ 8 ];
+  if ( binaryIn.read( magic, 8 ) && std::equal( binaryMagic, binaryMagic + 8, magic ) )
+    {
+    binaryIn.close();
+    return this->ReadBinary( fileName );
+    }
+  }
+
 #if 0
   std::string  zippedFileName = std::string( fileName ) + ".gz";
   igzstream  in( zippedFileName.c_str() );
@@ -885,6 +1101,209 @@ AtlasMeshCollection
 
 
 
+//  
+//
+//
+bool
+AtlasMeshCollection
+::ReadBinary( const char* fileName )
+{
+  std::ifstream  in( fileName, std::ios::binary );
+  if ( !in.is_open() )
+    {
+    std::cerr << "Can't open " << fileName << " for reading" << std::endl;
+    return false;
+    }
+    
+  // Read and check the header
+  BinaryHeader  header;
+  if ( !in.read( reinterpret_cast< char* >( &header ), sizeof( header ) ) )
+    return false;
+  if ( !std::equal( binaryMagic, binaryMagic + 8, header.m_Magic ) )
+    return false;
+  if ( header.m_ByteOrderMark != binaryByteOrderMark ) 
+    {
+    std::cerr << fileName << " was written on a machine with a different byte order" << std::endl;
+    return false;
+    }
+  if ( header.m_Version != binaryVersion ) 
+    {
+    std::cerr << fileName << " has unsupported version " << header.m_Version << std::endl;
+    return false;
+    }
+  const uint64_t  numberOfPoints = header.m_NumberOfPoints;
+  const uint64_t  numberOfCells = header.m_NumberOfCells;
+  const uint64_t  numberOfLabels = header.m_NumberOfLabels;
+  const uint64_t  numberOfMeshes = header.m_NumberOfMeshes;
+  m_K = header.m_K;
+
+  // The arrays must fill the rest of the file exactly; check this before
+  // allocating anything so that a corrupt header can't ask for terabytes.
+  // (Sizes are added up in double, which is exact for any real file size.)
+  const std::streampos  dataStart = in.tellg();
+  in.seekg( 0, std::ios::end );
+  const double  dataSize = static_cast< double >( in.tellg() - dataStart );
+  in.seekg( dataStart );
+  const double  expectedDataSize =
+    ( 3.0 + 3.0 * numberOfMeshes ) * numberOfPoints * sizeof( double ) +
+    ( static_cast< double >( numberOfPoints ) + numberOfCells + header.m_NumberOfCellPointIds ) * sizeof( uint64_t ) +
+    static_cast< double >( numberOfLabels ) * numberOfPoints * sizeof( float ) +
+    static_cast< double >( numberOfCells ) + 4.0 * numberOfPoints;
+  if ( expectedDataSize != dataSize )
+    {
+    std::cerr << fileName << " is truncated or corrupt" << std::endl;
+    return false;
+    }
+
+  // Read the arrays in bulk
+  std::vector< uint64_t >  pointIds;
+  std::vector< double >  referencePosition;
+  std::vector< std::vector< double > >  positions( numberOfMeshes );
+  std::vector< uint64_t >  cellIds;
+  std::vector< uint64_t >  cellPointIds;
+  std::vector< float >  alphas;
+  std::vector< uint8_t >  cellNumberOfPoints;
+  std::vector< uint8_t >  flags;
+  if ( !ReadArray( in, pointIds, numberOfPoints ) ||
+       !ReadArray( in, referencePosition, 3 * numberOfPoints ) )
+    return false;
+  for ( uint64_t i = 0; i < numberOfMeshes; i++ )
+    {
+    if ( !ReadArray( in, positions[ i ], 3 * numberOfPoints ) )
+      return false;
+    }
+  if ( !ReadArray( in, cellIds, numberOfCells ) ||
+       !ReadArray( in, cellPointIds, header.m_NumberOfCellPointIds ) ||
+       !ReadArray( in, alphas, numberOfLabels * numberOfPoints ) ||
+       !ReadArray( in, cellNumberOfPoints, numberOfCells ) ||
+       !ReadArray( in, flags, 4 * numberOfPoints ) )
+    return false;
+
+  // Point ids are renumbered 0, 1, 2, ... in the same way as when reading the text format
+#ifndef USE_DYNAMIC_MESH
+  bool  pointIdsAreCompressed = true;
+  for ( uint64_t pointNumber = 0; pointNumber < numberOfPoints; pointNumber++ )
+    {
+    if ( pointIds[ pointNumber ] != pointNumber )
+      {
+      pointIdsAreCompressed = false;
+      break;
+      }
+    }
+  if ( !pointIdsAreCompressed )
+    {
+    std::map< AtlasMesh::PointIdentifier, AtlasMesh::PointIdentifier >  pointIdCompressionLookupTable;
+    for ( uint64_t pointNumber = 0; pointNumber < numberOfPoints; pointNumber++ )
+      {
+      pointIdCompressionLookupTable[ pointIds[ pointNumber ] ] = pointNumber;
+      pointIds[ pointNumber ] = pointNumber;
+      }
+    for ( uint64_t i = 0; i < cellPointIds.size(); i++ )
+      {
+      std::map< AtlasMesh::PointIdentifier, AtlasMesh::PointIdentifier >::const_iterator  it
+        = pointIdCompressionLookupTable.find( cellPointIds[ i ] );
+      if ( it == pointIdCompressionLookupTable.end() )
+        return false;
+      cellPointIds[ i ] = it->second;
+      }
+    }
+  for ( uint64_t cellNumber = 0; cellNumber < numberOfCells; cellNumber++ )
+    {
+    cellIds[ cellNumber ] = cellNumber;
+    }
+#endif
+
+  // Reference position and positions
+  m_ReferencePosition = PointsContainerType::New();
+  for ( uint64_t pointNumber = 0; pointNumber < numberOfPoints; pointNumber++ )
+    {
+    AtlasMesh::PointType  point;
+    for ( int i = 0; i < 3; i++ )
+      {
+      point[ i ] = referencePosition[ 3 * pointNumber + i ];
+      }
+    m_ReferencePosition->InsertElement( pointIds[ pointNumber ], point );
+    }
+  
+  m_Positions.clear();
+  for ( uint64_t meshNumber = 0; meshNumber < numberOfMeshes; meshNumber++ )
+    {
+    PointsContainerType::Pointer  position = PointsContainerType::New();
+    for ( uint64_t pointNumber = 0; pointNumber < numberOfPoints; pointNumber++ )
+      {
+      AtlasMesh::PointType  point;
+      for ( int i = 0; i < 3; i++ )
+        {
+        point[ i ] = positions[ meshNumber ][ 3 * pointNumber + i ];
+        }
+      position->InsertElement( pointIds[ pointNumber ], point );
+      }
+    m_Positions.push_back( position );
+    }
+
+  // Cells
+  typedef itk::VertexCell< AtlasMesh::CellType >    VertexCell;
+  typedef itk::LineCell< AtlasMesh::CellType >      LineCell;
+  typedef itk::TriangleCell< AtlasMesh::CellType >  TriangleCell;
+  typedef itk::TetrahedronCell< AtlasMesh::CellType >  TetrahedronCell;
+  
+  m_Cells = CellsContainerType::New();
+  uint64_t  cellPointIdNumber = 0;
+  for ( uint64_t cellNumber = 0; cellNumber < numberOfCells; cellNumber++ )
+    {
+    const unsigned int  numberOfCellPoints = cellNumberOfPoints[ cellNumber ];
+    if ( cellPointIdNumber + numberOfCellPoints > cellPointIds.size() )
+      return false;
+      
+    AtlasMesh::CellAutoPointer newCell;
+    switch ( numberOfCellPoints )
+      {
+      case 1:
+        newCell.TakeOwnership( new VertexCell );
+        break;
+      case 2:
+        newCell.TakeOwnership( new LineCell );
+        break;
+      case 3:
+        newCell.TakeOwnership( new TriangleCell );
+        break;
+      case 4:
+        newCell.TakeOwnership( new TetrahedronCell );
+        break;
+      default:
+        return false;
+      }
+    for ( unsigned int i = 0; i < numberOfCellPoints; i++ )
+      {
+      newCell->SetPointId( i, cellPointIds[ cellPointIdNumber++ ] );
+      }
+      
+    m_Cells->InsertElement( cellIds[ cellNumber ], newCell.ReleaseOwnership() );
+    }
+    
+  // Point parameters
+  m_PointParameters = PointDataContainerType::New();
+  for ( uint64_t pointNumber = 0; pointNumber < numberOfPoints; pointNumber++ )
+    {
+    AtlasMesh::PixelType  pointParameter;
+    pointParameter.m_Alphas = AtlasAlphasType( numberOfLabels );
+    for ( uint64_t labelNumber = 0; labelNumber < numberOfLabels; labelNumber++ )
+      {
+      pointParameter.m_Alphas[ labelNumber ] = alphas[ numberOfLabels * pointNumber + labelNumber ];
+      }
+    pointParameter.m_CanChangeAlphas = flags[ 4 * pointNumber ];
+    pointParameter.m_CanMoveX = flags[ 4 * pointNumber + 1 ];
+    pointParameter.m_CanMoveY = flags[ 4 * pointNumber + 2 ];
+    pointParameter.m_CanMoveZ = flags[ 4 * pointNumber + 3 ];
+    
+    m_PointParameters->InsertElement( pointIds[ pointNumber ], pointParameter );
+    }
+    
+  return true;
+}
+
+
+
 
 
 /*!
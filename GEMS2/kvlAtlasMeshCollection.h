@@ -102,7 +102,11 @@ public :
   // Write out to file
   bool Write( const char* fileName ) const;
   
-  // Read from file
+  // Write out to file in the (uncompressed) binary format, which can be read back 
+  // with bulk reads instead of parsing. Read() recognizes it automatically
+  bool WriteBinary( const char* fileName ) const;
+
+  // Read from file, in either the text or the binary format
   bool Read( const char* fileName );
   
   
@@ -171,6 +175,9 @@ protected :
                                                    AtlasMesh::CellIdentifier&  transverseEdge0Id,
                                                    AtlasMesh::CellIdentifier&  transverseEdge1Id ) const;
 
+  //
+  bool ReadBinary( const char* fileName );
+
   //
   typedef itk::AutomaticTopologyMeshSource< kvl::AtlasMesh >  MeshSourceType;
   void FillCubeWithTetrahedra( MeshSourceType* meshSource, bool flippedConfiguration,
@@ -0,0 +1,202 @@
+#include "kvlAtlasMeshMultiAlphaDrawerCPU.h"
+
+#include "kvlTetrahedronInteriorScanner.h"
+
+
+namespace kvl
+{
+
+//
+// alphas[ c ] = pi0 * alphas0[ c ] + ... + pi3 * alphas3[ c ] for all classes c
+//
+static void InterpolateAlphas( float* alphas,
+                               const float* alphas0, const float* alphas1,
+                               const float* alphas2, const float* alphas3,
+                               const double* pi, int numberOfClasses )
+{
+  for ( int classNumber = 0; classNumber < numberOfClasses; classNumber++ )
+    {
+    alphas[ classNumber ] = pi[ 0 ] * alphas0[ classNumber ] +
+                            pi[ 1 ] * alphas1[ classNumber ] +
+                            pi[ 2 ] * alphas2[ classNumber ] +
+                            pi[ 3 ] * alphas3[ classNumber ];
+    }
+}
+
+
+#ifdef KVL_TETRAHEDRON_SCANNER_AVX2
+//
+// The same, 8 classes at a time in single precision. The alphas of a vertex are contiguous, so
+// these are plain unaligned loads. The remaining classes are done here too rather than by
+// calling InterpolateAlphas(): that is SSE code, and entering it with the upper halves of the
+// AVX registers in use costs more than the whole voxel
+//
+__attribute__(( target( "avx2" ) ))
+static void InterpolateAlphasAVX2( float* alphas,
+                                   const float* alphas0, const float* alphas1,
+                                   const float* alphas2, const float* alphas3,
+                                   const double* pi, int numberOfClasses )
+{
+  const __m256  pi0 = _mm256_set1_ps( pi[ 0 ] );
+  const __m256  pi1 = _mm256_set1_ps( pi[ 1 ] );
+  const __m256  pi2 = _mm256_set1_ps( pi[ 2 ] );
+  const __m256  pi3 = _mm256_set1_ps( pi[ 3 ] );
+
+  int  classNumber = 0;
+  for ( ; classNumber + 8 <= numberOfClasses; classNumber += 8 )
+    {
+    __m256  sum = _mm256_mul_ps( pi0, _mm256_loadu_ps( alphas0 + classNumber ) );
+    sum = _mm256_add_ps( sum, _mm256_mul_ps( pi1, _mm256_loadu_ps( alphas1 + classNumber ) ) );
+    sum = _mm256_add_ps( sum, _mm256_mul_ps( pi2, _mm256_loadu_ps( alphas2 + classNumber ) ) );
+    sum = _mm256_add_ps( sum, _mm256_mul_ps( pi3, _mm256_loadu_ps( alphas3 + classNumber ) ) );
+    _mm256_storeu_ps( alphas + classNumber, sum );
+    }
+  for ( ; classNumber < numberOfClasses; classNumber++ )
+    {
+    alphas[ classNumber ] = pi[ 0 ] * alphas0[ classNumber ] +
+                            pi[ 1 ] * alphas1[ classNumber ] +
+                            pi[ 2 ] * alphas2[ classNumber ] +
+                            pi[ 3 ] * alphas3[ classNumber ];
+    }
+}
+#endif
+
+
+//
+// What AtlasMeshMultiAlphaDrawer does with each voxel inside a tetrahedron
+//
+struct MultiAlphaDrawerOperation
+{
+  const float*  m_Alphas0;
+  const float*  m_Alphas1;
+  const float*  m_Alphas2;
+  const float*  m_Alphas3;
+  int  m_NumberOfClasses;
+  bool  m_UseAVX2;
+
+  void operator()( AtlasAlphasType& pixel, double, const double* pi ) const
+    {
+#ifdef KVL_TETRAHEDRON_SCANNER_AVX2
+    if ( m_UseAVX2 )
+      {
+      InterpolateAlphasAVX2( pixel.data_block(), m_Alphas0, m_Alphas1, m_Alphas2, m_Alphas3,
+                             pi, m_NumberOfClasses );
+      return;
+      }
+#endif
+    InterpolateAlphas( pixel.data_block(), m_Alphas0, m_Alphas1, m_Alphas2, m_Alphas3,
+                       pi, m_NumberOfClasses );
+    }
+};
+
+
+//
+//
+//
+AtlasMeshMultiAlphaDrawerCPU
+::AtlasMeshMultiAlphaDrawerCPU()
+{
+  m_UseAVX2 = TetrahedronInteriorScanner< ImageType::PixelType >::CanUseAVX2();
+  m_Image = 0;
+}
+
+
+
+//
+//
+//
+AtlasMeshMultiAlphaDrawerCPU
+::~AtlasMeshMultiAlphaDrawerCPU()
+{
+
+
+}
+
+
+//
+//
+//
+void
+AtlasMeshMultiAlphaDrawerCPU
+::SetUseAVX2( bool useAVX2 )
+{
+  m_UseAVX2 = useAVX2 && TetrahedronInteriorScanner< ImageType::PixelType >::CanUseAVX2();
+}
+
+
+
+//
+//
+//
+void
+AtlasMeshMultiAlphaDrawerCPU
+::Rasterize( const AtlasMesh* mesh )
+{
+  // Fill image with empty result (needed because area outside of the mesh will never be visited).
+  // This also gives every voxel its own array of numberOfClasses alphas, which the tetrahedra
+  // then overwrite in place
+  const int  numberOfClasses = mesh->GetPointData()->Begin().Value().m_Alphas.Size();
+  AtlasAlphasType  emptyEntry( numberOfClasses );
+  emptyEntry.Fill( 0.0f );
+  m_Image->FillBuffer( emptyEntry );
+
+  //
+  Superclass::Rasterize( mesh );
+
+}
+
+
+//
+//
+//
+bool
+AtlasMeshMultiAlphaDrawerCPU
+::RasterizeTetrahedron( const AtlasMesh* mesh,
+                        AtlasMesh::CellIdentifier tetrahedronId,
+                        int threadNumber )
+{
+  // Retrieve everything we need to know
+  AtlasMesh::CellAutoPointer  cell;
+  mesh->GetCell( tetrahedronId, cell );
+
+  AtlasMesh::CellType::PointIdIterator  pit = cell->PointIdsBegin();
+  const AtlasMesh::PointIdentifier  id0 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id1 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id2 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id3 = *pit;
+
+  AtlasMesh::PointType p0;
+  AtlasMesh::PointType p1;
+  AtlasMesh::PointType p2;
+  AtlasMesh::PointType p3;
+  mesh->GetPoint( id0, &p0 );
+  mesh->GetPoint( id1, &p1 );
+  mesh->GetPoint( id2, &p2 );
+  mesh->GetPoint( id3, &p3 );
+
+  const AtlasAlphasType&  alphasInVertex0 = mesh->GetPointData()->ElementAt( id0 ).m_Alphas;
+  const AtlasAlphasType&  alphasInVertex1 = mesh->GetPointData()->ElementAt( id1 ).m_Alphas;
+  const AtlasAlphasType&  alphasInVertex2 = mesh->GetPointData()->ElementAt( id2 ).m_Alphas;
+  const AtlasAlphasType&  alphasInVertex3 = mesh->GetPointData()->ElementAt( id3 ).m_Alphas;
+
+  MultiAlphaDrawerOperation  op;
+  op.m_Alphas0 = alphasInVertex0.data_block();
+  op.m_Alphas1 = alphasInVertex1.data_block();
+  op.m_Alphas2 = alphasInVertex2.data_block();
+  op.m_Alphas3 = alphasInVertex3.data_block();
+  op.m_NumberOfClasses = alphasInVertex0.Size();
+  op.m_UseAVX2 = m_UseAVX2;
+
+  // Loop over all voxels within the tetrahedron and do The Right Thing
+  TetrahedronInteriorScanner< ImageType::PixelType >  scanner( m_Image, p0, p1, p2, p3 );
+  scanner.Scan( op, m_UseAVX2 );
+
+  return true;
+}
+
+
+
+} // End namespace kvl
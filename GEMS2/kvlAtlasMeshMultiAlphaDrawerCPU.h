@@ -0,0 +1,84 @@
+#ifndef __kvlAtlasMeshMultiAlphaDrawerCPU_h
+#define __kvlAtlasMeshMultiAlphaDrawerCPU_h
+
+#include "kvlAtlasMeshRasterizor.h"
+#include "itkImage.h"
+
+
+namespace kvl
+{
+
+
+/**
+ *
+ * CPU implementation of AtlasMeshMultiAlphaDrawer. It visits exactly the same voxels, but walks
+ * each tetrahedron with a TetrahedronInteriorScanner and interpolates all the class alphas of a
+ * voxel at once from its baricentric coordinates, 8 classes per AVX2 instruction if the CPU has
+ * them (unless switched off with SetUseAVX2( false ) ). The alphas agree with those of
+ * AtlasMeshMultiAlphaDrawer up to rounding, not bit for bit: the reference updates each class
+ * alpha incrementally from voxel to voxel.
+ *
+ */
+class AtlasMeshMultiAlphaDrawerCPU: public AtlasMeshRasterizor
+{
+public :
+
+  /** Standard class typedefs */
+  typedef AtlasMeshMultiAlphaDrawerCPU  Self;
+  typedef AtlasMeshRasterizor Superclass;
+  typedef itk::SmartPointer< Self >  Pointer;
+  typedef itk::SmartPointer< const Self >  ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro( Self );
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro( AtlasMeshMultiAlphaDrawerCPU, itk::Object );
+
+  /** Some typedefs */
+  typedef itk::Image< AtlasAlphasType, 3 >  ImageType;
+
+  /** */
+  void SetRegions( const ImageType::RegionType&  region )
+    {
+    m_Image = ImageType::New();
+    m_Image->SetRegions( region );
+    m_Image->Allocate();
+    }
+
+  /** */
+  const ImageType*  GetImage() const
+    { return m_Image; }
+
+  //
+  void Rasterize( const AtlasMesh* mesh );
+
+  /** */
+  void SetUseAVX2( bool useAVX2 );
+
+  /** */
+  bool GetUseAVX2() const
+    { return m_UseAVX2; }
+
+protected:
+  AtlasMeshMultiAlphaDrawerCPU();
+  virtual ~AtlasMeshMultiAlphaDrawerCPU();
+
+  //
+  bool RasterizeTetrahedron( const AtlasMesh* mesh,
+                             AtlasMesh::CellIdentifier tetrahedronId,
+                             int threadNumber );
+
+private:
+  AtlasMeshMultiAlphaDrawerCPU(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  bool  m_UseAVX2;
+  ImageType::Pointer  m_Image;
+
+};
+
+
+} // end namespace kvl
+
+#endif
@@ -1,5 +1,7 @@
 #include "kvlAtlasMeshRasterizor.h"
 
+#include <algorithm>
+
 static itk::SimpleFastMutexLock rasterizorMutex;
 
 
@@ -27,23 +29,77 @@ AtlasMeshRasterizor
 ::Rasterize( const AtlasMesh* mesh )
 {
 
-  // Fill in the data structure to pass on to the threads
+  // Fill in the data structure to pass on to the threads. Tetrahedra are binned into
+  // cubic tiles of TileSize voxels by the lower corner of their bounding box, and the
+  // tiles are visited in raster order, so that each thread works on a compact piece of
+  // the image and touches a compact set of mesh nodes
   ThreadStruct  str;
   str.m_Rasterizor = this;
   str.m_Mesh = mesh;
+  std::vector< TileEntry >  entries;
   for ( AtlasMesh::CellsContainer::ConstIterator  cellIt = mesh->GetCells()->Begin();
         cellIt != mesh->GetCells()->End(); ++cellIt )
     {
-    if ( cellIt.Value()->GetType() == AtlasMesh::CellType::TETRAHEDRON_CELL )
+    if ( cellIt.Value()->GetType() != AtlasMesh::CellType::TETRAHEDRON_CELL )
+      {
+      continue;
+      }
+
+    AtlasMesh::PointType  lowerCorner;
+    AtlasMesh::PointType  upperCorner;
+    AtlasMesh::CellType::PointIdConstIterator  pit = cellIt.Value()->PointIdsBegin();
+    lowerCorner = upperCorner = mesh->GetPoints()->ElementAt( *pit );
+    for ( ++pit; pit != cellIt.Value()->PointIdsEnd(); ++pit )
+      {
+      const AtlasMesh::PointType&  p = mesh->GetPoints()->ElementAt( *pit );
+      for ( int i = 0; i < 3; i++ )
+        {
+        lowerCorner[ i ] = std::min( lowerCorner[ i ], p[ i ] );
+        upperCorner[ i ] = std::max( upperCorner[ i ], p[ i ] );
+        }
+      }
+
+    TileEntry  entry;
+    entry.m_Cost = 1.0;
+    for ( int i = 0; i < 3; i++ )
       {
-      str.m_TetrahedronIds.push_back( cellIt.Index() );
-      //str.m_TetrahedronIds.insert( cellIt.Index() );
+      entry.m_Tile[ 2-i ] = itk::Math::Floor< long >( lowerCorner[ i ] / TileSize );
+      entry.m_Cost *= 1.0 + std::max( 0.0, static_cast< double >( upperCorner[ i ] - lowerCorner[ i ] ) );
       }
+    entry.m_Cost += TetrahedronOverhead;
+    entry.m_Number = entries.size();
+    entry.m_TetrahedronId = cellIt.Index();
+    entries.push_back( entry );
+    }
+  std::sort( entries.begin(), entries.end() );
+
+  // Give each thread a contiguous run of roughly equal cost. The split only depends on
+  // the mesh and the number of threads, so repeating the same computation with the same
+  // number of threads adds up the same floating-point contributions in the same order
+  const int  numberOfThreads = this->GetNumberOfThreads();
+  double  totalCost = 0.0;
+  for ( std::vector< TileEntry >::const_iterator  it = entries.begin(); it != entries.end(); ++it )
+    {
+    totalCost += it->m_Cost;
+    }
+  str.m_TetrahedronIds.reserve( entries.size() );
+  str.m_ThreadBegins.assign( numberOfThreads + 1, entries.size() );
+  str.m_ThreadBegins[ 0 ] = 0;
+  double  cost = 0.0;
+  int  threadNumber = 1;
+  for ( std::vector< TileEntry >::const_iterator  it = entries.begin(); it != entries.end(); ++it )
+    {
+    while ( threadNumber < numberOfThreads && cost >= totalCost * threadNumber / numberOfThreads )
+      {
+      str.m_ThreadBegins[ threadNumber++ ] = str.m_TetrahedronIds.size();
+      }
+    str.m_TetrahedronIds.push_back( it->m_TetrahedronId );
+    cost += it->m_Cost;
     }
 
   // Set up the multithreader
   itk::MultiThreader::Pointer  threader = itk::MultiThreader::New();
-  threader->SetNumberOfThreads( this->GetNumberOfThreads() );
+  threader->SetNumberOfThreads( numberOfThreads );
   //threader->SetNumberOfThreads( 1 );
   threader->SetSingleMethod( this->ThreaderCallback, &str );
 
@@ -71,40 +127,34 @@ AtlasMeshRasterizor
 
   
 #if 1  
-  // Compute up-front which tetrahedra this thread should be responsible for. This isn't a 
-  // particularly good way of load-balancing, but it does allow us to get the exact same
-  // round-off errors (by adding many floating-point contributions) every single time we
+  // Rasterize the run of tile-ordered tetrahedra that Rasterize() assigned to this thread.
+  // This is decided up-front rather than handed out on demand, so that we get the exact 
+  // same round-off errors (by adding many floating-point contributions) every single time we
   // repeat the same computation on the same computer with the same number of threads.
-  const int  numberOfTetrahedra = str->m_TetrahedronIds.size();
-#if 0  
-  const int  numberOfTetrahedraPerThread = 
-          itk::Math::Ceil< int >( static_cast< double >( numberOfTetrahedra ) / numberOfThreads );
-  const int  thisThreadStartNumber =  threadNumber * numberOfTetrahedraPerThread;
-  int  thisThreadEndNumber =  thisThreadStartNumber + numberOfTetrahedraPerThread - 1;
-  if ( thisThreadEndNumber > (numberOfTetrahedra-1) )
+  // If the threader ended up with fewer threads than requested, the leftover runs are
+  // taken by the threads that do exist
+  for ( int  runNumber = threadNumber; 
+        runNumber < static_cast< int >( str->m_ThreadBegins.size() ) - 1; 
+        runNumber += numberOfThreads )
     {
-    thisThreadEndNumber = (numberOfTetrahedra-1);
-    }
-    
-  // Rasterize all tetrahedra assigned to this thread  
-  for ( int tetrahedronNumber = thisThreadStartNumber; 
-        tetrahedronNumber <= thisThreadEndNumber; 
-        tetrahedronNumber++ )
-#else
-  // Rasterize all tetrahedra assigned to this thread  
-  for ( int tetrahedronNumber = threadNumber; 
-        tetrahedronNumber < numberOfTetrahedra; 
-        tetrahedronNumber += numberOfThreads )
-#endif
-    {
-    if ( !str->m_Rasterizor->RasterizeTetrahedron( str->m_Mesh, 
-                                                   str->m_TetrahedronIds[ tetrahedronNumber ],
-                                                   threadNumber ) )
+    bool  ok = true;
+    for ( size_t  tetrahedronNumber = str->m_ThreadBegins[ runNumber ]; 
+          tetrahedronNumber < str->m_ThreadBegins[ runNumber + 1 ]; 
+          tetrahedronNumber++ )
+      {
+      if ( !str->m_Rasterizor->RasterizeTetrahedron( str->m_Mesh, 
+                                                     str->m_TetrahedronIds[ tetrahedronNumber ],
+                                                     runNumber ) )
+        {
+        // Something wrong with this tetrahedron; abort at least this thread
+        ok = false;
+        break;
+        }  
+      }
+    if ( !ok )
       {
-      // Something wrong with this tetrahedron; abort at least this thread
       break;
-      }  
-      
+      }
     }
 #else
 
@@ -54,13 +54,45 @@ protected:
    * control to ThreadedGenerateData(). */
   static ITK_THREAD_RETURN_TYPE ThreaderCallback( void *arg );
   
-  /** Internal structure used for passing information to the threading library */
+  /** Internal structure used for passing information to the threading library. Thread 
+   * number n rasterizes m_TetrahedronIds[ m_ThreadBegins[ n ] ] up to (but not including)
+   * m_TetrahedronIds[ m_ThreadBegins[ n+1 ] ] */
   struct ThreadStruct
     {
     Pointer  m_Rasterizor;
     AtlasMesh::ConstPointer  m_Mesh;
     std::vector< AtlasMesh::CellIdentifier >  m_TetrahedronIds;
     //std::set< AtlasMesh::CellIdentifier >  m_TetrahedronIds;
+    std::vector< size_t >  m_ThreadBegins;
+    };
+
+  /** Side of the cubic tiles, in voxels, that tetrahedra are binned into before being
+   * shared out among the threads, and the cost of a tetrahedron, in voxels, on top of the
+   * voxels in its bounding box */
+  static const int  TileSize = 16;
+  static const int  TetrahedronOverhead = 32;
+
+  /** A tetrahedron with the tile (in z, y, x order) it is binned into and its estimated cost. 
+   * Sorting these visits the tiles in raster order, and the tetrahedra within a tile in the 
+   * order the mesh stores them */
+  struct TileEntry
+    {
+    long  m_Tile[ 3 ];
+    double  m_Cost;
+    size_t  m_Number;
+    AtlasMesh::CellIdentifier  m_TetrahedronId;
+
+    bool operator<( const TileEntry& other ) const
+      {
+      for ( int i = 0; i < 3; i++ )
+        {
+        if ( m_Tile[ i ] != other.m_Tile[ i ] )
+          {
+          return m_Tile[ i ] < other.m_Tile[ i ];
+          }
+        }
+      return m_Number < other.m_Number;
+      }
     };
 
                                      
@@ -0,0 +1,95 @@
+#include "kvlAtlasMeshVisitCounterCPU.h"
+
+#include "kvlTetrahedronInteriorScanner.h"
+
+
+namespace kvl
+{
+
+//
+// What AtlasMeshVisitCounter does with each voxel inside a tetrahedron
+//
+struct VisitCounterOperation
+{
+  void operator()( int& pixel, double, const double* ) const
+    {
+    pixel++;
+    }
+};
+
+
+//
+//
+//
+AtlasMeshVisitCounterCPU
+::AtlasMeshVisitCounterCPU()
+{
+  m_UseAVX2 = TetrahedronInteriorScanner< ImageType::PixelType >::CanUseAVX2();
+  m_Image = 0; 
+}  
+
+
+
+//
+//
+//
+AtlasMeshVisitCounterCPU
+::~AtlasMeshVisitCounterCPU()
+{
+  
+}  
+
+
+//
+//
+//
+void
+AtlasMeshVisitCounterCPU
+::SetUseAVX2( bool useAVX2 )
+{
+  m_UseAVX2 = useAVX2 && TetrahedronInteriorScanner< ImageType::PixelType >::CanUseAVX2();
+}
+
+ 
+//
+//
+//
+bool
+AtlasMeshVisitCounterCPU
+::RasterizeTetrahedron( const AtlasMesh* mesh, 
+                        AtlasMesh::CellIdentifier tetrahedronId,
+                        int threadNumber )
+{
+  // Retrieve everything we need to know 
+  AtlasMesh::CellAutoPointer  cell;
+  mesh->GetCell( tetrahedronId, cell );
+
+  AtlasMesh::CellType::PointIdIterator  pit = cell->PointIdsBegin();
+  const AtlasMesh::PointIdentifier  id0 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id1 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id2 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id3 = *pit;
+  
+  AtlasMesh::PointType p0;
+  AtlasMesh::PointType p1;
+  AtlasMesh::PointType p2;
+  AtlasMesh::PointType p3;
+  mesh->GetPoint( id0, &p0 );
+  mesh->GetPoint( id1, &p1 );
+  mesh->GetPoint( id2, &p2 );
+  mesh->GetPoint( id3, &p3 );
+  
+  // Loop over all voxels within the tetrahedron and do The Right Thing  
+  TetrahedronInteriorScanner< ImageType::PixelType >  scanner( m_Image, p0, p1, p2, p3 );
+  VisitCounterOperation  op;
+  scanner.Scan( op, m_UseAVX2 );
+    
+  return true;
+}
+
+
+  
+} // End namespace kvl
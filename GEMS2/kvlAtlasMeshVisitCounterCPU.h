@@ -0,0 +1,87 @@
+#ifndef __kvlAtlasMeshVisitCounterCPU_h
+#define __kvlAtlasMeshVisitCounterCPU_h
+
+#include "kvlAtlasMeshRasterizor.h"
+#include "atlasmeshvisitcounter.hpp"
+#include "itkImage.h"
+
+
+namespace kvl
+{
+
+
+/**
+ *
+ * CPU implementation of interfaces::AtlasMeshVisitCounter. It counts exactly the same visits as
+ * AtlasMeshVisitCounter, but walks each tetrahedron with a TetrahedronInteriorScanner, using 
+ * AVX2 instructions if the CPU has them (unless switched off with SetUseAVX2( false ) ).
+ *
+ */
+class AtlasMeshVisitCounterCPU: public AtlasMeshRasterizor, public interfaces::AtlasMeshVisitCounter
+{
+public :
+  
+  /** Standard class typedefs */
+  typedef AtlasMeshVisitCounterCPU  Self;
+  typedef AtlasMeshRasterizor Superclass;
+  typedef itk::SmartPointer< Self >  Pointer;
+  typedef itk::SmartPointer< const Self >  ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro( Self );
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro( AtlasMeshVisitCounterCPU, itk::Object );
+
+  /** Some typedefs */
+  typedef interfaces::AtlasMeshVisitCounter::ImageType  ImageType;
+
+  /** */
+  virtual void SetRegions( const ImageType::RegionType&  region ) override
+    {
+    m_Image = ImageType::New();
+    m_Image->SetRegions( region );
+    m_Image->Allocate();
+    m_Image->FillBuffer( 0 );
+    }
+  
+  /** */
+  virtual void VisitCount( const AtlasMesh* mesh ) override
+    {
+    this->Rasterize( mesh );
+    }
+
+  /** */
+  virtual const ImageType*  GetImage() const override
+    { return m_Image; }
+    
+  /** */
+  void SetUseAVX2( bool useAVX2 );
+
+  /** */
+  bool GetUseAVX2() const
+    { return m_UseAVX2; }
+
+protected:
+  AtlasMeshVisitCounterCPU();
+  virtual ~AtlasMeshVisitCounterCPU();
+  
+  //
+  bool RasterizeTetrahedron( const AtlasMesh* mesh, 
+                             AtlasMesh::CellIdentifier tetrahedronId,
+                             int threadNumber );
+
+private:
+  AtlasMeshVisitCounterCPU(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+  
+  //
+  bool  m_UseAVX2;
+  ImageType::Pointer  m_Image;
+  
+};
+
+
+} // end namespace kvl
+
+#endif
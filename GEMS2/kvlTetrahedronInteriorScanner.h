@@ -0,0 +1,456 @@
+#ifndef kvlTetrahedronInteriorScanner_h
+#define kvlTetrahedronInteriorScanner_h
+
+#include <algorithm>
+
+#include "itkImage.h"
+#include "itkMath.h"
+#include "kvlAtlasMesh.h"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#include <immintrin.h>
+#define KVL_TETRAHEDRON_SCANNER_AVX2 1
+#endif
+
+
+namespace kvl
+{
+
+
+/**
+ *
+ * Visits the same voxels as TetrahedronInteriorIterator, in the same order, and with
+ * bit-for-bit the same baricentric coordinates and interpolated alpha, but without the
+ * per-voxel bookkeeping of an ITK image iterator. The voxels of a tetrahedron are walked as
+ * scanlines along the first image axis, and the four baricentric coordinates of each voxel are
+ * updated and tested with a single AVX2 instruction each when the CPU supports it.
+ *
+ * Typical usage is something like this:
+ *
+ *   TetrahedronInteriorScanner< ImageType::PixelType >  scanner( image, p0, p1, p2, p3 );
+ *   scanner.SetAlphas( alpha0, alpha1, alpha2, alpha3 );
+ *   scanner.Scan( op, useAVX2 );
+ *
+ * where op( pixel, alpha, pi ) is called for every voxel inside the tetrahedron with a reference
+ * to the pixel, the interpolated alpha there, and its four baricentric coordinates pi[ 0..3 ].
+ * An operation that interpolates many values per voxel (e.g. all class alphas) can compute them
+ * directly from pi rather than having the scanner carry an incremental value for each.
+ *
+ * The voxels along a scanline can't be done in parallel without changing the results: the
+ * iterator computes the baricentric coordinates of each voxel by adding a constant to those
+ * of the previous voxel, so the rounding of each voxel depends on all the ones before it.
+ * What is vectorized is the work per voxel (4 coordinates at once).
+ *
+ */
+template< typename TPixel >
+class TetrahedronInteriorScanner
+{
+public:
+  /** Some typedefs */
+  typedef itk::Image< TPixel, 3 >  ImageType;
+  typedef typename ImageType::RegionType  RegionType;
+  typedef typename RegionType::IndexType  IndexType;
+  typedef typename IndexType::IndexValueType  IndexValueType;
+  typedef AtlasMesh::PointType   PointType;
+
+  /** Constructor */
+  TetrahedronInteriorScanner( ImageType* image,
+                              const PointType& p0,
+                              const PointType& p1,
+                              const PointType& p2,
+                              const PointType& p3 );
+
+  /** Interpolate alpha0, alpha1, alpha2, alpha3 given in the vertices, as
+   * TetrahedronInteriorConstIterator::AddExtraLoading() does */
+  void SetAlphas( const double& alpha0, const double& alpha1, const double& alpha2, const double& alpha3 );
+
+  /** Call op( pixel, alpha, pi ) for every voxel inside the tetrahedron */
+  template< typename TOperation >
+  void Scan( TOperation& op, bool useAVX2 ) const
+    {
+#ifdef KVL_TETRAHEDRON_SCANNER_AVX2
+    if ( useAVX2 )
+      {
+      this->ScanAVX2( op );
+      return;
+      }
+#endif
+    this->ScanScalar( op );
+    }
+
+  /** Whether the CPU we're running on can do Scan( op, true ) */
+  static bool CanUseAVX2()
+    {
+#ifdef KVL_TETRAHEDRON_SCANNER_AVX2
+    static const bool  canUseAVX2 = __builtin_cpu_supports( "avx2" );
+    return canUseAVX2;
+#else
+    return false;
+#endif
+    }
+
+private:
+  template< typename TOperation >
+  void ScanScalar( TOperation& op ) const;
+
+#ifdef KVL_TETRAHEDRON_SCANNER_AVX2
+  template< typename TOperation >
+  __attribute__(( target( "avx2" ) )) void ScanAVX2( TOperation& op ) const;
+#endif
+
+  // First voxel of the bounding box, and the size of the bounding box (0 in some direction
+  // if the tetrahedron doesn't overlap the image)
+  TPixel*  m_FirstPixel;
+  long  m_Size[ 3 ];
+  long  m_OffsetTable[ 3 ];
+
+  // Baricentric coordinates pi0..pi3 and alpha in the first voxel, and what to add to them
+  // when moving one voxel along each image axis
+  double  m_Values[ 5 ];
+  double  m_NextRowAdditions[ 5 ];
+  double  m_NextColumnAdditions[ 5 ];
+  double  m_NextSliceAdditions[ 5 ];
+
+  // Bit n set if a voxel with pin exactly 0 lies outside (see IsOutsideTetrahdron())
+  int  m_BorderMask;
+
+};
+
+
+//
+//
+//
+template< typename TPixel >
+TetrahedronInteriorScanner< TPixel >
+::TetrahedronInteriorScanner( ImageType* image,
+                              const PointType& p0,
+                              const PointType& p1,
+                              const PointType& p2,
+                              const PointType& p3 )
+{
+  // The bounding box, transformation, and border rules are computed with exactly the same
+  // expressions as in TetrahedronInteriorConstIterator, so that the results are identical
+
+  // Compute the coordinates of the lower and upper corner of the bounding box around the tetradron
+  PointType  lowerCorner = p0;
+  PointType  upperCorner = p0;
+  for ( int i = 0; i < 3; i++ )
+    {
+    if ( p1[ i ] < lowerCorner[ i ] )
+      {
+      lowerCorner[ i ] = p1[ i ];
+      }
+    if ( p2[ i ] < lowerCorner[ i ] )
+      {
+      lowerCorner[ i ] = p2[ i ];
+      }
+    if ( p3[ i ] < lowerCorner[ i ] )
+      {
+      lowerCorner[ i ] = p3[ i ];
+      }
+    if ( p1[ i ] > upperCorner[ i ] )
+      {
+      upperCorner[ i ] = p1[ i ];
+      }
+    if ( p2[ i ] > upperCorner[ i ] )
+      {
+      upperCorner[ i ] = p2[ i ];
+      }
+    if ( p3[ i ] > upperCorner[ i ] )
+      {
+      upperCorner[ i ] = p3[ i ];
+      }
+    }
+
+  // Compute the lower and upper corner index, while clipping to the buffered region
+  const RegionType&  bufferedRegion = image->GetBufferedRegion();
+  IndexType  lowerCornerIndex = bufferedRegion.GetIndex();
+  IndexType  upperCornerIndex = bufferedRegion.GetUpperIndex();
+  for ( int i = 0; i < 3; i++ )
+    {
+    if ( lowerCorner[ i ] > lowerCornerIndex[ i ] )
+      {
+      lowerCornerIndex[ i ] = itk::Math::Ceil< IndexValueType >( lowerCorner[ i ] );
+      }
+    if ( lowerCornerIndex[ i ] > bufferedRegion.GetUpperIndex()[ i ] )
+      {
+      lowerCornerIndex[ i ] = bufferedRegion.GetUpperIndex()[ i ] + 1;
+      }
+    if ( upperCorner[ i ] < upperCornerIndex[ i ] )
+      {
+      upperCornerIndex[ i ] = itk::Math::Floor< IndexValueType >( upperCorner[ i ] );
+      }
+    if ( upperCornerIndex[ i ] < bufferedRegion.GetIndex()[ i ] )
+      {
+      upperCornerIndex[ i ] = bufferedRegion.GetIndex()[ i ] - 1;
+      }
+    }
+
+  long  offset = 0;
+  for ( int i = 0; i < 3; i++ )
+    {
+    m_Size[ i ] = std::max< long >( 0, upperCornerIndex[ i ] - lowerCornerIndex[ i ] + 1 );
+    m_OffsetTable[ i ] = ( i == 0 ) ? 1 : m_OffsetTable[ i-1 ] * bufferedRegion.GetSize()[ i-1 ];
+    offset += ( lowerCornerIndex[ i ] - bufferedRegion.GetIndex()[ i ] ) * m_OffsetTable[ i ];
+    }
+  m_FirstPixel = image->GetBufferPointer() + offset;
+
+  // t = p0
+  const double  t1 = p0[ 0 ];
+  const double  t2 = p0[ 1 ];
+  const double  t3 = p0[ 2 ];
+
+  // M = inv( [ p1-p0 p2-p0 p3-p0 ] )
+  const double  a = p1[0] - p0[0];
+  const double  b = p2[0] - p0[0];
+  const double  c = p3[0] - p0[0];
+  const double  d = p1[1] - p0[1];
+  const double  e = p2[1] - p0[1];
+  const double  f = p3[1] - p0[1];
+  const double  g = p1[2] - p0[2];
+  const double  h = p2[2] - p0[2];
+  const double  i = p3[2] - p0[2];
+
+  const double  A = ( e * i - f * h );
+  const double  D = -( b * i - c * h );
+  const double  G = ( b * f - c * e );
+  const double  B = -(d * i - f * g );
+  const double  E = ( a * i - c * g );
+  const double  H = -( a * f - c * d );
+  const double  C = ( d * h - e * g );
+  const double  F = - (a * h - b * g );
+  const double  I = ( a * e - b * d );
+
+  const double  determinant = a * A + b * B + c * C;
+  const double  m11 = A / determinant;
+  const double  m21 = B / determinant;
+  const double  m31 = C / determinant;
+  const double  m12 = D / determinant;
+  const double  m22 = E / determinant;
+  const double  m32 = F / determinant;
+  const double  m13 = G / determinant;
+  const double  m23 = H / determinant;
+  const double  m33 = I / determinant;
+
+  // Baricentric coordinates of the first voxel
+  const double  YminT1 = lowerCornerIndex[ 0 ] - t1;
+  const double  YminT2 = lowerCornerIndex[ 1 ] - t2;
+  const double  YminT3 = lowerCornerIndex[ 2 ] - t3;
+
+  const double  pi1 = m11 * YminT1 + m12 * YminT2 + m13 * YminT3;
+  const double  pi2 = m21 * YminT1 + m22 * YminT2 + m23 * YminT3;
+  const double  pi3 = m31 * YminT1 + m32 * YminT2 + m33 * YminT3;
+  const double  pi0 = 1.0 - pi1 - pi2 - pi3;
+
+  m_Values[ 0 ] = pi0;
+  m_Values[ 1 ] = pi1;
+  m_Values[ 2 ] = pi2;
+  m_Values[ 3 ] = pi3;
+  m_Values[ 4 ] = 0.0;
+
+  m_NextRowAdditions[ 0 ] = -( m11 + m21 + m31 );
+  m_NextRowAdditions[ 1 ] = m11;
+  m_NextRowAdditions[ 2 ] = m21;
+  m_NextRowAdditions[ 3 ] = m31;
+  m_NextRowAdditions[ 4 ] = 0.0;
+
+  m_NextColumnAdditions[ 0 ] = -( m12 + m22 + m32 );
+  m_NextColumnAdditions[ 1 ] = m12;
+  m_NextColumnAdditions[ 2 ] = m22;
+  m_NextColumnAdditions[ 3 ] = m32;
+  m_NextColumnAdditions[ 4 ] = 0.0;
+
+  m_NextSliceAdditions[ 0 ] = -( m13 + m23 + m33 );
+  m_NextSliceAdditions[ 1 ] = m13;
+  m_NextSliceAdditions[ 2 ] = m23;
+  m_NextSliceAdditions[ 3 ] = m33;
+  m_NextSliceAdditions[ 4 ] = 0.0;
+
+  // A voxel with a baricentric coordinate that is exactly zero lies outside if moving it a tiny
+  // bit along the first axis (or second, or third, if that doesn't move it off the face) makes
+  // the coordinate negative. This only depends on the tetrahedron, not on the voxel
+  m_BorderMask = 0;
+  for ( int vertexNumber = 0; vertexNumber < 4; vertexNumber++ )
+    {
+    const double  rowAddition = m_NextRowAdditions[ vertexNumber ];
+    const double  columnAddition = m_NextColumnAdditions[ vertexNumber ];
+    const double  sliceAddition = m_NextSliceAdditions[ vertexNumber ];
+    if ( ( rowAddition < 0 ) ||
+         ( rowAddition == 0 && columnAddition < 0 ) ||
+         ( rowAddition == 0 && columnAddition == 0 && sliceAddition < 0 ) )
+      {
+      m_BorderMask |= ( 1 << vertexNumber );
+      }
+    }
+
+}
+
+
+//
+//
+//
+template< typename TPixel >
+void
+TetrahedronInteriorScanner< TPixel >
+::SetAlphas( const double& alpha0, const double& alpha1, const double& alpha2, const double& alpha3 )
+{
+  m_Values[ 4 ] = alpha0 * m_Values[ 0 ] +
+                  alpha1 * m_Values[ 1 ] +
+                  alpha2 * m_Values[ 2 ] +
+                  alpha3 * m_Values[ 3 ];
+  m_NextRowAdditions[ 4 ] = alpha0 * m_NextRowAdditions[ 0 ] +
+                            alpha1 * m_NextRowAdditions[ 1 ] +
+                            alpha2 * m_NextRowAdditions[ 2 ] +
+                            alpha3 * m_NextRowAdditions[ 3 ];
+  m_NextColumnAdditions[ 4 ] = alpha0 * m_NextColumnAdditions[ 0 ] +
+                               alpha1 * m_NextColumnAdditions[ 1 ] +
+                               alpha2 * m_NextColumnAdditions[ 2 ] +
+                               alpha3 * m_NextColumnAdditions[ 3 ];
+  m_NextSliceAdditions[ 4 ] = alpha0 * m_NextSliceAdditions[ 0 ] +
+                              alpha1 * m_NextSliceAdditions[ 1 ] +
+                              alpha2 * m_NextSliceAdditions[ 2 ] +
+                              alpha3 * m_NextSliceAdditions[ 3 ];
+}
+
+
+//
+//
+//
+template< typename TPixel >
+template< typename TOperation >
+void
+TetrahedronInteriorScanner< TPixel >
+::ScanScalar( TOperation& op ) const
+{
+  double  sliceBeginValues[ 5 ];
+  double  columnBeginValues[ 5 ];
+  double  values[ 5 ];
+  std::copy( m_Values, m_Values + 5, sliceBeginValues );
+
+  TPixel*  sliceBeginPixel = m_FirstPixel;
+  for ( long z = 0; z < m_Size[ 2 ]; z++, sliceBeginPixel += m_OffsetTable[ 2 ] )
+    {
+    if ( z > 0 )
+      {
+      for ( int n = 0; n < 5; n++ )
+        {
+        sliceBeginValues[ n ] += m_NextSliceAdditions[ n ];
+        }
+      }
+    std::copy( sliceBeginValues, sliceBeginValues + 5, columnBeginValues );
+
+    TPixel*  columnBeginPixel = sliceBeginPixel;
+    for ( long y = 0; y < m_Size[ 1 ]; y++, columnBeginPixel += m_OffsetTable[ 1 ] )
+      {
+      if ( y > 0 )
+        {
+        for ( int n = 0; n < 5; n++ )
+          {
+          columnBeginValues[ n ] += m_NextColumnAdditions[ n ];
+          }
+        }
+      std::copy( columnBeginValues, columnBeginValues + 5, values );
+
+      TPixel*  pixel = columnBeginPixel;
+      for ( long x = 0; x < m_Size[ 0 ]; x++, pixel++ )
+        {
+        if ( x > 0 )
+          {
+          for ( int n = 0; n < 5; n++ )
+            {
+            values[ n ] += m_NextRowAdditions[ n ];
+            }
+          }
+
+        // Most voxels of the bounding box that are outside fail on the first coordinate or two,
+        // so stop at the first one that puts the voxel outside
+        bool  isOutside = false;
+        for ( int n = 0; n < 4; n++ )
+          {
+          if ( ( values[ n ] < 0 ) || ( values[ n ] == 0 && ( m_BorderMask & ( 1 << n ) ) ) )
+            {
+            isOutside = true;
+            break;
+            }
+          }
+        if ( !isOutside )
+          {
+          op( *pixel, values[ 4 ], values );
+          }
+        }
+      }
+    }
+
+}
+
+
+#ifdef KVL_TETRAHEDRON_SCANNER_AVX2
+//
+//
+//
+template< typename TPixel >
+template< typename TOperation >
+__attribute__(( target( "avx2" ) )) void
+TetrahedronInteriorScanner< TPixel >
+::ScanAVX2( TOperation& op ) const
+{
+  // pi0..pi3 go in one register, alpha in a scalar; each is updated with the same additions
+  // as in ScanScalar(), so the results are identical
+  const __m256d  zero = _mm256_setzero_pd();
+  const __m256d  nextRowAdditions = _mm256_loadu_pd( m_NextRowAdditions );
+  const __m256d  nextColumnAdditions = _mm256_loadu_pd( m_NextColumnAdditions );
+  const __m256d  nextSliceAdditions = _mm256_loadu_pd( m_NextSliceAdditions );
+
+  __m256d  sliceBeginValues = _mm256_loadu_pd( m_Values );
+  double  sliceBeginAlpha = m_Values[ 4 ];
+
+  TPixel*  sliceBeginPixel = m_FirstPixel;
+  for ( long z = 0; z < m_Size[ 2 ]; z++, sliceBeginPixel += m_OffsetTable[ 2 ] )
+    {
+    if ( z > 0 )
+      {
+      sliceBeginValues = _mm256_add_pd( sliceBeginValues, nextSliceAdditions );
+      sliceBeginAlpha += m_NextSliceAdditions[ 4 ];
+      }
+    __m256d  columnBeginValues = sliceBeginValues;
+    double  columnBeginAlpha = sliceBeginAlpha;
+
+    TPixel*  columnBeginPixel = sliceBeginPixel;
+    for ( long y = 0; y < m_Size[ 1 ]; y++, columnBeginPixel += m_OffsetTable[ 1 ] )
+      {
+      if ( y > 0 )
+        {
+        columnBeginValues = _mm256_add_pd( columnBeginValues, nextColumnAdditions );
+        columnBeginAlpha += m_NextColumnAdditions[ 4 ];
+        }
+      __m256d  values = columnBeginValues;
+      double  alpha = columnBeginAlpha;
+
+      TPixel*  pixel = columnBeginPixel;
+      for ( long x = 0; x < m_Size[ 0 ]; x++, pixel++ )
+        {
+        if ( x > 0 )
+          {
+          values = _mm256_add_pd( values, nextRowAdditions );
+          alpha += m_NextRowAdditions[ 4 ];
+          }
+
+        const int  negativeMask = _mm256_movemask_pd( _mm256_cmp_pd( values, zero, _CMP_LT_OQ ) );
+        const int  zeroMask = _mm256_movemask_pd( _mm256_cmp_pd( values, zero, _CMP_EQ_OQ ) );
+        if ( !negativeMask && !( zeroMask & m_BorderMask ) )
+          {
+          double  pi[ 4 ];
+          _mm256_storeu_pd( pi, values );
+          op( *pixel, alpha, pi );
+          }
+        }
+      }
+    }
+
+}
+#endif
+
+
+} // end namespace kvl
+
+#endif
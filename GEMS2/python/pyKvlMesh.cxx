@@ -7,8 +7,8 @@
 #include "pyKvlNumpy.h"
 #include "vnl/vnl_det.h"
 #include "itkCellInterface.h"
-#include "kvlAtlasMeshAlphaDrawer.h"
-#include "kvlAtlasMeshMultiAlphaDrawer.h"
+#include "kvlAtlasMeshAlphaDrawerCPU.h"
+#include "kvlAtlasMeshMultiAlphaDrawerCPU.h"
 
 #define XYZ_DIMENSIONS 3
 
@@ -235,9 +235,9 @@ unsigned int KvlMeshCollection::MeshCount() const {
 
 py::array_t<uint16_t> KvlMesh::RasterizeMesh(std::vector<size_t> size, int classNumber) {
     // Some typedefs
-    typedef kvl::AtlasMeshAlphaDrawer::ImageType  AlphaImageType;
+    typedef kvl::AtlasMeshAlphaDrawerCPU::ImageType  AlphaImageType;
     typedef AlphaImageType::SizeType  SizeType;
-    typedef kvl::AtlasMeshMultiAlphaDrawer::ImageType  MultiAlphasImageType;
+    typedef kvl::AtlasMeshMultiAlphaDrawerCPU::ImageType  MultiAlphasImageType;
 
     // Retrieve input arguments
     kvl::AtlasMesh::ConstPointer constMesh = static_cast< const kvl::AtlasMesh* >( mesh );
@@ -262,7 +262,7 @@ py::array_t<uint16_t> KvlMesh::RasterizeMesh(std::vector<size_t> size, int class
     {
 //        // Rasterize the specified prior. If the class number is 0, then pre-fill everything
 //        // so that parts not overlayed by the mesh are still considered to the background
-        kvl::AtlasMeshAlphaDrawer::Pointer  alphaDrawer = kvl::AtlasMeshAlphaDrawer::New();
+        kvl::AtlasMeshAlphaDrawerCPU::Pointer  alphaDrawer = kvl::AtlasMeshAlphaDrawerCPU::New();
         alphaDrawer->SetRegions( imageSize );
         alphaDrawer->SetClassNumber( classNumber );
         if ( classNumber == 0 )
@@ -313,7 +313,7 @@ py::array_t<uint16_t> KvlMesh::RasterizeMesh(std::vector<size_t> size, int class
         //std::cout << "numberOfClasses: " << numberOfClasses << std::endl;
 
         //std::cout << "Rasterizing mesh..." << std::flush;
-        kvl::AtlasMeshMultiAlphaDrawer::Pointer  drawer = kvl::AtlasMeshMultiAlphaDrawer::New();
+        kvl::AtlasMeshMultiAlphaDrawerCPU::Pointer  drawer = kvl::AtlasMeshMultiAlphaDrawerCPU::New();
         drawer->SetRegions( imageSize );
         //std::cout << "here: " << numberOfClasses << std::endl;
         drawer->Rasterize( mesh );
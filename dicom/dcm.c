@@ -1374,6 +1374,62 @@ DCM_GetElementSize(DCM_OBJECT ** callerObject, DCM_TAG tag,
 }
 
 
+/* DCM_GetElementFileOffset
+**
+** Purpose:
+**  Return where the value of a data element that was left in the file
+**  (the pixel data of an object opened from a file) starts, so that the
+**  caller can read the value itself without going through the object.
+**
+** Parameter Dictionary:
+**  object    Pointer to caller's ACR object
+**  tag       Tag of the data element of interest
+**  offset    Pointer to caller variable to hold the offset of the value
+**      in the file
+**  swapFlag  Pointer to caller variable that is set to TRUE if the
+**      value has to be byte swapped to native order
+**
+** Return Values:
+**
+**  DCM_NORMAL
+**  DCM_NULLOBJECT
+**  DCM_ILLEGALOBJECT
+**  DCM_ELEMENTNOTFOUND (also if the value is not left in the file)
+**
+** Algorithm:
+**  Description of the algorithm (optional) and any other notes.
+*/
+
+CONDITION
+DCM_GetElementFileOffset(DCM_OBJECT ** callerObject, DCM_TAG tag,
+                         off_t * offset, CTNBOOLEAN * swapFlag) {
+  PRIVATE_OBJECT
+  ** object;
+  PRV_ELEMENT_ITEM
+  * elementItem;
+  CONDITION
+  cond;
+
+  object = (PRIVATE_OBJECT **) callerObject;
+  cond = checkObject(object, "DCM_GetElementFileOffset");
+  if (cond != DCM_NORMAL)
+    return cond;
+
+  elementItem = locateElement(object, tag);
+  if (elementItem == NULL || elementItem->element.d.ot != NULL ||
+      (*object)->fd == -1 ||
+      elementItem->element.length == DCM_UNSPECIFIEDLENGTH)
+    return COND_PushCondition(DCM_ELEMENTNOTFOUND,
+                              DCM_Message(DCM_ELEMENTNOTFOUND),
+                              DCM_TAG_GROUP(tag), DCM_TAG_ELEMENT(tag),
+                              "DCM_GetElementFileOffset");
+
+  *offset = elementItem->dataOffset;
+  *swapFlag = (elementItem->byteOrder == BYTEORDER_REVERSE) ? TRUE : FALSE;
+  return DCM_NORMAL;
+}
+
+
 /* DCM_ScanParseObject
 **
 ** Purpose:
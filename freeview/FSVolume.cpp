@@ -2375,62 +2375,84 @@ MATRIX* FSVolume::GetRotationMatrix( int nPlane, double angle, double* origin )
   return m_r;
 }
 
-void FSVolume::CopyMRIDataToImage( MRI* mri,
-                                   vtkImageData* image )
+// Copy slices [z0, z1) of every frame of mri, whose voxels are of type S,
+// into the interleaved tuples of an image scalar array of type T.  With a
+// single frame each row is a straight copy.
+template <typename S, typename T>
+static void CopyMRISlicesToTuples( MRI* mri, T* tuples, int z0, int z1 )
 {
-  // Copy the slice data into the scalars.
   int zX = mri->width;
   int zY = mri->height;
   int zZ = mri->depth;
   int zFrames = mri->nframes;
 
-  vtkIdType nTuple = 0;
-  vtkDataArray *scalars = image->GetPointData()->GetScalars();
-  int nProgressStep = 20;
-  int nProgress = 0;
-  for ( int nZ = 0; nZ < zZ; nZ++ )
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for ( int nZ = z0; nZ < z1; nZ++ )
   {
     for ( int nY = 0; nY < zY; nY++ )
     {
-      for ( int nX = 0; nX < zX; nX++ )
+      T* dst = tuples + ( (size_t)nZ*zY + nY ) * zX * zFrames;
+      if ( zFrames == 1 )
       {
-        for ( int nFrame = 0; nFrame < zFrames; nFrame++ )
+        S* src = (S*)mri->slices[nZ][nY];
+        for ( int nX = 0; nX < zX; nX++ )
         {
-          switch ( mri->type )
-          {
-          case MRI_UCHAR:
-            scalars->SetComponent( nTuple, nFrame,
-                                   MRIseq_vox( mri, nX, nY, nZ, nFrame ) );
-            break;
-          case MRI_INT:
-            scalars->SetComponent( nTuple, nFrame,
-                                   MRIIseq_vox( mri, nX, nY, nZ, nFrame ) );
-            break;
-          case MRI_LONG:
-            scalars->SetComponent( nTuple, nFrame,
-                                   MRILseq_vox( mri, nX, nY, nZ, nFrame ) );
-            break;
-          case MRI_FLOAT:
-            scalars->SetComponent( nTuple, nFrame,
-                                   MRIFseq_vox( mri, nX, nY, nZ, nFrame ) );
-            break;
-          case MRI_SHORT:
-            scalars->SetComponent( nTuple, nFrame,
-                                   MRISseq_vox( mri, nX, nY, nZ, nFrame ) );
-            break;
-          default:
-            break;
-          }
+          dst[nX] = src[nX];
+        }
+        continue;
+      }
+      for ( int nFrame = 0; nFrame < zFrames; nFrame++ )
+      {
+        S* src = (S*)mri->slices[nZ + nFrame*zZ][nY];
+        for ( int nX = 0; nX < zX; nX++ )
+        {
+          dst[(size_t)nX*zFrames + nFrame] = src[nX];
         }
-        nTuple++;
       }
     }
+  }
+}
 
-    if ( nZ%(max(1, zZ/5)) == 0 )
+void FSVolume::CopyMRIDataToImage( MRI* mri,
+                                   vtkImageData* image )
+{
+  // Copy the slice data into the scalars, which CreateImage or
+  // ResizeRotatedImage allocated with the scalar type of mri.
+  int zZ = mri->depth;
+
+  vtkDataArray *scalars = image->GetPointData()->GetScalars();
+  void* tuples = scalars->GetVoidPointer( 0 );
+  int nProgressStep = 20;
+  int nProgress = 0;
+  int nSlicesPerStep = max(1, zZ/5);
+  for ( int nZ = 0; nZ < zZ; nZ += nSlicesPerStep )
+  {
+    int nZEnd = min(zZ, nZ + nSlicesPerStep);
+    switch ( mri->type )
     {
-      nProgress += nProgressStep;
-      emit ProgressChanged( nProgress );
+    case MRI_UCHAR:
+      CopyMRISlicesToTuples<unsigned char>( mri, (unsigned char*)tuples, nZ, nZEnd );
+      break;
+    case MRI_INT:
+      CopyMRISlicesToTuples<int>( mri, (int*)tuples, nZ, nZEnd );
+      break;
+    case MRI_LONG:
+      CopyMRISlicesToTuples<long32>( mri, (long*)tuples, nZ, nZEnd );
+      break;
+    case MRI_FLOAT:
+      CopyMRISlicesToTuples<float>( mri, (float*)tuples, nZ, nZEnd );
+      break;
+    case MRI_SHORT:
+      CopyMRISlicesToTuples<short>( mri, (short*)tuples, nZ, nZEnd );
+      break;
+    default:
+      break;
     }
+
+    nProgress += nProgressStep;
+    emit ProgressChanged( nProgress );
   }
 }
 
@@ -236,6 +236,7 @@ typedef struct
   double bval, bvecx, bvecy, bvecz;
   float LargestValue; // 0x28, 0x107
   int   ErrorFlag;   /* Set for error, eg, aborted run */
+  int   SliceDirCosPresent; /* Vs came from the ASCII header */
 
   // Rescaling parameters
   double RescaleIntercept, RescaleSlope; //(0028,1052) (0028,1053)
@@ -289,6 +290,8 @@ int DCMSliceDir(DICOMInfo **dcmfi_list, int nlist);
 MRI *DICOMRead2(const char *dcmfile, int LoadVolume);
 
 DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid);
+DCM_ELEMENT *GetElementFromObject(DCM_OBJECT **object, long grpid, long elid);
+DCM_ELEMENT *GetPixelDataFromFile(const char *dicomfile);
 int AllocElementData(DCM_ELEMENT *e);
 char *ElementValueString(DCM_ELEMENT *e, int DoBackslash);
 int FreeElementData(DCM_ELEMENT *e);
@@ -316,6 +319,15 @@ int DumpSDCMFileInfo(FILE *fp, SDCMFILEINFO *sdcmfi);
 int FreeSDCMFileInfo(SDCMFILEINFO **ppsdcmfi);
 SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile);
 SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles);
+
+/* The directory index parses each file in a directory once, in parallel,
+   and gives the SDCMFILEINFO of each Siemens DICOM file, in file name
+   order. If the environment variable FS_DICOM_INDEX_CACHE is set, the
+   index is kept on disk and only new or changed files are parsed again:
+     FS_DICOM_INDEX_CACHE=<directory>  sdcm.<hash of dicom dir>.index there
+     FS_DICOM_INDEX_CACHE=1            .sdcm.index in the dicom directory */
+SDCMFILEINFO **sdcmIndexDir(const char *PathName, int *NSDCMFiles);
+SDCMFILEINFO **ScanSiemensSeriesInfo(const char *dcmfile, int *nList);
 int CompareSDCMFileInfo(const void *a, const void *b);
 int SortSDCMFileInfo(SDCMFILEINFO **sdcmfi_list, int nlist);
 
@@ -43,6 +43,8 @@ int   	print_annotation_table(FILE *fp);
 int   	print_annotation_colortable(FILE *fp);
 int   	index_to_annotation(int index) ;
 LABEL*	annotation2label(int annotid, MRIS *Surf);
+LABEL**	MRISannotation2labels(MRIS *Surf, int *pnlabels);
+int   	MRISlabels2annotation(MRIS *Surf, LABEL **labels, int nlabels);
 int 	set_atable_from_ctable(COLOR_TABLE *pct);
 int  	MRISdivideAnnotation(MRI_SURFACE *mris, int *nunits) ;
 int  	MRISdivideAnnotationUnit(MRI_SURFACE *mris, int annot, int nunits) ;
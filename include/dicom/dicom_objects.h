@@ -286,6 +286,9 @@ extern "C"
   CONDITION
   DCM_GetElementValueOffset(DCM_OBJECT **obj, DCM_ELEMENT *element,
                             unsigned long offset);
+  CONDITION
+  DCM_GetElementFileOffset(DCM_OBJECT ** obj, DCM_TAG tag,
+                           off_t * offset, CTNBOOLEAN * swapFlag);
   typedef
   CONDITION(DCM_GET_COMPRESSED_CALLBACK) (void *buf, U32 bytesExported,
                                           int index, int startFlag, int lastFlag, int startOfFragment, void *ctx);
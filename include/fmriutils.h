@@ -78,6 +78,25 @@ typedef struct
 MRIGLM;
 /*---------------------------------------------------------*/
 
+/*---------------------------------------------------------*/
+// Things shared by all voxels when fitting in blocks (MRIglmBatch)
+typedef struct
+{
+  int nvox;          // Number of voxels in the mask
+  int *vc, *vr, *vs; // col, row, slice of each voxel
+  int nblocks;       // Number of blocks of voxels
+  int nf, nreg;      // Number of frames and regressors
+  int ncontrasts;
+  double *X;         // Weighted design matrix, nf-by-nreg
+  double *P;         // inv(X'*X)*X', nreg-by-nf
+  double **C;        // Contrast matrices
+  double **iCVM;     // inv(C*inv(X'*X)*C')
+  double *CVM;       // C*inv(X'*X)*C' (t-tests only)
+  double **Q, **a, **bsum; // For the pcc
+}
+GLMBATCH;
+/*---------------------------------------------------------*/
+
 const char *fMRISrcVersion(void);
 MRI *fMRImatrixMultiply(MRI *inmri, MATRIX *M, MRI *outmri);
 MRI *fMRIcovariance(MRI *fmri, int Lag, float DOFAdjust, MRI *mask, MRI *covar);
@@ -105,6 +124,11 @@ int MRIglmFit(MRIGLM *glmmri);
 int MRIglmTest(MRIGLM *mriglm);
 int MRIglmLoadVox(MRIGLM *mriglm, int c, int r, int s, int LoadBeta);
 int MRIglmNRegTot(MRIGLM *mriglm);
+int MRIglmCanBatch(MRIGLM *mriglm);
+int MRIglmBatch(MRIGLM *mriglm, int DoFit, int DoTest);
+GLMBATCH *MRIglmBatchAlloc(MRIGLM *mriglm, int DoTest);
+int MRIglmBatchBlock(MRIGLM *mriglm, GLMBATCH *gb, int nthblock, int DoFit, int DoTest, int *yperm, double *ysign);
+int MRIglmBatchFree(GLMBATCH **pgb);
 VECTOR *MRItoVector(MRI *mri, int c, int r, int s, VECTOR *v);
 int MRIsetSign(MRI *invol, MRI *signvol, int frame);
 MRI *MRIvolMax(MRI *invol, MRI *out);
@@ -155,6 +155,7 @@ typedef struct
   short   n_just_priors ;
   int     ntraining ;
   char    regularized ;
+  double  *dcache ;  // non-NULL while a density cache is active (see GCAlabel())
 }
 GC1D, GAUSSIAN_CLASSIFIER_1D ;
 
@@ -234,6 +235,9 @@ typedef struct
   int          total_training ;
   int          max_label ;
   COLOR_TABLE  *ct ;
+  struct GCA_PACK *pack ;  // non-NULL if the node/prior arrays live in packed storage (see GCApack())
+  double *dcache ;         // the gc->dcache entries, and how many users there are
+  int    dcache_refs ;
 }
 GAUSSIAN_CLASSIFIER_ARRAY, GCA ;
 
@@ -289,6 +293,20 @@ int  GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform,
 int  GCAtrainCovariances(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform) ;
 int  GCAwrite(GCA *gca,const char *fname) ;
 GCA  *GCAread(const char *fname) ;
+
+/* Packed GCA storage. All node labels, GC1D means/covariances, Gibbs
+   neighbor labels/priors and prior labels/priors of a packed GCA live in
+   a handful of flat arrays (indexed in node and prior order) instead of
+   one allocation per node, classifier and neighbor. The .gcp file format
+   is the same image on disk, so GCAread() can mmap() it (or read it in
+   one go) rather than parsing it value by value. GCAwrite() writes .gcp
+   when the file name ends in it, which converts an existing .gca. Code
+   that grows the per-node arrays (training, label insertion) unpacks
+   the GCA first. */
+int  GCAwritePacked(GCA *gca, const char *fname) ;
+GCA  *GCAreadPacked(const char *fname) ;
+int  GCApack(GCA *gca) ;
+int  GCAunpack(GCA *gca) ;
 int  GCAcompleteMeanTraining(GCA *gca) ;
 int  GCAcompleteCovarianceTraining(GCA *gca) ;
 MRI  *GCAlabel(MRI *mri_src, GCA *gca, MRI *mri_dst, TRANSFORM *transform) ;
@@ -314,6 +332,30 @@ float GCAcomputeNumberOfGoodFittingSamples(GCA *gca, GCA_SAMPLE *gcas,
 float  GCAcomputeLogSampleProbability(GCA *gca, GCA_SAMPLE *gcas,
                                       MRI *mri_inputs,
                                       TRANSFORM *transform,int nsamples, double clamp);
+
+// A structure-of-arrays copy of a sample list, for scoring many candidate
+// LINEAR_VOX_TO_VOX transforms at once (eg the mri_em_register grid search).
+// GCASsoaLogProbability() returns what GCAcomputeLogSampleProbability()
+// would for m_L (the mean log p of the samples, up to the order of the sum),
+// but it writes neither the samples nor a transform, so any number of threads
+// can call it. stride > 1 scores every stride'th sample only, for a coarse
+// first look at the candidates, and returns the mean over those.
+typedef struct GCAS_SOA {
+  int    nsamples;
+  int    ninputs;
+  float  *xp, *yp, *zp;   // prior coordinates
+  float  *means;          // [nsamples*ninputs]
+  float  *covars;         // one input: the variance
+  double *inv_covars;     // more: [nsamples*ninputs*ninputs]
+  double *log_norm;       // -log(sqrt(det(covars)))
+  double *log_prior;
+  MATRIX *m_prior2voxel;  // prior voxel -> atlas (talairach) voxel
+} GCAS_SOA;
+
+GCAS_SOA *GCASsoaAlloc(GCA *gca, GCA_SAMPLE *gcas, int nsamples);
+int       GCASsoaFree(GCAS_SOA **psoa);
+float     GCASsoaLogProbability(GCAS_SOA const *soa, MRI *mri_inputs, MATRIX const *m_L, int stride, double clamp);
+
 float  GCAcomputeLabelIntensityVariance(GCA *gca, GCA_SAMPLE *gcas,
 					MRI *mri_inputs,
 					TRANSFORM *transform,int nsamples);
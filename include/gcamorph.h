@@ -293,6 +293,12 @@ MRI       *GCAMmorphToAtlasWithDensityCorrection(MRI *mri_src,
                                                  MRI *mri_morphed, int frame) ;
 MRI       *GCAMmorphToAtlas(MRI *mri_src, 
                             GCA_MORPH *gcam, MRI *mri_dst, int frame, int sample_type) ;
+// A morph compiled to the source voxel coords of every atlas voxel, for
+// resampling several volumes through the same morph (see gcamorph.c)
+#define GCAM_FIELD_INVALID  -1e10f
+MRI       *GCAMmorphToAtlasField(GCA_MORPH *gcam, const char *cache_fname) ;
+MRI       *GCAMmorphFieldApply(MRI *mri_src, MRI *mri_field, MRI *mri_dst,
+                               int frame, int sample_type) ;
 MRI       *GCAMmorphToAtlasToMNI(MRI *mri_src, GCA_MORPH *gcam, GCA_MORPH *MNIgcam, 
 			    MRI *mri_dst, int frame, int sample_type) ;
 MRI       *GCAMmorphToAtlasType(MRI *mri_src, 
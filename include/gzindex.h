@@ -0,0 +1,73 @@
+/**
+ * @file  gzindex.h
+ * @brief random access into gzip files (eg, .mgz) through a seek index
+ *
+ * A gzip stream can only be decoded from the beginning. The index records
+ * "access points" every span bytes of uncompressed output: the bit position
+ * of a deflate block boundary in the compressed file plus the 32K of output
+ * that precedes it. Decoding can be restarted at any access point, so a
+ * byte range can be extracted without inflating everything before it, and
+ * the ranges between consecutive access points can be inflated in parallel.
+ * Based on the zran.c example distributed with zlib (Mark Adler).
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef GZINDEX_H
+#define GZINDEX_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define GZI_WINSIZE        32768           // deflate history window
+#define GZI_DEFAULT_SPAN   (4L*1024*1024)  // uncompressed bytes between access points
+#define GZI_EXTENSION      ".gzidx"        // cache file is <file>.gzidx
+
+typedef struct
+{
+  long long in ;      // offset in the compressed file of the first full byte
+  long long out ;     // corresponding offset in the uncompressed data
+  int       bits ;    // # of bits (1-7) of the byte at in-1 that belong to the block, or 0
+  unsigned char *window ; // the GZI_WINSIZE bytes of output preceding out
+}
+GZI_POINT ;
+
+typedef struct
+{
+  int        npoints ;
+  int        max_points ;
+  long long  span ;
+  long long  length ;     // total # of uncompressed bytes in the file
+  long long  file_size ;  // size and modification time of the compressed
+  long long  file_mtime ; // file the index was built from (for staleness)
+  GZI_POINT *points ;
+}
+GZ_INDEX ;
+
+GZ_INDEX  *GZindexBuild(const char *gzfname, long long span) ;
+GZ_INDEX  *GZindexRead(const char *idxfname) ;
+int        GZindexWrite(const GZ_INDEX *gzi, const char *idxfname) ;
+int        GZindexFree(GZ_INDEX **pgzi) ;
+int        GZindexIsCurrent(const GZ_INDEX *gzi, const char *gzfname) ;
+GZ_INDEX  *GZindexGet(const char *gzfname, int cache) ;
+long long  GZindexExtract(const GZ_INDEX *gzi, const char *gzfname,
+                          long long offset, void *buf, long long len) ;
+long long  GZmemberCompress(const void *buf, long long len, int level,
+                            unsigned char **pout) ;
+
+#if defined(__cplusplus)
+};
+#endif
+
+#endif
@@ -74,6 +74,15 @@ LABEL ;
 #define LABEL_COORDS_VOXEL        3
 #define LABEL_COORDS_SURFACE_RAS  4
 
+// A binary label starts with this magic number (written big-endian, so
+// its first byte can't begin an ascii label), then the version, coords,
+// # of points, and the space string (length then chars). Each point is
+// vno, x, y, z, stat (int and 4 floats, big-endian). LabelRead() reads
+// either kind of file, so binary labels can be kept as .label files.
+// LabelWrite() writes binary labels if FS_LABEL_BINARY is set.
+#define LABEL_BINARY_MAGIC        0xFFFFFE01
+#define LABEL_BINARY_VERSION      1
+
 #include "mrisurf.h" // MRI_SURFACE, MRIS
 
 LABEL *LabelToScannerRAS(LABEL *lsrc, MRI *mri, LABEL *ldst) ;
@@ -92,7 +101,9 @@ int     LabelDump(FILE *fp, LABEL *area) ;
 LABEL   *LabelRead(const char *subject_name,const char *label_name) ;
 LABEL   *LabelReadFrom(const char *subject_name, FILE *fp) ;
 int     LabelWriteInto(LABEL *area, FILE *fp) ;
+int     LabelWriteBinaryInto(LABEL *area, FILE *fp) ;
 int     LabelWrite(LABEL *area,const char *fname) ;
+int     LabelWriteBinary(LABEL *area,const char *fname) ;
 int     LabelToCurrent(LABEL *area, MRI_SURFACE *mris) ;
 int     LabelToCanonical(LABEL *area, MRI_SURFACE *mris) ;
 int     LabelThreshold(LABEL *area, float thresh) ;
@@ -127,6 +138,14 @@ int     LabelSphericalTransform(LABEL *area, MRI_SURFACE *mris) ;
 MATRIX  *LabelCovarianceMatrix(LABEL *area, MATRIX *mat) ;
 LABEL   *LabelCombine(LABEL *area, LABEL *area_dst) ;
 
+// Set algebra on the vertex numbers of two surface labels in O(n), using
+// a bitset of the vertices. Deleted points and points without a vertex
+// are ignored, each vertex is in the result once (with the first point
+// for it), in the order of area1 then area2.
+LABEL   *LabelVertexUnion(LABEL *area1, LABEL *area2, LABEL *ldst) ;
+LABEL   *LabelVertexIntersection(LABEL *area1, LABEL *area2, LABEL *ldst) ;
+LABEL   *LabelVertexDifference(LABEL *area1, LABEL *area2, LABEL *ldst) ;
+
 LABEL   *LabelTranslate(LABEL *area,
                         LABEL *area_offset,
                         float dx, float dy, float dz) ;
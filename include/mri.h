@@ -266,6 +266,13 @@ typedef struct
   ELTT( size_t, bytes_per_slice ) SEP    /* # bytes per slice */    \
   ELTT( size_t, bytes_per_vol ) SEP      /* # bytes per volume/timepoint */    \
   ELTT( size_t, bytes_total ) SEP        /* # total number of pixel bytes in the struct */    \
+  /* When the chunk lives in a private mmap() of the file it was read from */    \
+  /* (see MRIreadMapped()), map_base/map_len describe the mapping and */    \
+  /* map_ready[f] is nonzero once frame f holds host-order voxels. */    \
+  ELTP( void, map_base ) SEP    \
+  ELTX( size_t, map_len ) SEP    \
+  ELTX( int, map_swap ) SEP              /* bytes per voxel to swap, 0 if file order == host order */    \
+  ELTP( unsigned char, map_ready ) SEP    \
   ELTP( COLOR_TABLE, ct ) SEP    \
   ELTP( MRI_FRAME, frames )    \
 
@@ -426,6 +433,7 @@ int   MRIallocIndices(MRI *mri) ;
 int   MRIsetResolution(MRI *mri, float xres, float yres, float zres) ;
 int   MRIsetTransform(MRI *mri,   General_transform *transform) ;
 MRI * MRIallocChunk(int width, int height, int depth, int type, int nframes);
+int   MRIattachChunk(MRI *mri, void *chunk) ;
 int   MRIchunk(MRI **pmri);
 
 
@@ -960,6 +968,31 @@ mri->slices[z+(n)*mri->depth][y])[x])
 #define MRILseq_vox(mri,x,y,z,n)  (((long32 *)\
 mri->slices[z+(n)*mri->depth][y])[x])
 
+/* Contiguous ("chunked") voxel access. When mri->ischunked is set all frames
+   live in the single aligned block mri->chunk, and the byte strides between
+   neighbouring columns, rows, slices and frames are mri->bytes_per_vox,
+   bytes_per_row, bytes_per_slice and bytes_per_vol. These macros bypass the
+   slices[][] row table and must only be used on chunked volumes. */
+#define MRI_CHUNK_ALIGNMENT 64
+#define MRIchunk_ptr(mri,x,y,z,n) ((void *)((char *)(mri)->chunk  \
+  + (size_t)(x)*(mri)->bytes_per_vox + (size_t)(y)*(mri)->bytes_per_row \
+  + (size_t)(z)*(mri)->bytes_per_slice + (size_t)(n)*(mri)->bytes_per_vol))
+#define MRIchunk_vox(mri,x,y,z,n)   (*(BUFTYPE *)MRIchunk_ptr(mri,x,y,z,n))
+#define MRISchunk_vox(mri,x,y,z,n)  (*(short *)MRIchunk_ptr(mri,x,y,z,n))
+#define MRIIchunk_vox(mri,x,y,z,n)  (*(int *)MRIchunk_ptr(mri,x,y,z,n))
+#define MRIFchunk_vox(mri,x,y,z,n)  (*(float *)MRIchunk_ptr(mri,x,y,z,n))
+
+/* Element (not byte) strides of a chunked volume, for linear iteration:
+   voxel (x,y,z,n) is at index x + y*MRIstride_row + z*MRIstride_slice
+   + n*MRIstride_frame from MRIframeChunk(mri, 0). */
+#define MRIstride_row(mri)    ((mri)->bytes_per_row / (mri)->bytes_per_vox)
+#define MRIstride_slice(mri)  ((mri)->bytes_per_slice / (mri)->bytes_per_vox)
+#define MRIstride_frame(mri)  ((mri)->bytes_per_vol / (mri)->bytes_per_vox)
+
+void  *MRIframeChunk(const MRI *mri, int frame) ;
+float *MRIFframeChunk(const MRI *mri, int frame) ;
+int    MRIisContiguous(const MRI *mri) ;
+
 #define MRI_HEIGHT      0
 #define MRI_WIDTH       1
 #define MRI_DEPTH       2
@@ -1354,6 +1387,18 @@ MRI *MRIreadEx(const char *fname, int nthframe);
 MRI *MRIreadType(const char *fname, int type);
 MRI *MRIreadInfo(const char *fname);
 MRI *MRIreadHeader(const char *fname, int type);
+
+/* Memory-mapped reads of uncompressed .mgh and .nii volumes. The voxels
+   are used in place when the file byte order matches the host, otherwise
+   frames are byte-swapped in the (private, copy-on-write) mapping either
+   all at once or, with MRI_MAP_LAZY, only when MRImapFrame() is called.
+   Setting FS_MRI_MMAP=1 makes MRIread() and friends map eagerly where
+   possible. Unsupported files are read the normal way. */
+#define MRI_MAP_LAZY  0x01
+MRI *MRIreadMapped(const char *fname, int flags);
+int  MRIisMapped(const MRI *mri);
+int  MRImapFrame(MRI *mri, int frame);
+int  MRIunmapFrame(MRI *mri, int frame);
 int GetSPMStartFrame(void);
 int MRIwrite(MRI *mri,const  char *fname);
 int MRIwriteFrame(MRI *mri,const  char *fname, int frame) ;
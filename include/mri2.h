@@ -123,6 +123,28 @@ int MRIsegStatsRobust(MRI *seg, int segid, MRI *mri,int frame,
 		      float *min, float *max, float *range,
 		      float *mean, float *std, float Pct);
 
+/* Statistics of many segmentations (and frames) computed in one pass
+   over the volume, see MRIsegStatsTable(). Per-frame values are stored
+   at [n*nframes + f], where n indexes segids and f counts from frame0. */
+typedef struct
+{
+  int     nsegs ;
+  int    *segids ;
+  int     frame0 ;
+  int     nframes ;     // 0 when only counting
+  int    *nvoxels ;     // # of voxels with segids[n] (before any trimming)
+  double *min ;
+  double *max ;
+  double *range ;
+  double *mean ;
+  double *std ;
+  double *sum ;
+} SEGSTAT_TABLE ;
+
+SEGSTAT_TABLE *MRIsegStatsTable(MRI *seg, MRI *mri, int frame,
+                                const int *segidlist, int nsegs, float Pct);
+int MRIsegStatsTableFree(SEGSTAT_TABLE **ptable);
+
 MRI *MRImask_with_T2_and_aparc_aseg(MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior) ;
 int *MRIsegmentationList(MRI *seg, int *pListLength);
 
@@ -0,0 +1,65 @@
+/**
+ * @file  mrisbvh.h
+ * @brief bounding volume hierarchy over the vertices or faces of a surface
+ *
+ * A BVH answers closest vertex, closest face and within-distance queries
+ * in O(log n) without ever falling back to a search of the whole surface,
+ * unlike the MHT, whose searches are limited to nearby buckets.  The tree
+ * is not changed by queries, so any number of threads can query it at once.
+ * It is a snapshot: it must be rebuilt if the vertices move.
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRISBVH_H
+#define MRISBVH_H
+
+#include "mrisurf.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct MRIS_BVH MRIS_BVH;
+
+// which is CURRENT_VERTICES, ORIGINAL_VERTICES, CANONICAL_VERTICES,
+// WHITE_VERTICES, PIAL_VERTICES or FLATTENED_VERTICES.
+// Ripped vertices and ripped faces are left out.
+//
+MRIS_BVH *BVHcreateVertexTree(MRI_SURFACE const *mris, int which);
+MRIS_BVH *BVHcreateFaceTree  (MRI_SURFACE const *mris, int which);
+void      BVHfree(MRIS_BVH **pbvh);
+
+// Return the closest vertex or face number, and its distance in *min_dist
+// (if not NULL), or -1 if the tree is empty.  Of equally close vertices or
+// faces the lowest numbered is returned, as MRISfindClosestVertex() does.
+//
+int BVHfindClosestVertexNo(MRIS_BVH const *bvh, double x, double y, double z, float *min_dist);
+int BVHfindClosestFaceNo  (MRIS_BVH const *bvh, double x, double y, double z, float *min_dist);
+
+// The same for npoints points xyz[3*i..3*i+2], done in parallel.
+// min_dist may be NULL.
+//
+void BVHfindClosestVertexNos(MRIS_BVH const *bvh, int npoints, float const *xyz, int *vno, float *min_dist);
+void BVHfindClosestFaceNos  (MRIS_BVH const *bvh, int npoints, float const *xyz, int *fno, float *min_dist);
+
+// All the vertices or faces within max_dist of the point, in ascending order.
+// The result must be freed by the caller; NULL if there are none.
+//
+int *BVHgetAllWithinDistance(MRIS_BVH const *bvh, double x, double y, double z, double max_dist, int *pnum);
+
+#if defined(__cplusplus)
+};
+#endif
+
+#endif
@@ -2083,6 +2083,33 @@ int MRISextendedNeighbors(MRIS *SphSurf,int TargVtxNo, int CurVtxNo,
                           int nXNbrsMax, int DistType);
 MRI *MRISgaussianSmooth(MRIS *Surf, MRI *Src, double GStd, MRI *Targ,
                         double TruncFactor);
+
+/* The linear operator applied by MRISgaussianSmooth(), held as a sparse
+   matrix in compressed row form: row vno has the weights weight[k] for the
+   vertices col[k], rowStart[vno] <= k < rowStart[vno+1]. Building it is
+   most of the cost of smoothing, so it is kept for the last surface used
+   and, when FS_SURF_SMOOTH_CACHE is set, cached on disk keyed by the
+   surface checksum, gstd and truncation. FS_SURF_SMOOTH_CACHE can be a
+   directory, otherwise the cache is written next to the surface file. */
+typedef struct
+{
+  int nvertices;
+  unsigned long long checksum;
+  double gstd;
+  double truncFactor;
+  long long nnz;
+  long long *rowStart;
+  int *col;
+  double *weight;
+} MRIS_SMOOTH_OP;
+
+unsigned long long MRISsmoothOpChecksum(MRIS *Surf);
+MRIS_SMOOTH_OP *MRISgaussianSmoothOp(MRIS *Surf, double GStd, double TruncFactor);
+MRIS_SMOOTH_OP *MRISgaussianSmoothOpBuild(MRIS *Surf, double GStd, double TruncFactor);
+int MRISsmoothOpWrite(MRIS_SMOOTH_OP *op, const char *fname);
+MRIS_SMOOTH_OP *MRISsmoothOpRead(const char *fname);
+void MRISsmoothOpFree(MRIS_SMOOTH_OP **pop);
+MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP *op, MRI *Src, MRI *Targ);
 MRI *MRISdistSphere(MRIS *surf, double dmax);
 int MRISgaussianWeights(MRIS *surf, MRI *dist, double GStd);
 MRI *MRISspatialFilter(MRI *Src, MRI *wdist, MRI *Targ);
@@ -0,0 +1,104 @@
+/**
+ * @file  romp_profile.h
+ * @brief always-compiled, runtime-enabled hierarchical profiling of named scopes
+ *
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Unlike the ROMP_SUPPORT_ENABLED statistics, this support is always compiled in.
+// It does nothing beyond testing a flag unless the environment variable FS_PROFILE is set
+//
+//      FS_PROFILE=1            write the scope tree to stderr when the program exits
+//      FS_PROFILE=<directory>  write <directory>/<program>.<pid>.txt and .json
+//      FS_PROFILE=<file>       write the scope tree to stderr and the Chrome trace to <file>
+//
+// The .json file is in the Chrome trace event format, so it can be loaded into
+// chrome://tracing or https://ui.perfetto.dev.  Using a directory is convenient for
+// scripts such as recon-all that run many programs, since each gets its own pair of files.
+//
+//      FS_PROFILE_MAX_EVENTS=n limits the trace to n scope instances per thread (default 1000000)
+//                              the tree still counts every instance
+//
+// All the annotated omp for loops (ROMP_PF_begin) and ROMP_SCOPE_begin scopes, and the
+// TIMER_INTERVAL_BEGIN intervals, are reported as scopes.  Other scopes are added with
+//
+#if 0
+        ROMP_PROFILE_begin("GCAMregister")
+        ...                                     // break, return, goto out of the scope are illegal
+        ROMP_PROFILE_COUNT("line searches", 1)  // added to a per-thread counter in the current scope
+        ...
+        ROMP_PROFILE_end
+#endif
+//
+// Each thread has its own tree of scopes, keyed by the place in the source they are started.
+// Allocations are counted against the innermost scope when mgh_malloc.c is intercepting
+// malloc et. al. (see the link command described there)
+//
+typedef struct ROMP_profile_site {
+    const char*  name;          // NULL means use func
+    const char*  file;
+    const char*  func;
+    int          line;
+} ROMP_profile_site;
+
+typedef struct ROMP_profile_frame {
+    int depth;                  // -1 if the scope is not being recorded
+} ROMP_profile_frame;
+
+int  ROMP_profile_enabled(void);
+
+void ROMP_profile_begin(ROMP_profile_site* site, ROMP_profile_frame* frame);
+void ROMP_profile_end  (ROMP_profile_frame* frame);
+void ROMP_profile_count(const char* name, long delta);
+
+void ROMP_profile_noteAlloc(size_t size);
+void ROMP_profile_noteFree (void);
+    // called by mgh_malloc.c, these never allocate
+
+void ROMP_profile_show_tree  (FILE* file);
+int  ROMP_profile_write_trace(const char* filename);
+    // done automatically at exit when FS_PROFILE is set, but available for programs that want more
+
+
+#define ROMP_PROFILE_begin_named(VAR, NAME) \
+    static ROMP_profile_site VAR##_profileSite = { NAME, __FILE__, __func__, __LINE__ }; \
+    ROMP_profile_frame       VAR##_profileFrame; \
+    ROMP_profile_begin(&VAR##_profileSite, &VAR##_profileFrame); \
+    // end of macro
+
+#define ROMP_PROFILE_end_named(VAR) \
+    ROMP_profile_end(&VAR##_profileFrame); \
+    // end of macro
+
+#define ROMP_PROFILE_begin(NAME) \
+    { ROMP_PROFILE_begin_named(ROMP_profile, NAME)
+
+#define ROMP_PROFILE_end \
+    ROMP_PROFILE_end_named(ROMP_profile) }
+
+#define ROMP_PROFILE_COUNT(NAME, DELTA) \
+    ROMP_profile_count((NAME), (DELTA))
+
+#if defined(__cplusplus)
+};
+#endif
@@ -45,6 +45,12 @@
 #include "timer.h"
 
 
+// Whether or not ROMP_SUPPORT_ENABLED, the annotated loops and scopes below
+// are also scopes for the FS_PROFILE support
+//
+#include "romp_profile.h"
+
+
 // Optionally tell romp when the main program has started
 // so it can time the period before the first parallel loop    
 //
@@ -169,9 +175,11 @@ void ROMP_pflb_end(
 	// end of macro
 
     #define ROMP_PF_begin \
-	{
+	{ \
+	ROMP_PROFILE_begin_named(ROMP_pf, NULL)
 
     #define ROMP_PF_end \
+	ROMP_PROFILE_end_named(ROMP_pf) \
 	}
 
     #define ROMP_PFLB_begin
@@ -196,9 +204,11 @@ void ROMP_pflb_end(
 	{ \
 	static ROMP_pf_static_struct ROMP_pf_static = { 0L, __BASE_FILE__, __func__, __LINE__ }; \
 	ROMP_pf_stack_struct  ROMP_pf_stack;  \
-	ROMP_pf_begin(&ROMP_pf_static, &ROMP_pf_stack);
+	ROMP_pf_begin(&ROMP_pf_static, &ROMP_pf_stack); \
+	ROMP_PROFILE_begin_named(ROMP_pf, NULL)
 
     #define ROMP_PF_end \
+	ROMP_PROFILE_end_named(ROMP_pf) \
 	ROMP_pf_end(&ROMP_pf_stack); \
 	}
 
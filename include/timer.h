@@ -31,6 +31,8 @@
 
 #include <sys/timeb.h>
 
+#include "romp_profile.h"
+
 
 
 #if defined(__cplusplus)
@@ -56,11 +58,15 @@ Nanosecs TimerElapsedNanosecs(NanosecsTimer * then) ;	// returns delta in nanose
 extern int ftime (struct timeb *__timebuf);
 #endif
 
+// The intervals are also scopes for the FS_PROFILE support in romp_profile.h
+//
 #define TIMER_INTERVAL_BEGIN(NAME) 		\
       	struct timeb NAME;			\
-      	TimerStart(&NAME);
+      	TimerStart(&NAME);			\
+	ROMP_PROFILE_begin_named(NAME, #NAME)
  
 #define TIMER_INTERVAL_END(NAME)		\
+	ROMP_PROFILE_end_named(NAME)		\
 	fprintf(stderr, "%s:%d interval took %d msec\n", __FILE__, __LINE__, TimerStop(&NAME));
 	
 
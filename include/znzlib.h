@@ -78,12 +78,15 @@ extern "C"
 #endif
 
 
+  struct znz_pgz;   /* parallel gzip writer, see znzopen() */
+
   struct znzptr
   {
     int withz;
     FILE* nzfptr;
 #ifdef HAVE_ZLIB
     gzFile zfptr;
+    struct znz_pgz* pgz;   /* non-NULL: writing gzip to nzfptr in parallel */
 #endif
   } ;
 
@@ -99,12 +102,30 @@ extern "C"
   /* Note extra argument (use_compression) where
      use_compression==0 is no compression
      use_compression!=0 uses zlib (gzip) compression
+
+     A file opened for compressed writing ("w" or "a") is deflated by
+     several threads at once, pigz style, when more than one is
+     available: the data are cut into blocks that are compressed in
+     parallel, each primed with the 32K before it, and written as one
+     ordinary gzip member. Such a file can only be written.
+       FS_GZIP_THREADS=n  threads to use (default: the OpenMP maximum;
+                          0 or 1 means use a single gzFile stream)
+       FS_GZIP_LEVEL=n    compression level 1-9 (default 6), unless
+                          the mode gives one, as in gzopen(), eg "wb1"
   */
 
   znzFile znzopen(const char *path, const char *mode, int use_compression);
 
+  /* the compression level (1-9) FS_GZIP_LEVEL asks for, or
+     -1 (Z_DEFAULT_COMPRESSION) if it is not set */
+  int znz_gzip_level(void);
+
   znzFile znzdopen(int fd, const char *mode, int use_compression);
 
+  /* read-only, uncompressed stream over size bytes of memory at buf
+     (buf must stay valid until the stream is closed) */
+  znzFile znzmemopen(void *buf, size_t size);
+
   int Xznzclose(znzFile * file);
 
   size_t znzread(void* buf, size_t size, size_t nmemb, znzFile file);
@@ -42,6 +42,7 @@
 #include <math.h>
 #include "macros.h"
 #include "mrisurf.h"
+#include "mrisbvh.h"
 #include "mrisutils.h"
 #include "error.h"
 #include "diag.h"
@@ -69,8 +70,8 @@ int FindClosestLRWPVertexNo(int c, int r, int s,
                             MATRIX *Vox2RAS,
                             MRIS *lhwite,  MRIS *lhpial,
                             MRIS *rhwhite, MRIS *rhpial,
-                            MHT *lhwhite_hash, MHT *lhpial_hash,
-                            MHT *rhwhite_hash, MHT *rhpial_hash);
+                            MRIS_BVH *lhwhite_bvh, MRIS_BVH *lhpial_bvh,
+                            MRIS_BVH *rhwhite_bvh, MRIS_BVH *rhpial_bvh);
 int CCSegment(MRI *seg, int segid, int segidunknown);
 
 int main(int argc, char *argv[]) ;
@@ -97,8 +98,8 @@ static MRI *Dist;
 static MRI *lhRibbon=NULL,*rhRibbon=NULL,*RibbonSeg;
 static MRIS *lhwhite, *rhwhite;
 static MRIS *lhpial, *rhpial;
-static MHT *lhwhite_hash, *rhwhite_hash;
-static MHT *lhpial_hash, *rhpial_hash;
+static MRIS_BVH *lhwhite_bvh, *rhwhite_bvh;
+static MRIS_BVH *lhpial_bvh, *rhpial_bvh;
 static VERTEX vtx;
 static int  lhwvtx, lhpvtx, rhwvtx, rhpvtx;
 static MATRIX *Vox2RAS, *CRS, *RAS;
@@ -113,7 +114,7 @@ static char annotfile[1000];
 static char *annotname = "aparc";
 static char *asegname = "aseg";
 static int baseoffset = 0;
-static float hashres = 16;
+static float hashres = 16; // no longer used, the search trees need no resolution
 
 static int normal_smoothing_iterations = 10 ;
 int crsTest = 0, ctest=0, rtest=0, stest=0;
@@ -229,11 +230,11 @@ int main(int argc, char **argv)
       printf("Ripped %d vertices from left hemi\n",nripped);
     }
     printf("\n");
-    printf("Building hash of lh white\n");
-    lhwhite_hash = MHTcreateVertexTable_Resolution(lhwhite, CURRENT_VERTICES,hashres);
+    printf("Building search tree of lh white\n");
+    lhwhite_bvh = BVHcreateVertexTree(lhwhite, CURRENT_VERTICES);
     printf("\n");
-    printf("Building hash of lh pial\n");
-    lhpial_hash = MHTcreateVertexTable_Resolution(lhpial, CURRENT_VERTICES,hashres);
+    printf("Building search tree of lh pial\n");
+    lhpial_bvh = BVHcreateVertexTree(lhpial, CURRENT_VERTICES);
   }
 
   if(DoRH){
@@ -293,11 +294,11 @@ int main(int argc, char **argv)
       printf("Ripped %d vertices from right hemi\n",nripped);
     }
     printf("\n");
-    printf("Building hash of rh white\n");
-    rhwhite_hash = MHTcreateVertexTable_Resolution(rhwhite, CURRENT_VERTICES,hashres);
+    printf("Building search tree of rh white\n");
+    rhwhite_bvh = BVHcreateVertexTree(rhwhite, CURRENT_VERTICES);
     printf("\n");
-    printf("Building hash of rh pial\n");
-    rhpial_hash = MHTcreateVertexTable_Resolution(rhpial, CURRENT_VERTICES,hashres);
+    printf("Building search tree of rh pial\n");
+    rhpial_bvh = BVHcreateVertexTree(rhpial, CURRENT_VERTICES);
   }
 
   if(UseNewRibbon){
@@ -418,8 +419,8 @@ int main(int argc, char **argv)
                                   &rhwvtx, &rhpvtx, Vox2RAS,
                                   lhwhite,  lhpial,
                                   rhwhite, rhpial,
-                                  lhwhite_hash, lhpial_hash,
-                                  rhwhite_hash, rhpial_hash);
+                                  lhwhite_bvh, lhpial_bvh,
+                                  rhwhite_bvh, rhpial_bvh);
 
     printf("Result: err = %d\n",err);
     exit(err);
@@ -648,40 +649,23 @@ int main(int argc, char **argv)
 
         // Get the index of the closest vertex in the
         // lh.white, lh.pial, rh.white, rh.pial
+        // The search trees always find the closest vertex, as the brute
+        // force search does, so no fallback is needed
         if(UseHash) {
 	  if(DoLH){
-	    lhwvtx = MHTfindClosestVertexNo(lhwhite_hash,lhwhite,&vtx,&dlhw);
-	    lhpvtx = MHTfindClosestVertexNo(lhpial_hash, lhpial, &vtx,&dlhp);
+	    lhwvtx = BVHfindClosestVertexNo(lhwhite_bvh,vtx.x,vtx.y,vtx.z,&dlhw);
+	    lhpvtx = BVHfindClosestVertexNo(lhpial_bvh, vtx.x,vtx.y,vtx.z,&dlhp);
 	  } else {
 	    lhwvtx = -1;
 	    lhpvtx = -1;
 	  }
 	  if(DoRH){
-	    rhwvtx = MHTfindClosestVertexNo(rhwhite_hash,rhwhite,&vtx,&drhw);
-	    rhpvtx = MHTfindClosestVertexNo(rhpial_hash, rhpial, &vtx,&drhp);
+	    rhwvtx = BVHfindClosestVertexNo(rhwhite_bvh,vtx.x,vtx.y,vtx.z,&drhw);
+	    rhpvtx = BVHfindClosestVertexNo(rhpial_bvh, vtx.x,vtx.y,vtx.z,&drhp);
 	  } else {
 	    rhwvtx = -1;
 	    rhpvtx = -1;
 	  }
-          if (lhwvtx < 0 && lhpvtx < 0 && rhwvtx < 0 && rhpvtx < 0) {
-            /*
-            printf("  Could not map to any surface with hash table:\n");
-            printf("  crs = %d %d %d, ras = %6.4f %6.4f %6.4f \n",
-            c,r,s,vtx.x,vtx.y,vtx.z);
-            printf("  Using brute force search %d ... \n",nbrute);
-            fflush(stdout);
-            */
-	    if(DoLH){
-	      lhwvtx = MRISfindClosestVertex(lhwhite,vtx.x,vtx.y,vtx.z,&dlhw, CURRENT_VERTICES);
-	      lhpvtx = MRISfindClosestVertex(lhpial,vtx.x,vtx.y,vtx.z,&dlhp, CURRENT_VERTICES);
-	    }
-	    if(DoRH){
-	      rhwvtx = MRISfindClosestVertex(rhwhite,vtx.x,vtx.y,vtx.z,&drhw, CURRENT_VERTICES);
-	      rhpvtx = MRISfindClosestVertex(rhpial,vtx.x,vtx.y,vtx.z,&drhp, CURRENT_VERTICES);
-	    }
-            nbrute ++;
-            //exit(1);
-          }
         }
         else
         {
@@ -1542,8 +1526,8 @@ int FindClosestLRWPVertexNo(int c, int r, int s,
                             MATRIX *Vox2RAS,
                             MRIS *lhwite,  MRIS *lhpial,
                             MRIS *rhwhite, MRIS *rhpial,
-                            MHT *lhwhite_hash, MHT *lhpial_hash,
-                            MHT *rhwhite_hash, MHT *rhpial_hash)
+                            MRIS_BVH *lhwhite_bvh, MRIS_BVH *lhpial_bvh,
+                            MRIS_BVH *rhwhite_bvh, MRIS_BVH *rhpial_bvh)
 {
   static MATRIX *CRS = NULL;
   static MATRIX *RAS = NULL;
@@ -1567,10 +1551,10 @@ int FindClosestLRWPVertexNo(int c, int r, int s,
   vtx.y = RAS->rptr[2][1];
   vtx.z = RAS->rptr[3][1];
 
-  *lhwvtx = MHTfindClosestVertexNo(lhwhite_hash,lhwhite,&vtx,&dlhw);
-  *lhpvtx = MHTfindClosestVertexNo(lhpial_hash, lhpial, &vtx,&dlhp);
-  *rhwvtx = MHTfindClosestVertexNo(rhwhite_hash,rhwhite,&vtx,&drhw);
-  *rhpvtx = MHTfindClosestVertexNo(rhpial_hash, rhpial, &vtx,&drhp);
+  *lhwvtx = BVHfindClosestVertexNo(lhwhite_bvh,vtx.x,vtx.y,vtx.z,&dlhw);
+  *lhpvtx = BVHfindClosestVertexNo(lhpial_bvh, vtx.x,vtx.y,vtx.z,&dlhp);
+  *rhwvtx = BVHfindClosestVertexNo(rhwhite_bvh,vtx.x,vtx.y,vtx.z,&drhw);
+  *rhpvtx = BVHfindClosestVertexNo(rhpial_bvh, vtx.x,vtx.y,vtx.z,&drhp);
 
   printf("lh white: %d %g\n",*lhwvtx,dlhw);
   printf("lh pial:  %d %g\n",*lhpvtx,dlhp);
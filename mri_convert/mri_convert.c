@@ -46,6 +46,7 @@
 #include "fsinit.h"
 #include "fio.h"
 #include "mri_conform.h"
+#include "romp_support.h"
 
 
 /* ----- determines tolerance of non-orthogonal basis vectors ----- */
@@ -190,6 +191,7 @@ int main(int argc, char *argv[])
   MATRIX *T;
   float scale_factor, out_scale_factor, rescale_factor ;
   int nthframe=-1;
+  int nthreads=1;
   int reduce = 0 ;
   float fwhm, gstd;
   char cmdline[STRLEN] ;
@@ -1311,6 +1313,28 @@ int main(int argc, char *argv[])
       fclose(fptmp);
     }
     /*-------------------------------------------------------------*/
+    else if (strcmp(argv[i], "--threads") == 0 ||
+             strcmp(argv[i], "--nthreads") == 0)
+    {
+      /* Threads for reading DICOM series and writing mgh/mgz */
+      get_ints(argc, argv, &i, &nthreads, 1);
+#ifdef HAVE_OPENMP
+      omp_set_num_threads(nthreads);
+#endif
+    }
+    else if (strcmp(argv[i], "--write-mem") == 0)
+    {
+      /* Megabytes of buffers to use when writing mgh/mgz */
+      if ( (argc-1) - i < 1 )
+      {
+        fprintf(stderr,"ERROR: option --write-mem "
+                "requires one argument\n");
+        exit(1);
+      }
+      i++;
+      setenv("FS_MGZ_WRITE_MB",argv[i],1);
+    }
+    /*-------------------------------------------------------------*/
     else if (strcmp(argv[i], "--sdcmlist") == 0)
     {
       /* File name that contains a list of Siemens DICOM files
@@ -166,6 +166,7 @@ typedef struct {
 } COREG;
 
 double COREGcost(COREG *coreg);
+double COREGcostNoLog(COREG *coreg);
 float COREGcostPowell(float *pPowel) ;
 int COREGMinPowell();
 float MRIgetPercentile(MRI *mri, double Pct, int frame);
@@ -868,16 +869,21 @@ long COREGvolIndex(int ncols, int nrows, int nslices, int c, int r, int s)
 double COREGsamp(unsigned char *f, const double c, const double r, const double s, 
 		 const int ncols, const int nrows, const int nslices)	
 {
-  int cm,rm,sm,cp,rp,sp;
+  int cm,rm,sm;
+  long dc,dr,ds;
   double val,cmd,rmd,smd,cpd,rpd,spd;
+  unsigned char *f0;
 
   cm = floor(c);
   rm = floor(r);
   sm = floor(s);
 
-  cp = ceil(c);
-  rp = ceil(r);
-  sp = ceil(s);
+  // The 8 neighbors are offsets from the lower corner. The upper corner
+  // is ceil(), which is the lower corner itself on an integer coordinate
+  dc = (ceil(c) != cm);
+  dr = (ceil(r) != rm) * (long)ncols;
+  ds = (ceil(s) != sm) * (long)nrows*ncols;
+  f0 = &f[COREGvolIndex(ncols,nrows,nslices, cm, rm, sm)];
 
   cmd = c - cm ;
   rmd = r - rm ;
@@ -887,14 +893,14 @@ double COREGsamp(unsigned char *f, const double c, const double r, const double
   spd = (1.0 - smd) ;
 
   val =
-    cpd * rpd * spd * f[COREGvolIndex(ncols,nrows,nslices, cm, rm, sm)] +
-    cpd * rpd * smd * f[COREGvolIndex(ncols,nrows,nslices, cm, rm, sp)] +
-    cpd * rmd * spd * f[COREGvolIndex(ncols,nrows,nslices, cm, rp, sm)] +
-    cpd * rmd * smd * f[COREGvolIndex(ncols,nrows,nslices, cm, rp, sp)] +
-    cmd * rpd * spd * f[COREGvolIndex(ncols,nrows,nslices, cp, rm, sm)] +
-    cmd * rpd * smd * f[COREGvolIndex(ncols,nrows,nslices, cp, rm, sp)] +
-    cmd * rmd * spd * f[COREGvolIndex(ncols,nrows,nslices, cp, rp, sm)] +
-    cmd * rmd * smd * f[COREGvolIndex(ncols,nrows,nslices, cp, rp, sp)] ;
+    cpd * rpd * spd * f0[0] +
+    cpd * rpd * smd * f0[ds] +
+    cpd * rmd * spd * f0[dr] +
+    cpd * rmd * smd * f0[dr+ds] +
+    cmd * rpd * spd * f0[dc] +
+    cmd * rpd * smd * f0[dc+ds] +
+    cmd * rmd * spd * f0[dc+dr] +
+    cmd * rmd * smd * f0[dc+dr+ds] ;
 
   return(val);
 }
@@ -954,16 +960,31 @@ int COREGhist(COREG *coreg)
     int const crefBegin = (chunk+0)*chunkSize*coreg->sep;
     int       crefEnd   = (chunk+1)*chunkSize*coreg->sep;
     if (crefEnd > coreg->ref->width) crefEnd = coreg->ref->width;
+
+    // One run of slices at a time: the coordinates of the whole run are
+    // computed first, in a loop without branches that can be vectorized,
+    // then the in-bounds voxels are sampled, then they are histogrammed.
+    // Each value is computed exactly as it was one voxel at a time.
+    int const nrunmax = (coreg->ref->depth + coreg->sep - 1) / coreg->sep;
+    double *runbuf = (double *) calloc(7*nrunmax+1,sizeof(double));
+    double * const cref_run = runbuf;
+    double * const rref_run = runbuf + 1*nrunmax;
+    double * const sref_run = runbuf + 2*nrunmax;
+    double * const cmov_run = runbuf + 3*nrunmax;
+    double * const rmov_run = runbuf + 4*nrunmax;
+    double * const smov_run = runbuf + 5*nrunmax;
+    double * const vf_run   = runbuf + 6*nrunmax;
     
     int cref;
     for(cref=crefBegin; cref < crefEnd; cref += coreg->sep){
   
       double * const H = HH[chunk];
 
-      int rref,sref;
+      int rref,sref,k,nrun;
       for(rref=0; rref < coreg->ref->height; rref += coreg->sep){
-	for(sref=0; sref < coreg->ref->depth; sref += coreg->sep){
 
+	nrun = 0;
+	for(sref=0; sref < coreg->ref->depth; sref += coreg->sep){
           double dcref = cref, drref = rref, dsref = sref;
 
 	  if(coreg->DoCoordDither){
@@ -975,31 +996,48 @@ int COREGhist(COREG *coreg)
 	    if(drref > coreg->ref->height-1) drref = coreg->ref->height-1;
 	    if(dsref > coreg->ref->depth-1)  dsref = coreg->ref->depth-1;
 	  }
+	  cref_run[nrun] = dcref;
+	  rref_run[nrun] = drref;
+	  sref_run[nrun] = dsref;
+	  nrun++;
+	}
 
-	  double dcmov  = V2V[0]*dcref + V2V[4]*drref + V2V[ 8]*dsref +  V2V[12];
-	  double drmov  = V2V[1]*dcref + V2V[5]*drref + V2V[ 9]*dsref +  V2V[13];
+	for(k=0; k < nrun; k++){
+	  cmov_run[k] = V2V[0]*cref_run[k] + V2V[4]*rref_run[k] + V2V[ 8]*sref_run[k] +  V2V[12];
+	  rmov_run[k] = V2V[1]*cref_run[k] + V2V[5]*rref_run[k] + V2V[ 9]*sref_run[k] +  V2V[13];
+	  smov_run[k] = V2V[2]*cref_run[k] + V2V[6]*rref_run[k] + V2V[10]*sref_run[k] +  V2V[14];
+	}
+	if(coreg->optschema == 2) for(k=0; k < nrun; k++) smov_run[k] = 0;
 
+	for(k=0; k < nrun; k++){
+	  double const dcmov = cmov_run[k], drmov = rmov_run[k], dsmov = smov_run[k];
 	  int oob = 0;
 	  if(dcmov < 0 || dcmov > coreg->mov->width-1)  oob = 1;
 	  if(drmov < 0 || drmov > coreg->mov->height-1) oob = 1;
+	  if(dsmov < 0 || dsmov > coreg->mov->depth-1)  oob = 1;
 
-          double dsmov = 0;
-	  if(coreg->optschema != 2){
-	    dsmov  = V2V[2]*dcref + V2V[6]*drref + V2V[10]*dsref +  V2V[14];
-	    if(dsmov < 0 || dsmov > coreg->mov->depth-1)  oob = 1;
-	  }
-
-          double vf;
 	  if(!oob) {
-	    vf = COREGsamp(coreg->f, dcmov, drmov, dsmov, coreg->mov->width,coreg->mov->height,coreg->mov->depth);
+	    vf_run[k] = COREGsamp(coreg->f, dcmov, drmov, dsmov, coreg->mov->width,coreg->mov->height,coreg->mov->depth);
 	    nhits ++;
-	  } else {
+	  } 
+	  else vf_run[k] = -1; // out of bounds
+	}
+
+	for(k=0; k < nrun; k++){
+          double vf = vf_run[k];
+	  if(vf < 0) {
 	    if(coreg->MovOOBFlag) vf = 0;
 	    else continue;
 	  }
 
-
-	  double vg = COREGsamp(coreg->g, dcref, drref, dsref, coreg->ref->width,coreg->ref->height,coreg->ref->depth);
+	  // on the grid (no dither) trilinear interpolation is just the voxel
+	  double vg;
+	  if(coreg->DoCoordDither)
+	    vg = COREGsamp(coreg->g, cref_run[k], rref_run[k], sref_run[k], 
+			   coreg->ref->width,coreg->ref->height,coreg->ref->depth);
+	  else
+	    vg = coreg->g[COREGvolIndex(coreg->ref->width,coreg->ref->height,coreg->ref->depth,
+					cref, rref, k*coreg->sep)];
 
 	  int const ivf = floor(vf);
 	  int const ivg = floor(vg+0.5);
@@ -1008,6 +1046,7 @@ int COREGhist(COREG *coreg)
 	}
       }
     }
+    free(runbuf);
     ROMP_PFLB_end
   }
   ROMP_PF_end
@@ -1500,15 +1539,41 @@ double *COREGparams9(MATRIX *M9, double *p)
 
 
 double COREGcost(COREG *coreg)
+{
+  int n;
+
+  COREGcostNoLog(coreg);
+
+  if(coreg->fplogcost){
+    FILE *fp;
+    fp = coreg->fplogcost;
+    fprintf(fp,"%2d %4d  ",coreg->sep,coreg->nCostEvaluations);
+    for(n=0; n<coreg->nparams; n++) fprintf(fp,"%7.5f ",coreg->params[n]);
+    fprintf(fp,"  %9.7f\n",coreg->cost);
+    fflush(fp);
+  }
+  coreg->nCostEvaluations++;
+
+  return(coreg->cost);
+}
+
+/*!
+  \fn double COREGcostNoLog(COREG *coreg)
+  \brief Computes the cost at coreg->params without logging or counting
+  the evaluation. It only changes coreg's M, V2V, H0, H01d, nhits,
+  pcthits, and cost, so several can run at once on copies of coreg that
+  have their own M, V2V, and H0 (see COREGoptBruteForce()).
+ */
+double COREGcostNoLog(COREG *coreg)
 {
   double **H1,**H;
   double *g1, *g2, sum, std1, std2;
   int r,c,n,lim1,lim2,ng1,ng2;
   int H1rows,H1cols,Hrows,Hcols;
-  static double *params=NULL;
+  double params[12];
 
   // RefRAS-to-MovRAS
-  params = COREGoptSchema2MatrixPar(coreg, params);
+  COREGoptSchema2MatrixPar(coreg, params);
   coreg->M = COREGmatrix(params, coreg->M);
 
   // AnatVox-to-FuncVox
@@ -1563,16 +1628,6 @@ double COREGcost(COREG *coreg)
   free(g1); g1=NULL;
   free(g2); g2=NULL;
 
-  if(coreg->fplogcost){
-    FILE *fp;
-    fp = coreg->fplogcost;
-    fprintf(fp,"%2d %4d  ",coreg->sep,coreg->nCostEvaluations);
-    for(n=0; n<coreg->nparams; n++) fprintf(fp,"%7.5f ",coreg->params[n]);
-    fprintf(fp,"  %9.7f\n",coreg->cost);
-    fflush(fp);
-  }
-  coreg->nCostEvaluations++;
-
   return(coreg->cost);
 }
 
@@ -1821,15 +1876,20 @@ MRI *MRIconformNoScale(MRI *mri, MRI *mric)
 
 int COREGoptBruteForce(COREG *coreg, double lim0, int niters, int n1d)
 {
-  int iter,nthp,nth1d,n,newmin;
+  int iter,nthp,nth1d,n,n1,np,newmin;
   double curcost,mincost;
   double p,pmin,pmax,pdelta=0,popt;
-  double lim;
+  double lim,*plist,*costlist;
   FILE *fp;
   int dof,BakMovOOBFlag;
 
   printf("COREGoptBruteForce() %g %d %d\n",lim0,niters,n1d);
 
+  // p steps from pmin to pmax by (pmax-pmin)/n1d, which is n1d+1
+  // points, but allow for round off
+  plist    = (double *) calloc(n1d+3,sizeof(double));
+  costlist = (double *) calloc(n1d+3,sizeof(double));
+
   dof = 6;
   if(coreg->nparams < 6) dof = coreg->nparams;
 
@@ -1847,12 +1907,49 @@ int COREGoptBruteForce(COREG *coreg, double lim0, int niters, int n1d)
       pmax = coreg->params[nthp] + lim;
       pdelta = (pmax-pmin)/n1d;
 
+      // The points along this parameter are independent, so compute
+      // their costs in parallel, each on its own copy of coreg, then go
+      // through them in order as if they had been done one at a time.
+      // The copies are on the heap as H01d makes COREG too big for the
+      // stack of an OpenMP worker.
+      np = 0;
+      for(p=pmin; p<=pmax; p+=pdelta) plist[np++] = p;
+
+      ROMP_PF_begin
+      #ifdef HAVE_OPENMP
+      #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+      #endif
+      for(n=0; n < np; n++){
+	ROMP_PFLB_begin
+	COREG *c = (COREG *) malloc(sizeof(COREG));
+	*c = *coreg;
+	c->M = NULL;
+	c->V2V = NULL;
+	c->H0 = NULL;
+	c->params[nthp] = plist[n];
+	costlist[n] = COREGcostNoLog(c);
+	MatrixFree(&c->M);
+	MatrixFree(&c->V2V);
+	FreeDoubleMatrix(c->H0,256,256);
+	free(c);
+	ROMP_PFLB_end
+      }
+      ROMP_PF_end
+
       nth1d = 0;
       popt = coreg->params[nthp];
       newmin = 0;
-      for(p=pmin; p<=pmax; p+=pdelta){
+      for(n1=0; n1 < np; n1++){
+	p = plist[n1];
 	coreg->params[nthp] = p;
-	curcost = COREGcost(coreg);
+	curcost = coreg->cost = costlist[n1];
+	if(coreg->fplogcost){
+	  fprintf(coreg->fplogcost,"%2d %4d  ",coreg->sep,coreg->nCostEvaluations);
+	  for(n=0; n<coreg->nparams; n++) fprintf(coreg->fplogcost,"%7.5f ",coreg->params[n]);
+	  fprintf(coreg->fplogcost,"  %9.7f\n",coreg->cost);
+	  fflush(coreg->fplogcost);
+	}
+	coreg->nCostEvaluations++;
 	if(mincost > curcost){
 	  mincost = curcost;
 	  popt = p;
@@ -1882,6 +1979,8 @@ int COREGoptBruteForce(COREG *coreg, double lim0, int niters, int n1d)
   if(BakMovOOBFlag == 0) printf("Turning  MovOOB back off after brute force search\n");
   coreg->MovOOBFlag = BakMovOOBFlag;
 
+  free(plist);
+  free(costlist);
   return(0);
 }
 
@@ -107,6 +107,13 @@ static double find_optimal_linear_xform
  float min_trans, float max_trans,
  float angle_steps, float scale_steps, float trans_steps,
  int nreductions);
+static int linear_xform_steps(float min_val, float max_val, double delta,
+                              double *steps) ;
+static double search_linear_xform_grid
+(GCAS_SOA *soa, MRI *mri, MATRIX *m_L, MATRIX *m_origin, MATRIX *m_origin_inv,
+ double *scales, int nscale_steps, double *angles, int nangle_steps,
+ double *trans, int ntrans_steps, double max_log_p, int *best) ;
+static int coarse_stride = 1 ;
 
 const char         *Progname ;
 static MORPH_PARMS  parms ;
@@ -2088,6 +2095,13 @@ get_option(int argc, char *argv[])
     nargs = 1 ;
     printf("setting max translation search range to be %2.1f\n", MAX_TRANS) ;
   }
+  else if (!stricmp(option, "coarse_stride"))
+  {
+    coarse_stride = atoi(argv[2]) ;
+    nargs = 1 ;
+    printf("screening translations with every %dth sample...\n",
+           coarse_stride) ;
+  }
   else if (!stricmp(option, "steps"))
   {
     max_angles = atoi(argv[2]) ;
@@ -2268,6 +2282,7 @@ find_optimal_linear_xform
   double x_scale, y_scale, z_scale;
   double x_angle, y_angle, z_angle;
   double log_p;
+  GCAS_SOA *soa = NULL ;
 #endif
 
 
@@ -2296,6 +2311,13 @@ find_optimal_linear_xform
   max_log_p = local_GCAcomputeLogSampleProbability
     (gca, gcas, mri, m_L, nsamples, exvivo, Gclamp) ;
 #endif
+#if !( defined(FS_CUDA) && FAST_TRANSFORM )
+  // the plain log probability can be scored for many candidates at once
+  if (!exvivo && !robust && !use_variance)
+  {
+    soa = GCASsoaAlloc(gca, gcas, nsamples) ;
+  }
+#endif
 
   // Loop a set number of times to polish transform
 
@@ -2368,112 +2390,153 @@ find_optimal_linear_xform
 
 #else
 
-
-    // scale /////////////////////////////////////////////////////////////
-    for (x_scale = min_scale ; x_scale <= max_scale ; x_scale += delta_scale)
+    if (soa)
+    {
+      double *scales, *angles, *trans ;
+      int    nscale_steps, nangle_steps, ntrans_steps, best[9] ;
+
+      // the values the loops below would step through
+      nscale_steps = linear_xform_steps(min_scale, max_scale, delta_scale, NULL);
+      nangle_steps = linear_xform_steps(min_angle, max_angle, delta_rot, NULL) ;
+      ntrans_steps = linear_xform_steps(min_trans, max_trans, delta_trans, NULL);
+      scales = (double *)calloc(nscale_steps+1, sizeof(double)) ;
+      angles = (double *)calloc(nangle_steps+1, sizeof(double)) ;
+      trans = (double *)calloc(ntrans_steps+1, sizeof(double)) ;
+      linear_xform_steps(min_scale, max_scale, delta_scale, scales) ;
+      linear_xform_steps(min_angle, max_angle, delta_rot, angles) ;
+      linear_xform_steps(min_trans, max_trans, delta_trans, trans) ;
+
+      log_p = search_linear_xform_grid(soa, mri, m_L, m_origin, m_origin_inv,
+                                       scales, nscale_steps,
+                                       angles, nangle_steps,
+                                       trans, ntrans_steps, max_log_p, best) ;
+      if (log_p > max_log_p)
+      {
+        max_log_p = log_p ;
+        x_max_scale = scales[best[0]] ;
+        y_max_scale = scales[best[1]] ;
+        z_max_scale = scales[best[2]] ;
+        x_max_rot = angles[best[3]] ;
+        y_max_rot = angles[best[4]] ;
+        z_max_rot = angles[best[5]] ;
+        x_max_trans = trans[best[6]] ;
+        y_max_trans = trans[best[7]] ;
+        z_max_trans = trans[best[8]] ;
+      }
+      free(scales) ;
+      free(angles) ;
+      free(trans) ;
+    }
+    else
     {
-      /*      printf("x_scale = %2.3f\n", x_scale) ;*/
-      *MATRIX_RELT(m_scale, 1, 1) = x_scale ;
-      for (y_scale = min_scale ;
-           y_scale <= max_scale ;
-           y_scale += delta_scale)
+      // exvivo, robust and variance scores are computed one at a time
+
+      // scale /////////////////////////////////////////////////////////////
+      for (x_scale = min_scale ; x_scale <= max_scale ; x_scale += delta_scale)
       {
-        *MATRIX_RELT(m_scale, 2, 2) = y_scale ;
-        for (z_scale= min_scale ;
-             z_scale <= max_scale;
-             z_scale += delta_scale)
+        /*      printf("x_scale = %2.3f\n", x_scale) ;*/
+        *MATRIX_RELT(m_scale, 1, 1) = x_scale ;
+        for (y_scale = min_scale ;
+             y_scale <= max_scale ;
+             y_scale += delta_scale)
         {
-          *MATRIX_RELT(m_scale, 3, 3) = z_scale ;
-
-          /* reset translation values */
-          *MATRIX_RELT(m_scale, 1, 4) =
-            *MATRIX_RELT(m_scale, 2, 4) =
-              *MATRIX_RELT(m_scale, 3, 4) = 0.0f ;
-          m_tmp = MatrixMultiply(m_scale, m_origin_inv, m_tmp) ;
-          MatrixMultiply(m_origin, m_tmp, m_scale) ;
-
-          // angle //////////////////////////////
-          for (x_angle = min_angle ;
-               x_angle <= max_angle ;
-               x_angle += delta_rot)
+          *MATRIX_RELT(m_scale, 2, 2) = y_scale ;
+          for (z_scale= min_scale ;
+               z_scale <= max_scale;
+               z_scale += delta_scale)
           {
-            m_x_rot = MatrixReallocRotation
-                      (4, x_angle, X_ROTATION, m_x_rot) ;
-            for (y_angle = min_angle ;
-                 y_angle <= max_angle ;
-                 y_angle += delta_rot)
+            *MATRIX_RELT(m_scale, 3, 3) = z_scale ;
+
+            /* reset translation values */
+            *MATRIX_RELT(m_scale, 1, 4) =
+              *MATRIX_RELT(m_scale, 2, 4) =
+                *MATRIX_RELT(m_scale, 3, 4) = 0.0f ;
+            m_tmp = MatrixMultiply(m_scale, m_origin_inv, m_tmp) ;
+            MatrixMultiply(m_origin, m_tmp, m_scale) ;
+
+            // angle //////////////////////////////
+            for (x_angle = min_angle ;
+                 x_angle <= max_angle ;
+                 x_angle += delta_rot)
             {
-              m_y_rot = MatrixReallocRotation
-                        (4, y_angle, Y_ROTATION, m_y_rot);
-              m_tmp = MatrixMultiply(m_y_rot, m_x_rot, m_tmp) ;
-              for (z_angle= min_angle;
-                   z_angle <= max_angle;
-                   z_angle += delta_rot)
+              m_x_rot = MatrixReallocRotation
+                        (4, x_angle, X_ROTATION, m_x_rot) ;
+              for (y_angle = min_angle ;
+                   y_angle <= max_angle ;
+                   y_angle += delta_rot)
               {
-                m_z_rot = MatrixReallocRotation
-                          (4, z_angle,Z_ROTATION,m_z_rot);
-                m_rot = MatrixMultiply(m_z_rot, m_tmp, m_rot) ;
-                m_tmp2 = MatrixMultiply
-                         (m_rot, m_origin_inv, m_tmp2) ;
-                MatrixMultiply(m_origin, m_tmp2, m_rot) ;
-
-                m_tmp2 = MatrixMultiply(m_scale, m_rot, m_tmp2) ;
-                m_tmp3 = MatrixMultiply(m_tmp2, m_L, m_tmp3) ;
-
-                // translation //////////
-                for (x_trans = min_trans ;
-                     x_trans <= max_trans ;
-                     x_trans += delta_trans)
+                m_y_rot = MatrixReallocRotation
+                          (4, y_angle, Y_ROTATION, m_y_rot);
+                m_tmp = MatrixMultiply(m_y_rot, m_x_rot, m_tmp) ;
+                for (z_angle= min_angle;
+                     z_angle <= max_angle;
+                     z_angle += delta_rot)
                 {
-                  *MATRIX_RELT(m_trans, 1, 4) = x_trans ;
-                  for (y_trans = min_trans ;
-                       y_trans <= max_trans ;
-                       y_trans += delta_trans)
+                  m_z_rot = MatrixReallocRotation
+                            (4, z_angle,Z_ROTATION,m_z_rot);
+                  m_rot = MatrixMultiply(m_z_rot, m_tmp, m_rot) ;
+                  m_tmp2 = MatrixMultiply
+                           (m_rot, m_origin_inv, m_tmp2) ;
+                  MatrixMultiply(m_origin, m_tmp2, m_rot) ;
+
+                  m_tmp2 = MatrixMultiply(m_scale, m_rot, m_tmp2) ;
+                  m_tmp3 = MatrixMultiply(m_tmp2, m_L, m_tmp3) ;
+
+                  // translation //////////
+                  for (x_trans = min_trans ;
+                       x_trans <= max_trans ;
+                       x_trans += delta_trans)
                   {
-                    *MATRIX_RELT(m_trans, 2, 4) = y_trans ;
-                    for (z_trans= min_trans ;
-                         z_trans <= max_trans ;
-                         z_trans += delta_trans)
+                    *MATRIX_RELT(m_trans, 1, 4) = x_trans ;
+                    for (y_trans = min_trans ;
+                         y_trans <= max_trans ;
+                         y_trans += delta_trans)
                     {
-                      *MATRIX_RELT(m_trans, 3, 4) =
-                        z_trans ;
+                      *MATRIX_RELT(m_trans, 2, 4) = y_trans ;
+                      for (z_trans= min_trans ;
+                           z_trans <= max_trans ;
+                           z_trans += delta_trans)
+                      {
+                        *MATRIX_RELT(m_trans, 3, 4) =
+                          z_trans ;
 
-                      m_L_tmp = MatrixMultiply
-                                (m_trans, m_tmp3, m_L_tmp) ;
+                        m_L_tmp = MatrixMultiply
+                                  (m_trans, m_tmp3, m_L_tmp) ;
 
 #ifdef FS_CUDA
-                      log_p = CUDA_ComputeLogSampleProbability( m_L_tmp, Gclamp );
+                        log_p = CUDA_ComputeLogSampleProbability( m_L_tmp, Gclamp );
 #else
-                      log_p =
-                        local_GCAcomputeLogSampleProbability
-                        (gca, gcas, mri, m_L_tmp, nsamples, exvivo, Gclamp);
+                        log_p =
+                          local_GCAcomputeLogSampleProbability
+                          (gca, gcas, mri, m_L_tmp, nsamples, exvivo, Gclamp);
 #endif
-                      if (log_p > max_log_p)
-                      {
-                        if (exvivo)
-                          printf("current estimates G=%d, W=%d, F=%d\n",
-                                 (int)G_gm_mean, (int)G_wm_mean, (int)G_fluid_mean) ;
-                        max_log_p = log_p ;
-                        x_max_scale = x_scale ;
-                        y_max_scale = y_scale ;
-                        z_max_scale = z_scale ;
-                        x_max_rot = x_angle ;
-                        y_max_rot = y_angle ;
-                        z_max_rot = z_angle ;
-                        x_max_trans = x_trans ;
-                        y_max_trans = y_trans ;
-                        z_max_trans = z_trans ;
-                      }
+                        if (log_p > max_log_p)
+                        {
+                          if (exvivo)
+                            printf("current estimates G=%d, W=%d, F=%d\n",
+                                   (int)G_gm_mean, (int)G_wm_mean, (int)G_fluid_mean) ;
+                          max_log_p = log_p ;
+                          x_max_scale = x_scale ;
+                          y_max_scale = y_scale ;
+                          z_max_scale = z_scale ;
+                          x_max_rot = x_angle ;
+                          y_max_rot = y_angle ;
+                          z_max_rot = z_angle ;
+                          x_max_trans = x_trans ;
+                          y_max_trans = y_trans ;
+                          z_max_trans = z_trans ;
+                        }
 #if 0
-                      printf( "%s: log_p = %f\n", __FUNCTION__, log_p );
-                      printf( "%s: Translation (%4.2f, %4.2f, %4.2f)\n",
-                              __FUNCTION__, x_trans, y_trans, z_trans );
-                      printf( "%s: Rotation (%4.2f, %4.2f, %4.2f)\n",
-                              __FUNCTION__, x_angle, y_angle, z_angle );
-                      printf( "%s: Scale (%4.2f, %4.2f, %4.2f)\n",
-                              __FUNCTION__, x_scale, y_scale, z_scale );
-                      exit( 0 );
+                        printf( "%s: log_p = %f\n", __FUNCTION__, log_p );
+                        printf( "%s: Translation (%4.2f, %4.2f, %4.2f)\n",
+                                __FUNCTION__, x_trans, y_trans, z_trans );
+                        printf( "%s: Rotation (%4.2f, %4.2f, %4.2f)\n",
+                                __FUNCTION__, x_angle, y_angle, z_angle );
+                        printf( "%s: Scale (%4.2f, %4.2f, %4.2f)\n",
+                                __FUNCTION__, x_scale, y_scale, z_scale );
+                        exit( 0 );
 #endif
+                      }
                     }
                   }
                 }
@@ -2562,6 +2625,9 @@ find_optimal_linear_xform
   MatrixFree(&m_tmp2) ;
   MatrixFree(&m_trans) ;
   MatrixFree(&m_tmp3) ;
+#if !( defined(FS_CUDA) && FAST_TRANSFORM )
+  GCASsoaFree(&soa) ;
+#endif
 
 
 #ifdef FS_CUDA
@@ -2571,6 +2637,171 @@ find_optimal_linear_xform
   return(max_log_p) ;
 }
 
+/*
+  the values for (v = min_val ; v <= max_val ; v += delta) steps through,
+  stored in steps if it is not NULL, and how many there are
+*/
+static int
+linear_xform_steps(float min_val, float max_val, double delta, double *steps)
+{
+  double v ;
+  int    n ;
+
+  for (n = 0, v = min_val ; v <= max_val ; v += delta, n++)
+  {
+    if (steps)
+    {
+      steps[n] = v ;
+    }
+  }
+  return(n) ;
+}
+
+/*
+  Score every scale, rotation and translation of one reduction of
+  find_optimal_linear_xform() in parallel. Each scale and rotation is a
+  task that tries all the translations, and the tasks' best candidates
+  are compared in the order of the serial loops, so the answer (the first
+  candidate better than max_log_p, of equal ones) is the serial one for
+  any number of threads. With -coarse_stride n each task first scores its
+  translations on every nth sample and only scores the best of them on
+  all of the samples.
+  Returns the best log p, with the indices of its x/y/z scale, x/y/z
+  angle and x/y/z translation in best[].
+*/
+static double
+search_linear_xform_grid(GCAS_SOA *soa, MRI *mri, MATRIX *m_L,
+                         MATRIX *m_origin, MATRIX *m_origin_inv,
+                         double *scales, int nscale_steps,
+                         double *angles, int nangle_steps,
+                         double *trans, int ntrans_steps,
+                         double max_log_p, int *best)
+{
+  int    ntasks, task, best_task, i ;
+  double *task_log_p ;
+  int    *task_trans ;
+
+  ntasks = nscale_steps*nscale_steps*nscale_steps *
+           nangle_steps*nangle_steps*nangle_steps ;
+  task_log_p = (double *)calloc(ntasks+1, sizeof(double)) ;
+  task_trans = (int *)calloc(ntasks+1, sizeof(int)) ;
+  if (!task_log_p || !task_trans)
+  {
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d tasks",
+              Progname, ntasks) ;
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (task = 0 ; task < ntasks ; task++)
+  {
+    ROMP_PFLB_begin
+    MATRIX *m_scale, *m_x_rot, *m_y_rot, *m_z_rot, *m_rot, *m_tmp, *m_tmp2,
+           *m_tmp3, *m_trans, *m_L_tmp ;
+    int    idx[6], t, n, ntrans, stride, tbest ;
+    double log_p, tbest_log_p ;
+
+    // x scale is the outermost loop, z angle the innermost
+    for (t = task, n = 5 ; n >= 0 ; n--)
+    {
+      int nsteps = n < 3 ? nscale_steps : nangle_steps ;
+      idx[n] = t % nsteps ;
+      t /= nsteps ;
+    }
+
+    m_scale = MatrixIdentity(4, NULL) ;
+    *MATRIX_RELT(m_scale, 1, 1) = scales[idx[0]] ;
+    *MATRIX_RELT(m_scale, 2, 2) = scales[idx[1]] ;
+    *MATRIX_RELT(m_scale, 3, 3) = scales[idx[2]] ;
+    m_tmp = MatrixMultiply(m_scale, m_origin_inv, NULL) ;
+    MatrixMultiply(m_origin, m_tmp, m_scale) ;
+
+    m_x_rot = MatrixReallocRotation(4, angles[idx[3]], X_ROTATION, NULL) ;
+    m_y_rot = MatrixReallocRotation(4, angles[idx[4]], Y_ROTATION, NULL) ;
+    m_z_rot = MatrixReallocRotation(4, angles[idx[5]], Z_ROTATION, NULL) ;
+    m_tmp = MatrixMultiply(m_y_rot, m_x_rot, m_tmp) ;
+    m_rot = MatrixMultiply(m_z_rot, m_tmp, NULL) ;
+    m_tmp2 = MatrixMultiply(m_rot, m_origin_inv, NULL) ;
+    MatrixMultiply(m_origin, m_tmp2, m_rot) ;
+    m_tmp2 = MatrixMultiply(m_scale, m_rot, m_tmp2) ;
+    m_tmp3 = MatrixMultiply(m_tmp2, m_L, NULL) ;
+
+    m_trans = MatrixIdentity(4, NULL) ;
+    m_L_tmp = NULL ;
+    ntrans = ntrans_steps*ntrans_steps*ntrans_steps ;
+    stride = coarse_stride > 1 ? coarse_stride : 1 ;
+    tbest = -1 ;
+    tbest_log_p = 0 ;
+    for (t = 0 ; t < ntrans ; t++)
+    {
+      *MATRIX_RELT(m_trans, 1, 4) = trans[t / (ntrans_steps*ntrans_steps)] ;
+      *MATRIX_RELT(m_trans, 2, 4) = trans[(t / ntrans_steps) % ntrans_steps] ;
+      *MATRIX_RELT(m_trans, 3, 4) = trans[t % ntrans_steps] ;
+      m_L_tmp = MatrixMultiply(m_trans, m_tmp3, m_L_tmp) ;
+      log_p = GCASsoaLogProbability(soa, mri, m_L_tmp, stride, Gclamp) ;
+      if (tbest < 0 || log_p > tbest_log_p)
+      {
+        tbest = t ;
+        tbest_log_p = log_p ;
+      }
+    }
+    if (stride > 1 && tbest >= 0)
+    {
+      *MATRIX_RELT(m_trans, 1, 4) = trans[tbest/(ntrans_steps*ntrans_steps)];
+      *MATRIX_RELT(m_trans, 2, 4) = trans[(tbest/ntrans_steps)%ntrans_steps];
+      *MATRIX_RELT(m_trans, 3, 4) = trans[tbest % ntrans_steps] ;
+      m_L_tmp = MatrixMultiply(m_trans, m_tmp3, m_L_tmp) ;
+      tbest_log_p = GCASsoaLogProbability(soa, mri, m_L_tmp, 1, Gclamp) ;
+    }
+    task_trans[task] = tbest ;
+    task_log_p[task] = tbest_log_p ;
+
+    MatrixFree(&m_scale) ;
+    MatrixFree(&m_x_rot) ;
+    MatrixFree(&m_y_rot) ;
+    MatrixFree(&m_z_rot) ;
+    MatrixFree(&m_rot) ;
+    MatrixFree(&m_tmp) ;
+    MatrixFree(&m_tmp2) ;
+    MatrixFree(&m_tmp3) ;
+    MatrixFree(&m_trans) ;
+    if (m_L_tmp)
+    {
+      MatrixFree(&m_L_tmp) ;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (best_task = -1, task = 0 ; task < ntasks ; task++)
+  {
+    if (task_trans[task] >= 0 && task_log_p[task] > max_log_p)
+    {
+      max_log_p = task_log_p[task] ;
+      best_task = task ;
+    }
+  }
+  if (best_task >= 0)
+  {
+    int t = best_task ;
+    for (i = 5 ; i >= 0 ; i--)
+    {
+      int nsteps = i < 3 ? nscale_steps : nangle_steps ;
+      best[i] = t % nsteps ;
+      t /= nsteps ;
+    }
+    t = task_trans[best_task] ;
+    best[6] = t / (ntrans_steps*ntrans_steps) ;
+    best[7] = (t / ntrans_steps) % ntrans_steps ;
+    best[8] = t % ntrans_steps ;
+  }
+  free(task_log_p) ;
+  free(task_trans) ;
+  return(max_log_p) ;
+}
+
 static int
 mark_gcas_classes(GCA_SAMPLE *gcas, int nsamples)
 {
@@ -0,0 +1,123 @@
+/**
+ * @file  mri_gca_pack.c
+ * @brief convert a gca atlas to or from the packed (.gcp) format
+ *
+ * The packed format holds the atlas in a few flat arrays that GCAread()
+ * maps or reads in one go instead of parsing value by value, which makes
+ * loading an atlas such as RB_all_*.gca much faster. Any tool that reads
+ * a gca also reads a .gcp.
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "utils.h"
+#include "const.h"
+#include "timer.h"
+#include "version.h"
+#include "gca.h"
+
+int main(int argc, char *argv[]) ;
+static int get_option(int argc, char *argv[]) ;
+
+const char *Progname ;
+static void usage_exit(int code) ;
+
+
+int
+main(int argc, char *argv[]) {
+  int          nargs, msec ;
+  struct timeb start ;
+  GCA          *gca ;
+
+  nargs = handle_version_option (argc, argv, "$Id$", "$Name:  $");
+  if (nargs && argc - nargs == 1)
+    exit (0);
+  argc -= nargs;
+
+  Progname = argv[0] ;
+  ErrorInit(NULL, NULL, NULL) ;
+  DiagInit(NULL, NULL, NULL) ;
+
+  for ( ; argc > 1 && ISOPTION(*argv[1]) ; argc--, argv++) {
+    nargs = get_option(argc, argv) ;
+    argc -= nargs ;
+    argv += nargs ;
+  }
+
+  if (argc < 3)
+    usage_exit(1) ;
+
+  TimerStart(&start) ;
+  printf("reading gca from %s...\n", argv[1]) ;
+  gca = GCAread(argv[1]) ;
+  if (!gca)
+    ErrorExit(ERROR_NOFILE, "%s: could not read gca %s", Progname, argv[1]) ;
+  msec = TimerStop(&start) ;
+  printf("reading took %2.2f seconds\n", (float)msec/1000.0f) ;
+
+  printf("writing gca to %s...\n", argv[2]) ;
+  if (GCAwrite(gca, argv[2]) != NO_ERROR)
+    ErrorExit(Gerror, "%s: could not write gca %s", Progname, argv[2]) ;
+
+  GCAfree(&gca) ;
+  exit(0) ;
+  return(0) ;
+}
+/*----------------------------------------------------------------------
+            Parameters:
+
+           Description:
+----------------------------------------------------------------------*/
+static int
+get_option(int argc, char *argv[]) {
+  int  nargs = 0 ;
+  char *option ;
+
+  option = argv[1] + 1 ;            /* past '-' */
+  switch (toupper(*option)) {
+  case '?':
+  case 'U':
+    usage_exit(0) ;
+    break ;
+  default:
+    fprintf(stderr, "unknown option %s\n", argv[1]) ;
+    exit(1) ;
+    break ;
+  }
+
+  return(nargs) ;
+}
+/*----------------------------------------------------------------------
+            Parameters:
+
+           Description:
+----------------------------------------------------------------------*/
+static void
+usage_exit(int code) {
+  printf("usage: %s [options] <input gca> <output gca>\n", Progname) ;
+  printf("\n") ;
+  printf("Converts between the original (.gca, .gcz) and packed (.gcp) atlas formats.\n") ;
+  printf("The output format is chosen by the extension of <output gca>; the input\n") ;
+  printf("format is detected from its contents.\n") ;
+  exit(code) ;
+}
@@ -553,6 +553,7 @@ double round(double x);
 #include "dti.h"
 #include "image.h"
 #include "stats.h"
+#include "romp_support.h"
 
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag);
 
@@ -564,6 +565,15 @@ static void print_help(void) ;
 static void print_version(void) ;
 static void dump_options(FILE *fp);
 static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel);
+static unsigned long SimStreamSeed(long seed, int nthsim);
+static int SimRandPerm(int nthsim, int N, int *perm, double *sign);
+static double SimMaxSig(MRI *p, MRI *gamma, MRI *F, MRI *mask, int threshsign, MRI **psig, double *pFmax);
+static double SimMaxClusterSize(MRIS *surf, MRI *sig, MRI *mask, double thresh, int threshsign, int *pnClusters);
+static char *SimCSDFileName(CSD *csd, char *fname);
+static int SimWriteCSDs(int nreps, int msecRunTime);
+static int SimResumeCSDs(void);
+static MRIS *SimCloneSurf(MRIS *surf);
+static MRI *SimPermuteFrames(MRI *y0, int *perm, double *sign, MRI *y);
 
 int main(int argc, char *argv[]) ;
 
@@ -729,6 +739,16 @@ float ThreshList[4] = {1.3,  2.0,  2.3,  3.0};
 int  nSignList = 3, nthSign;
 int SignList[3] = {-1,0,1};
 CSD *csdList[5][3][20];
+int SimResume = 0;
+double SimCheckpointSec = 60;
+int nSimStart, SimParallel, nsimbatch, nthsimbatch, nthreads, nthThread, TimeLastCheckpoint;
+GLMBATCH *simbatch = NULL;
+MRIGLM **simglm = NULL;
+MRIS **simsurf = NULL;
+MRI **simsig = NULL;
+int **simperm = NULL;
+double **simsign = NULL;
+MRI *SimY0 = NULL;
 
 MATRIX *RTM_Cr, *RTM_intCr, *RTM_TimeSec, *RTM_TimeMin;
 int DoMRTM1=0;
@@ -764,8 +784,7 @@ int main(int argc, char **argv) {
   MATRIX *wvect=NULL, *Mtmp=NULL, *Xselfreg=NULL, *Ex=NULL, *XgNew=NULL;
   MATRIX *Ct, *CCt;
   FILE *fp;
-  double Ccond, dtmp, threshadj, eff;
-  char *tmpstr2=NULL;
+  double Ccond, dtmp, eff;
 
   eresfwhm = -1;
   csd = CSDalloc();
@@ -1665,209 +1684,297 @@ int main(int argc, char **argv) {
 	    csdList[nthThresh][nthSign][n] = CSDcopy(csd,NULL);
 	    csdList[nthThresh][nthSign][n]->thresh = ThreshList[nthThresh];
 	    csdList[nthThresh][nthSign][n]->threshsign = SignList[nthSign];
+	    // Change sign to abs for F-tests
+	    if(mriglm->glm->C[n]->rows > 1) csdList[nthThresh][nthSign][n]->threshsign = 0;
 	    csdList[nthThresh][nthSign][n]->seed = csd->seed;
+	    strcpy(csdList[nthThresh][nthSign][n]->contrast,mriglm->glm->Cname[n]);
 	  }
 	}
       }
     }
 
+    // Pick up where an interrupted simulation left off
+    nSimStart = 0;
+    if(SimResume) nSimStart = SimResumeCSDs();
+
+    // Each iteration draws from its own random stream (see SimStreamSeed()),
+    // so permutations can be run in parallel and resumed. Permutations
+    // reorder the data instead of the rows of X (same F, p, and gamma) so
+    // that inv(X'*X)*X' is computed only once for all of them. The serial
+    // path reorders the data the same way so both give the same results.
+    SimParallel = 0;
+    if (!strcmp(csd->simtype,"perm") && VarFWHM <= 0 && mriglm->wg == NULL &&
+        !DiagCluster && MRIglmCanBatch(mriglm)) {
+      GLMcMatrices(mriglm->glm);
+      simbatch = MRIglmBatchAlloc(mriglm,1);
+      if (!mriglm->glm->ill_cond_flag) SimParallel = 1;
+      else MRIglmBatchFree(&simbatch);
+    }
+
     printf("\n\nStarting simulation sim over %d trials\n",nsim);
     TimerStart(&mytimer) ;
-    for (nthsim=0; nthsim < nsim; nthsim++) {
-      msecFitTime = TimerStop(&mytimer) ;
-      if(debug) printf("%d/%d t=%g ---------------------------------\n",
-             nthsim+1,nsim,msecFitTime/(1000*60.0));
-
-      if (!strcmp(csd->simtype,"mc-full")) {
-	if(! UseUniform)
-	  MRIrandn(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		   mriglm->y->nframes,0,1,mriglm->y);
-	else
-	  MRIdrand48(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		  mriglm->y->nframes,UniformMin,UniformMax,mriglm->y);
-        if(logflag) MRIlog(mriglm->y,mriglm->mask,-1,1,mriglm->y);
-        if(FWHM > 0)
-          SmoothSurfOrVol(surf, mriglm->y, mriglm->mask, SmoothLevel);
+    TimeLastCheckpoint = 0;
+    if(SimParallel){
+      nthreads = 1;
+#ifdef HAVE_OPENMP
+      nthreads = omp_get_max_threads();
+#endif
+      printf("Running permutations with %d threads\n",nthreads);
+      simglm  = (MRIGLM **) calloc(nthreads,sizeof(MRIGLM *));
+      simsurf = (MRIS **)   calloc(nthreads,sizeof(MRIS *));
+      simsig  = (MRI **)    calloc(nthreads,sizeof(MRI *));
+      simperm = (int **)    calloc(nthreads,sizeof(int *));
+      simsign = (double **) calloc(nthreads,sizeof(double *));
+      for(nthThread = 0; nthThread < nthreads; nthThread++){
+        // Shares y, X, and C with mriglm, but has its own outputs
+        simglm[nthThread] = (MRIGLM *) calloc(sizeof(MRIGLM),1);
+        *simglm[nthThread] = *mriglm;
+        simglm[nthThread]->beta = NULL;
+        simglm[nthThread]->eres = NULL;
+        simglm[nthThread]->rvar = NULL;
+        simglm[nthThread]->yhat = NULL;
+        simglm[nthThread]->yhatsave = 0;
+        simglm[nthThread]->condsave = 0;
+        for (n=0; n < mriglm->glm->ncontrasts; n++) {
+          simglm[nthThread]->gamma[n] = MRIcloneBySpace(mriglm->y,MRI_FLOAT,mriglm->glm->C[n]->rows);
+          simglm[nthThread]->F[n] = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+          simglm[nthThread]->p[n] = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+          simglm[nthThread]->gammaVar[n] = NULL;
+          simglm[nthThread]->z[n] = NULL;
+          simglm[nthThread]->pcc[n] = NULL;
+        }
+        // Clustering stores the cluster numbers in the surface
+        if(surf == NULL || nthThread == 0) simsurf[nthThread] = surf;
+        else simsurf[nthThread] = SimCloneSurf(surf);
+        simperm[nthThread] = (int *) calloc(mriglm->y->nframes,sizeof(int));
+        simsign[nthThread] = (double *) calloc(mriglm->y->nframes,sizeof(double));
       }
-      if (!strcmp(csd->simtype,"perm")) {
-        if (!OneSamplePerm) MatrixRandPermRows(mriglm->Xg);
-        else {
-          for (n=0; n < mriglm->y->nframes; n++) {
-            if (drand48() > 0.5) m = +1;
-            else                m = -1;
-            mriglm->Xg->rptr[n+1][1] = m;
+
+      nthsim = nSimStart;
+      while(nthsim < nsim){
+        // Run a few iterations per thread between checkpoints
+        nsimbatch = MIN(4*nthreads,nsim-nthsim);
+        ROMP_PF_begin
+#ifdef HAVE_OPENMP
+        #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+#endif
+        for(nthsimbatch=0; nthsimbatch < nsimbatch; nthsimbatch++){
+          ROMP_PFLB_begin
+          int tid = 0, b, kthsim, kthThresh, kthSign, kn, ksign, knClusters;
+          double ksigmax, kFmax, kcsize;
+          CSD *kcsd;
+#ifdef HAVE_OPENMP
+          tid = omp_get_thread_num();
+#endif
+          kthsim = nthsim + nthsimbatch;
+          if (!OneSamplePerm) {
+            SimRandPerm(kthsim, mriglm->y->nframes, simperm[tid], NULL);
+            for(b=0; b < simbatch->nblocks; b++)
+              MRIglmBatchBlock(simglm[tid],simbatch,b,1,1,simperm[tid],NULL);
+          }
+          else {
+            SimRandPerm(kthsim, mriglm->y->nframes, NULL, simsign[tid]);
+            for(b=0; b < simbatch->nblocks; b++)
+              MRIglmBatchBlock(simglm[tid],simbatch,b,1,1,NULL,simsign[tid]);
           }
-          //MatrixPrint(stdout,mriglm->Xg);
+          for(kthThresh = 0; kthThresh < nThreshList; kthThresh++){
+            for(kthSign = 0; kthSign < nSignList; kthSign++){
+              for (kn=0; kn < mriglm->glm->ncontrasts; kn++) {
+                kcsd = csdList[kthThresh][kthSign][kn];
+                ksign = (int)kcsd->threshsign;
+                ksigmax = SimMaxSig(simglm[tid]->p[kn],simglm[tid]->gamma[kn],simglm[tid]->F[kn],
+                                    mriglm->mask,ksign,&simsig[tid],&kFmax);
+                kcsize = SimMaxClusterSize(simsurf[tid],simsig[tid],mriglm->mask,
+                                           kcsd->thresh,ksign,&knClusters);
+                if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
+                                 mriglm->glm->Cname[kn],kthsim,knClusters,kcsize,ksigmax,kFmax);
+                kcsd->nClusters[kthsim] = knClusters;
+                kcsd->MaxClusterSize[kthsim] = kcsize;
+                kcsd->MaxSig[kthsim] = ksigmax;
+                kcsd->MaxStat[kthsim] = kFmax;
+              }
+            }
+          }
+          ROMP_PFLB_end
+        }
+        ROMP_PF_end
+        nthsim += nsimbatch;
+
+        msecFitTime = TimerStop(&mytimer) ;
+        if(debug) printf("%d/%d t=%g ---------------------------------\n",
+                         nthsim,nsim,msecFitTime/(1000*60.0));
+        if(nthsim == nsim || msecFitTime - TimeLastCheckpoint >= 1000*SimCheckpointSec){
+          SimWriteCSDs(nthsim,msecFitTime);
+          TimeLastCheckpoint = msecFitTime;
+        }
+      }
+      MRIglmBatchFree(&simbatch);
+      for(nthThread = 0; nthThread < nthreads; nthThread++){
+        for (n=0; n < mriglm->glm->ncontrasts; n++) {
+          MRIfree(&simglm[nthThread]->gamma[n]);
+          MRIfree(&simglm[nthThread]->F[n]);
+          MRIfree(&simglm[nthThread]->p[n]);
         }
+        free(simglm[nthThread]);
+        if(simsurf[nthThread] != surf) MRISfree(&simsurf[nthThread]);
+        if(simsig[nthThread]) MRIfree(&simsig[nthThread]);
+        free(simperm[nthThread]);
+        free(simsign[nthThread]);
       }
+      free(simglm);
+      free(simsurf);
+      free(simsig);
+      free(simperm);
+      free(simsign);
+    }
 
-      // Variance smoothing
-      if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-        // If variance smoothing, then need to test and fit separately
-        if (VarFWHM > 0) {
-          if(!DoSim) printf("Starting fit\n");
-          MRIglmFit(mriglm);
-          if(!DoSim) printf("Variance smoothing\n");
-          SmoothSurfOrVol(surf, mriglm->rvar, mriglm->mask, VarSmoothLevel);
-          if(!DoSim) printf("Starting test\n");
-          MRIglmTest(mriglm);
+    if(!SimParallel) {
+      if (!strcmp(csd->simtype,"perm")) SimY0 = MRIcopy(mriglm->y,NULL);
+      simperm = (int **) calloc(1,sizeof(int *));
+      simsign = (double **) calloc(1,sizeof(double *));
+      simperm[0] = (int *) calloc(mriglm->y->nframes,sizeof(int));
+      simsign[0] = (double *) calloc(mriglm->y->nframes,sizeof(double));
+      for (nthsim=nSimStart; nthsim < nsim; nthsim++) {
+        msecFitTime = TimerStop(&mytimer) ;
+        if(debug) printf("%d/%d t=%g ---------------------------------\n",
+               nthsim+1,nsim,msecFitTime/(1000*60.0));
+
+        // Reseed so that this iteration does not depend on the previous ones
+        srand48((long)SimStreamSeed(SynthSeed,nthsim));
+        if (rfs) RFspecSetSeed(rfs,SimStreamSeed(SynthSeed,nthsim));
+
+        if (!strcmp(csd->simtype,"mc-full")) {
+          if(! UseUniform)
+            MRIrandn(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
+                     mriglm->y->nframes,0,1,mriglm->y);
+          else
+            MRIdrand48(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
+                    mriglm->y->nframes,UniformMin,UniformMax,mriglm->y);
+          if(logflag) MRIlog(mriglm->y,mriglm->mask,-1,1,mriglm->y);
+          if(FWHM > 0)
+            SmoothSurfOrVol(surf, mriglm->y, mriglm->mask, SmoothLevel);
         }
-	else {
-          if(!DoSim) printf("Starting fit and test\n");
-          MRIglmFitAndTest(mriglm);
+        if (!strcmp(csd->simtype,"perm")) {
+          if (!OneSamplePerm) {
+            SimRandPerm(nthsim, mriglm->y->nframes, simperm[0], NULL);
+            SimPermuteFrames(SimY0, simperm[0], NULL, mriglm->y);
+          }
+          else {
+            SimRandPerm(nthsim, mriglm->y->nframes, NULL, simsign[0]);
+            SimPermuteFrames(SimY0, NULL, simsign[0], mriglm->y);
+          }
         }
-      }
 
-      for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
-	for(nthSign = 0; nthSign < nSignList; nthSign++){
-	  // Go through each contrast.
-	  for (n=0; n < mriglm->glm->ncontrasts; n++) {
-	    if(DoSimThreshLoop) {
-	      csd = csdList[nthThresh][nthSign][n];
-	      tSimSign = SignList[nthSign];
-	    }
-	    if(debug) printf("%2d %d %5.1f  %d %2d %5.1f\n",nthsim,nthThresh,
-			     csd->thresh,nthSign,tSimSign,TimerStop(&mytimer)/1000.0);
+        // Variance smoothing
+        if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+          // If variance smoothing, then need to test and fit separately
+          if (VarFWHM > 0) {
+            if(!DoSim) printf("Starting fit\n");
+            MRIglmFit(mriglm);
+            if(!DoSim) printf("Variance smoothing\n");
+            SmoothSurfOrVol(surf, mriglm->rvar, mriglm->mask, VarSmoothLevel);
+            if(!DoSim) printf("Starting test\n");
+            MRIglmTest(mriglm);
+          }
+          else {
+            if(!DoSim) printf("Starting fit and test\n");
+            MRIglmFitAndTest(mriglm);
+          }
+        }
 
-	    // Change sign to abs for F-tests
-	    csd->threshsign = tSimSign;
-	    if(mriglm->glm->C[n]->rows > 1) csd->threshsign = 0;
-	    
-	    // Adjust threshold for one- or two-sided
-	    if(csd->threshsign == 0) threshadj = csd->thresh;
-	    else threshadj = csd->thresh - log10(2.0); // one-sided test
-
-	    if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,mriglm->gamma[n],0);
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      // Get Fmax at sig max 
-	      Fmax = MRIgetVoxVal(mriglm->F[n],cmax,rmax,smax,0);
-	      if(csd->threshsign != 0) Fmax = Fmax*SIGN(sigmax);
-	    } 
-	    else {
-	      // mc-z or mc-t: synth z-field, smooth, rescale,
-	      // compute p, compute sig
-	      // This should do the same thing as AFNI's AlphaSim
-	      // Synth and rescale without the mask, otherwise smoothing
-	      // smears the 0s into the mask area. Also, the stuff outisde
-	      // the mask area wont get zeroed.
-	      if(nthThresh == 0 && nthSign == 0) {
-		RFsynth(z,rfs,mriglm->mask); // z or t, as needed
-		if (SmoothLevel > 0) {
-		  SmoothSurfOrVol(surf, z, mriglm->mask, SmoothLevel);
-		  if(DiagCluster) {
-		    sprintf(tmpstr,"./%s-zsm0.%s",mriglm->glm->Cname[n],format);
-		    printf("Saving z into %s\n",tmpstr);
-		    MRIwrite(z,tmpstr);
-		    // Exits below
-		  }
-		  RFrescale(z,rfs,mriglm->mask,z);
-		}
-	      }
-	      if(DiagCluster) {
-		sprintf(tmpstr,"./%s-zsm1.%s",mriglm->glm->Cname[n],format);
-		printf("Saving z into %s\n",tmpstr);
-		MRIwrite(z,tmpstr);
-		// Exits below
-	      }
-	      // Slightly tortured way to get the right p-values because
-	      //   RFstat2P() computes one-sided, but I handle sidedness
-	      //   during thresholding.
-	      // First, use zabs to get a two-sided pval bet 0 and 0.5
-	      zabs = MRIabs(z,zabs);
-	      mriglm->p[n] = RFstat2P(zabs,rfs,mriglm->mask,0,mriglm->p[n]);
-	      // Next, mult pvals by 2 to get two-sided bet 0 and 1
-	      MRIscalarMul(mriglm->p[n],mriglm->p[n],2);
-	      // sig = -log10(p)
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,z,0);
-
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      Fmax = MRIgetVoxVal(z,cmax,rmax,smax,0);
-	      if(csd->threshsign == 0) Fmax = fabs(Fmax);
-	    }
-	    if(mriglm->mask) MRImask(sig,mriglm->mask,sig,0.0,0.0);
-
-	    if(surf) {
-	      // surface clustering -------------
-	      MRIScopyMRI(surf, sig, 0, "val");
-	      if(debug || Gdiag_no > 0) printf("Clustering on surface %lf\n",
-					       TimerStop(&mytimer)/1000.0);
-	      SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						    0,&nClusters,NULL);
-	      csize = sclustMaxClusterArea(SurfClustList, nClusters);
-	    } 
-	    else {
-	      // volume clustering -------------
-	      if (debug) printf("Clustering on volume\n");
-	      VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
-					      mriglm->mask, &nClusters, NULL);
-	      csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
-	      if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
-	      clustFreeClusterList(&VolClustList,nClusters);
-	    }
-	    if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
-			     mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
-
-	    // Re-write the full CSD file each time. Should not take that
-	    // long and assures output can be used immediately regardless
-	    // of whether the job terminated properly or not
-	    strcpy(csd->contrast,mriglm->glm->Cname[n]);
-	    if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
-	      if(round(csd->threshsign) ==  0) tmpstr2 = "abs"; 
-	      if(round(csd->threshsign) == +1) tmpstr2 = "pos"; 
-	      if(round(csd->threshsign) == -1) tmpstr2 = "neg"; 
-	      //sprintf(tmpstr,"%s-%s.th%04d.%s.csd",simbase,mriglm->glm->Cname[n],
-	      //      (int)round(csd->thresh*100),tmpstr2);
-	      sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
-		      (int)round(csd->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
-	    }
-	    else
-	      sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
-	    if(debug) printf("csd %s \n",tmpstr);
-	    fflush(stdout);
-	    fp = fopen(tmpstr,"w");
-	    if (fp == NULL) {
-	      printf("ERROR: opening %s\n",tmpstr);
-	      exit(1);
-	    }
-	    fprintf(fp,"# ClusterSimulationData 2\n");
-	    fprintf(fp,"# mri_glmfit simulation sim\n");
-	    fprintf(fp,"# hostname %s\n",uts.nodename);
-	    fprintf(fp,"# machine  %s\n",uts.machine);
-	    fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
-	    fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
-	    if (mriglm->mask) fprintf(fp,"# masking 1\n");
-	    else             fprintf(fp,"# masking 0\n");
-	    fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
-	    fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
-	    fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
-	    csd->nreps = nthsim+1;
-	    csd->nClusters[nthsim] = nClusters;
-	    csd->MaxClusterSize[nthsim] = csize;
-	    csd->MaxSig[nthsim] = sigmax;
-	    csd->MaxStat[nthsim] = Fmax;
-	    CSDprint(fp, csd);
-	    fclose(fp);
-	    if(debug) CSDprint(stdout, csd);
-
-	    if(DiagCluster) {
-	      sprintf(tmpstr,"./%s-sig.%s",mriglm->glm->Cname[n],format);
-	      printf("Saving sig into %s and exiting ... \n",tmpstr);
-	      MRIwrite(sig,tmpstr);
-	      exit(1);
-	    }
-	    free(SurfClustList);
-	  } // contrasts
-	} // sign list
-      } // thresh list
-      //MRIfree(&sig);
-    }// simulation loop
+        for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+          for(nthSign = 0; nthSign < nSignList; nthSign++){
+            // Go through each contrast.
+            for (n=0; n < mriglm->glm->ncontrasts; n++) {
+              if(DoSimThreshLoop) {
+                csd = csdList[nthThresh][nthSign][n];
+                tSimSign = SignList[nthSign];
+              }
+              if(debug) printf("%2d %d %5.1f  %d %2d %5.1f\n",nthsim,nthThresh,
+                               csd->thresh,nthSign,tSimSign,TimerStop(&mytimer)/1000.0);
+
+              if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+                sigmax = SimMaxSig(mriglm->p[n],mriglm->gamma[n],mriglm->F[n],mriglm->mask,
+                                   (int)csd->threshsign,&sig,&Fmax);
+              } 
+              else {
+                // mc-z or mc-t: synth z-field, smooth, rescale,
+                // compute p, compute sig
+                // This should do the same thing as AFNI's AlphaSim
+                // Synth and rescale without the mask, otherwise smoothing
+                // smears the 0s into the mask area. Also, the stuff outisde
+                // the mask area wont get zeroed.
+                if(nthThresh == 0 && nthSign == 0) {
+                  RFsynth(z,rfs,mriglm->mask); // z or t, as needed
+                  if (SmoothLevel > 0) {
+                    SmoothSurfOrVol(surf, z, mriglm->mask, SmoothLevel);
+                    if(DiagCluster) {
+                      sprintf(tmpstr,"./%s-zsm0.%s",mriglm->glm->Cname[n],format);
+                      printf("Saving z into %s\n",tmpstr);
+                      MRIwrite(z,tmpstr);
+                      // Exits below
+                    }
+                    RFrescale(z,rfs,mriglm->mask,z);
+                  }
+                }
+                if(DiagCluster) {
+                  sprintf(tmpstr,"./%s-zsm1.%s",mriglm->glm->Cname[n],format);
+                  printf("Saving z into %s\n",tmpstr);
+                  MRIwrite(z,tmpstr);
+                  // Exits below
+                }
+                // Slightly tortured way to get the right p-values because
+                //   RFstat2P() computes one-sided, but I handle sidedness
+                //   during thresholding.
+                // First, use zabs to get a two-sided pval bet 0 and 0.5
+                zabs = MRIabs(z,zabs);
+                mriglm->p[n] = RFstat2P(zabs,rfs,mriglm->mask,0,mriglm->p[n]);
+                // Next, mult pvals by 2 to get two-sided bet 0 and 1
+                MRIscalarMul(mriglm->p[n],mriglm->p[n],2);
+                // sig = -log10(p)
+                sig = MRIlog10(mriglm->p[n],NULL,sig,1);
+                // If test is not ABS then apply the sign
+                if(csd->threshsign != 0) MRIsetSign(sig,z,0);
+
+                sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
+                                     &cmax,&rmax,&smax);
+                Fmax = MRIgetVoxVal(z,cmax,rmax,smax,0);
+                if(csd->threshsign == 0) Fmax = fabs(Fmax);
+              }
+              if(debug || Gdiag_no > 0) printf("Clustering %lf\n",TimerStop(&mytimer)/1000.0);
+              csize = SimMaxClusterSize(surf,sig,mriglm->mask,csd->thresh,
+                                        (int)csd->threshsign,&nClusters);
+              if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
+                               mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
+
+              csd->nClusters[nthsim] = nClusters;
+              csd->MaxClusterSize[nthsim] = csize;
+              csd->MaxSig[nthsim] = sigmax;
+              csd->MaxStat[nthsim] = Fmax;
+
+              if(DiagCluster) {
+                SimWriteCSDs(nthsim+1,msecFitTime);
+                sprintf(tmpstr,"./%s-sig.%s",mriglm->glm->Cname[n],format);
+                printf("Saving sig into %s and exiting ... \n",tmpstr);
+                MRIwrite(sig,tmpstr);
+                exit(1);
+              }
+            } // contrasts
+          } // sign list
+        } // thresh list
+
+        // Re-write the full CSD files every so often. Should not take
+        // that long and assures output can be used (or resumed with
+        // --sim-resume) regardless of whether the job terminated properly
+        msecFitTime = TimerStop(&mytimer) ;
+        if(nthsim == nsim-1 || msecFitTime - TimeLastCheckpoint >= 1000*SimCheckpointSec){
+          SimWriteCSDs(nthsim+1,msecFitTime);
+          TimeLastCheckpoint = msecFitTime;
+        }
+        //MRIfree(&sig);
+      }// simulation loop
+      if(SimY0) MRIfree(&SimY0);
+    }
     if(SimDoneFile){
       fp = fopen(SimDoneFile,"w");
       fclose(fp);
@@ -2869,6 +2976,33 @@ static int parse_commandline(int argc, char **argv) {
       SimDoneFile = pargv[0];
       nargsused = 1;
     } 
+    else if(!strcasecmp(option, "--sim-resume")) SimResume = 1;
+    else if (!strcmp(option, "--sim-checkpoint")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%lf",&SimCheckpointSec);
+      nargsused = 1;
+    } 
+    else if (!strcmp(option, "--sim-merge")) {
+      // Merge the CSDs of simulations run as separate jobs and exit
+      CSD *csdmerge = NULL;
+      int n;
+      if(nargc < 3) CMDargNErr(option,3);
+      for(n=1; CMDnthIsArg(nargc, pargv, n); n++){
+        csdmerge = CSDreadMerge(pargv[n],csdmerge);
+        if(csdmerge == NULL) exit(1);
+      }
+      printf("Merged %d CSDs, %d iterations, into %s\n",n-1,csdmerge->nreps,pargv[0]);
+      err = CSDwrite(pargv[0],csdmerge);
+      exit(err);
+    } 
+    else if(!strcasecmp(option, "--threads") || !strcasecmp(option, "--nthreads") ){
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&nthreads);
+      #ifdef HAVE_OPENMP
+      omp_set_num_threads(nthreads);
+      #endif
+      nargsused = 1;
+    } 
     else {
       fprintf(stderr,"ERROR: Option %s unknown\n",option);
       if (CMDsingleDash(option))
@@ -2970,6 +3104,10 @@ printf("                  before --fsgd)\n");
 printf("   --allow-zero-dof : mostly for very special purposes\n");
 printf("   --illcond : allow ill-conditioned design matrices\n");
 printf("   --sim-done SimDoneFile : create DoneFile when simulation finished \n");
+printf("   --sim-resume : continue a simulation from the CSD files it left behind\n");
+printf("   --sim-checkpoint sec : write the CSD files every sec seconds (default 60)\n");
+printf("   --sim-merge outcsd csd1 csd2 ... : merge CSD files from separate jobs and exit\n");
+printf("   --threads nthreads : number of threads (perm simulations and fitting)\n");
 printf("\n");
 printf("\n");
 }
@@ -3332,10 +3470,15 @@ printf("  contrast will get its own file (created by appending the contrast\n");
 printf("  name to the base name). A '.csd' is appended to each file name.\n");
 printf("\n");
 printf("Multiple simulations can be run in parallel by specifying different\n");
-printf("csdbasenames. Then pass the multiple CSD files to mri_surfcluster\n");
-printf("and mri_volcluster. The Full CSD file is written on each iteration,\n");
+printf("csdbasenames and seeds. Then pass the multiple CSD files to mri_surfcluster\n");
+printf("and mri_volcluster, or merge them into one with --sim-merge.\n");
+printf("Permutations are also run in parallel across threads (--threads).\n");
+printf("Each iteration draws from its own random stream derived from the\n");
+printf("seed, so the result does not depend on the number of threads.\n");
+printf("The full CSD file is rewritten every 60 sec (--sim-checkpoint),\n");
 printf("which means that the CSD file will be valid if the simulation\n");
-printf("is aborted or crashes.\n");
+printf("is aborted or crashes. Running the same command with --sim-resume\n");
+printf("(and the same --seed) continues from the last CSD file written.\n");
 printf("\n");
 printf("In the cases where the design matrix is a single columns of ones\n");
 printf("(ie, one-sample group mean), it makes no sense to permute the\n");
@@ -3402,6 +3545,10 @@ static void check_options(void) {
     printf("ERROR: must specify input y file\n");
     exit(1);
   }
+  if(SimResume && SynthSeed < 0) {
+    printf("ERROR: --sim-resume needs the --seed of the simulation it resumes\n");
+    exit(1);
+  }
   if (nContrasts > 0 && OneSampleGroupMean) {
     printf("ERROR: cannot specify --C with --osgm\n");
     exit(1);
@@ -3622,6 +3769,274 @@ static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel) {
   return(0);
 }
 
+/*--------------------------------------------------------------------
+  SimStreamSeed() - seed of the random stream for the nthsim-th
+  simulation iteration. Mixes the global seed and the iteration number
+  (splitmix64) so that each iteration gets an independent stream that
+  does not depend on the order or the thread the iterations run in.
+  --------------------------------------------------------------------*/
+static unsigned long SimStreamSeed(long seed, int nthsim)
+{
+  unsigned long long x;
+
+  x = (unsigned long long)seed * 0x9E3779B97F4A7C15ULL + (unsigned long long)(nthsim + 1);
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x = x ^ (x >> 31);
+  x &= 0x7fffffff;
+  if (x == 0) x = 1;  // 0 means "pick a seed" to RFspecSetSeed()
+  return ((unsigned long)x);
+}
+
+/*--------------------------------------------------------------------
+  SimRandPerm() - draws the permutation (perm, zero-based) or the +/-1
+  sign flips (sign, for one-sample group means) for the nthsim-th
+  permutation from its own stream. Thread safe.
+  --------------------------------------------------------------------*/
+static int SimRandPerm(int nthsim, int N, int *perm, double *sign)
+{
+  unsigned short xsubi[3];
+  unsigned long seed;
+  int n, m, tmp;
+
+  seed = SimStreamSeed(SynthSeed, nthsim);
+  xsubi[0] = 0x330E;
+  xsubi[1] = seed & 0xffff;
+  xsubi[2] = (seed >> 16) & 0xffff;
+
+  if (sign != NULL) {
+    for (n = 0; n < N; n++) {
+      if (erand48(xsubi) > 0.5) sign[n] = +1;
+      else                      sign[n] = -1;
+    }
+    return(0);
+  }
+  for (n = 0; n < N; n++) perm[n] = n;
+  for (n = N-1; n > 0; n--) {
+    m = (int)floor(erand48(xsubi)*(n+1));
+    tmp = perm[n];
+    perm[n] = perm[m];
+    perm[m] = tmp;
+  }
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimMaxSig() - computes sig = -log10(p), signed by gamma for one-sided
+  tests, and returns its maximum in the mask. The stat (F, signed for
+  one-sided tests) at the maximum is returned in pFmax. sig is
+  allocated if *psig is NULL. Used by perm and mc-full.
+  --------------------------------------------------------------------*/
+static double SimMaxSig(MRI *p, MRI *gamma, MRI *F, MRI *mask, int threshsign, MRI **psig, double *pFmax)
+{
+  int cmax, rmax, smax;
+  double sigmax;
+
+  *psig = MRIlog10(p,NULL,*psig,1);
+  // If test is not ABS then apply the sign
+  if(threshsign != 0) MRIsetSign(*psig,gamma,0);
+  sigmax = MRIframeMax(*psig,0,mask,threshsign,&cmax,&rmax,&smax);
+  // Get Fmax at sig max
+  *pFmax = MRIgetVoxVal(F,cmax,rmax,smax,0);
+  if(threshsign != 0) *pFmax = *pFmax*SIGN(sigmax);
+  return(sigmax);
+}
+
+/*--------------------------------------------------------------------
+  SimMaxClusterSize() - masks sig, clusters it at thresh (adjusted
+  when one-sided), and returns the size of the largest cluster (area
+  for surfaces, volume for volumes). The number of clusters is
+  returned in pnClusters. surf is NULL for volumes. The cluster
+  numbers are stored in surf, so each thread needs its own.
+  --------------------------------------------------------------------*/
+static double SimMaxClusterSize(MRIS *surf, MRI *sig, MRI *mask, double thresh, int threshsign, int *pnClusters)
+{
+  double threshadj, csize;
+  SURFCLUSTERSUM *SurfClustList;
+  VOLCLUSTER **VolClustList;
+
+  // Adjust threshold for one- or two-sided
+  if(threshsign == 0) threshadj = thresh;
+  else threshadj = thresh - log10(2.0); // one-sided test
+
+  if(mask) MRImask(sig,mask,sig,0.0,0.0);
+
+  if(surf) {
+    // surface clustering -------------
+    MRIScopyMRI(surf, sig, 0, "val");
+    SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,threshsign,0,pnClusters,NULL);
+    csize = sclustMaxClusterArea(SurfClustList, *pnClusters);
+    free(SurfClustList);
+  }
+  else {
+    // volume clustering -------------
+    VolClustList = clustGetClusters(sig, 0, threshadj,-1,threshsign,0,mask,pnClusters,NULL);
+    csize = voxelsize*clustMaxClusterCount(VolClustList,*pnClusters);
+    if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,*pnClusters);
+    clustFreeClusterList(&VolClustList,*pnClusters);
+  }
+  return(csize);
+}
+
+/*--------------------------------------------------------------------
+  SimCSDFileName() - name of the CSD file of the given csd
+  --------------------------------------------------------------------*/
+static char *SimCSDFileName(CSD *csd, char *fname)
+{
+  char *signstr = "abs";
+
+  if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
+    if(round(csd->threshsign) == +1) signstr = "pos";
+    if(round(csd->threshsign) == -1) signstr = "neg";
+    sprintf(fname,"%s.th%02d.%s.j001-%s.csd",simbase,
+            (int)round(csd->thresh*10),signstr,csd->contrast);
+  }
+  else
+    sprintf(fname,"%s-%s.csd",simbase,csd->contrast);
+  return(fname);
+}
+
+/*--------------------------------------------------------------------
+  SimWriteCSDs() - writes the first nreps iterations of all the CSDs.
+  Each file is written to a temporary file that is then renamed so
+  that an interrupted job never leaves a truncated CSD behind.
+  --------------------------------------------------------------------*/
+static int SimWriteCSDs(int nreps, int msecRunTime)
+{
+  int nthThresh, nthSign, n;
+  CSD *csd;
+  FILE *fp;
+  char fname[2000], tmpname[2100];
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+        csd = csdList[nthThresh][nthSign][n];
+        SimCSDFileName(csd,fname);
+        sprintf(tmpname,"%s.tmp",fname);
+        if(debug) printf("csd %s \n",fname);
+        fp = fopen(tmpname,"w");
+        if (fp == NULL) {
+          printf("ERROR: opening %s\n",tmpname);
+          exit(1);
+        }
+        fprintf(fp,"# ClusterSimulationData 2\n");
+        fprintf(fp,"# mri_glmfit simulation sim\n");
+        fprintf(fp,"# hostname %s\n",uts.nodename);
+        fprintf(fp,"# machine  %s\n",uts.machine);
+        fprintf(fp,"# runtime_min %g\n",msecRunTime/(1000*60.0));
+        fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
+        if (mriglm->mask) fprintf(fp,"# masking 1\n");
+        else             fprintf(fp,"# masking 0\n");
+        fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
+        fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
+        fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
+        csd->nreps = nreps;
+        CSDprint(fp, csd);
+        fclose(fp);
+        if(rename(tmpname,fname) != 0){
+          printf("ERROR: renaming %s to %s\n",tmpname,fname);
+          exit(1);
+        }
+        if(debug) CSDprint(stdout, csd);
+      }
+    }
+  }
+  fflush(stdout);
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimResumeCSDs() - reads the CSD files left by an interrupted run
+  with the same parameters and seed, copies their iterations into
+  csdList, and returns the iteration to resume from. Iterations do
+  not depend on one another (SimStreamSeed()), so the resumed run
+  gives the same result as an uninterrupted one.
+  --------------------------------------------------------------------*/
+static int SimResumeCSDs(void)
+{
+  int nthThresh, nthSign, n, nthrep, nreps, nstart;
+  CSD *csd, *csdr;
+  char fname[2000];
+
+  nstart = nsim;
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+        csd = csdList[nthThresh][nthSign][n];
+        SimCSDFileName(csd,fname);
+        if(!fio_FileExistsReadable(fname)){
+          printf("INFO: %s does not exist, starting simulation from the beginning\n",fname);
+          return(0);
+        }
+        csdr = CSDread(fname);
+        if(csdr == NULL) exit(1);
+        if(strcmp(csdr->simtype,csd->simtype) || fabs(csdr->thresh-csd->thresh) > 1e-4 ||
+           csdr->threshsign != csd->threshsign){
+          printf("ERROR: %s is from a different simulation\n",fname);
+          exit(1);
+        }
+        if(csdr->seed != csd->seed){
+          printf("ERROR: %s was run with seed %ld, not %ld\n",fname,csdr->seed,csd->seed);
+          exit(1);
+        }
+        nreps = MIN(csdr->nreps,nsim);
+        for(nthrep = 0; nthrep < nreps; nthrep++){
+          csd->nClusters[nthrep] = csdr->nClusters[nthrep];
+          csd->MaxClusterSize[nthrep] = csdr->MaxClusterSize[nthrep];
+          csd->MaxSig[nthrep] = csdr->MaxSig[nthrep];
+          csd->MaxStat[nthrep] = csdr->MaxStat[nthrep];
+        }
+        nstart = MIN(nstart,nreps);
+        CSDfreeData(csdr);
+        free(csdr);
+      }
+    }
+  }
+  printf("Resuming simulation at iteration %d\n",nstart);
+  return(nstart);
+}
+
+/*--------------------------------------------------------------------
+  SimCloneSurf() - copy of the surface with what is needed for
+  clustering, including the group vertex areas.
+  --------------------------------------------------------------------*/
+static MRIS *SimCloneSurf(MRIS *surf)
+{
+  MRIS *surfcopy;
+  int vno;
+
+  surfcopy = MRISclone(surf);
+  for(vno = 0; vno < surf->nvertices; vno++)
+    surfcopy->vertices[vno].group_avg_area = surf->vertices[vno].group_avg_area;
+  surfcopy->group_avg_surface_area = surf->group_avg_surface_area;
+  surfcopy->group_avg_vtxarea_loaded = surf->group_avg_vtxarea_loaded;
+  return(surfcopy);
+}
+
+/*--------------------------------------------------------------------
+  SimPermuteFrames() - sets frame k of y to frame perm[k] of y0 times
+  sign[k] (either can be NULL), which is what MRIglmBatchBlock() fits
+  for a permutation.
+  --------------------------------------------------------------------*/
+static MRI *SimPermuteFrames(MRI *y0, int *perm, double *sign, MRI *y)
+{
+  int c, r, s, k;
+  double val;
+
+  for (s=0; s < y0->depth; s++) {
+    for (r=0; r < y0->height; r++) {
+      for (c=0; c < y0->width; c++) {
+        for (k=0; k < y0->nframes; k++) {
+          val = MRIgetVoxVal(y0,c,r,s,perm ? perm[k] : k);
+          if (sign) val *= sign[k];
+          MRIsetVoxVal(y,c,r,s,k,val);
+        }
+      }
+    }
+  }
+  return(y);
+}
 
 /*--------------------------------------------------------------------*/
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag) {
@@ -296,6 +296,10 @@ static int parse_commandline(int argc, char **argv) {
       nargsused = 1;
     } else if (!strcmp(option, "--sortbyrun")) {
       sortbyrun = 1;
+    } else if (!strcmp(option, "--index-cache")) {
+      if (nargc < 1) argnerr(option,1);
+      setenv("FS_DICOM_INDEX_CACHE",pargv[0],1);
+      nargsused = 1;
     } else {
       fprintf(stderr,"ERROR: Option %s unknown\n",option);
       if (singledash(option))
@@ -321,6 +325,7 @@ static void print_usage(void) {
   fprintf(stdout, "   --sortbyrun    : assign run numbers\n");
   fprintf(stdout, "   --summarize    : only print out info for run leaders\n");
   fprintf(stdout, "   --dwi          : try to read dwi params. Generally no need to.\n");
+  fprintf(stdout, "   --index-cache dir : keep an index of the parsed files in dir\n");
   fprintf(stdout, "   --help         : how to use this program \n");
   fprintf(stdout, "\n");
 }
@@ -371,6 +376,11 @@ static void print_help(void) {
   printf("  --summarize : forces print out of information for the first file in the run.\n");
   printf("\n");
 
+  printf("  --index-cache dir : keep an index of what was parsed from each file in dir\n");
+  printf("      (or in sdicomdir if dir is 1), so that the next run on the same directory\n");
+  printf("      only parses new or changed files. Same as setting FS_DICOM_INDEX_CACHE.\n");
+  printf("\n");
+
   printf(
     "BUGS:\n"
     "Prior to 5/25/05, the protocol name was stripped of anything that\n"
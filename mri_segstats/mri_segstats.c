@@ -211,6 +211,8 @@ int main(int argc, char **argv)
   float min, max, range, mean, std, snr;
   FILE *fp;
   double  **favg, *favgmn;
+  SEGSTAT_TABLE *segstattab = NULL;
+  int *tabsegids;
   char tmpstr[1000];
   double atlas_icv=0;
   int ntotalsegid=0;
@@ -780,6 +782,20 @@ int main(int argc, char **argv)
   printf("Computing statistics for each segmentation\n");
   fflush(stdout);
 
+  // Count (and get the stats of) all the segmentations in a single pass
+  // over the volume rather than rescanning it for each one
+  tabsegids = (int *) calloc(sizeof(int),nsegid);
+  for (n=0; n < nsegid; n++) tabsegids[n] = StatSumTable[n].id;
+  if (!dontrun)
+  {
+    segstattab = MRIsegStatsTable(seg, (InVolFile != NULL) ? invol : NULL, frame,
+                                  tabsegids, nsegid, UseRobust ? RobustPct : 0);
+    if (segstattab == NULL)
+    {
+      exit(1);
+    }
+  }
+
   DoContinue=0;nx=0;skip=0;n0=0;vol=0;nhits=0;c=0;min=0.0;max=0.0;range=0.0;mean=0.0;std=0.0;snr=0.0;
 
   ROMP_PF_begin
@@ -824,13 +840,13 @@ int main(int argc, char **argv)
       {
         if (pvvol == NULL)
         {
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = segstattab->nvoxels[n];
           vol = nhits*voxelvolume;
         }
         else
         {
           vol = MRIvoxelsInLabelWithPartialVolumeEffects(seg, pvvol, StatSumTable[n].id, NULL, NULL);
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = segstattab->nvoxels[n];
 //          nhits = nint(vol/voxelvolume);
         }
       }
@@ -867,12 +883,12 @@ int main(int argc, char **argv)
     {
       if (nhits > 0)
       {
-        if(UseRobust == 0)
-          MRIsegStats(seg, StatSumTable[n].id, invol, frame,
-            &min, &max, &range, &mean, &std);
-        else
-          MRIsegStatsRobust(seg, StatSumTable[n].id, invol, frame,
-            &min, &max, &range, &mean, &std, RobustPct);
+        // robust (trimmed) if UseRobust, see MRIsegStatsRobust()
+        min   = segstattab->min[n];
+        max   = segstattab->max[n];
+        range = segstattab->range[n];
+        mean  = segstattab->mean[n];
+        std   = segstattab->std[n];
 
         snr = mean/std;
       }
@@ -896,6 +912,7 @@ int main(int argc, char **argv)
     ROMP_PFLB_end
   }
   ROMP_PF_end
+  MRIsegStatsTableFree(&segstattab);
   
   /* print results ordered */
   for (n=0; n < nsegid; n++)
@@ -1372,11 +1389,16 @@ int main(int argc, char **argv)
     for (n=0; n < nsegid; n++)
       favg[n] = (double *) calloc(sizeof(double),invol->nframes);
     favgmn = (double *) calloc(sizeof(double *),nsegid);
+    // all frames of all segs in one pass, same as MRIsegFrameAvg()
+    segstattab = MRIsegStatsTable(seg, invol, -1, tabsegids, nsegid, 0);
+    if (segstattab == NULL)
+    {
+      exit(1);
+    }
     for (n=0; n < nsegid; n++) {
-      printf("%3d",n);
-      if (n%20 == 19) printf("\n");
-      fflush(stdout);
-      nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
+      nvox = segstattab->nvoxels[n];
+      for(f=0; f < invol->nframes; f++)
+        favg[n][f] = segstattab->mean[n*invol->nframes + f];
       favgmn[n] = 0.0;
       for(f=0; f < invol->nframes; f++) {
 	if(DoFrameSum) favg[n][f] *= nvox; // Undo spatial average
@@ -1385,7 +1407,7 @@ int main(int argc, char **argv)
       favgmn[n] /= invol->nframes;
       if(RmFrameAvgMn) for(f=0; f < invol->nframes; f++) favg[n][f] -= favgmn[n];
     }
-    printf("\n");
+    MRIsegStatsTableFree(&segstattab);
 
     // Save mean over space and frames in simple text file
     // Each seg on a separate line
@@ -1430,6 +1452,7 @@ int main(int argc, char **argv)
       MRIwrite(famri,FrameAvgVolFile);
     }
   }// Done with Frame Average
+  free(tabsegids);
 
 #ifdef FS_CUDA
   PrintGPUtimers();
@@ -163,6 +163,18 @@ OPTIONS
     results as --nsmooth-{in,out}, but automatically computes the the
     number of iterations based on the desired fwhm.
 
+  --conv
+
+    With --fwhm-src or --fwhm-trg, convolve with a gaussian on the surface
+    registration (sphere.reg) instead of doing nearest neighbor smoothing.
+
+  --smooth-cache dir
+
+    With --conv, cache the gaussian smoothing operator in dir, so that
+    smoothing other data on the same surface with the same fwhm does not
+    have to rebuild it. If dir is not a directory, the cache is written
+    next to the surface registration. Same as setenv FS_SURF_SMOOTH_CACHE.
+
   --nsmooth-in  niterations
   --nsmooth-out niterations  [note: same as --smooth]
 
@@ -1296,6 +1308,12 @@ static int parse_commandline(int argc, char **argv)
       SplitFrames = 1;
     } else if (!strcasecmp(option, "--conv")) {
       ConvGaussian = 1;
+    } else if (!strcasecmp(option, "--smooth-cache")) {
+      if (nargc < 1) {
+        argnerr(option,1);
+      }
+      setenv("FS_SURF_SMOOTH_CACHE",pargv[0],1);
+      nargsused = 1;
     } else if (!strcasecmp(option, "--no-rev-face-order")) {
       OKToRevFaceOrder = 0;
     }
@@ -1779,6 +1797,8 @@ static void print_usage(void)
   printf("   --frame      save only nth frame (with --trg_type paint)\n");
   printf("   --fwhm-src fwhmsrc: smooth the source to fwhmsrc\n");
   printf("   --fwhm-trg fwhmtrg: smooth the target to fwhmtrg\n");
+  printf("   --conv : convolve with a gaussian instead of iterative smoothing\n");
+  printf("   --smooth-cache dir : cache the --conv smoothing operator in dir\n");
   printf("   --nsmooth-in N  : smooth the input\n");
   printf("   --nsmooth-out N : smooth the output\n");
   printf("   --cortex : use ?h.cortex.label as a smoothing mask\n");
@@ -1947,6 +1967,18 @@ printf("    method is similar to heat kernel smoothing. This will give the same\
 printf("    results as --nsmooth-{in,out}, but automatically computes the the\n");
 printf("    number of iterations based on the desired fwhm.\n");
 printf("\n");
+printf("  --conv\n");
+printf("\n");
+printf("    With --fwhm-src or --fwhm-trg, convolve with a gaussian on the surface\n");
+printf("    registration (sphere.reg) instead of doing nearest neighbor smoothing.\n");
+printf("\n");
+printf("  --smooth-cache dir\n");
+printf("\n");
+printf("    With --conv, cache the gaussian smoothing operator in dir, so that\n");
+printf("    smoothing other data on the same surface with the same fwhm does not\n");
+printf("    have to rebuild it. If dir is not a directory, the cache is written\n");
+printf("    next to the surface registration. Same as setenv FS_SURF_SMOOTH_CACHE.\n");
+printf("\n");
 printf("  --nsmooth-in  niterations\n");
 printf("  --nsmooth-out niterations  [note: same as --smooth]\n");
 printf("\n");
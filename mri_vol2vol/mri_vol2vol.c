@@ -562,6 +562,7 @@ char gcamfile[1000];
 char MNIgcamfile[1000];
 MRI_REGION region;
 char *m3zfile = "talairach.m3z";
+char *morphcachefile = NULL;
 
 double angles[3] = {0,0,0};
 MATRIX *Mrot = NULL;
@@ -983,7 +984,15 @@ int main(int argc, char **argv) {
       printf("Applying reg to gcam\n");
       GCAMapplyTransform(gcam, Rtransform);  //voxel2voxel
       printf("Applying morph to input\n");
-      out = GCAMmorphToAtlas(in, gcam, NULL, -1, interpcode);
+      if(morphcachefile){
+	MRI *mri_field;
+	printf("Using morph field cache %s\n",morphcachefile);
+	mri_field = GCAMmorphToAtlasField(gcam, morphcachefile);
+	out = GCAMmorphFieldApply(in, mri_field, NULL, -1, interpcode);
+	MRIfree(&mri_field);
+      }
+      else
+	out = GCAMmorphToAtlas(in, gcam, NULL, -1, interpcode);
 
       //sprintf(MNIgcamfile,"%s/transforms/talairach.m3z", fio_dirname(gcam->atlas.fname));
       //printf("The MNI gcam fname is: %s\n", MNIgcamfile);      
@@ -1209,6 +1218,10 @@ static int parse_commandline(int argc, char **argv) {
       if (nargc < 1) argnerr(option,1);
       m3zfile = pargv[0]; DoMorph = 1;
       nargsused = 1;
+    } else if (istringnmatch(option, "--morph-cache",0)) {
+      if (nargc < 1) argnerr(option,1);
+      morphcachefile = pargv[0];
+      nargsused = 1;
     } else if (istringnmatch(option, "--noDefM3zPath",0)) {
       defM3zPath = 0; // use the m3z file as it is; no assumed location
       if(R == NULL) R = MatrixIdentity(4,NULL); // as subjid is not neccesary any more
@@ -1539,6 +1552,9 @@ printf("\n");
 printf("  --m3z morph    : non-linear morph encoded in the m3z format\n");
 printf("  --noDefM3zPath : flag indicating that the code should not be looking for the non-linear m3z morph in the default location (subj/mri/transforms), but should use the morph name as is\n");
 printf("  --inv-morph    : compute and use the inverse of the m3z morph\n");
+printf("  --morph-cache file : keep the morph (with --reg) as a field of voxel coords in file, and\n");
+printf("                       reuse it when file was written from the same morph and reg, to\n");
+printf("                       resample several volumes quickly (mgz keeps the morph id it checks)\n");
 printf("\n");
 printf("  --fstarg <vol>      : optionally use vol from subject in --reg as target. default is orig.mgz \n");
 printf("  --crop scale        : crop and change voxel size\n");
@@ -2073,6 +2089,7 @@ static void dump_options(FILE *fp) {
   if(DoMorph){
     fprintf(fp,"Morphing\n");
     fprintf(fp,"InvertMorph %d\n",InvertMorph);
+    if(morphcachefile) fprintf(fp,"MorphCache %s\n",morphcachefile);
   }
 
   fprintf(fp,"Synth      %d\n",synth);
@@ -195,6 +195,8 @@ int DetrendOrder = -1;
 int DoDetrend = 1;
 int SmoothOnly = 0;
 int DoSqr = 0; // take square of input before smoothing
+int ConvGaussian = 0; // smooth by gaussian convolution on the sphere
+MRIS *sphere;
 
 char *ar1fname = NULL;
 char *arNfname = NULL;
@@ -369,9 +371,20 @@ int main(int argc, char *argv[]) {
 
   if (infwhm > 0 || niters > 0) {
     if(niters < 0) niters = MRISfwhm2niters(infwhm,surf);
-    printf("Smoothing input by fwhm=%lf, gstd=%lf, niters=%d \n",
-           infwhm,ingstd,niters);
-    InVals = MRISsmoothMRI(surf, InVals, niters, mask,InVals);
+    if(ConvGaussian) {
+      sprintf(tmpstr,"%s/%s/surf/%s.sphere",SUBJECTS_DIR,subject,hemi);
+      printf("Convolving input with gaussian fwhm=%lf, gstd=%lf on %s\n",
+             infwhm,ingstd,tmpstr);
+      sphere = MRISread(tmpstr);
+      if(sphere == NULL) exit(1);
+      InVals = MRISgaussianSmooth(sphere, InVals, ingstd, InVals, 3.5);
+      MRISfree(&sphere);
+    }
+    else {
+      printf("Smoothing input by fwhm=%lf, gstd=%lf, niters=%d \n",
+             infwhm,ingstd,niters);
+      InVals = MRISsmoothMRI(surf, InVals, niters, mask,InVals);
+    }
     if(InVals == NULL) exit(1);
     if(DoSpatialINorm){
       mritmp = SpatialINorm(InVals, mask, NULL);
@@ -500,6 +513,12 @@ static int parse_commandline(int argc, char **argv) {
     }
     else if (!strcasecmp(option, "--sqr")) DoSqr = 1;
     else if (!strcasecmp(option, "--fast")) setenv("USE_FAST_SURF_SMOOTHER","1",1);
+    else if (!strcasecmp(option, "--conv")) ConvGaussian = 1;
+    else if (!strcasecmp(option, "--smooth-cache")) {
+      if (nargc < 1) CMDargNErr(option,1);
+      setenv("FS_SURF_SMOOTH_CACHE",pargv[0],1);
+      nargsused = 1;
+    }
     else if (!strcasecmp(option, "--no-fast")) setenv("USE_FAST_SURF_SMOOTHER","0",1);
     else if (!strcasecmp(option, "--smooth-only") || !strcasecmp(option, "--so")) {
       DoDetrend = 0;
@@ -720,6 +739,8 @@ static void print_usage(void) {
   printf("   --out-mask outmask : save final mask\n");
   printf("   \n");
   printf("   --fwhm fwhm : apply before measuring\n");
+  printf("   --conv : smooth by convolving with a gaussian on ?h.sphere\n");
+  printf("   --smooth-cache dir : cache the --conv smoothing operator in dir\n");
   printf("   --niters-only <niters> : only report on niters for fwhm\n");
   printf("   --o output\n");
   printf("\n");
@@ -800,6 +821,19 @@ printf("--fwhm fwhm\n");
 printf("\n");
 printf("Smooth input by fwhm mm.\n");
 printf("\n");
+printf("--conv\n");
+printf("\n");
+printf("Smooth by convolving with a gaussian on ?h.sphere instead of doing\n");
+printf("iterative nearest neighbor smoothing. The mask is not used for the\n");
+printf("smoothing. Same as mri_surf2surf --conv.\n");
+printf("\n");
+printf("--smooth-cache dir\n");
+printf("\n");
+printf("With --conv, cache the gaussian smoothing operator in dir, so that\n");
+printf("smoothing other data on the same surface with the same fwhm does not\n");
+printf("have to rebuild it. If dir is not a directory, the cache is written\n");
+printf("next to ?h.sphere. Same as setenv FS_SURF_SMOOTH_CACHE.\n");
+printf("\n");
 printf("--niters-only <nitersfile>\n");
 printf("\n");
 printf("Only report the number of iterations needed to achieve the FWHM given\n");
@@ -854,6 +888,10 @@ static void check_options(void) {
     printf("ERROR: must specify --fwhm with --niters-only\n");
     exit(1);
   }
+  if (infwhm == 0 && ConvGaussian) {
+    printf("ERROR: must specify --fwhm with --conv\n");
+    exit(1);
+  }
   if(X != NULL && DetrendOrder > 0){
     printf("ERROR: cannot --X and --detrend\n");
     exit(1);
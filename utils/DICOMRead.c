@@ -23,11 +23,14 @@
 
 #include <ctype.h>
 #include <dirent.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/timeb.h>
 #include <sys/types.h>
@@ -47,10 +50,12 @@ void *malloc(size_t size);
 #include "diag.h"
 #include "dti.h"
 #include "fio.h"
+#include "fnv_hash.h"
 #include "fsenv.h"
 #include "macros.h"  // DEGREES
 #include "mosaic.h"
 #include "mri_identify.h"
+#include "romp_support.h"
 
 // #include "affine.h"
 
@@ -59,6 +64,25 @@ void *malloc(size_t size);
 #undef _DICOMRead_SRC
 
 static int DCMPrintCond(CONDITION cond);
+static int dcmGetVolResFromObject(DCM_OBJECT **object, float *ColRes, float *RowRes, float *SliceRes);
+static int dcmGetNRowsFromObject(DCM_OBJECT **object);
+static int dcmGetNColsFromObject(DCM_OBJECT **object);
+static int dcmImageDirCosFromObject(DCM_OBJECT **object, float *Vcx, float *Vcy, float *Vcz, float *Vrx, float *Vry, float *Vrz);
+static int dcmImagePositionFromObject(DCM_OBJECT **object, float *x, float *y, float *z);
+static char *sdcmReadAsciiHeader(const char *dcmfile);
+static char *sdcmAsciiHeaderTag(const char *header, const char *TagString);
+static int sdcmSliceDirCosFromHeader(const char *header, float *Vsx, float *Vsy, float *Vsz);
+static int sdcmIsMosaicFromInfo(const char *PhEncDir,
+                                int Nrows,
+                                int Ncols,
+                                int VolResErr,
+                                float ColRes,
+                                float RowRes,
+                                const char *header,
+                                int *pNcols,
+                                int *pNrows,
+                                int *pNslices,
+                                int *pNframes);
 void *ReadDICOMImage2(int nfiles, DICOMInfo **aDicomInfo, int startIndex);
 
 static BOOL IsTagPresent[NUMBEROFTAGS];
@@ -95,31 +119,24 @@ static const char *rllEncoded_UID = "1.2.840.10008.1.2.5";
 MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
 {
   SDCMFILEINFO *sdfi;
-  DCM_ELEMENT *element;
   SDCMFILEINFO **sdfi_list;
-  int nthfile;
+  int nthfile, ndone;
   int nlist;
   int ncols, nrows, nslices, nframes;
-  int nmoscols, nmosrows;
-  int mosrow, moscol, mosindex;
-  int err, OutOfBounds, IsMosaic;
-  int row, col, slice, frame, fid;
-  unsigned short *pixeldata;
+  int IsMosaic;
+  int frame;
   MRI *vol, *voltmp;
   char **SeriesList;
   char *tmpstring;
   int Maj, Min, MinMin;
-  double xs, ys, zs, xe, ye, ze, d, MinSliceScaleFactor, val;
+  double xs, ys, zs, xe, ye, ze, d, MinSliceScaleFactor;
   int nnlist;
   int vol_datatype;
   FSENV *env;
-  char tmpfile[2000], tmpfilestdout[2000], *FileNameUse, cmd[4000];
-  int IsCompressed, IsDWI;
+  int IsDWI;
   extern int sliceDirCosPresent;  // set when no ascii header
 
   xs = ys = zs = xe = ye = ze = d = 0.; /* to avoid compiler warnings */
-  slice = 0;
-  frame = 0; /* to avoid compiler warnings */
 
   sliceDirCosPresent = 0;  // assume not present
 
@@ -127,34 +144,43 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
   int nstart = global_progress_range[0];
   int nend = global_progress_range[1];
   global_progress_range[1] = nstart + (nend - nstart) / 3;
-  if (SDCMListFile != NULL)
+  if (SDCMListFile != NULL) {
     SeriesList = ReadSiemensSeries(SDCMListFile, &nlist, dcmfile);
-  else
-    SeriesList = ScanSiemensSeries(dcmfile, &nlist);
 
-  if (SeriesList == NULL) {
-    fprintf(stderr, "ERROR: could not find any files (SeriesList==NULL)\n");
-    return (NULL);
-  }
+    if (SeriesList == NULL) {
+      fprintf(stderr, "ERROR: could not find any files (SeriesList==NULL)\n");
+      return (NULL);
+    }
 
-  if (nlist == 0) {
-    fprintf(stderr, "ERROR: could not find any files (nlist==0)\n");
-    return (NULL);
-  }
+    if (nlist == 0) {
+      fprintf(stderr, "ERROR: could not find any files (nlist==0)\n");
+      return (NULL);
+    }
 
-  // for(nnlist=0; nnlist<nlist; nnlist++) fprintf(stdout,"%3d  %s\n",
-  // nnlist,SeriesList[nnlist]);
-  // fflush(stdout);
+    global_progress_range[0] = global_progress_range[1];
+    global_progress_range[1] += (nend - nstart) / 3;
+    printf("INFO: loading series header info.\n");
+    sdfi_list = LoadSiemensSeriesInfo(SeriesList, nlist);
 
-  global_progress_range[0] = global_progress_range[1];
-  global_progress_range[1] += (nend - nstart) / 3;
-  printf("INFO: loading series header info.\n");
-  sdfi_list = LoadSiemensSeriesInfo(SeriesList, nlist);
+    // free memory
+    nnlist = nlist;
+    while (nnlist--) free(SeriesList[nnlist]);
+    free(SeriesList);
+  }
+  else {
+    // Parse the directory only once, rather than once to find the
+    // series and again to load it
+    printf("INFO: loading series header info.\n");
+    sdfi_list = ScanSiemensSeriesInfo(dcmfile, &nlist);
+    global_progress_range[0] = global_progress_range[1];
+    global_progress_range[1] += (nend - nstart) / 3;
+  }
 
-  // free memory
-  nnlist = nlist;
-  while (nnlist--) free(SeriesList[nnlist]);
-  free(SeriesList);
+  if (sdfi_list == NULL || nlist == 0) {
+    fprintf(stderr, "ERROR: could not load series header info\n");
+    return (NULL);
+  }
+  sliceDirCosPresent = sdfi_list[nlist - 1]->SliceDirCosPresent;
 
   printf("INFO: sorting.\n");
   SortSDCMFileInfo(sdfi_list, nlist);
@@ -403,8 +429,27 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
   }
 
   env = FSENVgetenv();
+
+  /* The files are read in parallel. The dicom library is not thread
+     safe, so only one thread at a time gets pixel data from it, but
+     decompressing the file and placing the pixels in the volume (ie,
+     unpacking the mosaic) for one file overlap with reading the
+     next. Each file goes to its own slice/frame, so no two threads
+     write the same voxels. */
+  ndone = 0;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
   for (nthfile = 0; nthfile < nlist; nthfile++) {
-    sdfi = sdfi_list[nthfile];
+    ROMP_PFLB_begin
+    SDCMFILEINFO *sdfi = sdfi_list[nthfile];
+    DCM_ELEMENT *element;
+    unsigned short *pixeldata;
+    char tmpfile[2000], tmpfilestdout[2000], *FileNameUse, cmd[4000];
+    int IsCompressed, row, col, slice, frame, fid, err;
+    int nmoscols, nmosrows, mosrow, moscol, mosindex, OutOfBounds;
+    double val;
 
     /* Handle compression */
     // If changing this code, make sure to change similar code below
@@ -444,10 +489,9 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
     }
 
     /* Get the pixel data */
-    element = GetElementFromFile(FileNameUse, 0x7FE0, 0x10);
+    element = GetPixelDataFromFile(FileNameUse);
     if (element == NULL) {
       printf("ERROR: reading pixel data from %s\n", FileNameUse);
-      MRIfree(&vol);
       exit(1);
     }
     if (IsCompressed) {
@@ -460,10 +504,9 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
     if (!IsMosaic) {
       /*---------------------------------------------*/
       /* It's not a mosaic -- load rows and cols from pixel data */
-      if (nthfile == 0) {
-        frame = 0;
-        slice = 0;
-      }
+      /* The files are sorted by slice, then frame */
+      frame = nthfile % nframes;
+      slice = nthfile / nframes;
       if (Gdiag_no > 0) {
         printf("%3d %3d %3d    %s   %6.1f %6.1f %6.1f\n",
                nthfile,
@@ -506,17 +549,6 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
           }
         }
       }
-      if (IsDWI) {
-        vol->bvals->rptr[frame + 1][1] = sdfi->bval;
-        vol->bvecs->rptr[frame + 1][1] = sdfi->bvecx;
-        vol->bvecs->rptr[frame + 1][2] = sdfi->bvecy;
-        vol->bvecs->rptr[frame + 1][3] = sdfi->bvecz;
-      }
-      frame++;
-      if (frame >= nframes) {
-        frame = 0;
-        slice++;
-      }
     }
     else {  // is a mosaic
       /*---------------------------------------------*/
@@ -524,42 +556,53 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
       frame = nthfile;
       nmoscols = sdfi->NImageCols;
       nmosrows = sdfi->NImageRows;
-      for (row = 0; row < nrows; row++) {
-        for (col = 0; col < ncols; col++) {
-          for (slice = 0; slice < nslices; slice++) {
-            /* compute the mosaic col and row from the volume
-               col, row , and slice */
-            err = VolSS2MosSS(col, row, slice, ncols, nrows, nmoscols, nmosrows, &moscol, &mosrow, &OutOfBounds);
-            if (err || OutOfBounds) {
-              FreeElementData(element);
-              free(element);
-              MRIfree(&vol);
-              exit(1);
-            }
-            /* Compute the linear index into the block of pixel data */
-            mosindex = moscol + mosrow * nmoscols;
+      for (slice = 0; slice < nslices; slice++) {
+        /* compute the mosaic col and row of the first voxel of the
+           slice. The rest of the slice follows it in the mosaic. */
+        err = VolSS2MosSS(0, 0, slice, ncols, nrows, nmoscols, nmosrows, &moscol, &mosrow, &OutOfBounds);
+        if (!err && !OutOfBounds) {
+          int lastcol, lastrow;
+          VolSS2MosSS(ncols - 1, nrows - 1, slice, ncols, nrows, nmoscols, nmosrows, &lastcol, &lastrow, &OutOfBounds);
+        }
+        if (err || OutOfBounds) {
+          exit(1);
+        }
+        for (row = 0; row < nrows; row++) {
+          /* Compute the linear index into the block of pixel data */
+          mosindex = moscol + (mosrow + row) * nmoscols;
+          for (col = 0; col < ncols; col++) {
             if (sdfi->UseSliceScaleFactor)
-              val = ((float)*(pixeldata + mosindex)) / sdfi->SliceScaleFactor;
+              val = ((float)*(pixeldata + mosindex + col)) / sdfi->SliceScaleFactor;
             else
-              val = *(pixeldata + mosindex);
+              val = *(pixeldata + mosindex + col);
 	    if(DoRescale)
 	      val = val*sdfi->RescaleSlope + sdfi->RescaleIntercept;
             MRIsetVoxVal(vol, col, row, slice, frame, val);
           }
         }
       }
-      if (IsDWI) {
-        vol->bvals->rptr[frame + 1][1] = sdfi->bval;
-        vol->bvecs->rptr[frame + 1][1] = sdfi->bvecx;
-        vol->bvecs->rptr[frame + 1][2] = sdfi->bvecy;
-        vol->bvecs->rptr[frame + 1][3] = sdfi->bvecz;
-      }
     }
 
     FreeElementData(element);
     free(element);
-    exec_progress_callback(nthfile, nlist, 0, 1);
+#ifdef HAVE_OPENMP
+    #pragma omp critical(sdcm_progress)
+#endif
+    exec_progress_callback(ndone++, nlist, 0, 1);
+    ROMP_PFLB_end
   } /* for nthfile */
+  ROMP_PF_end
+
+  if (IsDWI) {
+    for (nthfile = 0; nthfile < nlist; nthfile++) {
+      sdfi = sdfi_list[nthfile];
+      frame = IsMosaic ? nthfile : nthfile % nframes;
+      vol->bvals->rptr[frame + 1][1] = sdfi->bval;
+      vol->bvecs->rptr[frame + 1][1] = sdfi->bvecx;
+      vol->bvecs->rptr[frame + 1][2] = sdfi->bvecy;
+      vol->bvecs->rptr[frame + 1][3] = sdfi->bvecz;
+    }
+  }
 
   /* Determine whether Siemens has reversed the slice order prior to
      packing into mosaic. This makes it inconsistent with the geometry
@@ -659,39 +702,46 @@ MRI *sdcmLoadVolumeAutoScale(const char *dcmfile, int LoadVolume, int nthonly)
   global_progress_range[1] = nstart + (nend - nstart) / 3;
   if (SDCMListFile != NULL) {
     SeriesList = ReadSiemensSeries(SDCMListFile, &nlist, dcmfile);
+
+    if (SeriesList == NULL) {
+      fprintf(stderr, "ERROR: could not find any files (SeriesList==NULL)\n");
+      return (NULL);
+    }
+
+    if (nlist == 0) {
+      fprintf(stderr, "ERROR: could not find any files (nlist==0)\n");
+      return (NULL);
+    }
+
+    global_progress_range[0] = global_progress_range[1];
+    global_progress_range[1] += (nend - nstart) / 3;
+    printf("INFO: loading series header info.\n");
+    sdfi_list = LoadSiemensSeriesInfo(SeriesList, nlist);
+
+    // free memory
+    nnlist = nlist;
+    while (nnlist--) {
+      free(SeriesList[nnlist]);
+    }
+    free(SeriesList);
   }
   else {
-    SeriesList = ScanSiemensSeries(dcmfile, &nlist);
+    // Parse the directory only once, rather than once to find the
+    // series and again to load it
+    printf("INFO: loading series header info.\n");
+    sdfi_list = ScanSiemensSeriesInfo(dcmfile, &nlist);
+    global_progress_range[0] = global_progress_range[1];
+    global_progress_range[1] += (nend - nstart) / 3;
   }
 
-  if (SeriesList == NULL) {
-    fprintf(stderr, "ERROR: could not find any files (SeriesList==NULL)\n");
-    return (NULL);
-  }
-
-  if (nlist == 0) {
-    fprintf(stderr, "ERROR: could not find any files (nlist==0)\n");
+  if (sdfi_list == NULL || nlist == 0) {
+    fprintf(stderr, "ERROR: could not load series header info\n");
     return (NULL);
   }
+  sliceDirCosPresent = sdfi_list[nlist - 1]->SliceDirCosPresent;
 
   fprintf(stderr, "WARNING: YOU ARE USING A BETA AUTOSCALE VERSION !\n");
 
-  // for(nnlist=0; nnlist<nlist; nnlist++) fprintf(stdout,"%3d  %s\n",
-  // nnlist,SeriesList[nnlist]);
-  // fflush(stdout);
-
-  global_progress_range[0] = global_progress_range[1];
-  global_progress_range[1] += (nend - nstart) / 3;
-  printf("INFO: loading series header info.\n");
-  sdfi_list = LoadSiemensSeriesInfo(SeriesList, nlist);
-
-  // free memory
-  nnlist = nlist;
-  while (nnlist--) {
-    free(SeriesList[nnlist]);
-  }
-  free(SeriesList);
-
   printf("INFO: sorting.\n");
   SortSDCMFileInfo(sdfi_list, nlist);
 
@@ -1173,6 +1223,97 @@ MATRIX *sdcmAutoAlignMatrix(const char *dcmfile)
 DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
 {
   DCM_OBJECT *object = 0;
+  DCM_ELEMENT *element;
+
+  object = GetObjectFromFile(dicomfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+
+  element = GetElementFromObject(&object, grpid, elid);
+  DCM_CloseObject(&object);
+  if (element == NULL) {
+    return (NULL);
+  }
+
+  COND_PopCondition(1); /********************************/
+
+  return (element);
+}
+/*---------------------------------------------------------------
+  GetPixelDataFromFile() - same as GetElementFromFile(dicomfile,
+  0x7FE0, 0x10), but only the parse of the header by the DICOM
+  library (which is not thread safe) is serialized. The pixel data
+  itself is read outside of the critical section so that several
+  files can be loaded at the same time.
+  ---------------------------------------------------------------*/
+DCM_ELEMENT *GetPixelDataFromFile(const char *dicomfile)
+{
+  DCM_OBJECT *object = 0;
+  DCM_ELEMENT *element;
+  CONDITION cond = DCM_NORMAL;
+  CTNBOOLEAN swap = FALSE;
+  off_t offset = 0;
+  FILE *fp;
+  size_t n;
+  int opened;
+  char tmp;
+
+  element = (DCM_ELEMENT *)calloc(1, sizeof(DCM_ELEMENT));
+#ifdef HAVE_OPENMP
+  #pragma omp critical(sdcm_dcmlib)
+#endif
+  {
+    object = GetObjectFromFile(dicomfile, 0);
+    opened = (object != NULL);
+    if (opened) {
+      cond = DCM_GetElement(&object, DCM_MAKETAG(0x7FE0, 0x10), element);
+      if (cond == DCM_NORMAL) cond = DCM_GetElementFileOffset(&object, element->tag, &offset, &swap);
+      DCM_CloseObject(&object);
+      COND_PopCondition(1);
+    }
+  }
+  if (!opened) exit(1);  // as in GetElementFromFile()
+
+  if (cond != DCM_NORMAL) {
+    // the pixel data is not where it can be read directly
+    free(element);
+#ifdef HAVE_OPENMP
+    #pragma omp critical(sdcm_dcmlib)
+#endif
+    element = GetElementFromFile(dicomfile, 0x7FE0, 0x10);
+    return (element);
+  }
+
+  AllocElementData(element);
+  fp = fopen(dicomfile, "rb");
+  n = 0;
+  if (fp != NULL) {
+    if (fseeko(fp, offset, SEEK_SET) == 0) n = fread(element->d.ot, 1, element->length, fp);
+    fclose(fp);
+  }
+  if (n != element->length) {
+    FreeElementData(element);
+    free(element);
+    return (NULL);
+  }
+  if (swap && element->representation == DCM_OW) {
+    for (n = 0; n + 1 < element->length; n += 2) {
+      tmp = element->d.string[n];
+      element->d.string[n] = element->d.string[n + 1];
+      element->d.string[n + 1] = tmp;
+    }
+  }
+  return (element);
+}
+/*---------------------------------------------------------------
+  GetElementFromObject() - same as GetElementFromFile() but for an
+  object that is already open, so that any number of elements can
+  be had from one parse of the file. Returns NULL if the element
+  is not there.
+  ---------------------------------------------------------------*/
+DCM_ELEMENT *GetElementFromObject(DCM_OBJECT **object, long grpid, long elid)
+{
   CONDITION cond;
   DCM_ELEMENT *element;
   DCM_TAG tag;
@@ -1181,30 +1322,20 @@ DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
 
   element = (DCM_ELEMENT *)calloc(1, sizeof(DCM_ELEMENT));
 
-  object = GetObjectFromFile(dicomfile, 0);
-  if (object == NULL) {
-    exit(1);
-  }
-
   tag = DCM_MAKETAG(grpid, elid);
-  cond = DCM_GetElement(&object, tag, element);
+  cond = DCM_GetElement(object, tag, element);
   if (cond != DCM_NORMAL) {
-    DCM_CloseObject(&object);
     free(element);
     return (NULL);
   }
   AllocElementData(element);
-  cond = DCM_GetElementValue(&object, element, &rtnLength, &Ctx);
+  cond = DCM_GetElementValue(object, element, &rtnLength, &Ctx);
   /* Does Ctx have to be freed? */
   if (cond != DCM_NORMAL) {
-    DCM_CloseObject(&object);
     FreeElementData(element);
     free(element);
     return (NULL);
   }
-  DCM_CloseObject(&object);
-
-  COND_PopCondition(1); /********************************/
 
   return (element);
 }
@@ -1817,6 +1948,130 @@ char *SiemensAsciiTag(const char *dcmfile, const char *TagString, int flag)
 
   return (VariableValue);
 }
+/*-----------------------------------------------------------------
+  sdcmFindBytes() - first occurrence of str in the n bytes at buf,
+  or NULL. buf need not be null terminated.
+  -----------------------------------------------------------------*/
+static const char *sdcmFindBytes(const char *buf, size_t n, const char *str)
+{
+  size_t len = strlen(str);
+  const char *p = buf, *end = buf + n;
+
+  while ((size_t)(end - p) >= len) {
+    p = (const char *)memchr(p, str[0], end - p - len + 1);
+    if (p == NULL) {
+      return (NULL);
+    }
+    if (memcmp(p, str, len) == 0) {
+      return (p);
+    }
+    p++;
+  }
+  return (NULL);
+}
+/*-----------------------------------------------------------------
+  sdcmReadAsciiHeader() - reads the Siemens ASCII header(s) of a
+  dicom file in one pass, giving the lines between each
+  "### ASCCONV BEGIN" and "### ASCCONV END ###" as one null
+  terminated string. Non-printing chars become newlines, as they do
+  with the unix strings command that SiemensAsciiTagEx() uses, so
+  the tags found are the same. Returns NULL if there is no header.
+  The result must be freed. Unlike SiemensAsciiTagEx(), there is
+  no static state, so this can be called from several threads.
+  -----------------------------------------------------------------*/
+static char *sdcmReadAsciiHeader(const char *dcmfile)
+{
+  FILE *fp;
+  char *buf, *header;
+  const char *p, *end, *q;
+  long n, nheader;
+  size_t i;
+
+  fp = fopen(dcmfile, "rb");
+  if (fp == NULL) {
+    return (NULL);
+  }
+  fseek(fp, 0, SEEK_END);
+  n = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (n <= 0) {
+    fclose(fp);
+    return (NULL);
+  }
+  buf = (char *)malloc(n);
+  if (fread(buf, 1, n, fp) != (size_t)n) {
+    fclose(fp);
+    free(buf);
+    return (NULL);
+  }
+  fclose(fp);
+
+  header = NULL;
+  nheader = 0;
+  p = buf;
+  end = buf + n;
+  while ((p = sdcmFindBytes(p, end - p, "### ASCCONV BEGIN")) != NULL) {
+    q = sdcmFindBytes(p, end - p, "### ASCCONV END ###");
+    if (q == NULL) {
+      q = end;
+    }
+    header = (char *)realloc(header, nheader + (q - p) + 2);
+    for (i = 0; i < (size_t)(q - p); i++) {
+      unsigned char c = p[i];
+      header[nheader + i] = (isprint(c) || c == '\t') ? c : '\n';
+    }
+    nheader += q - p;
+    header[nheader++] = '\n';
+    header[nheader] = 0;
+    p = q;
+  }
+  free(buf);
+
+  return (header);
+}
+/*-----------------------------------------------------------------
+  sdcmAsciiHeaderTag() - SiemensAsciiTagEx() for a header read by
+  sdcmReadAsciiHeader(). Returns the value of the last line whose
+  variable name is TagString, or NULL. The result must be freed.
+  -----------------------------------------------------------------*/
+static char *sdcmAsciiHeaderTag(const char *header, const char *TagString)
+{
+  char VariableName[512], tmpstr2[512], line[4000];
+  char *VariableValue = NULL;
+  const char *p, *eol;
+  size_t len;
+
+  if (header == NULL) {
+    return (NULL);
+  }
+
+  for (p = header; *p; p = eol + (*eol != 0)) {
+    eol = strchr(p, '\n');
+    if (eol == NULL) {
+      eol = p + strlen(p);
+    }
+    len = eol - p;
+    if (len >= sizeof(line)) {
+      len = sizeof(line) - 1;
+    }
+    memcpy(line, p, len);
+    line[len] = 0;
+
+    VariableName[0] = 0;
+    sscanf(line, "%511s", VariableName);
+    if (VariableName[0] == 0 || strcmp(VariableName, TagString) != 0) {
+      continue;
+    }
+    tmpstr2[0] = 0;
+    sscanf(line, "%*s %*s %511s", tmpstr2);
+    if (VariableValue) {
+      free(VariableValue);
+    }
+    VariableValue = strcpyalloc(tmpstr2);
+  }
+
+  return (VariableValue);
+}
 /*-----------------------------------------------------------------------
   dcmGetVolRes - Gets the volume resolution (mm) from a DICOM File. The
   column and row resolution is obtained from tag (28,30). This tag is stored
@@ -1826,6 +2081,22 @@ char *SiemensAsciiTag(const char *dcmfile, const char *TagString, int flag)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *SliceRes)
+{
+  DCM_OBJECT *object;
+  int err;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  err = dcmGetVolResFromObject(&object, ColRes, RowRes, SliceRes);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (err);
+}
+/*----------------------------------------------------------*/
+static int dcmGetVolResFromObject(DCM_OBJECT **object, float *ColRes, float *RowRes, float *SliceRes)
 {
   DCM_ELEMENT *e;
   char *s;
@@ -1835,7 +2106,7 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
 
   /* Load the Pixel Spacing - this is a string of the form:
      ColRes\RowRes   */
-  e = GetElementFromFile(dcmfile, 0x28, 0x30);
+  e = GetElementFromObject(object, 0x28, 0x30);
   if (e == NULL) {
     return (1);
   }
@@ -1875,7 +2146,7 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
 
   if (AutoSliceResElTag) {
     printf("Automatically determining SliceResElTag\n");
-    e = GetElementFromFile(dcmfile, 0x18, 0x23);
+    e = GetElementFromObject(object, 0x18, 0x23);
     if (e != NULL) {
       if (strcmp(e->d.string, "3D") == 0)
         SliceResElTag1 = 0x50;
@@ -1889,7 +2160,7 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
   /* By default, the slice resolution is determined from 18,88. If
      that does not exist, then 18,50 is used. For siemens mag res
      angiogram (MRAs), 18,50 must be used first */
-  e = GetElementFromFile(dcmfile, 0x18, SliceResElTag1);
+  e = GetElementFromObject(object, 0x18, SliceResElTag1);
   if (e == NULL)
     tag_not_found = 1;
   else {
@@ -1901,7 +2172,7 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
     }
   }
   if (tag_not_found) {  // so either no tag or tag was zero
-    e = GetElementFromFile(dcmfile, 0x18, SliceResElTag2);
+    e = GetElementFromObject(object, 0x18, SliceResElTag2);
     if (e == NULL) return (1);  // no tag
     sscanf(e->d.string, "%f", SliceRes);
     FreeElementData(e);
@@ -1943,11 +2214,27 @@ int dcmGetSeriesNo(const char *dcmfile)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int dcmGetNRows(const char *dcmfile)
+{
+  DCM_OBJECT *object;
+  int NRows;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  NRows = dcmGetNRowsFromObject(&object);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (NRows);
+}
+/*----------------------------------------------------------*/
+static int dcmGetNRowsFromObject(DCM_OBJECT **object)
 {
   DCM_ELEMENT *e;
   int NRows;
 
-  e = GetElementFromFile(dcmfile, 0x28, 0x10);
+  e = GetElementFromObject(object, 0x28, 0x10);
   if (e == NULL) {
     return (-1);
   }
@@ -1955,7 +2242,7 @@ int dcmGetNRows(const char *dcmfile)
   NRows = *(e->d.us);
 
   if (e->representation != DCM_US) {
-    printf("bad element for %s\n", dcmfile);
+    printf("bad element for (28,10)\n");
   }
 
   FreeElementData(e);
@@ -1971,11 +2258,27 @@ int dcmGetNRows(const char *dcmfile)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int dcmGetNCols(const char *dcmfile)
+{
+  DCM_OBJECT *object;
+  int NCols;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  NCols = dcmGetNColsFromObject(&object);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (NCols);
+}
+/*----------------------------------------------------------*/
+static int dcmGetNColsFromObject(DCM_OBJECT **object)
 {
   DCM_ELEMENT *e;
   int NCols;
 
-  e = GetElementFromFile(dcmfile, 0x28, 0x11);
+  e = GetElementFromObject(object, 0x28, 0x11);
   if (e == NULL) {
     return (-1);
   }
@@ -1997,6 +2300,22 @@ int dcmGetNCols(const char *dcmfile)
   Author: Douglas N. Greve, 9/10/2001
   -----------------------------------------------------------------------*/
 int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, float *Vrx, float *Vry, float *Vrz)
+{
+  DCM_OBJECT *object;
+  int err;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  err = dcmImageDirCosFromObject(&object, Vcx, Vcy, Vcz, Vrx, Vry, Vrz);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (err);
+}
+/*----------------------------------------------------------*/
+static int dcmImageDirCosFromObject(DCM_OBJECT **object, float *Vcx, float *Vcy, float *Vcz, float *Vrx, float *Vry, float *Vrz)
 {
   DCM_ELEMENT *e;
   char *s;
@@ -2005,7 +2324,7 @@ int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, floa
 
   /* Load the direction cosines - this is a string of the form:
      Vcx\Vcy\Vcz\Vrx\Vry\Vrz */
-  e = GetElementFromFile(dcmfile, 0x20, 0x37);
+  e = GetElementFromObject(object, 0x20, 0x37);
   if (e == NULL) {
     return (1);
   }
@@ -2060,6 +2379,22 @@ int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, floa
   Author: Douglas N. Greve, 9/10/2001
   -----------------------------------------------------------------------*/
 int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
+{
+  DCM_OBJECT *object;
+  int err;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  err = dcmImagePositionFromObject(&object, x, y, z);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (err);
+}
+/*----------------------------------------------------------*/
+static int dcmImagePositionFromObject(DCM_OBJECT **object, float *x, float *y, float *z)
 {
   DCM_ELEMENT *e;
   char *s;
@@ -2067,7 +2402,7 @@ int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
 
   /* Load the Image Position: this is a string of the form:
      x\y\z  */
-  e = GetElementFromFile(dcmfile, 0x20, 0x32);
+  e = GetElementFromObject(object, 0x20, 0x32);
   if (e == NULL) {
     return (1);
   }
@@ -2114,33 +2449,47 @@ int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
   -----------------------------------------------------------------------*/
 int sdcmSliceDirCos(const char *dcmfile, float *Vsx, float *Vsy, float *Vsz)
 {
-  char *tmpstr;
-  float rms;
+  char *header;
+  int err;
 
   if (!IsSiemensDICOM(dcmfile)) {
     return (1);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].sNormal.dSag", 0);
+  header = sdcmReadAsciiHeader(dcmfile);
+  err = sdcmSliceDirCosFromHeader(header, Vsx, Vsy, Vsz);
+  if (header) {
+    free(header);
+  }
+  sliceDirCosPresent = !err;
+
+  return (err);
+}
+/*----------------------------------------------------------*/
+static int sdcmSliceDirCosFromHeader(const char *header, float *Vsx, float *Vsy, float *Vsz)
+{
+  char *tmpstr;
+  float rms;
+
+  tmpstr = sdcmAsciiHeaderTag(header, "sSliceArray.asSlice[0].sNormal.dSag");
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%f", Vsx);
     free(tmpstr);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].sNormal.dCor", 0);
+  tmpstr = sdcmAsciiHeaderTag(header, "sSliceArray.asSlice[0].sNormal.dCor");
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%f", Vsy);
     free(tmpstr);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].sNormal.dTra", 0);
+  tmpstr = sdcmAsciiHeaderTag(header, "sSliceArray.asSlice[0].sNormal.dTra");
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%f", Vsz);
     free(tmpstr);
   }
 
   if (*Vsx == 0 && *Vsy == 0 && *Vsz == 0) {
-    sliceDirCosPresent = 0;
     return (1);
   }
 
@@ -2155,8 +2504,6 @@ int sdcmSliceDirCos(const char *dcmfile, float *Vsx, float *Vsy, float *Vsz)
   (*Vsy) /= rms;
   (*Vsz) /= rms;
 
-  sliceDirCosPresent = 1;
-
   return (0);
 }
 
@@ -2175,19 +2522,67 @@ int sdcmSliceDirCos(const char *dcmfile, float *Vsx, float *Vsy, float *Vsz)
   -----------------------------------------------------------------------*/
 int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, int *pNframes)
 {
+  DCM_OBJECT *object;
   DCM_ELEMENT *e;
-  char *PhEncDir;
-  int Nrows, Ncols;
+  char *PhEncDir = NULL, *header;
+  int Nrows, Ncols, VolResErr, IsMosaic;
   float ColRes, RowRes, SliceRes;
-  int NrowsExp, NcolsExp;
-  float PhEncFOV, ReadOutFOV;
-  int err, IsMosaic;
-  char *tmpstr;
 
   if (!IsSiemensDICOM(dcmfile)) {
     return (0);
   }
 
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  e = GetElementFromObject(&object, 0x18, 0x1312);
+  if (e != NULL) {
+    PhEncDir = deblank((char *)e->d.string);
+    FreeElementData(e);
+    free(e);
+  }
+  Nrows = dcmGetNRowsFromObject(&object);
+  Ncols = dcmGetNColsFromObject(&object);
+  VolResErr = dcmGetVolResFromObject(&object, &ColRes, &RowRes, &SliceRes);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  header = sdcmReadAsciiHeader(dcmfile);
+  IsMosaic =
+      sdcmIsMosaicFromInfo(PhEncDir, Nrows, Ncols, VolResErr, ColRes, RowRes, header, pNcols, pNrows, pNslices, pNframes);
+  if (header) {
+    free(header);
+  }
+  if (PhEncDir) {
+    free(PhEncDir);
+  }
+
+  return (IsMosaic);
+}
+/*-----------------------------------------------------------------------
+  sdcmIsMosaicFromInfo() - sdcmIsMosaic() given the phase encode
+  direction (NULL if absent), image size and resolution of the file
+  (VolResErr set if the resolution could not be had) and its ASCII
+  header.
+  -----------------------------------------------------------------------*/
+static int sdcmIsMosaicFromInfo(const char *PhEncDir,
+                                int Nrows,
+                                int Ncols,
+                                int VolResErr,
+                                float ColRes,
+                                float RowRes,
+                                const char *header,
+                                int *pNcols,
+                                int *pNrows,
+                                int *pNslices,
+                                int *pNframes)
+{
+  int NrowsExp, NcolsExp;
+  float PhEncFOV, ReadOutFOV;
+  int IsMosaic;
+  char *tmpstr;
+
   tmpstr = getenv("SDCM_ISMOSAIC_OVERRIDE");
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%d", &IsMosaic);
@@ -2197,42 +2592,33 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
 
   IsMosaic = 0;
 
-  /* Get the phase encode direction: should be COL or ROW */
+  /* The phase encode direction: should be COL or ROW */
   /* COL means that each row is a different phase encode (??)*/
-  e = GetElementFromFile(dcmfile, 0x18, 0x1312);
-  if (e == NULL) {
+  if (PhEncDir == NULL) {
     return (0);
   }
-  PhEncDir = deblank((char *)e->d.string);
-  FreeElementData(e);
-  free(e);
-
-  Nrows = dcmGetNRows(dcmfile);
   if (Nrows == -1) {
     return (0);
   }
-
-  Ncols = dcmGetNCols(dcmfile);
   if (Ncols == -1) {
     return (0);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dPhaseFOV", 0);
+  tmpstr = sdcmAsciiHeaderTag(header, "sSliceArray.asSlice[0].dPhaseFOV");
   if (tmpstr == NULL) {
     return (0);
   }
   sscanf(tmpstr, "%f", &PhEncFOV);
   free(tmpstr);
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dReadoutFOV", 0);
+  tmpstr = sdcmAsciiHeaderTag(header, "sSliceArray.asSlice[0].dReadoutFOV");
   if (tmpstr == NULL) {
     return (0);
   }
   sscanf(tmpstr, "%f", &ReadOutFOV);
   free(tmpstr);
 
-  err = dcmGetVolRes(dcmfile, &ColRes, &RowRes, &SliceRes);
-  if (err) {
+  if (VolResErr) {
     return (-1);
   }
 
@@ -2272,7 +2658,7 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
     if (pNslices != NULL) {
       tmpstr = getenv("NSLICES_OVERRIDE"); // was NSLICES_OVERRIDE_BCHWAUNIE
       if (tmpstr == NULL) {
-        tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.lSize", 0);
+        tmpstr = sdcmAsciiHeaderTag(header, "sSliceArray.lSize");
         if (tmpstr == NULL) {
           return (0);
         }
@@ -2285,7 +2671,7 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
       }
     }
     if (pNframes != NULL) {
-      tmpstr = SiemensAsciiTagEx(dcmfile, "lRepetitions", 0);
+      tmpstr = sdcmAsciiHeaderTag(header, "lRepetitions");
       if (tmpstr == NULL) {
         return (0);
       }
@@ -2294,204 +2680,328 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
       free(tmpstr);
     }
   }
-  free(PhEncDir);
 
   return (IsMosaic);
 }
 /*----------------------------------------------------------------
-  GetSDCMFileInfo() - this fills a SDCMFILEINFO structure for a
-  single Siemens DICOM file. Some of the data are filled from
-  the DICOM header and some from the Siemens ASCII header. The
-  pixel data are not loaded.
+  sdcmOpenObject() - GetObjectFromFile() without the IsDICOM() check
+  (which parses the whole file just to throw it away) and without
+  dumping the conditions, for files that may well not be dicom.
+  Returns NULL if the file cannot be opened as dicom. Not thread
+  safe, as nothing in the dicom library is.
   ----------------------------------------------------------------*/
-SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
+static DCM_OBJECT *sdcmOpenObject(const char *fname)
 {
+  static unsigned long const formats[4] = {
+      DCM_PART10FILE, DCM_ORDERLITTLEENDIAN, DCM_ORDERBIGENDIAN, DCM_FORMATCONVERSION};
+  CONDITION cond;
   DCM_OBJECT *object = 0;
-  SDCMFILEINFO *sdcmfi;
+  int n;
+
+  for (n = 0; n < 4; n++) {
+    cond = DCM_OpenFile(fname, formats[n] | DCM_ACCEPTVRMISMATCH, &object);
+    if (cond == DCM_NORMAL) {
+      return (object);
+    }
+    DCM_CloseObject(&object);
+    object = 0;
+  }
+  COND_PopCondition(1);
+  return (NULL);
+}
+/*----------------------------------------------------------------
+  sdcmParseFile() - does the work of GetSDCMFileInfo(), but parses
+  the dicom file only once and reads the ASCII header only once.
+  *status is set to SDCM_PARSE_OK, SDCM_PARSE_NOTSIEMENS (NULL is
+  returned) or SDCM_PARSE_ERROR (NULL is returned, the file could
+  not be used). If SeriesNo is not NULL it is set to the Series
+  Number of a file that could not be used, so that the caller can
+  tell which series it belongs to (-1 otherwise). The dicom library is not thread safe, so the part
+  that uses it is serialized; reading the ASCII header and
+  everything derived from it can be done by several threads at
+  once. Does not touch the sliceDirCosPresent global.
+  ----------------------------------------------------------------*/
+#define SDCM_PARSE_OK 0
+#define SDCM_PARSE_NOTSIEMENS 1
+#define SDCM_PARSE_ERROR 2
+static SDCMFILEINFO *sdcmParseFile(const char *dcmfile, int *status, int *SeriesNo)
+{
+  DCM_OBJECT *object = 0;
+  SDCMFILEINFO *sdcmfi = NULL;
   CONDITION cond;
   DCM_TAG tag;
   DCM_ELEMENT *e;
-  int l;
   unsigned short ustmp = 0;
   double dtmp = 0;
-  char *strtmp, *strtmp2, *pc;
-  int retval, nDiffDirections, nB0;
+  char *strtmp, *strtmp2, *pc, *header;
+  int retval, nDiffDirections, nB0, PhEncDirPresent = 0, VolResErr = 1;
   double xr, xa, xs, yr, ya, ys, zr, za, zs;
   int DoDWI;
 
-  if (!IsSiemensDICOM(dcmfile)) {
+  *status = SDCM_PARSE_NOTSIEMENS;
+  if (SeriesNo) {
+    *SeriesNo = -1;
+  }
+  if (fio_IsDirectory(dcmfile)) {
     return (NULL);
   }
 
-  sdcmfi = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
-
-  fflush(stdout);
-  fflush(stderr);
-  object = GetObjectFromFile(dcmfile, 0);
-  fflush(stdout);
-  fflush(stderr);
-  if (object == NULL) {
-    exit(1);
+  DoDWI = 1;
+  pc = getenv("FS_LOAD_DWI");
+  if (pc != NULL && strcmp(pc, "0") == 0) {
+    DoDWI = 0;
   }
 
-  l = strlen(dcmfile);
-  sdcmfi->FileName = (char *)calloc(l + 1, sizeof(char));
-  memmove(sdcmfi->FileName, dcmfile, l);
+  // Read the ASCII header first, outside of the critical section
+  header = sdcmReadAsciiHeader(dcmfile);
 
-  // This stores the 'Transfer Syntax Unique Identification',
-  // which reports the structure of the image data, revealing
-  // whether the data has been compressed. See:
-  // http://www.psychology.nottingham.ac.uk/staff/cr1/dicom.html
-  tag = DCM_MAKETAG(0x2, 0x10);
-  cond = GetString(&object, tag, &sdcmfi->TransferSyntaxUID);
+#ifdef HAVE_OPENMP
+  #pragma omp critical(sdcm_dcmlib)
+#endif
+  {
+    object = sdcmOpenObject(dcmfile);
+    if (object != NULL) {
+      e = GetElementFromObject(&object, 0x8, 0x70);
+      if (e == NULL) {
+        printf(
+            "WARNING: searching dicom file %s for "
+            "Manufacturer tag 0x8, 0x70\n",
+            dcmfile);
+        printf("WARNING: the result could be a mess.\n");
+      }
+      /* Siemens appears to add a space onto the end of their
+         Manufacturer string*/
+      else if (strcmp(e->d.string, "SIEMENS") == 0 || strcmp(e->d.string, "SIEMENS ") == 0) {
+        sdcmfi = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
+      }
+      if (e != NULL) {
+        FreeElementData(e);
+        free(e);
+      }
+    }
 
-  tag = DCM_MAKETAG(0x10, 0x10);
-  cond = GetString(&object, tag, &sdcmfi->PatientName);
+    if (sdcmfi != NULL) {
+      *status = SDCM_PARSE_OK;
+      sdcmfi->FileName = strcpyalloc(dcmfile);
 
-  tag = DCM_MAKETAG(0x8, 0x20);
-  cond = GetString(&object, tag, &sdcmfi->StudyDate);
+      // This stores the 'Transfer Syntax Unique Identification',
+      // which reports the structure of the image data, revealing
+      // whether the data has been compressed. See:
+      // http://www.psychology.nottingham.ac.uk/staff/cr1/dicom.html
+      tag = DCM_MAKETAG(0x2, 0x10);
+      cond = GetString(&object, tag, &sdcmfi->TransferSyntaxUID);
 
-  tag = DCM_MAKETAG(0x8, 0x30);
-  cond = GetString(&object, tag, &sdcmfi->StudyTime);
+      tag = DCM_MAKETAG(0x10, 0x10);
+      cond = GetString(&object, tag, &sdcmfi->PatientName);
 
-  tag = DCM_MAKETAG(0x8, 0x31);
-  cond = GetString(&object, tag, &sdcmfi->SeriesTime);
+      tag = DCM_MAKETAG(0x8, 0x20);
+      cond = GetString(&object, tag, &sdcmfi->StudyDate);
 
-  tag = DCM_MAKETAG(0x8, 0x32);
-  cond = GetString(&object, tag, &sdcmfi->AcquisitionTime);
+      tag = DCM_MAKETAG(0x8, 0x30);
+      cond = GetString(&object, tag, &sdcmfi->StudyTime);
 
-  tag = DCM_MAKETAG(0x8, 0x1090);
-  cond = GetString(&object, tag, &sdcmfi->ScannerModel);
+      tag = DCM_MAKETAG(0x8, 0x31);
+      cond = GetString(&object, tag, &sdcmfi->SeriesTime);
 
-  tag = DCM_MAKETAG(0x18, 0x1020);
-  cond = GetString(&object, tag, &sdcmfi->NumarisVer);
+      tag = DCM_MAKETAG(0x8, 0x32);
+      cond = GetString(&object, tag, &sdcmfi->AcquisitionTime);
 
-  tag = DCM_MAKETAG(0x18, 0x24);
-  cond = GetString(&object, tag, &sdcmfi->PulseSequence);
+      tag = DCM_MAKETAG(0x8, 0x1090);
+      cond = GetString(&object, tag, &sdcmfi->ScannerModel);
 
-  tag = DCM_MAKETAG(0x18, 0x1030);
-  cond = GetString(&object, tag, &sdcmfi->ProtocolName);
-  if (strlen(sdcmfi->ProtocolName) == 0) {
-    sdcmfi->ProtocolName = strcpyalloc("PROTOCOL_UNKOWN");
-  }
+      tag = DCM_MAKETAG(0x18, 0x1020);
+      cond = GetString(&object, tag, &sdcmfi->NumarisVer);
 
-  tag = DCM_MAKETAG(0x20, 0x11);
-  cond = GetUSFromString(&object, tag, &ustmp);
-  if (cond != DCM_NORMAL) {
-    printf("WARNING: No Series Number (20,11) found in %s\n", sdcmfi->FileName);
-    sdcmfi->ErrorFlag = 1;
-  }
-  sdcmfi->SeriesNo = (int)ustmp;
-  sdcmfi->RunNo = sdcmfi->SeriesNo - 1;
+      tag = DCM_MAKETAG(0x18, 0x24);
+      cond = GetString(&object, tag, &sdcmfi->PulseSequence);
 
-  tag = DCM_MAKETAG(0x20, 0x13);
-  cond = GetUSFromString(&object, tag, &ustmp);
-  if (cond != DCM_NORMAL) {
-    printf("WARNING: No Image Number (20,13) found in %s\n", sdcmfi->FileName);
-    sdcmfi->ErrorFlag = 1;
-  }
-  sdcmfi->ImageNo = (int)ustmp;
+      tag = DCM_MAKETAG(0x18, 0x1030);
+      cond = GetString(&object, tag, &sdcmfi->ProtocolName);
+      if (strlen(sdcmfi->ProtocolName) == 0) {
+        free(sdcmfi->ProtocolName);
+        sdcmfi->ProtocolName = strcpyalloc("PROTOCOL_UNKOWN");
+      }
 
-  sdcmfi->UseSliceScaleFactor = 0;
-  sdcmfi->SliceScaleFactor = 1;
-  if (getenv("FS_NO_SLICE_SCALE_FACTOR") == NULL) {
-    tag = DCM_MAKETAG(0x20, 0x4000);
-    cond = GetString(&object, tag, &strtmp);
-    if (cond == DCM_NORMAL) {
-      if (strncmp(strtmp, "Scale Factor", 12) == 0) {
-        sscanf(strtmp, "%*s %*s %lf", &sdcmfi->SliceScaleFactor);
-        // printf("Slice Scale Factor %lf\n",sdcmfi->SliceScaleFactor);
-        sdcmfi->UseSliceScaleFactor = 1;
+      tag = DCM_MAKETAG(0x20, 0x11);
+      cond = GetUSFromString(&object, tag, &ustmp);
+      if (cond != DCM_NORMAL) {
+        printf("WARNING: No Series Number (20,11) found in %s\n", sdcmfi->FileName);
+        sdcmfi->ErrorFlag = 1;
       }
-    }
-  }
+      sdcmfi->SeriesNo = (int)ustmp;
+      sdcmfi->RunNo = sdcmfi->SeriesNo - 1;
 
-  sdcmfi->RescaleIntercept = 0;
-  tag = DCM_MAKETAG(0x28, 0x1052);
-  cond = GetString(&object, tag, &strtmp);
-  if(cond == DCM_NORMAL) {
-    sscanf(strtmp, "%lf", &sdcmfi->RescaleIntercept);
-    free(strtmp);
-    if(sdcmfi->RescaleIntercept != 0.0 && Gdiag_no > 0)
-      printf("Info: %d RescaleIntercept = %lf \n",DCM_ImageNumber,sdcmfi->RescaleIntercept);
-  }
-  sdcmfi->RescaleSlope = 1.0;
-  tag = DCM_MAKETAG(0x28, 0x1053);
-  cond = GetString(&object, tag, &strtmp);
-  if(cond == DCM_NORMAL) {
-    sscanf(strtmp, "%lf", &sdcmfi->RescaleSlope);
-    free(strtmp);
-    if(sdcmfi->RescaleSlope != 1.0 && Gdiag_no > 0)
-      printf("Info: %d RescaleSlope = %lf \n",DCM_ImageNumber,sdcmfi->RescaleSlope);
-  }
-  //DCMcheckInterceptSlope(object);
+      tag = DCM_MAKETAG(0x20, 0x13);
+      cond = GetUSFromString(&object, tag, &ustmp);
+      if (cond != DCM_NORMAL) {
+        printf("WARNING: No Image Number (20,13) found in %s\n", sdcmfi->FileName);
+        sdcmfi->ErrorFlag = 1;
+      }
+      sdcmfi->ImageNo = (int)ustmp;
+
+      sdcmfi->UseSliceScaleFactor = 0;
+      sdcmfi->SliceScaleFactor = 1;
+      if (getenv("FS_NO_SLICE_SCALE_FACTOR") == NULL) {
+        tag = DCM_MAKETAG(0x20, 0x4000);
+        cond = GetString(&object, tag, &strtmp);
+        if (cond == DCM_NORMAL) {
+          if (strncmp(strtmp, "Scale Factor", 12) == 0) {
+            sscanf(strtmp, "%*s %*s %lf", &sdcmfi->SliceScaleFactor);
+            sdcmfi->UseSliceScaleFactor = 1;
+          }
+        }
+        free(strtmp);
+      }
 
-  tag = DCM_MAKETAG(0x18, 0x86);
-  cond = GetUSFromString(&object, tag, &ustmp);
-  sdcmfi->EchoNo = (int)ustmp;
+      sdcmfi->RescaleIntercept = 0;
+      tag = DCM_MAKETAG(0x28, 0x1052);
+      cond = GetString(&object, tag, &strtmp);
+      if (cond == DCM_NORMAL) {
+        sscanf(strtmp, "%lf", &sdcmfi->RescaleIntercept);
+        if (sdcmfi->RescaleIntercept != 0.0 && Gdiag_no > 0)
+          printf("Info: %d RescaleIntercept = %lf \n", DCM_ImageNumber, sdcmfi->RescaleIntercept);
+      }
+      free(strtmp);
+      sdcmfi->RescaleSlope = 1.0;
+      tag = DCM_MAKETAG(0x28, 0x1053);
+      cond = GetString(&object, tag, &strtmp);
+      if (cond == DCM_NORMAL) {
+        sscanf(strtmp, "%lf", &sdcmfi->RescaleSlope);
+        if (sdcmfi->RescaleSlope != 1.0 && Gdiag_no > 0)
+          printf("Info: %d RescaleSlope = %lf \n", DCM_ImageNumber, sdcmfi->RescaleSlope);
+      }
+      free(strtmp);
 
-  tag = DCM_MAKETAG(0x18, 0x1020);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
+      tag = DCM_MAKETAG(0x18, 0x86);
+      cond = GetUSFromString(&object, tag, &ustmp);
+      sdcmfi->EchoNo = (int)ustmp;
 
-  tag = DCM_MAKETAG(0x18, 0x1314);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
-  if (cond == DCM_NORMAL) {
-    sdcmfi->FlipAngle = (float)M_PI * dtmp / 180.0;
-  }
-  else {
-    sdcmfi->FlipAngle = 0;
-  }
+      tag = DCM_MAKETAG(0x18, 0x1314);
+      cond = GetDoubleFromString(&object, tag, &dtmp);
+      if (cond == DCM_NORMAL) {
+        sdcmfi->FlipAngle = (float)M_PI * dtmp / 180.0;
+      }
+      else {
+        sdcmfi->FlipAngle = 0;
+      }
 
-  tag = DCM_MAKETAG(0x18, 0x81);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
-  sdcmfi->EchoTime = (float)dtmp;
+      tag = DCM_MAKETAG(0x18, 0x81);
+      cond = GetDoubleFromString(&object, tag, &dtmp);
+      sdcmfi->EchoTime = (float)dtmp;
 
-  tag = DCM_MAKETAG(0x18, 0x87);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
-  sdcmfi->FieldStrength = (float)dtmp;
+      tag = DCM_MAKETAG(0x18, 0x87);
+      cond = GetDoubleFromString(&object, tag, &dtmp);
+      sdcmfi->FieldStrength = (float)dtmp;
 
-  tag = DCM_MAKETAG(0x18, 0x82);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
-  if (cond == DCM_NORMAL)
-    sdcmfi->InversionTime = (float)dtmp;
-  else
-    sdcmfi->InversionTime = -1;
+      tag = DCM_MAKETAG(0x18, 0x82);
+      cond = GetDoubleFromString(&object, tag, &dtmp);
+      if (cond == DCM_NORMAL)
+        sdcmfi->InversionTime = (float)dtmp;
+      else
+        sdcmfi->InversionTime = -1;
 
-  e = GetElementFromFile(dcmfile, 0x28, 0x107);
-  if (e)
-    sdcmfi->LargestValue = (float)*(e->d.us);
-  else
-    sdcmfi->LargestValue = 0;
+      e = GetElementFromObject(&object, 0x28, 0x107);
+      if (e) {
+        sdcmfi->LargestValue = (float)*(e->d.us);
+        FreeElementData(e);
+        free(e);
+      }
+      else
+        sdcmfi->LargestValue = 0;
+
+      /* Get the phase encode direction: should be COL or ROW */
+      /* COL means that each row is a different phase encode (??)*/
+      tag = DCM_MAKETAG(0x18, 0x1312);
+      cond = GetString(&object, tag, &strtmp);
+      PhEncDirPresent = (cond == DCM_NORMAL);
+      sdcmfi->PhEncDir = deblank(strtmp);
+      free(strtmp);
 
-  /* Get the phase encode direction: should be COL or ROW */
-  /* COL means that each row is a different phase encode (??)*/
-  // Phase Enc Dir (DNG)
-  tag = DCM_MAKETAG(0x18, 0x1312);
-  cond = GetString(&object, tag, &strtmp);
-  sdcmfi->PhEncDir = deblank(strtmp);
-  free(strtmp);
+      tag = DCM_MAKETAG(0x18, 0x80);
+      cond = GetDoubleFromString(&object, tag, &dtmp);
+      sdcmfi->RepetitionTime = (float)dtmp;
 
-  tag = DCM_MAKETAG(0x18, 0x80);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
-  sdcmfi->RepetitionTime = (float)dtmp;
+      sdcmfi->NImageRows = dcmGetNRowsFromObject(&object);
+      if (sdcmfi->NImageRows < 0) {
+        printf("WARNING: Could not determine number of image rows in %s\n", sdcmfi->FileName);
+        sdcmfi->ErrorFlag = 1;
+      }
+      sdcmfi->NImageCols = dcmGetNColsFromObject(&object);
+      if (sdcmfi->NImageCols < 0) {
+        printf("WARNING: Could not determine number of image cols in %s\n", sdcmfi->FileName);
+        sdcmfi->ErrorFlag = 1;
+      }
+
+      dcmImagePositionFromObject(&object, &(sdcmfi->ImgPos[0]), &(sdcmfi->ImgPos[1]), &(sdcmfi->ImgPos[2]));
+
+      dcmImageDirCosFromObject(&object,
+                               &(sdcmfi->Vc[0]),
+                               &(sdcmfi->Vc[1]),
+                               &(sdcmfi->Vc[2]),
+                               &(sdcmfi->Vr[0]),
+                               &(sdcmfi->Vr[1]),
+                               &(sdcmfi->Vr[2]));
+
+      VolResErr =
+          dcmGetVolResFromObject(&object, &(sdcmfi->VolRes[0]), &(sdcmfi->VolRes[1]), &(sdcmfi->VolRes[2]));
+
+      if (DoDWI) {
+        double bval, xbvec, ybvec, zbvec;
+        int err;
+        err = dcmGetDWIParams(object, &bval, &xbvec, &ybvec, &zbvec);
+        if (err) {
+          printf("ERROR: GetSDCMFileInfo(): dcmGetDWIParams() %d\n", err);
+          printf("DICOM File: %s\n", dcmfile);
+          printf("break %s:%d\n", __FILE__, __LINE__);
+          *status = SDCM_PARSE_ERROR;
+        }
+        else {
+          if (Gdiag_no > 0)
+            printf("GetSDCMFileInfo(): DWI: %s %d %lf %lf %lf %lf\n", dcmfile, err, bval, xbvec, ybvec, zbvec);
+          sdcmfi->bval = bval;
+          sdcmfi->bvecx = xbvec;
+          sdcmfi->bvecy = ybvec;
+          sdcmfi->bvecz = zbvec;
+        }
+      }
+    }
+
+    if (object != NULL) {
+      DCM_CloseObject(&object);
+    }
+
+    /* Clear the condition stack to prevent overflow */
+    COND_PopCondition(1);
+  }
+
+  if (*status != SDCM_PARSE_OK) {
+    if (sdcmfi) {
+      if (SeriesNo) {
+        *SeriesNo = sdcmfi->SeriesNo;
+      }
+      FreeSDCMFileInfo(&sdcmfi);
+    }
+    if (header) {
+      free(header);
+    }
+    return (NULL);
+  }
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "lRepetitions", 0);
+  // Everything else comes from the ASCII header
+  strtmp = sdcmAsciiHeaderTag(header, "lRepetitions");
   if (strtmp != NULL) {
     // This can cause problems with DTI scans if lRepetitions is actually set
     sscanf(strtmp, "%d", &(sdcmfi->lRepetitions));
     free(strtmp);
   }
   else {
-    strtmp = SiemensAsciiTag(dcmfile, "sDiffusion.lDiffDirections", 0);
-    strtmp2 = SiemensAsciiTag(dcmfile, "sWiPMemBlock.alFree[8]", 0);
+    strtmp = sdcmAsciiHeaderTag(header, "sDiffusion.lDiffDirections");
+    strtmp2 = sdcmAsciiHeaderTag(header, "sWiPMemBlock.alFree[8]");
     if (strtmp != NULL && strtmp2 != NULL) {
       sscanf(strtmp, "%d", &nDiffDirections);
       sscanf(strtmp, "%d", &nB0);
       sdcmfi->lRepetitions = nB0 + nDiffDirections - 1;
       DTIparsePulseSeqName(sdcmfi->PulseSequence, &sdcmfi->bValue, &sdcmfi->nthDirection);
-      // printf("nDiffDirections = %d, nB0 = %d\n",nDiffDirections,nB0);
-      // printf("%s %g %d\n",sdcmfi->PulseSequence,
-      //     sdcmfi->bValue, sdcmfi->nthDirection);
     }
     else {
       sdcmfi->lRepetitions = 0;
@@ -2506,7 +3016,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   sdcmfi->NFrames = sdcmfi->lRepetitions + 1;
   /* This is not the last word on NFrames. See sdfiAssignRunNo().*/
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "sSliceArray.lSize", 0);
+  strtmp = sdcmAsciiHeaderTag(header, "sSliceArray.lSize");
   if (strtmp != NULL) {
     sscanf(strtmp, "%d", &(sdcmfi->SliceArraylSize));
     free(strtmp);
@@ -2515,7 +3025,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     sdcmfi->SliceArraylSize = 0;
   }
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dPhaseFOV", 0);
+  strtmp = sdcmAsciiHeaderTag(header, "sSliceArray.asSlice[0].dPhaseFOV");
   if (strtmp != NULL) {
     sscanf(strtmp, "%f", &(sdcmfi->PhEncFOV));
     free(strtmp);
@@ -2524,7 +3034,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     sdcmfi->PhEncFOV = 0;
   }
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dReadoutFOV", 0);
+  strtmp = sdcmAsciiHeaderTag(header, "sSliceArray.asSlice[0].dReadoutFOV");
   if (strtmp != NULL) {
     sscanf(strtmp, "%f", &(sdcmfi->ReadoutFOV));
     free(strtmp);
@@ -2533,34 +3043,24 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     sdcmfi->ReadoutFOV = 0;
   }
 
-  sdcmfi->NImageRows = dcmGetNRows(dcmfile);
-  if (sdcmfi->NImageRows < 0) {
-    printf("WARNING: Could not determine number of image rows in %s\n", sdcmfi->FileName);
-    sdcmfi->ErrorFlag = 1;
-  }
-  sdcmfi->NImageCols = dcmGetNCols(dcmfile);
-  if (sdcmfi->NImageCols < 0) {
-    printf("WARNING: Could not determine number of image cols in %s\n", sdcmfi->FileName);
-    sdcmfi->ErrorFlag = 1;
-  }
-
-  dcmImagePosition(dcmfile, &(sdcmfi->ImgPos[0]), &(sdcmfi->ImgPos[1]), &(sdcmfi->ImgPos[2]));
-
-  dcmImageDirCos(dcmfile,
-                 &(sdcmfi->Vc[0]),
-                 &(sdcmfi->Vc[1]),
-                 &(sdcmfi->Vc[2]),
-                 &(sdcmfi->Vr[0]),
-                 &(sdcmfi->Vr[1]),
-                 &(sdcmfi->Vr[2]));
-
   /* The following may return 1 (Vs[i] = 0 for all i) when there is no
      ASCII header (anonymization?). This is a show-stopper for mosaics.
      For non-mosaics, it is recoverable because we can sort the files
      and compute the slice dir cos from the image position.*/
-  retval = sdcmSliceDirCos(dcmfile, &(sdcmfi->Vs[0]), &(sdcmfi->Vs[1]), &(sdcmfi->Vs[2]));
-
-  sdcmfi->IsMosaic = sdcmIsMosaic(dcmfile, NULL, NULL, NULL, NULL);
+  retval = sdcmSliceDirCosFromHeader(header, &(sdcmfi->Vs[0]), &(sdcmfi->Vs[1]), &(sdcmfi->Vs[2]));
+  sdcmfi->SliceDirCosPresent = !retval;
+
+  sdcmfi->IsMosaic = sdcmIsMosaicFromInfo(PhEncDirPresent ? sdcmfi->PhEncDir : NULL,
+                                          sdcmfi->NImageRows,
+                                          sdcmfi->NImageCols,
+                                          VolResErr,
+                                          sdcmfi->VolRes[0],
+                                          sdcmfi->VolRes[1],
+                                          header,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          NULL);
 
   /* If could not get sliceDirCos, then we calculate an initial value.
      This might not be used at all. If it is used, then it is only
@@ -2595,54 +3095,47 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     /* Confirm sign by two files later  */
   }
 
-  dcmGetVolRes(dcmfile, &(sdcmfi->VolRes[0]), &(sdcmfi->VolRes[1]), &(sdcmfi->VolRes[2]));
-
   if (sdcmfi->IsMosaic) {
-    sdcmIsMosaic(dcmfile, &(sdcmfi->VolDim[0]), &(sdcmfi->VolDim[1]), &(sdcmfi->VolDim[2]), &(sdcmfi->NFrames));
+    sdcmIsMosaicFromInfo(PhEncDirPresent ? sdcmfi->PhEncDir : NULL,
+                         sdcmfi->NImageRows,
+                         sdcmfi->NImageCols,
+                         VolResErr,
+                         sdcmfi->VolRes[0],
+                         sdcmfi->VolRes[1],
+                         header,
+                         &(sdcmfi->VolDim[0]),
+                         &(sdcmfi->VolDim[1]),
+                         &(sdcmfi->VolDim[2]),
+                         &(sdcmfi->NFrames));
   }
   else {
     sdcmfi->VolDim[0] = sdcmfi->NImageCols;
     sdcmfi->VolDim[1] = sdcmfi->NImageRows;
   }
 
-  DoDWI = 1;
-  pc = getenv("FS_LOAD_DWI");
-  if (pc == NULL)
-    DoDWI = 1;
-  else if (strcmp(pc, "0") == 0)
-    DoDWI = 0;
-
-  if (DoDWI) {
-    double bval, xbvec, ybvec, zbvec;
-    int err;
-    err = dcmGetDWIParams(object, &bval, &xbvec, &ybvec, &zbvec);
-    if (err) {
-      printf("ERROR: GetSDCMFileInfo(): dcmGetDWIParams() %d\n", err);
-      printf("DICOM File: %s\n", dcmfile);
-      printf("break %s:%d\n", __FILE__, __LINE__);
-      return (NULL);
-    }
-    if (Gdiag_no > 0)
-      printf("GetSDCMFileInfo(): DWI: %s %d %lf %lf %lf %lf\n", dcmfile, err, bval, xbvec, ybvec, zbvec);
-    sdcmfi->bval = bval;
-    sdcmfi->bvecx = xbvec;
-    sdcmfi->bvecy = ybvec;
-    sdcmfi->bvecz = zbvec;
+  if (header) {
+    free(header);
   }
-  else {
-    sdcmfi->bval = 0;
-    sdcmfi->bvecx = 0;
-    sdcmfi->bvecy = 0;
-    sdcmfi->bvecz = 0;
-  }
-
-  // cleanup Ascii storage
-  SiemensAsciiTagEx(dcmfile, (char *)0, 1);
 
-  cond = DCM_CloseObject(&object);
+  return (sdcmfi);
+}
+/*----------------------------------------------------------------
+  GetSDCMFileInfo() - this fills a SDCMFILEINFO structure for a
+  single Siemens DICOM file. Some of the data are filled from
+  the DICOM header and some from the Siemens ASCII header. The
+  pixel data are not loaded. Returns NULL if the file is not a
+  Siemens dicom file or its DWI parameters cannot be had.
+  ----------------------------------------------------------------*/
+SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
+{
+  SDCMFILEINFO *sdcmfi;
+  int status;
 
-  /* Clear the condition stack to prevent overflow */
-  COND_PopCondition(1);
+  sdcmfi = sdcmParseFile(dcmfile, &status, NULL);
+  if (sdcmfi == NULL) {
+    return (NULL);
+  }
+  sliceDirCosPresent = sdcmfi->SliceDirCosPresent;
 
   return (sdcmfi);
 }
@@ -2813,113 +3306,731 @@ char *sdcmExtractNumarisVer(const char *e_18_1020, int *Maj, int *Min, int *MinM
   return (ver);
 }
 /*--------------------------------------------------------------------
-  ScanSiemensDCMDir() - similar to ScanDir but returns only files that
-  are Siemens DICOM Files. It also returns a pointer to an array of
-  SDCMFILEINFO structures.
+  The on-disk directory index (see FS_DICOM_INDEX_CACHE in
+  DICOMRead.h). It is a text file. The first line gives the version
+  and a hash of the environment variables that change what is parsed
+  out of a file, the second the fields saved for each file. Then
+  there is one line per directory entry, tab separated: the base name,
+  its size and mtime, S (Siemens) or N (not), and, for S, the fields.
+  A NULL string is \N. The index is thrown away if the first two
+  lines do not match; an entry is used only if the size and mtime
+  still match.
+  *------------------------------------------------------------------*/
+#define SDCM_INDEX_VERSION 1
+#define SDCM_FLD_STR 0
+#define SDCM_FLD_INT 1
+#define SDCM_FLD_FLT 2
+#define SDCM_FLD_DBL 3
+typedef struct
+{
+  const char *name;
+  int type;
+  size_t offset;
+  int count;
+} SDCM_INDEX_FIELD;
+
+#define SDCM_FLD(TYPE, NAME, COUNT) \
+  { #NAME, TYPE, offsetof(SDCMFILEINFO, NAME), COUNT }
+static SDCM_INDEX_FIELD const sdcmIndexFields[] = {SDCM_FLD(SDCM_FLD_STR, PatientName, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, StudyDate, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, StudyTime, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, SeriesTime, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, AcquisitionTime, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, PulseSequence, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, ProtocolName, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, PhEncDir, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, NumarisVer, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, ScannerModel, 1),
+                                                   SDCM_FLD(SDCM_FLD_STR, TransferSyntaxUID, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, EchoNo, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, FlipAngle, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, EchoTime, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, RepetitionTime, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, InversionTime, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, FieldStrength, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, PhEncFOV, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, ReadoutFOV, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, SeriesNo, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, ImageNo, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, NImageRows, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, NImageCols, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, ImgPos, 3),
+                                                   SDCM_FLD(SDCM_FLD_INT, lRepetitions, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, SliceArraylSize, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, Vc, 3),
+                                                   SDCM_FLD(SDCM_FLD_FLT, Vr, 3),
+                                                   SDCM_FLD(SDCM_FLD_FLT, Vs, 3),
+                                                   SDCM_FLD(SDCM_FLD_INT, RunNo, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, IsMosaic, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, VolDim, 3),
+                                                   SDCM_FLD(SDCM_FLD_FLT, VolRes, 3),
+                                                   SDCM_FLD(SDCM_FLD_FLT, VolCenter, 3),
+                                                   SDCM_FLD(SDCM_FLD_INT, NFrames, 1),
+                                                   SDCM_FLD(SDCM_FLD_DBL, bValue, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, nthDirection, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, UseSliceScaleFactor, 1),
+                                                   SDCM_FLD(SDCM_FLD_DBL, SliceScaleFactor, 1),
+                                                   SDCM_FLD(SDCM_FLD_DBL, bval, 1),
+                                                   SDCM_FLD(SDCM_FLD_DBL, bvecx, 1),
+                                                   SDCM_FLD(SDCM_FLD_DBL, bvecy, 1),
+                                                   SDCM_FLD(SDCM_FLD_DBL, bvecz, 1),
+                                                   SDCM_FLD(SDCM_FLD_FLT, LargestValue, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, ErrorFlag, 1),
+                                                   SDCM_FLD(SDCM_FLD_INT, SliceDirCosPresent, 1),
+                                                   SDCM_FLD(SDCM_FLD_DBL, RescaleIntercept, 1),
+                                                   SDCM_FLD(SDCM_FLD_DBL, RescaleSlope, 1)};
+#undef SDCM_FLD
+#define SDCM_NINDEX_FIELDS (int)(sizeof(sdcmIndexFields) / sizeof(sdcmIndexFields[0]))
+
+typedef struct
+{
+  char *name;        // base name of the file
+  long long size;
+  long long mtime;
+  int status;        // SDCM_PARSE_OK, SDCM_PARSE_NOTSIEMENS or SDCM_PARSE_ERROR (never in the index file)
+  int SeriesNo;      // Series Number of a file that could not be read
+  SDCMFILEINFO *sdfi;
+} SDCM_INDEX_ENTRY;
 
-  Author: Douglas Greve.
-  Date: 09/10/2001
+/*--------------------------------------------------------------------
+  sdcmIndexSettings() - hash of the environment variables that change
+  what sdcmParseFile() gives, so that an index made with different
+  settings is not used.
   *------------------------------------------------------------------*/
-SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
+static unsigned long sdcmIndexSettings(void)
 {
-  struct dirent **NameList;
-  int i, pathlength;
-  int NFiles;
-  char tmpstr[1000];
-  SDCMFILEINFO **sdcmfi_list;
-  int pct, sumpct;
-  FILE *fp;
+  static const char *const vars[] = {"FS_LOAD_DWI",
+                                     "FS_NO_SLICE_SCALE_FACTOR",
+                                     "SDCM_ISMOSAIC_OVERRIDE",
+                                     "NROWS_OVERRIDE",
+                                     "NCOLS_OVERRIDE",
+                                     "NSLICES_OVERRIDE"};
+  unsigned long hash = fnv_init();
+  const char *val;
+  int n;
+
+  for (n = 0; n < (int)(sizeof(vars) / sizeof(vars[0])); n++) {
+    val = getenv(vars[n]);
+    if (val == NULL) {
+      val = "\001";
+    }
+    hash = fnv_add(hash, (const unsigned char *)val, strlen(val) + 1);
+  }
+  return (hash & 0xffffffffUL);
+}
+/*--------------------------------------------------------------------
+  sdcmIndexCacheName() - the index file for the dicom directory dir,
+  or 0 if FS_DICOM_INDEX_CACHE is not set.
+  *------------------------------------------------------------------*/
+static int sdcmIndexCacheName(const char *dir, char *fname)
+{
+  char const *cache = getenv("FS_DICOM_INDEX_CACHE");
+  char absdir[PATH_MAX];
+  unsigned long hash;
 
-  char *pname = (char *)calloc(strlen(PathName) + 1, sizeof(char));
-  strcpy(pname, PathName);
+  if (cache == NULL || cache[0] == 0 || !strcmp(cache, "0")) {
+    return (0);
+  }
 
-  /* Remove all trailing forward slashes from pname */
-  pathlength = strlen(pname);
-  if (pname[pathlength - 1] == '/') {
-    for (i = pathlength - 1; i >= 0; i--) {
-      if (pname[i] == '/') {
-        pname[i] = ' ';
+  if (fio_IsDirectory(cache)) {
+    if (realpath(dir, absdir) == NULL) {
+      strncpy(absdir, dir, PATH_MAX - 1);
+      absdir[PATH_MAX - 1] = 0;
+    }
+    hash = fnv_add(fnv_init(), (const unsigned char *)absdir, strlen(absdir));
+    snprintf(fname, STRLEN, "%s/sdcm.%08lx.index", cache, hash & 0xffffffffUL);
+  }
+  else {
+    snprintf(fname, STRLEN, "%s/.sdcm.index", dir);
+  }
+  return (1);
+}
+/*--------------------------------------------------------------------
+  sdcmIndexPutString() - writes a string field of the index, escaping
+  the chars that would break up the line.
+  *------------------------------------------------------------------*/
+static void sdcmIndexPutString(FILE *fp, const char *str)
+{
+  if (str == NULL) {
+    fputs("\\N", fp);
+    return;
+  }
+  for (; *str; str++) {
+    switch (*str) {
+      case '\\':
+        fputs("\\\\", fp);
+        break;
+      case '\t':
+        fputs("\\t", fp);
         break;
+      case '\n':
+        fputs("\\n", fp);
+        break;
+      case '\r':
+        fputs("\\r", fp);
+        break;
+      default:
+        fputc(*str, fp);
+    }
+  }
+}
+/*--------------------------------------------------------------------
+  sdcmIndexGetString() - undoes sdcmIndexPutString() for one tab
+  separated field, which is modified in place.
+  *------------------------------------------------------------------*/
+static char *sdcmIndexGetString(char *field)
+{
+  char *src, *dst;
+
+  if (strcmp(field, "\\N") == 0) {
+    return (NULL);
+  }
+  for (src = dst = field; *src; src++) {
+    if (*src == '\\' && src[1]) {
+      src++;
+      switch (*src) {
+        case 't':
+          *dst++ = '\t';
+          break;
+        case 'n':
+          *dst++ = '\n';
+          break;
+        case 'r':
+          *dst++ = '\r';
+          break;
+        default:
+          *dst++ = *src;
       }
     }
+    else {
+      *dst++ = *src;
+    }
   }
-  pathlength = strlen(pname);
+  *dst = 0;
+  return (strcpyalloc(field));
+}
+/*--------------------------------------------------------------------
+  sdcmIndexHeader() - writes the first two lines of the index
+  *------------------------------------------------------------------*/
+static void sdcmIndexHeader(FILE *fp)
+{
+  int f;
 
-  /* select all directory entries, and sort them by name */
-  NFiles = scandir(pname, &NameList, 0, alphasort);
+  fprintf(fp, "sdcm-index %d %08lx\n", SDCM_INDEX_VERSION, sdcmIndexSettings());
+  fprintf(fp, "fields");
+  for (f = 0; f < SDCM_NINDEX_FIELDS; f++) {
+    fprintf(fp, "\t%s", sdcmIndexFields[f].name);
+    if (sdcmIndexFields[f].count > 1) {
+      fprintf(fp, "[%d]", sdcmIndexFields[f].count);
+    }
+  }
+  fprintf(fp, "\n");
+}
+/*--------------------------------------------------------------------
+  sdcmIndexCompare() - for sorting and searching entries by name
+  *------------------------------------------------------------------*/
+static int sdcmIndexCompare(const void *a, const void *b)
+{
+  return (strcmp(((const SDCM_INDEX_ENTRY *)a)->name, ((const SDCM_INDEX_ENTRY *)b)->name));
+}
+/*--------------------------------------------------------------------
+  sdcmIndexRead() - reads the index file, giving its entries sorted
+  by name, with the FileName of each SDCMFILEINFO in dir. Returns
+  NULL (*nentries=0) if the index does not exist or cannot be used.
+  *------------------------------------------------------------------*/
+static SDCM_INDEX_ENTRY *sdcmIndexRead(const char *fname, const char *dir, int *nentries)
+{
+  FILE *fp, *hp;
+  char *line = NULL, *expected = NULL, *field, *save, *name;
+  size_t linecap = 0, expectedcap = 0;
+  ssize_t len;
+  SDCM_INDEX_ENTRY *entries = NULL, *e;
+  int nalloc = 0, ok = 1, f, c;
+  char tmpstr[STRLEN];
+  char *p;
+
+  *nentries = 0;
+  fp = fopen(fname, "r");
+  if (fp == NULL) {
+    return (NULL);
+  }
 
-  if (NFiles < 0) {
-    fprintf(stderr, "WARNING: No files found in %s\n", pname);
-    free(pname);
+  // The first two lines must be exactly what would be written now
+  hp = tmpfile();
+  if (hp == NULL) {
+    fclose(fp);
     return (NULL);
   }
-  fprintf(stderr, "INFO: Found %d files in %s\n", NFiles, pname);
+  sdcmIndexHeader(hp);
+  rewind(hp);
+  for (c = 0; c < 2 && ok; c++) {
+    if (getline(&line, &linecap, fp) < 0 || getline(&expected, &expectedcap, hp) < 0 || strcmp(line, expected) != 0) {
+      ok = 0;
+    }
+  }
+  fclose(hp);
+  free(expected);
 
-  /* Count the number of Siemens DICOM Files */
-  fprintf(stderr, "INFO: counting Siemens Files\n");
-  (*NSDCMFiles) = 0;
-  for (i = 0; i < NFiles; i++) {
-    sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      (*NSDCMFiles)++;
+  while (ok && (len = getline(&line, &linecap, fp)) > 0) {
+    if (line[len - 1] != '\n') {
+      ok = 0;  // truncated
+      break;
+    }
+    line[len - 1] = 0;
+    if (*nentries == nalloc) {
+      nalloc = nalloc ? 2 * nalloc : 256;
+      entries = (SDCM_INDEX_ENTRY *)realloc(entries, nalloc * sizeof(SDCM_INDEX_ENTRY));
+    }
+    e = &entries[*nentries];
+    memset(e, 0, sizeof(*e));
+
+    field = strtok_r(line, "\t", &save);
+    name = field ? sdcmIndexGetString(field) : NULL;
+    if (name == NULL) {
+      ok = 0;
+      break;
+    }
+    e->name = name;
+    (*nentries)++;
+    field = strtok_r(NULL, "\t", &save);
+    if (field == NULL || sscanf(field, "%lld", &e->size) != 1) {
+      ok = 0;
+      break;
+    }
+    field = strtok_r(NULL, "\t", &save);
+    if (field == NULL || sscanf(field, "%lld", &e->mtime) != 1) {
+      ok = 0;
+      break;
+    }
+    field = strtok_r(NULL, "\t", &save);
+    if (field == NULL || (strcmp(field, "S") != 0 && strcmp(field, "N") != 0)) {
+      ok = 0;
+      break;
+    }
+    if (field[0] == 'N') {
+      e->status = SDCM_PARSE_NOTSIEMENS;
+      continue;
+    }
+    e->status = SDCM_PARSE_OK;
+    e->sdfi = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
+    snprintf(tmpstr, STRLEN, "%s/%s", dir, e->name);
+    e->sdfi->FileName = strcpyalloc(tmpstr);
+    for (f = 0; f < SDCM_NINDEX_FIELDS && ok; f++) {
+      SDCM_INDEX_FIELD const *fld = &sdcmIndexFields[f];
+      p = (char *)e->sdfi + fld->offset;
+      for (c = 0; c < fld->count; c++) {
+        field = strtok_r(NULL, "\t", &save);
+        if (field == NULL) {
+          ok = 0;
+          break;
+        }
+        switch (fld->type) {
+          case SDCM_FLD_STR:
+            ((char **)p)[c] = sdcmIndexGetString(field);
+            break;
+          case SDCM_FLD_INT:
+            ok = (sscanf(field, "%d", &((int *)p)[c]) == 1);
+            break;
+          case SDCM_FLD_FLT:
+            ok = (sscanf(field, "%f", &((float *)p)[c]) == 1);
+            break;
+          case SDCM_FLD_DBL:
+            ok = (sscanf(field, "%lf", &((double *)p)[c]) == 1);
+            break;
+        }
+        if (!ok) {
+          break;
+        }
+      }
+    }
+    if (ok && strtok_r(NULL, "\t", &save) != NULL) {
+      ok = 0;
     }
   }
+  free(line);
+  fclose(fp);
 
-  fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
+  if (!ok) {
+    printf("INFO: ignoring dicom index %s\n", fname);
+    for (c = 0; c < *nentries; c++) {
+      free(entries[c].name);
+      if (entries[c].sdfi) {
+        FreeSDCMFileInfo(&entries[c].sdfi);
+      }
+    }
+    free(entries);
+    *nentries = 0;
+    return (NULL);
+  }
 
-  if (*NSDCMFiles == 0) {
-    free(pname);
+  if (*nentries > 0) {
+    qsort(entries, *nentries, sizeof(SDCM_INDEX_ENTRY), sdcmIndexCompare);
+  }
+  return (entries);
+}
+/*--------------------------------------------------------------------
+  sdcmIndexWrite() - writes the index to a temporary file and renames
+  it, so that a reader never sees a partial index. Failure to write is
+  not an error, the index is just not kept.
+  *------------------------------------------------------------------*/
+static int sdcmIndexWrite(const char *fname, SDCM_INDEX_ENTRY *entries, int nentries)
+{
+  char tmpname[STRLEN + 32];
+  FILE *fp;
+  int n, f, c, err;
+
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp.%d", fname, (int)getpid());
+  fp = fopen(tmpname, "w");
+  if (fp == NULL) {
+    return (1);
+  }
+  sdcmIndexHeader(fp);
+  for (n = 0; n < nentries; n++) {
+    SDCM_INDEX_ENTRY const *e = &entries[n];
+    sdcmIndexPutString(fp, e->name);
+    fprintf(fp, "\t%lld\t%lld\t%s", e->size, e->mtime, e->status == SDCM_PARSE_OK ? "S" : "N");
+    if (e->status == SDCM_PARSE_OK) {
+      for (f = 0; f < SDCM_NINDEX_FIELDS; f++) {
+        SDCM_INDEX_FIELD const *fld = &sdcmIndexFields[f];
+        const char *p = (const char *)e->sdfi + fld->offset;
+        for (c = 0; c < fld->count; c++) {
+          fputc('\t', fp);
+          switch (fld->type) {
+            case SDCM_FLD_STR:
+              sdcmIndexPutString(fp, ((char *const *)p)[c]);
+              break;
+            case SDCM_FLD_INT:
+              fprintf(fp, "%d", ((const int *)p)[c]);
+              break;
+            case SDCM_FLD_FLT:
+              fprintf(fp, "%.9g", ((const float *)p)[c]);
+              break;
+            case SDCM_FLD_DBL:
+              fprintf(fp, "%.17g", ((const double *)p)[c]);
+              break;
+          }
+        }
+      }
+    }
+    fputc('\n', fp);
+  }
+  err = ferror(fp);
+  if (fclose(fp) != 0 || err || rename(tmpname, fname) != 0) {
+    unlink(tmpname);
+    return (1);
+  }
+  return (0);
+}
+/*--------------------------------------------------------------------
+  sdcmIndexDir() - the SDCMFILEINFO of each Siemens DICOM file in the
+  directory, in file name order. Each file is parsed only once, and
+  the files are parsed in parallel. If FS_DICOM_INDEX_CACHE is set
+  the results are kept on disk and only the files that are new or
+  have changed since are parsed. Returns NULL if there are no Siemens
+  files or one of them could not be read. See sdcmIndexDirWkr().
+  *------------------------------------------------------------------*/
+static SDCMFILEINFO **sdcmIndexDirWkr(const char *PathName, int *NSDCMFiles, int **BadSeriesNos, int *nBad);
+
+SDCMFILEINFO **sdcmIndexDir(const char *PathName, int *NSDCMFiles)
+{
+  SDCMFILEINFO **sdcmfi_list;
+  int *BadSeriesNos, nBad, n;
+
+  sdcmfi_list = sdcmIndexDirWkr(PathName, NSDCMFiles, &BadSeriesNos, &nBad);
+  free(BadSeriesNos);
+  if (nBad > 0 && sdcmfi_list != NULL) {
+    for (n = 0; n < *NSDCMFiles; n++) {
+      FreeSDCMFileInfo(&sdcmfi_list[n]);
+    }
+    free(sdcmfi_list);
+    sdcmfi_list = NULL;
+    *NSDCMFiles = 0;
+  }
+  return (sdcmfi_list);
+}
+/*--------------------------------------------------------------------
+  sdcmIndexDirWkr() - does the work of sdcmIndexDir(), but returns
+  the files that could be read even if some could not. The Series
+  Numbers of the nBad files that could not be read are returned in
+  *BadSeriesNos (to be freed by the caller), so that a series can
+  still be loaded when the trouble is in other series.
+  *------------------------------------------------------------------*/
+static SDCMFILEINFO **sdcmIndexDirWkr(const char *PathName, int *NSDCMFiles, int **BadSeriesNos, int *nBad)
+{
+  struct dirent **NameList;
+  struct stat st;
+  SDCM_INDEX_ENTRY *entries, *cached, *found, key;
+  SDCMFILEINFO **sdcmfi_list;
+  int NFiles, nentries, ncached, nparse, ndone, *parselist;
+  int i, n, useCache, failed, sumpct, *bad;
+  char fname[STRLEN], cachename[STRLEN];
+  FILE *fp;
+
+  *NSDCMFiles = 0;
+  *BadSeriesNos = NULL;
+  *nBad = 0;
+
+  /* select all directory entries, and sort them by name */
+  NFiles = scandir(PathName, &NameList, 0, alphasort);
+  if (NFiles < 0) {
+    fprintf(stderr, "WARNING: No files found in %s\n", PathName);
     return (NULL);
   }
+  fprintf(stderr, "INFO: Found %d files in %s\n", NFiles, PathName);
 
-  sdcmfi_list = (SDCMFILEINFO **)calloc(*NSDCMFiles, sizeof(SDCMFILEINFO *));
+  /* Keep only the files, with their size and mtime */
+  entries = (SDCM_INDEX_ENTRY *)calloc(NFiles > 0 ? NFiles : 1, sizeof(SDCM_INDEX_ENTRY));
+  nentries = 0;
+  for (i = 0; i < NFiles; i++) {
+    snprintf(fname, STRLEN, "%s/%s", PathName, NameList[i]->d_name);
+    if (stat(fname, &st) == 0 && !S_ISDIR(st.st_mode)) {
+      entries[nentries].name = strcpyalloc(NameList[i]->d_name);
+      entries[nentries].size = (long long)st.st_size;
+      entries[nentries].mtime = (long long)st.st_mtime;
+      entries[nentries].status = -1;
+      entries[nentries].SeriesNo = -1;
+      nentries++;
+    }
+    free(NameList[i]);
+  }
+  free(NameList);
 
-  fprintf(stderr, "INFO: scanning info from Siemens Files\n");
+  /* Take what has not changed from the index */
+  useCache = sdcmIndexCacheName(PathName, cachename);
+  cached = NULL;
+  ncached = 0;
+  if (useCache) {
+    cached = sdcmIndexRead(cachename, PathName, &ncached);
+  }
+  parselist = (int *)calloc(nentries > 0 ? nentries : 1, sizeof(int));
+  nparse = 0;
+  for (i = 0; i < nentries; i++) {
+    found = NULL;
+    if (ncached > 0) {
+      key.name = entries[i].name;
+      found = (SDCM_INDEX_ENTRY *)bsearch(&key, cached, ncached, sizeof(SDCM_INDEX_ENTRY), sdcmIndexCompare);
+    }
+    if (found && found->size == entries[i].size && found->mtime == entries[i].mtime) {
+      entries[i].status = found->status;
+      entries[i].sdfi = found->sdfi;
+      found->sdfi = NULL;
+    }
+    else {
+      parselist[nparse++] = i;
+    }
+  }
+  for (i = 0; i < ncached; i++) {
+    free(cached[i].name);
+    if (cached[i].sdfi) {
+      FreeSDCMFileInfo(&cached[i].sdfi);
+    }
+  }
+  if (cached) {
+    free(cached);
+  }
+  if (useCache) {
+    fprintf(stderr, "INFO: %d files from index %s\n", nentries - nparse, cachename);
+  }
 
+  /* Parse the rest in parallel */
+  fprintf(stderr, "INFO: scanning info from %d files\n", nparse);
   if (SDCMStatusFile != NULL) {
     fprintf(stderr, "INFO: status file is %s\n", SDCMStatusFile);
   }
-
   fprintf(stderr, "%2d ", 0);
   sumpct = 0;
-  (*NSDCMFiles) = 0;
-  for (i = 0; i < NFiles; i++) {
-    // fprintf(stderr,"%4d ",i);
-    pct = rint(100 * (i + 1) / NFiles) - sumpct;
-    if (pct >= 2) {
-      sumpct += pct;
-      fprintf(stderr, "%3d ", sumpct);
-      fflush(stderr);
-      if (SDCMStatusFile != NULL) {
-        fp = fopen(SDCMStatusFile, "w");
-        if (fp != NULL) {
-          fprintf(fp, "%3d\n", sumpct);
-          fclose(fp);
+  ndone = 0;
+  failed = 0;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (n = 0; n < nparse; n++) {
+    ROMP_PFLB_begin
+    SDCM_INDEX_ENTRY *e = &entries[parselist[n]];
+    char path[STRLEN];
+    int status, pct;
+
+    snprintf(path, STRLEN, "%s/%s", PathName, e->name);
+    e->sdfi = sdcmParseFile(path, &status, &e->SeriesNo);
+    e->status = status;
+
+#ifdef HAVE_OPENMP
+    #pragma omp critical(sdcm_progress)
+#endif
+    {
+      if (status == SDCM_PARSE_ERROR) {
+        failed = 1;
+      }
+      ndone++;
+      pct = rint(100 * ndone / nparse) - sumpct;
+      if (pct >= 2) {
+        sumpct += pct;
+        fprintf(stderr, "%3d ", sumpct);
+        fflush(stderr);
+        if (SDCMStatusFile != NULL) {
+          fp = fopen(SDCMStatusFile, "w");
+          if (fp != NULL) {
+            fprintf(fp, "%3d\n", sumpct);
+            fclose(fp);
+          }
         }
       }
     }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  fprintf(stderr, "\n");
 
-    sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      sdcmfi_list[*NSDCMFiles] = GetSDCMFileInfo(tmpstr);
-      if (sdcmfi_list[*NSDCMFiles] == NULL) {
-        return (NULL);
-      }
+  if (useCache && nparse > 0 && !failed) {
+    if (sdcmIndexWrite(cachename, entries, nentries) == 0) {
+      fprintf(stderr, "INFO: wrote index %s\n", cachename);
+    }
+  }
+
+  /* Hand over the Siemens files in directory order, and the series of
+     the files that could not be read */
+  sdcmfi_list = NULL;
+  bad = (int *)calloc(nentries > 0 ? nentries : 1, sizeof(int));
+  for (i = 0; i < nentries; i++) {
+    if (entries[i].status == SDCM_PARSE_OK) {
       (*NSDCMFiles)++;
     }
+    else if (entries[i].status == SDCM_PARSE_ERROR) {
+      fprintf(stderr, "ERROR: could not read %s/%s (series %d)\n", PathName, entries[i].name, entries[i].SeriesNo);
+      bad[(*nBad)++] = entries[i].SeriesNo;
+    }
   }
-  fprintf(stderr, "\n");
+  *BadSeriesNos = bad;
+  fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
+  if (*NSDCMFiles > 0) {
+    sdcmfi_list = (SDCMFILEINFO **)calloc(*NSDCMFiles, sizeof(SDCMFILEINFO *));
+  }
+  n = 0;
+  for (i = 0; i < nentries; i++) {
+    if (entries[i].sdfi) {
+      if (sdcmfi_list) {
+        sdcmfi_list[n++] = entries[i].sdfi;
+      }
+      else {
+        FreeSDCMFileInfo(&entries[i].sdfi);
+      }
+    }
+    free(entries[i].name);
+  }
+  free(entries);
+  free(parselist);
 
-  // free memory
-  while (NFiles--) {
-    free(NameList[NFiles]);
+  if (sdcmfi_list == NULL) {
+    *NSDCMFiles = 0;
   }
-  free(NameList);
+  return (sdcmfi_list);
+}
+/*--------------------------------------------------------------------
+  ScanSiemensDCMDir() - similar to ScanDir but returns only files that
+  are Siemens DICOM Files. It also returns a pointer to an array of
+  SDCMFILEINFO structures. See sdcmIndexDir().
 
-  free(pname);
+  Author: Douglas Greve.
+  Date: 09/10/2001
+  *------------------------------------------------------------------*/
+SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
+{
+  SDCMFILEINFO **sdcmfi_list;
+  int pathlength;
+
+  char *pname = strcpyalloc(PathName);
 
+  /* Remove all trailing forward slashes from pname */
+  pathlength = strlen(pname);
+  while (pathlength > 1 && pname[pathlength - 1] == '/') {
+    pname[--pathlength] = 0;
+  }
+
+  sdcmfi_list = sdcmIndexDir(pname, NSDCMFiles);
+
+  free(pname);
   return (sdcmfi_list);
 }
+/*--------------------------------------------------------------------
+  ScanSiemensSeriesInfo() - the SDCMFILEINFO of each Siemens DICOM
+  file in the directory of dcmfile with the same Series Number as
+  dcmfile (including dcmfile), in file name order. This is what
+  LoadSiemensSeriesInfo(ScanSiemensSeries()) gives, but each file in
+  the directory is parsed only once (and maybe not at all, see
+  sdcmIndexDir()).
+  *------------------------------------------------------------------*/
+SDCMFILEINFO **ScanSiemensSeriesInfo(const char *dcmfile, int *nList)
+{
+  SDCMFILEINFO **sdfi_all, **sdfi_list;
+  char *dcmdir, *dcmbase, *fbase;
+  int nall, n, SeriesNo, *BadSeriesNos, nBad;
+
+  *nList = 0;
+  dcmdir = fio_dirname(dcmfile);
+  dcmbase = fio_basename(dcmfile, NULL);
+
+  sdfi_all = sdcmIndexDirWkr(dcmdir, &nall, &BadSeriesNos, &nBad);
+  if (sdfi_all == NULL) {
+    fprintf(stderr, "ERROR: no Siemens DICOM files read from %s\n", dcmdir);
+    free(BadSeriesNos);
+    free(dcmdir);
+    free(dcmbase);
+    return (NULL);
+  }
+
+  SeriesNo = -1;
+  for (n = 0; n < nall; n++) {
+    fbase = fio_basename(sdfi_all[n]->FileName, NULL);
+    if (strcmp(fbase, dcmbase) == 0) {
+      SeriesNo = sdfi_all[n]->SeriesNo;
+    }
+    free(fbase);
+    if (SeriesNo != -1) {
+      break;
+    }
+  }
+  if (n == nall) {
+    fprintf(stderr, "ERROR: %s is not a Siemens DICOM File\n", dcmfile);
+  }
+  else {
+    // Files of other series that could not be read do not matter
+    for (n = 0; n < nBad; n++) {
+      if (BadSeriesNos[n] == SeriesNo) {
+        fprintf(stderr, "ERROR: could not read all the files of series %d\n", SeriesNo);
+        SeriesNo = -1;
+        break;
+      }
+    }
+  }
+  free(BadSeriesNos);
+  if (SeriesNo == -1) {
+    for (n = 0; n < nall; n++) {
+      FreeSDCMFileInfo(&sdfi_all[n]);
+    }
+    free(sdfi_all);
+    free(dcmdir);
+    free(dcmbase);
+    return (NULL);
+  }
+
+  sdfi_list = (SDCMFILEINFO **)calloc(nall, sizeof(SDCMFILEINFO *));
+  for (n = 0; n < nall; n++) {
+    if (sdfi_all[n]->SeriesNo == SeriesNo) {
+      sdfi_list[(*nList)++] = sdfi_all[n];
+    }
+    else {
+      FreeSDCMFileInfo(&sdfi_all[n]);
+    }
+  }
+  fprintf(stderr, "INFO: found %d files in series\n", *nList);
+
+  free(sdfi_all);
+  free(dcmdir);
+  free(dcmbase);
+  return (sdfi_list);
+}
 /*--------------------------------------------------------------------
   LoadSiemensSeriesInfo() - loads header info from each of the nList
   files listed in SeriesList. This list is obtained from either
@@ -331,6 +331,96 @@ LABEL *annotation2label(int annotid, MRIS *Surf)
   return (label);
 }
 
+/*------------------------------------------------------------
+  MRISannotation2labels() - converts all of an annotation into
+  labels in one pass over the surface, rather than one pass per
+  label as annotation2label() does. Returns an array of *pnlabels
+  labels indexed by color table index (NULL where no vertex has
+  that index), which the caller frees along with the labels.
+------------------------------------------------------------*/
+LABEL **MRISannotation2labels(MRIS *Surf, int *pnlabels)
+{
+  int vtxno, annot, vtxannotid, lastannot, lastid, nlabels, n;
+  int *annotid, *npoints;
+  VERTEX *vtx;
+  LABEL **labels;
+
+  // the index of each vertex, looking each run of one annotation up once
+  annotid = (int *)calloc(Surf->nvertices + 1, sizeof(int));
+  if (!annotid) ErrorExit(ERROR_NOMEMORY, "MRISannotation2labels: could not allocate");
+  nlabels = Surf->ct ? Surf->ct->nentries : 0;
+  lastannot = lastid = -1;
+  for (vtxno = 0; vtxno < Surf->nvertices; vtxno++) {
+    annot = Surf->vertices[vtxno].annotation;
+    if (vtxno == 0 || annot != lastannot) {
+      if (Surf->ct)
+        CTABfindAnnotation(Surf->ct, annot, &lastid);
+      else
+        lastid = annotation_to_index(annot);
+      lastannot = annot;
+    }
+    annotid[vtxno] = lastid;
+    if (lastid >= nlabels) nlabels = lastid + 1;
+  }
+
+  npoints = (int *)calloc(nlabels + 1, sizeof(int));
+  labels = (LABEL **)calloc(nlabels + 1, sizeof(LABEL *));
+  if (!npoints || !labels) ErrorExit(ERROR_NOMEMORY, "MRISannotation2labels: could not allocate");
+  for (vtxno = 0; vtxno < Surf->nvertices; vtxno++)
+    if (annotid[vtxno] >= 0) npoints[annotid[vtxno]]++;
+  for (n = 0; n < nlabels; n++) {
+    if (npoints[n] == 0) continue;
+    labels[n] = LabelAlloc(npoints[n], NULL, "");
+    if (Surf->ct && Surf->ct->entries[n]) strcpy(labels[n]->name, Surf->ct->entries[n]->name);
+  }
+
+  for (vtxno = 0; vtxno < Surf->nvertices; vtxno++) {
+    vtxannotid = annotid[vtxno];
+    if (vtxannotid < 0) continue;
+    vtx = &(Surf->vertices[vtxno]);
+    n = labels[vtxannotid]->n_points++;
+    labels[vtxannotid]->lv[n].vno = vtxno;
+    labels[vtxannotid]->lv[n].x = vtx->x;
+    labels[vtxannotid]->lv[n].y = vtx->y;
+    labels[vtxannotid]->lv[n].z = vtx->z;
+  }
+
+  free(annotid);
+  free(npoints);
+  *pnlabels = nlabels;
+  return (labels);
+}
+
+/*------------------------------------------------------------
+  MRISlabels2annotation() - the reverse of MRISannotation2labels():
+  sets the annotation of the vertices of labels[n] to the annotation
+  of color table index n. Where labels overlap the later one wins.
+  Vertices that aren't in any label are left alone.
+------------------------------------------------------------*/
+int MRISlabels2annotation(MRIS *Surf, LABEL **labels, int nlabels)
+{
+  int n, k, vtxno, annot;
+  LABEL *label;
+
+  for (n = 0; n < nlabels; n++) {
+    label = labels[n];
+    if (label == NULL) continue;
+    if (Surf->ct) {
+      if (CTABannotationAtIndex(Surf->ct, n, &annot) != NO_ERROR)
+        ErrorReturn(ERROR_BADPARM,
+                    (ERROR_BADPARM, "MRISlabels2annotation: no color table entry %d for label %s", n, label->name));
+    }
+    else
+      annot = index_to_annotation(n);
+    for (k = 0; k < label->n_points; k++) {
+      vtxno = label->lv[k].vno;
+      if (label->lv[k].deleted || vtxno < 0 || vtxno >= Surf->nvertices) continue;
+      Surf->vertices[vtxno].annotation = annot;
+    }
+  }
+  return (NO_ERROR);
+}
+
 int set_atable_from_ctable(COLOR_TABLE *pct)
 {
   CTE *cte;
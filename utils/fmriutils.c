@@ -49,6 +49,7 @@ double round(double x);
 #include "numerics.h"
 #include "pdf.h"
 #include "randomfields.h"
+#include "romp_support.h"
 #include "sig.h"
 #include "utils.h"
 #include "volcluster.h"
@@ -905,6 +906,384 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
   return (wn);
 }
 
+/*---------------------------------------------------------------------
+  Batched GLM. When the design matrix is the same at every voxel (no
+  per-voxel weights or regressors, no frame mask, no fixed effects), the
+  voxels do not need to be fit one at a time through GLMfit()/GLMtest().
+  Instead the data of a block of voxels is loaded as an nframes-by-nvox
+  matrix Y and
+     beta = inv(X'*X)*X' * Y
+     yhat = X*beta, eres = Y - yhat, rvar = sum(eres.^2)/dof
+  are computed with matrix-matrix products, then the contrasts are
+  tested on the block, all using matrices that are computed only once
+  (GLMBATCH). Blocks are processed in parallel. Set FS_GLM_BATCH to 0 to
+  force the voxel-by-voxel code.
+  --------------------------------------------------------------------*/
+#define GLM_BATCH_NVOX 128  // voxels per block
+
+/* C = A*B where A is m-by-k, B is k-by-n, all row-major */
+static void glmBatchMultiply(const double *A, const double *B, double *C, int m, int k, int n)
+{
+  int i, l, j;
+  double a;
+  const double *b;
+  double *c;
+
+  for (i = 0; i < m; i++) {
+    c = &C[(size_t)i * n];
+    for (j = 0; j < n; j++) c[j] = 0;
+    for (l = 0; l < k; l++) {
+      a = A[(size_t)i * k + l];
+      if (a == 0) continue;
+      b = &B[(size_t)l * n];
+      for (j = 0; j < n; j++) c[j] += a * b[j];
+    }
+  }
+}
+
+/* copies a MATRIX into a new row-major array */
+static double *glmBatchArray(MATRIX *M)
+{
+  int r, c;
+  double *a;
+
+  a = (double *)calloc((size_t)M->rows * M->cols, sizeof(double));
+  for (r = 0; r < M->rows; r++)
+    for (c = 0; c < M->cols; c++) a[(size_t)r * M->cols + c] = M->rptr[r + 1][c + 1];
+  return (a);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmCanBatch() - returns 1 if the GLM can be fit and tested in
+  batches, ie, the design is the same at all voxels (see above).
+  --------------------------------------------------------------------*/
+int MRIglmCanBatch(MRIGLM *mriglm)
+{
+  int n;
+  char *env;
+
+  env = getenv("FS_GLM_BATCH");
+  if (env != NULL && strcmp(env, "0") == 0) return (0);
+  if (mriglm->w != NULL || mriglm->npvr != 0 || mriglm->FrameMask != NULL || mriglm->yffxvar != NULL) return (0);
+  for (n = 0; n < mriglm->glm->ncontrasts; n++)
+    if (mriglm->glm->ypmfflag[n]) return (0);
+  return (1);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmBatchAlloc() - loads the (weighted) global design into glm->X,
+  computes the X matrices, and builds the list of voxels in the mask
+  and the matrices shared by all the voxels. If the design is
+  ill-conditioned (glm->ill_cond_flag), only the voxel list is built.
+  GLMcMatrices() must have been run. Only call when MRIglmCanBatch().
+  --------------------------------------------------------------------*/
+GLMBATCH *MRIglmBatchAlloc(MRIGLM *mriglm, int DoTest)
+{
+  GLMMAT *glm = mriglm->glm;
+  GLMBATCH *gb;
+  int nc, nr, ns, c, r, s, f, n;
+  MATRIX *PM, *iM;
+  float Xcond = 0;
+
+  nc = mriglm->y->width;
+  nr = mriglm->y->height;
+  ns = mriglm->y->depth;
+
+  gb = (GLMBATCH *)calloc(1, sizeof(GLMBATCH));
+  gb->nf = mriglm->y->nframes;
+  gb->nreg = mriglm->Xg->cols;
+
+  // X = wg.*Xg, the same at every voxel
+  for (f = 1; f <= gb->nf; f++)
+    for (n = 1; n <= gb->nreg; n++) {
+      glm->X->rptr[f][n] = mriglm->Xg->rptr[f][n];
+      if (mriglm->wg != NULL && !mriglm->skipweight) glm->X->rptr[f][n] *= mriglm->wg->rptr[f][1];
+    }
+  mriglm->XgLoaded = 1;
+  GLMxMatrices(glm);
+  if (mriglm->condsave) Xcond = MatrixConditionNumber(glm->XtX);
+
+  // list of voxels in the mask
+  gb->vc = (int *)calloc((size_t)nc * nr * ns, sizeof(int));
+  gb->vr = (int *)calloc((size_t)nc * nr * ns, sizeof(int));
+  gb->vs = (int *)calloc((size_t)nc * nr * ns, sizeof(int));
+  for (c = 0; c < nc; c++) {
+    for (r = 0; r < nr; r++) {
+      for (s = 0; s < ns; s++) {
+        if (mriglm->mask != NULL && MRIgetVoxVal(mriglm->mask, c, r, s, 0) < 0.5) continue;
+        if (mriglm->condsave) MRIsetVoxVal(mriglm->cond, c, r, s, 0, Xcond);
+        gb->vc[gb->nvox] = c;
+        gb->vr[gb->nvox] = r;
+        gb->vs[gb->nvox] = s;
+        gb->nvox++;
+      }
+    }
+  }
+  gb->nblocks = (gb->nvox + GLM_BATCH_NVOX - 1) / GLM_BATCH_NVOX;
+  if (glm->ill_cond_flag) return (gb);
+
+  gb->X = glmBatchArray(glm->X);
+  PM = MatrixMultiplyD(glm->iXtX, glm->Xt, NULL);  // beta = P*y
+  gb->P = glmBatchArray(PM);
+  MatrixFree(&PM);
+  gb->ncontrasts = glm->ncontrasts;
+  gb->C = (double **)calloc(glm->ncontrasts + 1, sizeof(double *));
+  gb->iCVM = (double **)calloc(glm->ncontrasts + 1, sizeof(double *));
+  gb->Q = (double **)calloc(glm->ncontrasts + 1, sizeof(double *));
+  gb->a = (double **)calloc(glm->ncontrasts + 1, sizeof(double *));
+  gb->bsum = (double **)calloc(glm->ncontrasts + 1, sizeof(double *));
+  gb->CVM = (double *)calloc(glm->ncontrasts + 1, sizeof(double));
+  for (n = 0; DoTest && n < glm->ncontrasts; n++) {
+    gb->C[n] = glmBatchArray(glm->C[n]);
+    gb->CVM[n] = glm->CiXtXCt[n]->rptr[1][1];
+    iM = MatrixInverse(glm->CiXtXCt[n], NULL);
+    if (iM != NULL) {
+      gb->iCVM[n] = glmBatchArray(iM);
+      MatrixFree(&iM);
+    }
+    if (glm->DoPCC && glm->C[n]->rows == 1 && glm->Dt[n] != NULL) {
+      // pcc needs Xcd'*yhatd, sum(yhatd) and sum(yhatd.^2) where
+      // yhatd = RD*yhat = (RD*X)*beta, all of which are linear or
+      // quadratic in beta
+      MATRIX *RDXm, *RDXt, *Qm, *am, *ones, *bm;
+      RDXm = MatrixMultiplyD(glm->RD[n], glm->X, NULL);
+      RDXt = MatrixTranspose(RDXm, NULL);
+      Qm = MatrixMultiplyD(RDXt, RDXm, NULL);
+      am = MatrixMultiplyD(glm->Xcdt[n], RDXm, NULL);
+      ones = MatrixConstVal(1.0, 1, gb->nf, NULL);
+      bm = MatrixMultiplyD(ones, RDXm, NULL);
+      gb->Q[n] = glmBatchArray(Qm);
+      gb->a[n] = glmBatchArray(am);
+      gb->bsum[n] = glmBatchArray(bm);
+      MatrixFree(&RDXm);
+      MatrixFree(&RDXt);
+      MatrixFree(&Qm);
+      MatrixFree(&am);
+      MatrixFree(&ones);
+      MatrixFree(&bm);
+    }
+  }
+  return (gb);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmBatchFree() - frees a GLMBATCH and sets the pointer to NULL.
+  --------------------------------------------------------------------*/
+int MRIglmBatchFree(GLMBATCH **pgb)
+{
+  GLMBATCH *gb = *pgb;
+  int n;
+
+  for (n = 0; n < gb->ncontrasts; n++) {
+    if (gb->C[n]) free(gb->C[n]);
+    if (gb->iCVM[n]) free(gb->iCVM[n]);
+    if (gb->Q[n]) free(gb->Q[n]);
+    if (gb->a[n]) free(gb->a[n]);
+    if (gb->bsum[n]) free(gb->bsum[n]);
+  }
+  if (gb->C) free(gb->C);
+  if (gb->iCVM) free(gb->iCVM);
+  if (gb->Q) free(gb->Q);
+  if (gb->a) free(gb->a);
+  if (gb->bsum) free(gb->bsum);
+  if (gb->CVM) free(gb->CVM);
+  if (gb->X) free(gb->X);
+  if (gb->P) free(gb->P);
+  free(gb->vc);
+  free(gb->vr);
+  free(gb->vs);
+  free(gb);
+  *pgb = NULL;
+  return (0);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmBatchBlock() - fits (DoFit) and/or tests (DoTest) the nthblock
+  block of voxels of the GLMBATCH. When fitting, frame k of the design
+  is fit to frame yperm[k] of the input multiplied by ysign[k]; either
+  can be NULL. This is how permutations are run without changing X.
+  Only the outputs that are non-NULL in mriglm are written, so callers
+  (eg, simulations) can leave out the ones they do not need. Blocks
+  can be run concurrently as long as the outputs are not shared.
+  --------------------------------------------------------------------*/
+int MRIglmBatchBlock(MRIGLM *mriglm, GLMBATCH *gb, int nthblock, int DoFit, int DoTest, int *yperm, double *ysign)
+{
+  GLMMAT *glm = mriglm->glm;
+  int nf = gb->nf, nreg = gb->nreg;
+  int v, v0, nv, k, j, J, jj, vc0, vr0, vs0, con;
+  double *Y, *beta, *yhat, *rvar, *gamma, val, dtmp, F, p, z, gbv, sumyhatd, sumyhatd2, pcc;
+
+  v0 = nthblock * GLM_BATCH_NVOX;
+  nv = MIN(GLM_BATCH_NVOX, gb->nvox - v0);
+  J = 1;
+  for (con = 0; con < glm->ncontrasts; con++) J = MAX(J, glm->C[con]->rows);
+  Y = (double *)calloc((size_t)nf * nv, sizeof(double));
+  beta = (double *)calloc((size_t)nreg * nv, sizeof(double));
+  yhat = (double *)calloc((size_t)nf * nv, sizeof(double));
+  rvar = (double *)calloc(nv, sizeof(double));
+  gamma = (double *)calloc((size_t)J * nv, sizeof(double));
+
+  if (DoFit) {
+    // Y is nf-by-nv, weighted the same way as X
+    for (k = 0; k < nf; k++) {
+      for (v = 0; v < nv; v++) {
+        val = MRIgetVoxVal(mriglm->y, gb->vc[v0 + v], gb->vr[v0 + v], gb->vs[v0 + v], yperm ? yperm[k] : k);
+        if (ysign) val *= ysign[k];
+        if (mriglm->wg != NULL && !mriglm->skipweight) val *= mriglm->wg->rptr[k + 1][1];
+        Y[(size_t)k * nv + v] = val;
+      }
+    }
+    glmBatchMultiply(gb->P, Y, beta, nreg, nf, nv);
+    glmBatchMultiply(gb->X, beta, yhat, nf, nreg, nv);
+    for (k = 0; k < nf; k++) {
+      for (v = 0; v < nv; v++) {
+        // Y becomes eres
+        Y[(size_t)k * nv + v] -= yhat[(size_t)k * nv + v];
+        rvar[v] += Y[(size_t)k * nv + v] * Y[(size_t)k * nv + v];
+      }
+    }
+    for (v = 0; v < nv; v++) {
+      rvar[v] /= glm->dof;
+      // What to do when rvar=0? Set to FLT_MIN. See GLMfit().
+      if (rvar[v] < FLT_MIN) rvar[v] = FLT_MIN;
+      vc0 = gb->vc[v0 + v];
+      vr0 = gb->vr[v0 + v];
+      vs0 = gb->vs[v0 + v];
+      if (mriglm->rvar) MRIsetVoxVal(mriglm->rvar, vc0, vr0, vs0, 0, rvar[v]);
+      if (mriglm->beta)
+        for (k = 0; k < nreg; k++) MRIsetVoxVal(mriglm->beta, vc0, vr0, vs0, k, beta[(size_t)k * nv + v]);
+      for (k = 0; k < nf; k++) {
+        if (mriglm->eres) MRIsetVoxVal(mriglm->eres, vc0, vr0, vs0, k, Y[(size_t)k * nv + v]);
+        if (mriglm->yhatsave && mriglm->yhat)
+          MRIsetVoxVal(mriglm->yhat, vc0, vr0, vs0, k, yhat[(size_t)k * nv + v]);
+      }
+    }
+  }
+  else {
+    for (v = 0; v < nv; v++) {
+      vc0 = gb->vc[v0 + v];
+      vr0 = gb->vr[v0 + v];
+      vs0 = gb->vs[v0 + v];
+      for (k = 0; k < nreg; k++) beta[(size_t)k * nv + v] = MRIgetVoxVal(mriglm->beta, vc0, vr0, vs0, k);
+      rvar[v] = MRIgetVoxVal(mriglm->rvar, vc0, vr0, vs0, 0);
+    }
+  }
+
+  for (con = 0; DoTest && con < glm->ncontrasts; con++) {
+    J = glm->C[con]->rows;
+    // gamma = C*beta (J-by-nv)
+    glmBatchMultiply(gb->C[con], beta, gamma, J, nreg, nv);
+    if (glm->UseGamma0[con])
+      for (j = 0; j < J; j++)
+        for (v = 0; v < nv; v++) gamma[(size_t)j * nv + v] -= glm->gamma0[con]->rptr[j + 1][1];
+
+    for (v = 0; v < nv; v++) {
+      vc0 = gb->vc[v0 + v];
+      vr0 = gb->vr[v0 + v];
+      vs0 = gb->vs[v0 + v];
+      // Error trap for when rvar==0, as in GLMtest()
+      if (rvar[v] < 2 * FLT_MIN)
+        dtmp = 1e10 * J;
+      else
+        dtmp = rvar[v] * J;
+      F = 0;
+      p = 1;
+      z = 0;
+      pcc = 0;
+      if (gb->iCVM[con] != NULL && rvar[v] > FLT_MIN) {
+        // F = gamma' * inv(C*inv(X'*X)*C') * gamma / (rvar*J)
+        for (j = 0; j < J; j++) {
+          gbv = 0;
+          for (jj = 0; jj < J; jj++) gbv += gb->iCVM[con][j * J + jj] * gamma[(size_t)jj * nv + v];
+          F += gamma[(size_t)j * nv + v] * gbv;
+        }
+        F /= dtmp;
+        p = sc_cdf_fdist_Q(F, J, glm->dof);
+        z = sc_cdf_gaussian_Qinv(p / 2.0, 1);
+        if (J == 1 && gamma[v] < 0) z *= -1;
+        if (gb->Q[con] != NULL) {
+          gbv = 0;
+          sumyhatd = 0;
+          sumyhatd2 = 0;
+          for (k = 0; k < nreg; k++) {
+            double bk = beta[(size_t)k * nv + v];
+            gbv += gb->a[con][k] * bk;
+            sumyhatd += gb->bsum[con][k] * bk;
+            for (j = 0; j < nreg; j++) sumyhatd2 += bk * gb->Q[con][k * nreg + j] * beta[(size_t)j * nv + v];
+          }
+          sumyhatd2 += glm->dof * rvar[v];
+          pcc = (gbv - glm->sumXcd[con]->rptr[1][1] * sumyhatd) /
+                sqrt((glm->sumXcd2[con]->rptr[1][1] - glm->sumXcd[con]->rptr[1][1] * glm->sumXcd[con]->rptr[1][1]) *
+                     (sumyhatd2 - sumyhatd * sumyhatd));
+        }
+      }
+      if (mriglm->gamma[con])
+        for (j = 0; j < J; j++) MRIsetVoxVal(mriglm->gamma[con], vc0, vr0, vs0, j, gamma[(size_t)j * nv + v]);
+      if (J == 1) {
+        if (mriglm->gammaVar[con]) MRIsetVoxVal(mriglm->gammaVar[con], vc0, vr0, vs0, 0, gb->CVM[con] * dtmp);
+        if (glm->DoPCC && mriglm->pcc[con]) MRIsetVoxVal(mriglm->pcc[con], vc0, vr0, vs0, 0, pcc);
+      }
+      if (mriglm->F[con]) MRIsetVoxVal(mriglm->F[con], vc0, vr0, vs0, 0, F);
+      if (mriglm->p[con]) MRIsetVoxVal(mriglm->p[con], vc0, vr0, vs0, 0, p);
+      if (mriglm->z[con]) MRIsetVoxVal(mriglm->z[con], vc0, vr0, vs0, 0, z);
+    }
+  }
+
+  free(Y);
+  free(beta);
+  free(yhat);
+  free(rvar);
+  free(gamma);
+  return (0);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmBatch() - batched version of MRIglmFit() (DoFit), MRIglmTest()
+  (DoTest) or both. The output volumes must already be allocated and
+  GLMcMatrices() run. Only call when MRIglmCanBatch().
+  --------------------------------------------------------------------*/
+int MRIglmBatch(MRIGLM *mriglm, int DoFit, int DoTest)
+{
+  GLMMAT *glm = mriglm->glm;
+  GLMBATCH *gb;
+  int n, b;
+
+  gb = MRIglmBatchAlloc(mriglm, DoTest);
+
+  mriglm->n_ill_cond = 0;
+  if (glm->ill_cond_flag) {
+    // same at every voxel, so there is nothing to fit
+    if (DoFit) {
+      mriglm->n_ill_cond = gb->nvox;
+    }
+    else {
+      for (b = 0; b < gb->nvox; b++) {
+        for (n = 0; n < glm->ncontrasts; n++) {
+          MRIsetVoxVal(mriglm->F[n], gb->vc[b], gb->vr[b], gb->vs[b], 0, 0);
+          MRIsetVoxVal(mriglm->p[n], gb->vc[b], gb->vr[b], gb->vs[b], 0, 1);
+          MRIsetVoxVal(mriglm->z[n], gb->vc[b], gb->vr[b], gb->vs[b], 0, 0);
+        }
+      }
+    }
+    MRIglmBatchFree(&gb);
+    return (0);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic)
+#endif
+  for (b = 0; b < gb->nblocks; b++) {
+    ROMP_PFLB_begin
+    MRIglmBatchBlock(mriglm, gb, b, DoFit, DoTest, NULL, NULL);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  MRIglmBatchFree(&gb);
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFitAndTest() - fits and tests glm on a voxel-by-voxel basis.
   There are also two other related functions, MRIglmFit() and
@@ -986,6 +1365,8 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
     }
   }
 
+  if (MRIglmCanBatch(mriglm)) return (MRIglmBatch(mriglm, 1, 1));
+
   //--------------------------------------------
   pctdone = 0;
   nthvox = 0;
@@ -1112,6 +1493,8 @@ int MRIglmFit(MRIGLM *mriglm)
     }
   }
 
+  if (MRIglmCanBatch(mriglm)) return (MRIglmBatch(mriglm, 1, 0));
+
   //--------------------------------------------
   pctdone = 0;
   nthvox = 0;
@@ -1211,6 +1594,8 @@ int MRIglmTest(MRIGLM *mriglm)
     }
   }
 
+  if (MRIglmCanBatch(mriglm)) return (MRIglmBatch(mriglm, 0, 1));
+
   //--------------------------------------------
   pctdone = 0;
   nthvox = 0;
@@ -29,9 +29,13 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -159,6 +163,20 @@ static GC1D *findGCInWindow(GCA *gca, int x, int y, int z, int label, int wsize)
 static int gcaCheck(GCA *gca);
 double gcaVoxelLogPosterior(GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, int y, int z, TRANSFORM *transform);
 static double gcaGibbsImpossibleConfiguration(GCA *gca, MRI *mri_labels, int x, int y, int z, TRANSFORM *transform);
+static double gcaVoxelGibbsLogPosteriorAtNode(GCA *gca,
+                                              MRI *mri_labels,
+                                              MRI *mri_inputs,
+                                              float *vals,
+                                              int x,
+                                              int y,
+                                              int z,
+                                              int node_ok,
+                                              int xn,
+                                              int yn,
+                                              int zn,
+                                              GCA_PRIOR *gcap,
+                                              TRANSFORM *transform,
+                                              double gibbs_coef);
 static GCA_SAMPLE *gcaExtractLabelAsSamples(
     GCA *gca, MRI *mri_labeled, TRANSFORM *transform, int *pnsamples, int label);
 #if 0
@@ -224,6 +242,10 @@ float getPrior(GCA_PRIOR *gcap, int label);
 GCA_PRIOR *getGCAP(GCA *gca, MRI *mri, TRANSFORM *transform, int xv, int yv, int zv);
 GCA_PRIOR *getGCAPfloat(GCA *gca, MRI *mri, TRANSFORM *transform, float xv, float yv, float zv);
 static int gcaNodeToPrior(const GCA *gca, int xn, int yn, int zn, int *pxp, int *pyp, int *pzp);
+static int gcaPackFree(struct GCA_PACK **ppack);
+static int gcaDensityCacheBegin(GCA *gca);
+static void gcaDensityCacheEnd(GCA *gca);
+static void gcaComputeLogDensities(GC1D **gcs, const float *priors, int n, const float *vals, int ninputs, double *log_p);
 static HISTOGRAM *gcaHistogramSamples(
     GCA *gca, GCA_SAMPLE *gcas, MRI *mri, TRANSFORM *transform, int nsamples, HISTOGRAM *histo, int frame);
 int GCApriorToNode(const GCA *gca, int xp, int yp, int zp, int *pxn, int *pyn, int *pzn);
@@ -1880,7 +1902,7 @@ int GCAfree(GCA **pgca)
 
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
-      for (z = 0; z < gca->node_depth; z++) {
+      for (z = 0; z < gca->node_depth && !gca->pack; z++) {
         GCANfree(&gca->nodes[x][y][z], gca->ninputs);
       }
       free(gca->nodes[x][y]);
@@ -1891,7 +1913,7 @@ int GCAfree(GCA **pgca)
 
   for (x = 0; x < gca->prior_width; x++) {
     for (y = 0; y < gca->prior_height; y++) {
-      for (z = 0; z < gca->prior_depth; z++) {
+      for (z = 0; z < gca->prior_depth && !gca->pack; z++) {
         free(gca->priors[x][y][z].labels);
         free(gca->priors[x][y][z].priors);
       }
@@ -1901,6 +1923,10 @@ int GCAfree(GCA **pgca)
   }
 
   free(gca->priors);
+  if (gca->pack) {
+    gcaPackFree(&gca->pack);
+  }
+  free(gca->dcache);
   GCAcleanup(gca);
 
   free(gca);
@@ -2380,6 +2406,10 @@ int GCAwrite(GCA *gca, const char *fname)
   GC1D *gc;
   int gzipped = 0;
 
+  if (strstr(fname, ".gcp")) {
+    return (GCAwritePacked(gca, fname));
+  }
+
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
@@ -2519,6 +2549,727 @@ int GCAwrite(GCA *gca, const char *fname)
   return (NO_ERROR);
 }
 
+/*-------------------------------------------------------------------------
+  Packed GCA storage and the .gcp file format.
+
+  A .gcp file is a GCA_PACK_HEADER followed by the flat arrays listed in
+  the GCA_PACK_* enum, each starting on an 8 byte boundary, and optionally
+  a binary colortable at the end. Everything is in host byte order so the
+  file can be mapped and used in place. A packed GCA keeps the file image
+  (mapped or malloc()ed) and points its nodes and priors into it.
+  -------------------------------------------------------------------------*/
+#define GCA_PACK_MAGIC "FSGCAPK"
+#define GCA_PACK_VERSION 1
+#define GCA_PACK_ENDIAN 0x01020304
+
+enum {
+  GCA_PACK_NODE_NLABELS = 0,     // int    [nnodes]
+  GCA_PACK_NODE_TOTAL_TRAINING,  // int    [nnodes]
+  GCA_PACK_NODE_LABELS,          // ushort [ngcs]
+  GCA_PACK_MEANS,                // float  [ngcs*ninputs]
+  GCA_PACK_COVARS,               // float  [ngcs*ncovars]
+  GCA_PACK_GIBBS_NLABELS,        // short  [ngcs*GIBBS_NEIGHBORS]
+  GCA_PACK_GIBBS_LABELS,         // ushort [ngibbs]
+  GCA_PACK_GIBBS_PRIORS,         // float  [ngibbs]
+  GCA_PACK_PRIOR_NLABELS,        // short  [npriors]
+  GCA_PACK_PRIOR_TOTAL_TRAINING, // int    [npriors]
+  GCA_PACK_PRIOR_LABELS,         // ushort [nprior_labels]
+  GCA_PACK_PRIOR_PRIORS,         // float  [nprior_labels]
+  GCA_PACK_NARRAYS
+};
+
+typedef struct
+{
+  char magic[8];
+  int endian;
+  int version;
+  int header_size;
+  int ninputs, flags, type;
+  float prior_spacing, node_spacing;
+  int node_width, node_height, node_depth;
+  int prior_width, prior_height, prior_depth;
+  int width, height, depth;
+  float xsize, ysize, zsize;
+  float x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s;
+  double TRs[MAX_GCA_INPUTS], FAs[MAX_GCA_INPUTS], TEs[MAX_GCA_INPUTS];
+  long long ngcs, ngibbs, nprior_labels;
+  long long offset[GCA_PACK_NARRAYS];  // from the start of the file
+  long long ct_offset;                 // 0 if there is no colortable
+} GCA_PACK_HEADER;
+
+struct GCA_PACK
+{
+  void *base;  // the file image
+  size_t len;
+  int mapped;  // base is an mmap() of the file, otherwise malloc()ed
+  GC1D *gcs;   // every node's classifiers, in node order
+  unsigned short **gibbs_labels;  // [ngcs*GIBBS_NEIGHBORS] pointers into the image
+  float **gibbs_priors;
+};
+
+#define GCA_PACK_ARRAY(hdr, type, which) ((type *)((char *)(hdr) + (hdr)->offset[which]))
+
+static int gcaPackFree(struct GCA_PACK **ppack)
+{
+  struct GCA_PACK *pack = *ppack;
+
+  *ppack = NULL;
+  if (pack->mapped) {
+    munmap(pack->base, pack->len);
+  }
+  else {
+    free(pack->base);
+  }
+  free(pack->gcs);
+  free(pack->gibbs_labels);
+  free(pack->gibbs_priors);
+  free(pack);
+  return (NO_ERROR);
+}
+
+/* Set gc->ntraining from the node training counts and the priors, as
+   GCAread() does for the original format. */
+static int gcaComputeNodeTraining(GCA *gca)
+{
+  int x, y, z, n, xp, yp, zp;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+
+  for (x = 0; x < gca->node_width; x++) {
+    for (y = 0; y < gca->node_height; y++) {
+      for (z = 0; z < gca->node_depth; z++) {
+        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
+          DiagBreak();
+        }
+        gcan = &gca->nodes[x][y][z];
+        if (gcaNodeToPrior(gca, x, y, z, &xp, &yp, &zp) == NO_ERROR) {
+          gcap = &gca->priors[xp][yp][zp];
+          if (gcap == NULL) {
+            continue;
+          }
+          for (n = 0; n < gcan->nlabels; n++) {
+            gcan->gcs[n].ntraining = gcan->total_training * getPrior(gcap, gcan->labels[n]);
+          }
+        }
+      }
+    }
+  }
+  return (NO_ERROR);
+}
+
+/* Build the .gcp image of gca (without colortable) in one malloc()ed block */
+/*-------------------------------------------------------------------------
+  gcaPackArraySizes() - the number of elements and the element size of
+  each of the GCA_PACK_* arrays
+  -------------------------------------------------------------------------*/
+static void gcaPackArraySizes(int ninputs,
+                              int mrf,
+                              long long nnodes,
+                              long long npriors,
+                              long long ngcs,
+                              long long ngibbs,
+                              long long nprior_labels,
+                              long long *nelts,
+                              size_t *eltsize)
+{
+  int ncovars = ninputs * (ninputs + 1) / 2;
+
+  nelts[GCA_PACK_NODE_NLABELS] = nnodes;
+  eltsize[GCA_PACK_NODE_NLABELS] = sizeof(int);
+  nelts[GCA_PACK_NODE_TOTAL_TRAINING] = nnodes;
+  eltsize[GCA_PACK_NODE_TOTAL_TRAINING] = sizeof(int);
+  nelts[GCA_PACK_NODE_LABELS] = ngcs;
+  eltsize[GCA_PACK_NODE_LABELS] = sizeof(unsigned short);
+  nelts[GCA_PACK_MEANS] = ngcs * ninputs;
+  eltsize[GCA_PACK_MEANS] = sizeof(float);
+  nelts[GCA_PACK_COVARS] = ngcs * ncovars;
+  eltsize[GCA_PACK_COVARS] = sizeof(float);
+  nelts[GCA_PACK_GIBBS_NLABELS] = mrf ? ngcs * GIBBS_NEIGHBORS : 0;
+  eltsize[GCA_PACK_GIBBS_NLABELS] = sizeof(short);
+  nelts[GCA_PACK_GIBBS_LABELS] = ngibbs;
+  eltsize[GCA_PACK_GIBBS_LABELS] = sizeof(unsigned short);
+  nelts[GCA_PACK_GIBBS_PRIORS] = ngibbs;
+  eltsize[GCA_PACK_GIBBS_PRIORS] = sizeof(float);
+  nelts[GCA_PACK_PRIOR_NLABELS] = npriors;
+  eltsize[GCA_PACK_PRIOR_NLABELS] = sizeof(short);
+  nelts[GCA_PACK_PRIOR_TOTAL_TRAINING] = npriors;
+  eltsize[GCA_PACK_PRIOR_TOTAL_TRAINING] = sizeof(int);
+  nelts[GCA_PACK_PRIOR_LABELS] = nprior_labels;
+  eltsize[GCA_PACK_PRIOR_LABELS] = sizeof(unsigned short);
+  nelts[GCA_PACK_PRIOR_PRIORS] = nprior_labels;
+  eltsize[GCA_PACK_PRIOR_PRIORS] = sizeof(float);
+}
+
+static GCA_PACK_HEADER *gcaPackImage(GCA *gca, size_t *plen)
+{
+  GCA_PACK_HEADER *hdr;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  long long ngcs, ngibbs, nprior_labels, nnodes, npriors, nelts[GCA_PACK_NARRAYS];
+  size_t eltsize[GCA_PACK_NARRAYS], len;
+  int x, y, z, n, i, j, ncovars, mrf;
+  long long nno, pno, gno, gbo, plo;
+
+  ncovars = gca->ninputs * (gca->ninputs + 1) / 2;
+  mrf = !(gca->flags & GCA_NO_MRF);
+  nnodes = (long long)gca->node_width * gca->node_height * gca->node_depth;
+  npriors = (long long)gca->prior_width * gca->prior_height * gca->prior_depth;
+
+  ngcs = ngibbs = nprior_labels = 0;
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        ngcs += gcan->nlabels;
+        if (!mrf) continue;
+        for (n = 0; n < gcan->nlabels; n++)
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) ngibbs += gcan->gcs[n].nlabels[i];
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) nprior_labels += gca->priors[x][y][z].nlabels;
+
+  gcaPackArraySizes(gca->ninputs, mrf, nnodes, npriors, ngcs, ngibbs, nprior_labels, nelts, eltsize);
+
+  len = (sizeof(GCA_PACK_HEADER) + 7) & ~(size_t)7;
+  for (i = 0; i < GCA_PACK_NARRAYS; i++) {
+    size_t offset = len;
+    len += (nelts[i] * eltsize[i] + 7) & ~(size_t)7;
+    nelts[i] = offset;  // reuse as the offset from here on
+  }
+
+  hdr = (GCA_PACK_HEADER *)calloc(1, len);
+  if (!hdr) ErrorExit(ERROR_NOMEMORY, "gcaPackImage: could not allocate %zu bytes", len);
+
+  memmove(hdr->magic, GCA_PACK_MAGIC, sizeof(GCA_PACK_MAGIC));
+  hdr->endian = GCA_PACK_ENDIAN;
+  hdr->version = GCA_PACK_VERSION;
+  hdr->header_size = sizeof(GCA_PACK_HEADER);
+  hdr->ninputs = gca->ninputs;
+  hdr->flags = gca->flags;
+  hdr->type = gca->type;
+  hdr->prior_spacing = gca->prior_spacing;
+  hdr->node_spacing = gca->node_spacing;
+  hdr->node_width = gca->node_width;
+  hdr->node_height = gca->node_height;
+  hdr->node_depth = gca->node_depth;
+  hdr->prior_width = gca->prior_width;
+  hdr->prior_height = gca->prior_height;
+  hdr->prior_depth = gca->prior_depth;
+  hdr->width = gca->width;
+  hdr->height = gca->height;
+  hdr->depth = gca->depth;
+  hdr->xsize = gca->xsize;
+  hdr->ysize = gca->ysize;
+  hdr->zsize = gca->zsize;
+  hdr->x_r = gca->x_r;
+  hdr->x_a = gca->x_a;
+  hdr->x_s = gca->x_s;
+  hdr->y_r = gca->y_r;
+  hdr->y_a = gca->y_a;
+  hdr->y_s = gca->y_s;
+  hdr->z_r = gca->z_r;
+  hdr->z_a = gca->z_a;
+  hdr->z_s = gca->z_s;
+  hdr->c_r = gca->c_r;
+  hdr->c_a = gca->c_a;
+  hdr->c_s = gca->c_s;
+  memmove(hdr->TRs, gca->TRs, sizeof(gca->TRs));
+  memmove(hdr->FAs, gca->FAs, sizeof(gca->FAs));
+  memmove(hdr->TEs, gca->TEs, sizeof(gca->TEs));
+  hdr->ngcs = ngcs;
+  hdr->ngibbs = ngibbs;
+  hdr->nprior_labels = nprior_labels;
+  for (i = 0; i < GCA_PACK_NARRAYS; i++) hdr->offset[i] = nelts[i];
+
+  {
+    int *node_nlabels = GCA_PACK_ARRAY(hdr, int, GCA_PACK_NODE_NLABELS);
+    int *node_total_training = GCA_PACK_ARRAY(hdr, int, GCA_PACK_NODE_TOTAL_TRAINING);
+    unsigned short *node_labels = GCA_PACK_ARRAY(hdr, unsigned short, GCA_PACK_NODE_LABELS);
+    float *means = GCA_PACK_ARRAY(hdr, float, GCA_PACK_MEANS);
+    float *covars = GCA_PACK_ARRAY(hdr, float, GCA_PACK_COVARS);
+    short *gibbs_nlabels = GCA_PACK_ARRAY(hdr, short, GCA_PACK_GIBBS_NLABELS);
+    unsigned short *gibbs_labels = GCA_PACK_ARRAY(hdr, unsigned short, GCA_PACK_GIBBS_LABELS);
+    float *gibbs_priors = GCA_PACK_ARRAY(hdr, float, GCA_PACK_GIBBS_PRIORS);
+    short *prior_nlabels = GCA_PACK_ARRAY(hdr, short, GCA_PACK_PRIOR_NLABELS);
+    int *prior_total_training = GCA_PACK_ARRAY(hdr, int, GCA_PACK_PRIOR_TOTAL_TRAINING);
+    unsigned short *prior_labels = GCA_PACK_ARRAY(hdr, unsigned short, GCA_PACK_PRIOR_LABELS);
+    float *prior_priors = GCA_PACK_ARRAY(hdr, float, GCA_PACK_PRIOR_PRIORS);
+
+    nno = gno = gbo = 0;
+    for (x = 0; x < gca->node_width; x++)
+      for (y = 0; y < gca->node_height; y++)
+        for (z = 0; z < gca->node_depth; z++, nno++) {
+          gcan = &gca->nodes[x][y][z];
+          node_nlabels[nno] = gcan->nlabels;
+          node_total_training[nno] = gcan->total_training;
+          for (n = 0; n < gcan->nlabels; n++, gno++) {
+            gc = &gcan->gcs[n];
+            node_labels[gno] = gcan->labels[n];
+            memmove(means + gno * gca->ninputs, gc->means, gca->ninputs * sizeof(float));
+            memmove(covars + gno * ncovars, gc->covars, ncovars * sizeof(float));
+            if (!mrf) continue;
+            for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+              gibbs_nlabels[gno * GIBBS_NEIGHBORS + i] = gc->nlabels[i];
+              for (j = 0; j < gc->nlabels[i]; j++, gbo++) {
+                gibbs_labels[gbo] = gc->labels[i][j];
+                gibbs_priors[gbo] = gc->label_priors[i][j];
+              }
+            }
+          }
+        }
+
+    pno = plo = 0;
+    for (x = 0; x < gca->prior_width; x++)
+      for (y = 0; y < gca->prior_height; y++)
+        for (z = 0; z < gca->prior_depth; z++, pno++) {
+          gcap = &gca->priors[x][y][z];
+          prior_nlabels[pno] = gcap->nlabels;
+          prior_total_training[pno] = gcap->total_training;
+          for (n = 0; n < gcap->nlabels; n++, plo++) {
+            prior_labels[plo] = gcap->labels[n];
+            prior_priors[plo] = gcap->priors[n];
+          }
+        }
+  }
+
+  *plen = len;
+  return (hdr);
+}
+
+/* Point the nodes and priors of gca into the .gcp image at base. If
+   release_old is set, the classifier bookkeeping (ntraining etc) is
+   carried over from, and then the memory of, the existing per-node
+   arrays; otherwise those arrays are assumed to be empty. */
+static int gcaPackAttach(GCA *gca, void *base, size_t len, int mapped, int release_old)
+{
+  GCA_PACK_HEADER *hdr = (GCA_PACK_HEADER *)base;
+  struct GCA_PACK *pack;
+  GCA_NODE *gcan, old_gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  int x, y, z, n, i, ncovars, mrf;
+  long long nno, pno, gno, gbo, plo;
+
+  int *node_nlabels = GCA_PACK_ARRAY(hdr, int, GCA_PACK_NODE_NLABELS);
+  int *node_total_training = GCA_PACK_ARRAY(hdr, int, GCA_PACK_NODE_TOTAL_TRAINING);
+  unsigned short *node_labels = GCA_PACK_ARRAY(hdr, unsigned short, GCA_PACK_NODE_LABELS);
+  float *means = GCA_PACK_ARRAY(hdr, float, GCA_PACK_MEANS);
+  float *covars = GCA_PACK_ARRAY(hdr, float, GCA_PACK_COVARS);
+  short *gibbs_nlabels = GCA_PACK_ARRAY(hdr, short, GCA_PACK_GIBBS_NLABELS);
+  unsigned short *gibbs_labels = GCA_PACK_ARRAY(hdr, unsigned short, GCA_PACK_GIBBS_LABELS);
+  float *gibbs_priors = GCA_PACK_ARRAY(hdr, float, GCA_PACK_GIBBS_PRIORS);
+  short *prior_nlabels = GCA_PACK_ARRAY(hdr, short, GCA_PACK_PRIOR_NLABELS);
+  int *prior_total_training = GCA_PACK_ARRAY(hdr, int, GCA_PACK_PRIOR_TOTAL_TRAINING);
+  unsigned short *prior_labels = GCA_PACK_ARRAY(hdr, unsigned short, GCA_PACK_PRIOR_LABELS);
+  float *prior_priors = GCA_PACK_ARRAY(hdr, float, GCA_PACK_PRIOR_PRIORS);
+
+  ncovars = gca->ninputs * (gca->ninputs + 1) / 2;
+  mrf = !(gca->flags & GCA_NO_MRF);
+
+  pack = (struct GCA_PACK *)calloc(1, sizeof(struct GCA_PACK));
+  if (!pack) ErrorExit(ERROR_NOMEMORY, "gcaPackAttach: could not allocate pack");
+  pack->base = base;
+  pack->len = len;
+  pack->mapped = mapped;
+  pack->gcs = (GC1D *)calloc(hdr->ngcs + 1, sizeof(GC1D));
+  if (mrf) {
+    pack->gibbs_labels = (unsigned short **)calloc(hdr->ngcs * GIBBS_NEIGHBORS + 1, sizeof(unsigned short *));
+    pack->gibbs_priors = (float **)calloc(hdr->ngcs * GIBBS_NEIGHBORS + 1, sizeof(float *));
+  }
+  if (!pack->gcs || (mrf && (!pack->gibbs_labels || !pack->gibbs_priors)))
+    ErrorExit(ERROR_NOMEMORY, "gcaPackAttach: could not allocate %lld classifiers", hdr->ngcs);
+
+  nno = gno = gbo = 0;
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++, nno++) {
+        gcan = &gca->nodes[x][y][z];
+        old_gcan = *gcan;
+        gcan->nlabels = gcan->max_labels = node_nlabels[nno];
+        gcan->total_training = node_total_training[nno];
+        gcan->labels = gcan->nlabels ? node_labels + gno : NULL;
+        gcan->gcs = gcan->nlabels ? pack->gcs + gno : NULL;
+        for (n = 0; n < gcan->nlabels; n++, gno++) {
+          gc = &gcan->gcs[n];
+          gc->means = means + gno * gca->ninputs;
+          gc->covars = covars + gno * ncovars;
+          if (release_old) {
+            gc->ntraining = old_gcan.gcs[n].ntraining;
+            gc->n_just_priors = old_gcan.gcs[n].n_just_priors;
+            gc->regularized = old_gcan.gcs[n].regularized;
+          }
+          if (!mrf) continue;
+          gc->nlabels = gibbs_nlabels + gno * GIBBS_NEIGHBORS;
+          gc->labels = pack->gibbs_labels + gno * GIBBS_NEIGHBORS;
+          gc->label_priors = pack->gibbs_priors + gno * GIBBS_NEIGHBORS;
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            gc->labels[i] = gibbs_labels + gbo;
+            gc->label_priors[i] = gibbs_priors + gbo;
+            gbo += gc->nlabels[i];
+          }
+        }
+        if (release_old) {
+          // alloc_gcs() allocated max_labels classifiers, GCAread() nlabels
+          if (old_gcan.gcs) free_gcs(old_gcan.gcs, MAX(old_gcan.nlabels, old_gcan.max_labels), gca->ninputs);
+          free(old_gcan.labels);
+        }
+      }
+
+  pno = plo = 0;
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++, pno++) {
+        gcap = &gca->priors[x][y][z];
+        if (release_old) {
+          free(gcap->labels);
+          free(gcap->priors);
+        }
+        gcap->nlabels = gcap->max_labels = prior_nlabels[pno];
+        gcap->total_training = prior_total_training[pno];
+        gcap->labels = gcap->nlabels ? prior_labels + plo : NULL;
+        gcap->priors = gcap->nlabels ? prior_priors + plo : NULL;
+        plo += gcap->nlabels;
+      }
+
+  gca->pack = pack;
+  return (NO_ERROR);
+}
+
+/*-------------------------------------------------------------------------
+  GCApack() - move the node and prior arrays of gca into packed storage.
+  Classifier contents are unchanged; the per-node allocations are freed.
+  -------------------------------------------------------------------------*/
+int GCApack(GCA *gca)
+{
+  GCA_PACK_HEADER *hdr;
+  size_t len;
+
+  if (gca->pack) {
+    return (NO_ERROR);
+  }
+  hdr = gcaPackImage(gca, &len);
+  return (gcaPackAttach(gca, hdr, len, 0, 1));
+}
+
+/*-------------------------------------------------------------------------
+  GCAunpack() - give every node, classifier and prior of a packed gca its
+  own allocations again so they can be grown (eg, during training).
+  -------------------------------------------------------------------------*/
+int GCAunpack(GCA *gca)
+{
+  int x, y, z, n;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gcs;
+  unsigned short *labels;
+  float *priors;
+
+  if (!gca->pack) {
+    return (NO_ERROR);
+  }
+
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        if (gcan->nlabels == 0) {
+          continue;
+        }
+        gcs = alloc_gcs(gcan->nlabels, gca->flags, gca->ninputs);
+        copy_gcs(gcan->nlabels, gcan->gcs, gcs, gca->ninputs);
+        for (n = 0; n < gcan->nlabels; n++) {
+          gcs[n].n_just_priors = gcan->gcs[n].n_just_priors;
+          gcs[n].regularized = gcan->gcs[n].regularized;
+        }
+        labels = (unsigned short *)calloc(gcan->nlabels, sizeof(unsigned short));
+        if (!labels) ErrorExit(ERROR_NOMEMORY, "GCAunpack: could not allocate %d labels", gcan->nlabels);
+        memmove(labels, gcan->labels, gcan->nlabels * sizeof(unsigned short));
+        gcan->gcs = gcs;
+        gcan->labels = labels;
+      }
+
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        if (gcap->nlabels == 0) {
+          continue;
+        }
+        labels = (unsigned short *)calloc(gcap->nlabels, sizeof(unsigned short));
+        priors = (float *)calloc(gcap->nlabels, sizeof(float));
+        if (!labels || !priors) ErrorExit(ERROR_NOMEMORY, "GCAunpack: could not allocate %d priors", gcap->nlabels);
+        memmove(labels, gcap->labels, gcap->nlabels * sizeof(unsigned short));
+        memmove(priors, gcap->priors, gcap->nlabels * sizeof(float));
+        gcap->labels = labels;
+        gcap->priors = priors;
+      }
+
+  return (gcaPackFree(&gca->pack));
+}
+
+int GCAwritePacked(GCA *gca, const char *fname)
+{
+  GCA_PACK_HEADER *hdr;
+  size_t len;
+  FILE *fp;
+  znzFile file;
+
+  hdr = gcaPackImage(gca, &len);
+  if (gca->ct) {
+    hdr->ct_offset = len;
+  }
+
+  fp = fopen(fname, "wb");
+  if (!fp) {
+    free(hdr);
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAwritePacked(%s): could not open file", fname));
+  }
+  if (fwrite(hdr, 1, len, fp) != len) {
+    fclose(fp);
+    free(hdr);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAwritePacked(%s): could not write %zu bytes", fname, len));
+  }
+  fclose(fp);
+  free(hdr);
+
+  if (gca->ct) {
+    file = znzopen(fname, "ab", 0);
+    if (znz_isnull(file)) {
+      ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAwritePacked(%s): could not reopen file", fname));
+    }
+    znzCTABwriteIntoBinary(gca->ct, file);
+    znzclose(file);
+  }
+  return (NO_ERROR);
+}
+
+/*-------------------------------------------------------------------------
+  gcaPackCountsMatch() - whether the per node, per classifier and per
+  prior label counts in a file image add up to the totals in its header,
+  as gcaPackAttach() indexes the arrays with them
+  -------------------------------------------------------------------------*/
+static int gcaPackCountsMatch(GCA_PACK_HEADER *hdr)
+{
+  int *node_nlabels = GCA_PACK_ARRAY(hdr, int, GCA_PACK_NODE_NLABELS);
+  short *gibbs_nlabels = GCA_PACK_ARRAY(hdr, short, GCA_PACK_GIBBS_NLABELS);
+  short *prior_nlabels = GCA_PACK_ARRAY(hdr, short, GCA_PACK_PRIOR_NLABELS);
+  long long nnodes, npriors, n, sum;
+
+  nnodes = (long long)hdr->node_width * hdr->node_height * hdr->node_depth;
+  npriors = (long long)hdr->prior_width * hdr->prior_height * hdr->prior_depth;
+
+  for (sum = n = 0; n < nnodes; n++) {
+    if (node_nlabels[n] < 0) return (0);
+    sum += node_nlabels[n];
+  }
+  if (sum != hdr->ngcs) return (0);
+
+  if (!(hdr->flags & GCA_NO_MRF)) {
+    for (sum = n = 0; n < hdr->ngcs * GIBBS_NEIGHBORS; n++) {
+      if (gibbs_nlabels[n] < 0) return (0);
+      sum += gibbs_nlabels[n];
+    }
+    if (sum != hdr->ngibbs) return (0);
+  }
+
+  for (sum = n = 0; n < npriors; n++) {
+    if (prior_nlabels[n] < 0) return (0);
+    sum += prior_nlabels[n];
+  }
+  return (sum == hdr->nprior_labels);
+}
+
+static int gcaIsPackedFile(const char *fname)
+{
+  char magic[sizeof(GCA_PACK_MAGIC)];
+  FILE *fp;
+  int packed;
+
+  fp = fopen(fname, "rb");
+  if (!fp) {
+    return (0);
+  }
+  packed = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && !memcmp(magic, GCA_PACK_MAGIC, sizeof(magic));
+  fclose(fp);
+  return (packed);
+}
+
+/*-------------------------------------------------------------------------
+  GCAreadPacked() - read a .gcp file. The file is mmap()ed privately
+  (copy-on-write, so the GCA can still be modified) unless FS_GCA_NO_MMAP
+  is set or mapping fails, in which case it is read with a single read.
+  -------------------------------------------------------------------------*/
+GCA *GCAreadPacked(const char *fname)
+{
+  GCA_PACK_HEADER hdr, *image;
+  GCA *gca;
+  struct stat st;
+  void *base;
+  size_t len, nread, eltsize[GCA_PACK_NARRAYS];
+  ssize_t nbytes;
+  long long nelts[GCA_PACK_NARRAYS];
+  int fd, mapped, ok, i, n, x, y, z;
+  znzFile file;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    ErrorReturn(NULL, (ERROR_BADPARM, "GCAreadPacked(%s): could not open file", fname));
+  }
+  if (fstat(fd, &st) < 0 || pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+    close(fd);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadPacked(%s): could not read header", fname));
+  }
+  if (memcmp(hdr.magic, GCA_PACK_MAGIC, sizeof(hdr.magic)) || hdr.version != GCA_PACK_VERSION ||
+      hdr.header_size != (int)sizeof(hdr)) {
+    close(fd);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadPacked(%s): not a version %d packed GCA", fname, GCA_PACK_VERSION));
+  }
+  if (hdr.endian != GCA_PACK_ENDIAN) {
+    close(fd);
+    ErrorReturn(NULL,
+                (ERROR_BADFILE,
+                 "GCAreadPacked(%s): written on a machine with different byte order, "
+                 "recreate it from the .gca",
+                 fname));
+  }
+  // every array has to end within the file (before the colortable), with
+  // the sizes that follow from the counts in the header
+  len = hdr.ct_offset ? (size_t)hdr.ct_offset : (size_t)st.st_size;
+  ok = len <= (size_t)st.st_size && hdr.ninputs >= 1 && hdr.ninputs <= MAX_GCA_INPUTS && hdr.node_width > 0 &&
+       hdr.node_height > 0 && hdr.node_depth > 0 && hdr.prior_width > 0 && hdr.prior_height > 0 &&
+       hdr.prior_depth > 0 && (double)hdr.node_width * hdr.node_height * hdr.node_depth <= len &&
+       (double)hdr.prior_width * hdr.prior_height * hdr.prior_depth <= len && hdr.ngcs >= 0 &&
+       hdr.ngcs <= (long long)len && hdr.ngibbs >= 0 && hdr.ngibbs <= (long long)len && hdr.nprior_labels >= 0 &&
+       hdr.nprior_labels <= (long long)len;
+  if (ok) {
+    gcaPackArraySizes(hdr.ninputs,
+                      !(hdr.flags & GCA_NO_MRF),
+                      (long long)hdr.node_width * hdr.node_height * hdr.node_depth,
+                      (long long)hdr.prior_width * hdr.prior_height * hdr.prior_depth,
+                      hdr.ngcs,
+                      hdr.ngibbs,
+                      hdr.nprior_labels,
+                      nelts,
+                      eltsize);
+    for (i = 0; ok && i < GCA_PACK_NARRAYS; i++)
+      ok = hdr.offset[i] >= (long long)sizeof(hdr) && (size_t)hdr.offset[i] <= len &&
+           nelts[i] <= (long long)((len - hdr.offset[i]) / eltsize[i]);
+  }
+  if (!ok) {
+    close(fd);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadPacked(%s): truncated or corrupt file", fname));
+  }
+
+  mapped = 0;
+  base = NULL;
+  if (!getenv("FS_GCA_NO_MMAP")) {
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+      base = NULL;
+    }
+    else {
+      mapped = 1;
+    }
+  }
+  if (!base) {
+    base = malloc(len);
+    if (!base) {
+      close(fd);
+      ErrorReturn(NULL, (ERROR_NOMEMORY, "GCAreadPacked(%s): could not allocate %zu bytes", fname, len));
+    }
+    for (nread = 0; nread < len; nread += nbytes) {
+      nbytes = pread(fd, (char *)base + nread, len - nread, nread);
+      if (nbytes <= 0) {
+        close(fd);
+        free(base);
+        ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadPacked(%s): could not read %zu bytes", fname, len));
+      }
+    }
+  }
+  close(fd);
+  image = (GCA_PACK_HEADER *)base;
+  if (!gcaPackCountsMatch(image)) {
+    if (mapped) {
+      munmap(base, len);
+    }
+    else {
+      free(base);
+    }
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadPacked(%s): label counts don't match the header", fname));
+  }
+
+  gca = gcaAllocMax(hdr.ninputs,
+                    hdr.prior_spacing,
+                    hdr.node_spacing,
+                    hdr.node_spacing * hdr.node_width,
+                    hdr.node_spacing * hdr.node_height,
+                    hdr.node_spacing * hdr.node_depth,
+                    0,
+                    hdr.flags);
+  if (gca->node_width != hdr.node_width || gca->node_height != hdr.node_height ||
+      gca->node_depth != hdr.node_depth || gca->prior_width != hdr.prior_width ||
+      gca->prior_height != hdr.prior_height || gca->prior_depth != hdr.prior_depth) {
+    GCAfree(&gca);
+    if (mapped) {
+      munmap(base, len);
+    }
+    else {
+      free(base);
+    }
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadPacked(%s): inconsistent node/prior dimensions", fname));
+  }
+
+  gca->type = hdr.type;
+  memmove(gca->TRs, hdr.TRs, sizeof(gca->TRs));
+  memmove(gca->FAs, hdr.FAs, sizeof(gca->FAs));
+  memmove(gca->TEs, hdr.TEs, sizeof(gca->TEs));
+  gca->x_r = hdr.x_r;
+  gca->x_a = hdr.x_a;
+  gca->x_s = hdr.x_s;
+  gca->y_r = hdr.y_r;
+  gca->y_a = hdr.y_a;
+  gca->y_s = hdr.y_s;
+  gca->z_r = hdr.z_r;
+  gca->z_a = hdr.z_a;
+  gca->z_s = hdr.z_s;
+  gca->c_r = hdr.c_r;
+  gca->c_a = hdr.c_a;
+  gca->c_s = hdr.c_s;
+  gca->width = hdr.width;
+  gca->height = hdr.height;
+  gca->depth = hdr.depth;
+  gca->xsize = hdr.xsize;
+  gca->ysize = hdr.ysize;
+  gca->zsize = hdr.zsize;
+
+  gcaPackAttach(gca, image, len, mapped, 0);
+  gcaComputeNodeTraining(gca);
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++)
+        for (n = 0; n < gca->priors[x][y][z].nlabels; n++)
+          if (gca->priors[x][y][z].labels[n] > gca->max_label) gca->max_label = gca->priors[x][y][z].labels[n];
+
+  if (hdr.ct_offset) {
+    file = znzopen(fname, "rb", 0);
+    if (!znz_isnull(file) && znzseek(file, hdr.ct_offset, SEEK_SET) == 0) {
+      fprintf(stdout, "reading colortable from GCA file...\n");
+      gca->ct = znzCTABreadFromBinary(file);
+      if (NULL != gca->ct)
+        fprintf(stdout, "colortable with %d entries read (originally %s)\n", gca->ct->nentries, gca->ct->fname);
+    }
+    if (!znz_isnull(file)) {
+      znzclose(file);
+    }
+  }
+
+  GCAsetup(gca);
+
+  return (gca);
+}
+
 GCA *GCAread(const char *fname)
 {
   znzFile file;
@@ -2534,6 +3285,10 @@ GCA *GCAread(const char *fname)
   int gzipped = 0;
   int tempZNZ;
 
+  if (gcaIsPackedFile(fname)) {
+    return (GCAreadPacked(fname));
+  }
+
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
@@ -2841,28 +3596,7 @@ GCA *GCAread(const char *fname)
     }
   }
 
-  for (x = 0; x < gca->node_width; x++) {
-    for (y = 0; y < gca->node_height; y++) {
-      for (z = 0; z < gca->node_depth; z++) {
-        int xp, yp, zp;
-
-        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
-          DiagBreak();
-        }
-        gcan = &gca->nodes[x][y][z];
-        if (gcaNodeToPrior(gca, x, y, z, &xp, &yp, &zp) == NO_ERROR) {
-          gcap = &gca->priors[xp][yp][zp];
-          if (gcap == NULL) {
-            continue;
-          }
-          for (n = 0; n < gcan->nlabels; n++) {
-            gc = &gcan->gcs[n];
-            gc->ntraining = gcan->total_training * getPrior(gcap, gcan->labels[n]);
-          }
-        }
-      }
-    }
-  }
+  gcaComputeNodeTraining(gca);
 
   while (znzreadIntEx(&tag, file)) {
     int n, nparms;
@@ -2965,6 +3699,9 @@ static int GCAupdatePrior(GCA *gca, MRI *mri, int xn, int yn, int zn, int label)
   int n;
   GCA_PRIOR *gcap;
 
+  if (gca->pack) { /* packed arrays can't grow */
+    GCAunpack(gca);
+  }
   if (label >= MAX_CMA_LABEL)
     ErrorReturn(ERROR_BADPARM,
                 (ERROR_BADPARM, "GCAupdatePrior(%d, %d, %d, %d): label out of range", xn, yn, zn, label));
@@ -3081,6 +3818,9 @@ static int GCAupdateNode(GCA *gca, MRI *mri, int xn, int yn, int zn, float *vals
   GCA_NODE *gcan;
   GC1D *gc;
 
+  if (gca->pack) { /* packed arrays can't grow */
+    GCAunpack(gca);
+  }
   if (label >= MAX_CMA_LABEL)
     ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAupdateNode(%d, %d, %d, %d): label out of range", xn, yn, zn, label));
 
@@ -3527,10 +4267,11 @@ int GCAcompleteCovarianceTraining(GCA *gca)
 
 MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
 {
-  int x, width, height, depth, num_pv, use_partial_volume_stuff;
-#if INTERP_PRIOR
-  float prior;
-#endif
+  int x, width, height, depth, num_pv, use_partial_volume_stuff, max_cands;
+  GC1D **cand_gcs;
+  float *cand_priors;
+  int *cand_labels;
+  double *cand_log_p;
 
   use_partial_volume_stuff = (getenv("USE_PARTIAL_VOLUME_STUFF") != NULL);
   if (use_partial_volume_stuff) {
@@ -3554,12 +4295,21 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
   height = mri_inputs->height;
   depth = mri_inputs->depth;
   num_pv = 0;
+
+  // the candidate labels at a voxel are evaluated together, using
+  // inverse covariances and normalizers computed once per classifier
+  gcaDensityCacheBegin(gca);
+  max_cands = 0;
+  cand_gcs = NULL;
+  cand_priors = NULL;
+  cand_labels = NULL;
+  cand_log_p = NULL;
   // if 0
   // ifdef HAVE_OPENMP
   // pragma omp parallel for if_ROMP(experimental) reduction(+: num_pv)
   // endif
   for (x = 0; x < width; x++) {
-    int y, z, n, label, xn, yn, zn;
+    int y, z, n, label, xn, yn, zn, ncands;
     // int max_n;
     float vals[MAX_GCA_INPUTS], max_p, p;
     GCA_NODE *gcan;
@@ -3589,12 +4339,18 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
           // max_n = -1;
           // max_gc = NULL;
           max_p = 2 * GIBBS_NEIGHBORS * BIG_AND_NEGATIVE;
+          if (gcap->nlabels > max_cands) {
+            max_cands = gcap->nlabels;
+            cand_gcs = (GC1D **)realloc(cand_gcs, max_cands * sizeof(GC1D *));
+            cand_priors = (float *)realloc(cand_priors, max_cands * sizeof(float));
+            cand_labels = (int *)realloc(cand_labels, max_cands * sizeof(int));
+            cand_log_p = (double *)realloc(cand_log_p, max_cands * sizeof(double));
+            if (!cand_gcs || !cand_priors || !cand_labels || !cand_log_p) {
+              ErrorExit(ERROR_NOMEMORY, "GCAlabel: could not allocate %d candidates", max_cands);
+            }
+          }
           // going through gcap labels
-          for (n = 0; n < gcap->nlabels; n++) {
-#if 0
-            p = GCAcomputePosteriorDensity(gcap, gcan, -1, n, vals,
-                                           gca->ninputs,xn,yn,zn,gca) ;
-#else
+          for (ncands = n = 0; n < gcap->nlabels; n++) {
             gc = GCAfindGC(gca, xn, yn, zn, gcap->labels[n]);
             if (gc == NULL) {
               gc = GCAfindClosestValidGC(gca, xn, yn, zn, gcap->labels[n], 0);
@@ -3603,19 +4359,22 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
               MRIsetVoxVal(mri_dst, x, y, z, 0, 0);  // unknown
               continue;
             }
+            cand_gcs[ncands] = gc;
+            cand_labels[ncands] = gcap->labels[n];
 #if INTERP_PRIOR
-            prior = gcaComputePrior(gca, mri_inputs, transform, x, y, z, gcap->labels[n]);
-            p = gcaComputeLogDensity(gc, vals, gca->ninputs, prior, gcap->labels[n]);
+            cand_priors[ncands] = gcaComputePrior(gca, mri_inputs, transform, x, y, z, gcap->labels[n]);
 #else
-            p = gcaComputeLogDensity(gc, vals, gca->ninputs, gcap->priors[n], gcap->labels[n]);
-#endif
+            cand_priors[ncands] = gcap->priors[n];
 #endif
+            ncands++;
+          }
+          gcaComputeLogDensities(cand_gcs, cand_priors, ncands, vals, gca->ninputs, cand_log_p);
+          for (n = 0; n < ncands; n++) {
+            p = cand_log_p[n];
             // look for largest p
             if (p > max_p) {
               max_p = p;
-              label = gcap->labels[n];
-              // max_n = n;
-              // max_gc = gc;
+              label = cand_labels[n];
             }
           }
 
@@ -3703,6 +4462,12 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
     }    // y loop
   }      // x loop
 
+  free(cand_gcs);
+  free(cand_priors);
+  free(cand_labels);
+  free(cand_log_p);
+  gcaDensityCacheEnd(gca);
+
   return (mri_dst);
 }
 
@@ -4722,6 +5487,166 @@ float GCAcomputeLogSampleProbability(
   return ((float)total_log_p / nsamples);
 }
 
+/*
+  GCASsoaAlloc() - the parts of each sample GCAcomputeLogSampleProbability()
+  reads, laid out by field, with the per-sample constants of the density
+  (normalizer, log prior, inverse covariance) computed once.
+*/
+GCAS_SOA *GCASsoaAlloc(GCA *gca, GCA_SAMPLE *gcas, int nsamples)
+{
+  GCAS_SOA *soa;
+  int i, j, ninputs;
+  MATRIX *m_cov = NULL, *m_inv = NULL;
+
+  ninputs = gca->ninputs;
+  soa = (GCAS_SOA *)calloc(1, sizeof(GCAS_SOA));
+  if (soa == NULL) ErrorExit(ERROR_NOMEMORY, "GCASsoaAlloc: could not allocate %d samples", nsamples);
+  soa->nsamples = nsamples;
+  soa->ninputs = ninputs;
+  soa->xp = (float *)calloc(nsamples, sizeof(float));
+  soa->yp = (float *)calloc(nsamples, sizeof(float));
+  soa->zp = (float *)calloc(nsamples, sizeof(float));
+  soa->means = (float *)calloc(nsamples * ninputs, sizeof(float));
+  soa->covars = (float *)calloc(nsamples, sizeof(float));
+  soa->inv_covars = (double *)calloc(nsamples * ninputs * ninputs, sizeof(double));
+  soa->log_norm = (double *)calloc(nsamples, sizeof(double));
+  soa->log_prior = (double *)calloc(nsamples, sizeof(double));
+  if (!soa->xp || !soa->yp || !soa->zp || !soa->means || !soa->covars || !soa->inv_covars || !soa->log_norm ||
+      !soa->log_prior)
+    ErrorExit(ERROR_NOMEMORY, "GCASsoaAlloc: could not allocate %d samples", nsamples);
+
+  for (i = 0; i < nsamples; i++) {
+    soa->xp[i] = gcas[i].xp;
+    soa->yp[i] = gcas[i].yp;
+    soa->zp[i] = gcas[i].zp;
+    for (j = 0; j < ninputs; j++) {
+      soa->means[i * ninputs + j] = gcas[i].means[j];
+    }
+    soa->covars[i] = gcas[i].covars[0];
+    soa->log_norm[i] = -log(sqrt(sample_covariance_determinant(&gcas[i], ninputs)));
+    soa->log_prior[i] = gcas_getPriorLog(gcas[i]);
+    if (ninputs > 1) {
+      // the same (upper triangular) matrix GCAsampleMahDist() inverts
+      m_cov = load_sample_covariance_matrix(&gcas[i], m_cov, ninputs);
+      m_inv = MatrixInverse(m_cov, m_inv);
+      if (!m_inv) {
+        ErrorExit(ERROR_BADPARM, "singular covariance matrix!");
+      }
+      for (j = 0; j < ninputs * ninputs; j++) {
+        soa->inv_covars[i * ninputs * ninputs + j] = *MATRIX_RELT(m_inv, j / ninputs + 1, j % ninputs + 1);
+      }
+    }
+  }
+  if (m_cov) MatrixFree(&m_cov);
+  if (m_inv) MatrixFree(&m_inv);
+
+  soa->m_prior2voxel = MatrixMultiply(gca->mri_tal__->r_to_i__, gca->prior_i_to_r__, NULL);
+  return (soa);
+}
+
+int GCASsoaFree(GCAS_SOA **psoa)
+{
+  GCAS_SOA *soa = *psoa;
+
+  *psoa = NULL;
+  if (soa == NULL) return (NO_ERROR);
+  free(soa->xp);
+  free(soa->yp);
+  free(soa->zp);
+  free(soa->means);
+  free(soa->covars);
+  free(soa->inv_covars);
+  free(soa->log_norm);
+  free(soa->log_prior);
+  MatrixFree(&soa->m_prior2voxel);
+  free(soa);
+  return (NO_ERROR);
+}
+
+float GCASsoaLogProbability(GCAS_SOA const *soa, MRI *mri_inputs, MATRIX const *m_L, int stride, double clamp)
+{
+  MATRIX *m_inv, *m_p2s;
+  float m[3][4];
+  double total_log_p = 0.0;
+  int i, r, c, nscored, ninputs = soa->ninputs;
+
+  // what TransformInvert() and GCAgetPriorToSourceVoxelMatrix() compute
+  m_inv = MatrixInverse(m_L, NULL);
+  if (m_inv == NULL) ErrorExit(ERROR_BADPARM, "TransformInvert: xform noninvertible");
+  m_p2s = MatrixMultiply(m_inv, soa->m_prior2voxel, NULL);
+  for (r = 0; r < 3; r++)
+    for (c = 0; c < 4; c++) {
+      m[r][c] = *MATRIX_RELT(m_p2s, r + 1, c + 1);
+    }
+  MatrixFree(&m_inv);
+  MatrixFree(&m_p2s);
+
+  if (stride < 1) stride = 1;
+  nscored = 0;
+  for (i = 0; i < soa->nsamples; i += stride, nscored++) {
+    float xv, yv, zv, vals[MAX_GCA_INPUTS];
+    int x, y, z;
+    double log_p;
+
+    // accumulated in float, in the order MatrixMultiply() does it
+    xv = 0.0f;
+    xv += m[0][0] * soa->xp[i];
+    xv += m[0][1] * soa->yp[i];
+    xv += m[0][2] * soa->zp[i];
+    xv += m[0][3];
+    yv = 0.0f;
+    yv += m[1][0] * soa->xp[i];
+    yv += m[1][1] * soa->yp[i];
+    yv += m[1][2] * soa->zp[i];
+    yv += m[1][3];
+    zv = 0.0f;
+    zv += m[2][0] * soa->xp[i];
+    zv += m[2][1] * soa->yp[i];
+    zv += m[2][2] * soa->zp[i];
+    zv += m[2][3];
+    x = nint(xv);
+    y = nint(yv);
+    z = nint(zv);
+
+    if (MRIindexNotInVolume(mri_inputs, x, y, z) == 0) {
+      if (ninputs == 1) {
+        float v;
+        load_vals(mri_inputs, x, y, z, vals, 1);
+        v = vals[0] - soa->means[i];
+        log_p = soa->log_norm[i] - .5 * (double)(v * v / soa->covars[i]);
+      }
+      else {
+        const float *means = soa->means + i * ninputs;
+        const double *inv = soa->inv_covars + i * ninputs * ninputs;
+        double d[MAX_GCA_INPUTS], dsq = 0.0;
+
+#ifdef FASTER_MRI_EM_REGISTER
+        load_vals_xyzInt(mri_inputs, x, y, z, vals, ninputs);
+#else
+        load_vals(mri_inputs, x, y, z, vals, ninputs);
+#endif
+        for (r = 0; r < ninputs; r++) {
+          d[r] = means[r] - vals[r];
+        }
+        for (r = 0; r < ninputs; r++)
+          for (c = 0; c < ninputs; c++) {
+            dsq += d[r] * inv[r * ninputs + c] * d[c];
+          }
+        log_p = soa->log_norm[i] - .5 * dsq;
+      }
+      log_p += soa->log_prior[i];
+      if (log_p < -clamp) log_p = -clamp;
+    }
+    else {
+      log_p = -1000000;  // as GCAcomputeLogSampleProbability() does
+    }
+    total_log_p += log_p;
+  }
+  // the mean, as GCAcomputeLogSampleProbability() returns, over the samples scored
+  if (nscored == 0) return (0.0f);
+  return ((float)total_log_p / nscored);
+}
+
 float GCAcomputeLogSampleProbabilityLongitudinal(
     GCA *gca, GCA_SAMPLE *gcas, MRI *mri_inputs, TRANSFORM *transform, int nsamples, double clamp)
 {
@@ -7127,6 +8052,9 @@ static int GCAupdateNodeGibbsPriors(GCA *gca, MRI *mri, int xn, int yn, int zn,
   GCA_NODE *gcan;
   GC1D *gc;
 
+  if (gca->pack) { /* packed arrays can't grow */
+    GCAunpack(gca);
+  }
   gcan = &gca->nodes[xn][yn][zn];
 
   // look for this label
@@ -7740,6 +8668,9 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
 
   mri_changed = MRIclone(mri_dst, NULL);
 
+  // every voxel tries each of its labels, so precompute the densities
+  gcaDensityCacheBegin(gca);
+
   /* go through each voxel in the input volume and find the canonical
      voxel (and hence the classifier) to which it maps. Then update the
      classifiers statistics based on this voxel's intensity and label.
@@ -7851,10 +8782,10 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
     // pragma omp parallel for if_ROMP(experimental) reduction(+: nchanged)
     //#endif
     for (index = 0; index < nindices; index++) {
-      int x, y, z, n, label, old_label;
+      int x, y, z, n, label, old_label, xn = 0, yn = 0, zn = 0, node_ok;
       GCA_PRIOR *gcap;
       double new_posterior, max_posterior;
-      // float val;
+      float vals[MAX_GCA_INPUTS];
 
       x = x_indices[index];
       y = y_indices[index];
@@ -7867,10 +8798,6 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       // if not marked, don't do anything
       if (MRIgetVoxVal(mri_changed, x, y, z, 0) == 0) continue;
 
-      // get the grey value
-      // val =
-      MRIgetVoxVal(mri_inputs, x, y, z, 0);
-
       /* find the node associated with this coordinate and classify */
       gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
       // it is not in the right place
@@ -7879,10 +8806,15 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       // only one label associated, don't do anything
       if (gcap->nlabels == 1) continue;
 
+      // get the grey value and node once for all the labels tried
+      load_vals(mri_inputs, x, y, z, vals, gca->ninputs);
+      node_ok = !GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn);
+
       // save the current label
       label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
       // calculate neighborhood likelihood
-      max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+      max_posterior = gcaVoxelGibbsLogPosteriorAtNode(
+          gca, mri_dst, mri_inputs, vals, x, y, z, node_ok, xn, yn, zn, gcap, transform, prior_factor);
 
       // go through all labels at this point
       for (n = 0; n < gcap->nlabels; n++) {
@@ -7892,7 +8824,8 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
         // assign the new label
         MRIsetVoxVal(mri_dst, x, y, z, 0, gcap->labels[n]);
         // calculate neighborhood likelihood
-        new_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+        new_posterior = gcaVoxelGibbsLogPosteriorAtNode(
+            gca, mri_dst, mri_inputs, vals, x, y, z, node_ok, xn, yn, zn, gcap, transform, prior_factor);
         // if it is bigger than the old one, then replace the label
         // and change max_posterior
         if (new_posterior > max_posterior) {
@@ -8186,6 +9119,7 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
   free(z_indices);
   MRIfree(&mri_changed);
 
+  gcaDensityCacheEnd(gca);
   return (mri_dst);
 }
 
@@ -8363,15 +9297,31 @@ double GCAwindowPosteriorLogProbability(
   return (total_posterior / nvox);
 }
 
-double GCAvoxelGibbsLogPosterior(
-    GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, int y, int z, TRANSFORM *transform, double gibbs_coef)
+/*
+  gcaVoxelGibbsLogPosteriorAtNode() - GCAvoxelGibbsLogPosterior() once the
+  voxel's values, node and prior are known, so that several labels can be
+  tried at a voxel without looking them up again. node_ok is zero if the
+  voxel has no node.
+*/
+static double gcaVoxelGibbsLogPosteriorAtNode(GCA *gca,
+                                              MRI *mri_labels,
+                                              MRI *mri_inputs,
+                                              float *vals,
+                                              int x,
+                                              int y,
+                                              int z,
+                                              int node_ok,
+                                              int xn,
+                                              int yn,
+                                              int zn,
+                                              GCA_PRIOR *gcap,
+                                              TRANSFORM *transform,
+                                              double gibbs_coef)
 {
   double log_posterior /*, dist*/, nbr_prior;
-  int xn, yn, zn, xnbr, ynbr, znbr, nbr_label, label, i, j, n;
+  int xnbr, ynbr, znbr, nbr_label, label, i, j, n;
   GCA_NODE *gcan = 0;
-  GCA_PRIOR *gcap = 0;
   GC1D *gc = 0;
-  float vals[MAX_GCA_INPUTS];
 #if INTERP_PRIOR
   float prior;
 #endif
@@ -8380,15 +9330,12 @@ double GCAvoxelGibbsLogPosterior(
   // signify error
   log_posterior = 0.;
 
-  // get the grey value
-  load_vals(mri_inputs, x, y, z, vals, gca->ninputs);
   // get the label
   label = nint(MRIgetVoxVal(mri_labels, x, y, z, 0));
   // what happens with higher number > CMA_MAX?
   /* find the node associated with this coordinate and classify */
-  if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
+  if (node_ok) {
     gcan = &gca->nodes[xn][yn][zn];
-    gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
     if (gcap == NULL || gcap->nlabels <= 0) {
       if (label == Unknown)  // okay for there to be an
                              // unknown label out of the fov
@@ -8510,6 +9457,31 @@ double GCAvoxelGibbsLogPosterior(
 #endif
   return (log_posterior);
 }
+
+double GCAvoxelGibbsLogPosterior(
+    GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, int y, int z, TRANSFORM *transform, double gibbs_coef)
+{
+  int xn = 0, yn = 0, zn = 0, node_ok;
+  float vals[MAX_GCA_INPUTS];
+
+  // get the grey value
+  load_vals(mri_inputs, x, y, z, vals, gca->ninputs);
+  node_ok = !GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn);
+  return (gcaVoxelGibbsLogPosteriorAtNode(gca,
+                                          mri_labels,
+                                          mri_inputs,
+                                          vals,
+                                          x,
+                                          y,
+                                          z,
+                                          node_ok,
+                                          xn,
+                                          yn,
+                                          zn,
+                                          node_ok ? getGCAP(gca, mri_inputs, transform, x, y, z) : NULL,
+                                          transform,
+                                          gibbs_coef));
+}
 // the posterior of an image given a segmentation without any MRF
 double GCAimagePosteriorLogProbability(GCA *gca, MRI *mri_labels, MRI *mri_inputs, TRANSFORM *transform)
 {
@@ -14475,6 +15447,58 @@ double GCAcomputeNormalizedConditionalDensity(GCA *gca, int xp, int yp, int zp,
   return (plabel);
 }
 
+/*
+  gcaCachedMahDist() - GCAmahDist() for a gc with a density cache entry,
+  which holds -log(sqrt(det(covars))) followed by the ninputs x ninputs
+  inverse covariance. One input is done exactly as GCAmahDist() does it.
+*/
+static inline double gcaCachedMahDist(const GC1D *gc, const float *vals, int ninputs)
+{
+  const double *inv = gc->dcache + 1;
+  double d[MAX_GCA_INPUTS], dsq;
+  int i, j;
+
+  if (ninputs == 1) {
+    float v;
+    v = vals[0] - gc->means[0];
+    dsq = v * v / gc->covars[0];
+    return (dsq);
+  }
+  for (i = 0; i < ninputs; i++) {
+    d[i] = gc->means[i] - vals[i];
+  }
+  for (dsq = 0.0, i = 0; i < ninputs; i++, inv += ninputs) {
+    double row = 0.0;
+    for (j = 0; j < ninputs; j++) {
+      row += inv[j] * d[j];
+    }
+    dsq += d[i] * row;
+  }
+  return (dsq);
+}
+
+/*
+  gcaComputeLogDensities() - gcaComputeLogDensity() for the n candidate
+  classifiers at one voxel at once. With a density cache active this is a
+  flat loop over the candidates with no matrix work.
+*/
+static void gcaComputeLogDensities(GC1D **gcs, const float *priors, int n, const float *vals, int ninputs, double *log_p)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (gcs[i]->dcache) {
+      log_p[i] = gcs[i]->dcache[0] - .5 * gcaCachedMahDist(gcs[i], vals, ninputs);
+    }
+    else {
+      log_p[i] = GCAcomputeConditionalLogDensity(gcs[i], (float *)vals, ninputs, 0);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    log_p[i] += log(priors[i]);
+  }
+}
+
 static double gcaComputeLogDensity(GC1D *gc, float *vals, int ninputs, float prior, int label)
 {
   double log_p;
@@ -14488,6 +15512,10 @@ double GCAcomputeConditionalLogDensity(const GC1D *gc, float *vals, int ninputs,
 {
   double log_p, det;
 
+  if (gc->dcache) {
+    return (gc->dcache[0] - .5 * gcaCachedMahDist(gc, vals, ninputs));
+  }
+
 /* compute 1-d Mahalanobis distance */
 #if 0
   if (label == Unknown)  /* uniform distribution */
@@ -14892,6 +15920,27 @@ int GCAfreeGibbs(GCA *gca)
     return (NO_ERROR); /* already done */
   }
 
+  if (gca->pack) /* the gibbs arrays are part of the packed image */
+  {
+    for (x = 0; x < gca->node_width; x++)
+      for (y = 0; y < gca->node_height; y++)
+        for (z = 0; z < gca->node_depth; z++) {
+          gcan = &gca->nodes[x][y][z];
+          for (n = 0; n < gcan->nlabels; n++) {
+            gc = &gcan->gcs[n];
+            gc->nlabels = NULL;
+            gc->labels = NULL;
+            gc->label_priors = NULL;
+          }
+        }
+    free(gca->pack->gibbs_labels);
+    free(gca->pack->gibbs_priors);
+    gca->pack->gibbs_labels = NULL;
+    gca->pack->gibbs_priors = NULL;
+    gca->flags |= GCA_NO_MRF;
+    return (NO_ERROR);
+  }
+
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -15258,6 +16307,113 @@ double covariance_determinant(const GC1D *gc, const int ninputs)
   return (det);
 }
 
+/*
+  gcaDensityCacheBegin() - precompute -log(sqrt(det)) and the inverse
+  covariance of every classifier in the atlas into gca->dcache and point
+  each gc->dcache at its entry, so GCAcomputeConditionalLogDensity() is a
+  few multiply-adds. The means and covariances must not change until the
+  matching gcaDensityCacheEnd(); begin/end pairs may nest. A classifier
+  whose covariance cannot be inverted gets no entry and is computed the
+  old way.
+*/
+static int gcaDensityCacheBegin(GCA *gca)
+{
+  int x, ninputs, stride;
+  long long ngcs, *node_offsets;
+
+  if (gca->dcache_refs++ > 0) {
+    return (NO_ERROR);
+  }
+
+  ninputs = gca->ninputs;
+  stride = 1 + ninputs * ninputs;
+  node_offsets = (long long *)calloc(gca->node_width * gca->node_height, sizeof(long long));
+  if (node_offsets == NULL) {
+    ErrorExit(ERROR_NOMEMORY, "gcaDensityCacheBegin: could not allocate offsets");
+  }
+  for (ngcs = 0, x = 0; x < gca->node_width; x++) {
+    int y, z;
+    for (y = 0; y < gca->node_height; y++) {
+      node_offsets[x * gca->node_height + y] = ngcs;
+      for (z = 0; z < gca->node_depth; z++) {
+        ngcs += gca->nodes[x][y][z].nlabels;
+      }
+    }
+  }
+  gca->dcache = (double *)calloc(ngcs ? ngcs * stride : 1, sizeof(double));
+  if (gca->dcache == NULL) {
+    ErrorExit(ERROR_NOMEMORY, "gcaDensityCacheBegin: could not allocate %lld entries", ngcs);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (x = 0; x < gca->node_width; x++) {
+    ROMP_PFLB_begin
+    int y, z, n, i, j;
+    MATRIX *m_cov = NULL, *m_inv = NULL;
+
+    if (ninputs > 1) {
+      m_cov = MatrixAlloc(ninputs, ninputs, MATRIX_REAL);
+      m_inv = MatrixAlloc(ninputs, ninputs, MATRIX_REAL);
+    }
+    for (y = 0; y < gca->node_height; y++) {
+      double *entry = gca->dcache + node_offsets[x * gca->node_height + y] * stride;
+      for (z = 0; z < gca->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        for (n = 0; n < gcan->nlabels; n++, entry += stride) {
+          GC1D *gc = &gcan->gcs[n];
+          entry[0] = -log(sqrt(covariance_determinant(gc, ninputs)));
+          if (ninputs == 1) {
+            entry[1] = 1.0 / gc->covars[0];
+            gc->dcache = entry;
+            continue;
+          }
+          // the same inverse GCAmahDist() uses
+          m_cov = load_covariance_matrix(gc, m_cov, ninputs);
+          if (MatrixInverse(m_cov, m_inv) == NULL) {
+            gc->dcache = NULL;
+            continue;
+          }
+          MatrixSVDInverse(m_cov, m_inv);
+          for (i = 0; i < ninputs; i++)
+            for (j = 0; j < ninputs; j++) {
+              entry[1 + i * ninputs + j] = *MATRIX_RELT(m_inv, i + 1, j + 1);
+            }
+          gc->dcache = entry;
+        }
+      }
+    }
+    if (m_cov) MatrixFree(&m_cov);
+    if (m_inv) MatrixFree(&m_inv);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(node_offsets);
+  return (NO_ERROR);
+}
+
+static void gcaDensityCacheEnd(GCA *gca)
+{
+  int x, y, z, n;
+
+  if (--gca->dcache_refs > 0) {
+    return;
+  }
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        for (n = 0; n < gcan->nlabels; n++) {
+          gcan->gcs[n].dcache = NULL;
+        }
+      }
+  free(gca->dcache);
+  gca->dcache = NULL;
+}
+
 static double gcaComputeSampleLogDensity(GCA_SAMPLE *gcas, float *vals, int ninputs)
 {
   double log_p;
@@ -22082,6 +23238,10 @@ GCA *GCAcompactify(GCA *gca)
   int i, j, k;
   double byteSaved = 0.;
 
+  if (gca->pack) {
+    return gca;  // nothing to trim
+  }
+
   width = gca->prior_width;
   height = gca->prior_height;
   depth = gca->prior_depth;
@@ -26066,6 +27226,9 @@ int GCAinsertLabels(GCA *gca,
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  if (gca->pack) { /* packed arrays can't grow */
+    GCAunpack(gca);
+  }
   for (l = 0; l < ninsertions; l++) {
     whalf = insert_whalf[l];
     label = insert_labels[l];
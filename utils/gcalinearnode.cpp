@@ -426,6 +426,9 @@ void GCAlinearNode::ScorchNodes(GCA *targ) const
     a GCA, prior to inhumation of new data
   */
 
+  // Packed storage is owned by the GCA as a whole
+  GCAunpack(targ);
+
   for (int ix = 0; ix < targ->node_width; ix++) {
     for (int iy = 0; iy < targ->node_height; iy++) {
       for (int iz = 0; iz < targ->node_depth; iz++) {
@@ -242,6 +242,10 @@ void GCAlinearPrior::ScorchPriors(GCA *targ) const
     This method destroys the priors structure of a GCA,
     prior to inhumation of new data
   */
+
+  // Packed storage is owned by the GCA as a whole
+  GCAunpack(targ);
+
   for (int ix = 0; ix < targ->prior_width; ix++) {
     for (int iy = 0; iy < targ->prior_height; iy++) {
       for (int iz = 0; iz < targ->prior_depth; iz++) {
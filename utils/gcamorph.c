@@ -80,6 +80,7 @@
 #include <stdlib.h>
 
 #include "faster_variants.h"
+#include "fnv_hash.h"
 #include "romp_support.h"
 
 #include "cma.h"
@@ -205,6 +206,7 @@ double gcamMaxGradient(GCA_MORPH *gcam);
 int gcamCheck(GCA_MORPH *gcam, MRI *mri);
 int gcamWriteDiagnostics(GCA_MORPH *gcam);
 int gcamShowCompressed(GCA_MORPH *gcam, FILE *fp);
+static void gcamSetMorphedGeometry(MRI *mri_morphed, const VOL_GEOM *atlas);
 MATRIX *gcamComputeOptimalTargetLinearTransform(GCA_MORPH *gcam, MATRIX *m_L, double reg);
 int gcamApplyLinearTransform(GCA_MORPH *gcam, MATRIX *m_L);
 int gcamComputeTargetGradient(GCA_MORPH *gcam);
@@ -4780,10 +4782,8 @@ int GCAMmorphPlistToSource(int N, float *points_in, GCA_MORPH *gcam, float *poin
 
 MRI *GCAMmorphToAtlas(MRI *mri_src, GCA_MORPH *gcam, MRI *mri_morphed, int frame, int sample_type)
 {
-  int width, height, depth, x, y, z, start_frame, end_frame;
-  int out_of_gcam;
-  float xd, yd, zd;
-  double val, xoff, yoff, zoff;
+  int width, height, depth, x, start_frame, end_frame;
+  double xoff, yoff, zoff;
 
   if (frame >= 0 && frame < mri_src->nframes) {
     start_frame = end_frame = frame;
@@ -4836,7 +4836,16 @@ MRI *GCAMmorphToAtlas(MRI *mri_src, GCA_MORPH *gcam, MRI *mri_morphed, int frame
   }
 
   // x, y, z are the col, row, and slice (and xyz) in the gcam/target volume
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
   for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+    int y, z, f, out_of_gcam;
+    float xd, yd, zd;
+    double val;
+
     for (y = 0; y < height; y++) {
       for (z = 0; z < depth; z++) {
         if (x == Gx && y == Gy && z == Gz) {
@@ -4861,33 +4870,44 @@ MRI *GCAMmorphToAtlas(MRI *mri_src, GCA_MORPH *gcam, MRI *mri_morphed, int frame
           xd += xoff;
           yd += yoff;
           zd += zoff;
-          for (frame = start_frame; frame <= end_frame; frame++) {
+          for (f = start_frame; f <= end_frame; f++) {
             if (nint(xd) == Gx && nint(yd) == Gy && nint(zd) == Gz) {
               DiagBreak();
             }
 
             if (xd > -1 && yd > -1 && zd > 0 && xd < mri_src->width && yd < mri_src->height && zd < mri_src->depth) {
               if (sample_type == SAMPLE_CUBIC_BSPLINE) {
-                MRIsampleBSpline(bspline, xd, yd, zd, frame, &val);
+                MRIsampleBSpline(bspline, xd, yd, zd, f, &val);
               }
               else
-                MRIsampleVolumeFrameType(mri_src, xd, yd, zd, frame, sample_type, &val);
+                MRIsampleVolumeFrameType(mri_src, xd, yd, zd, f, sample_type, &val);
               // printf("Within GCAMmorphToAtlas: (%d, %d, %d): (%f, %f, %f): %f \n", x, y, z, xd, yd, zd, val) ;
             }
             else {
               val = 0.0;
             }
-            MRIsetVoxVal(mri_morphed, x, y, z, frame - start_frame, val);
+            MRIsetVoxVal(mri_morphed, x, y, z, f - start_frame, val);
           }
         }
       }
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
   if (bspline) {
     MRIfreeBSpline(&bspline);
   }
 
-  // copy the gcam dst information to the morphed volume
+  gcamSetMorphedGeometry(mri_morphed, &gcam->atlas);
+  return (mri_morphed);
+}
+
+/*
+  gcamSetMorphedGeometry() - copy the gcam dst (atlas) information to a
+  volume morphed to the atlas
+*/
+static void gcamSetMorphedGeometry(MRI *mri_morphed, const VOL_GEOM *atlas)
+{
   if (getenv("USE_AVERAGE305")) {
     fprintf(stderr, "INFO: Environmental variable USE_AVERAGE305 set\n");
     fprintf(stderr, "INFO: Modifying dst c_(r,a,s), using average_305 values\n");
@@ -4900,9 +4920,264 @@ MRI *GCAMmorphToAtlas(MRI *mri_src, GCA_MORPH *gcam, MRI *mri_morphed, int frame
     MRIreInitCache(mri_morphed);
   }
   else {
-    useVolGeomToMRI(&gcam->atlas, mri_morphed);
+    useVolGeomToMRI(atlas, mri_morphed);
+  }
+}
+
+/*
+  gcamMorphFieldId() - a hash of everything GCAMmorphToAtlasField() reads:
+  the node positions and invalid flags, after GCAMapplyTransform() has
+  folded in any registration, the node grid and atlas geometry, and the
+  MGH_TAL offset. Each x plane is hashed in parallel and the plane hashes
+  are then combined in order, so the id does not depend on the threads.
+*/
+static unsigned long gcamMorphFieldId(GCA_MORPH *gcam, double xoff, double yoff, double zoff)
+{
+  unsigned long hash, *plane_hash;
+  double geom[25];
+  int x;
+
+  plane_hash = (unsigned long *)calloc(gcam->width, sizeof(unsigned long));
+  if (!plane_hash) {
+    ErrorExit(ERROR_NOMEMORY, "gcamMorphFieldId: could not allocate %d planes", gcam->width);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (x = 0; x < gcam->width; x++) {
+    ROMP_PFLB_begin
+    unsigned long h = fnv_init();
+    int y, z;
+
+    for (y = 0; y < gcam->height; y++) {
+      for (z = 0; z < gcam->depth; z++) {
+        GCA_MORPH_NODE const *gcamn = &gcam->nodes[x][y][z];
+        double xyz[3];
+        int invalid = gcamn->invalid;
+        xyz[0] = gcamn->x;
+        xyz[1] = gcamn->y;
+        xyz[2] = gcamn->z;
+        h = fnv_add(h, (const unsigned char *)xyz, sizeof(xyz));
+        h = fnv_add(h, (const unsigned char *)&invalid, sizeof(invalid));
+      }
+    }
+    plane_hash[x] = h;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  geom[0] = gcam->width;
+  geom[1] = gcam->height;
+  geom[2] = gcam->depth;
+  geom[3] = gcam->spacing;
+  geom[4] = gcam->atlas.width;
+  geom[5] = gcam->atlas.height;
+  geom[6] = gcam->atlas.depth;
+  geom[7] = gcam->atlas.xsize;
+  geom[8] = gcam->atlas.ysize;
+  geom[9] = gcam->atlas.zsize;
+  geom[10] = gcam->atlas.x_r;
+  geom[11] = gcam->atlas.x_a;
+  geom[12] = gcam->atlas.x_s;
+  geom[13] = gcam->atlas.y_r;
+  geom[14] = gcam->atlas.y_a;
+  geom[15] = gcam->atlas.y_s;
+  geom[16] = gcam->atlas.z_r;
+  geom[17] = gcam->atlas.z_a;
+  geom[18] = gcam->atlas.z_s;
+  geom[19] = gcam->atlas.c_r;
+  geom[20] = gcam->atlas.c_a;
+  geom[21] = gcam->atlas.c_s;
+  geom[22] = xoff;
+  geom[23] = yoff;
+  geom[24] = zoff;
+
+  hash = fnv_add(fnv_init(), (const unsigned char *)geom, sizeof(geom));
+  hash = fnv_add(hash, (const unsigned char *)plane_hash, gcam->width * sizeof(unsigned long));
+  free(plane_hash);
+  return (hash);
+}
+
+/*
+  GCAMmorphToAtlasField() - "compiles" the morph for resampling many
+  volumes: the source voxel coords of every atlas voxel, computed as
+  GCAMmorphToAtlas() does (including the MGH_TAL offset). Frames 0-2
+  are x, y and z, and atlas voxels outside the morph have an x of
+  GCAM_FIELD_INVALID. The header is the atlas geometry. Any linear
+  transform should already be applied to the gcam with
+  GCAMapplyTransform(), so the field holds the whole chain.
+
+  If cache_fname is not NULL the field is read from it if it was written
+  from the same morph, otherwise it is computed and written to it. The
+  cache records gcamMorphFieldId() of the gcam it was computed from in
+  its command lines, so a cache left by a different m3z or --reg (or one
+  in a format that drops the command lines) is recomputed, not reused.
+*/
+MRI *GCAMmorphToAtlasField(GCA_MORPH *gcam, const char *cache_fname)
+{
+  int width, height, depth, x, n;
+  double xoff, yoff, zoff;
+  char id[STRLEN];
+  MRI *mri_field;
+
+  width = gcam->width * gcam->spacing;
+  height = gcam->height * gcam->spacing;
+  depth = gcam->depth * gcam->spacing;
+
+  if (getenv("MGH_TAL")) {
+    xoff = -7.42;
+    yoff = 24.88;
+    zoff = -18.85;
+    printf("INFO: adding MGH tal offset (%2.1f, %2.1f, %2.1f) to xform\n", xoff, yoff, zoff);
+  }
+  else {
+    xoff = yoff = zoff = 0;
+  }
+
+  if (cache_fname) {
+    sprintf(id, "GCAMmorphToAtlasField id %016lx", gcamMorphFieldId(gcam, xoff, yoff, zoff));
+  }
+
+  if (cache_fname && fio_FileExistsReadable(cache_fname)) {
+    mri_field = MRIread(cache_fname);
+    if (mri_field && mri_field->width == width && mri_field->height == height && mri_field->depth == depth &&
+        mri_field->nframes == 3 && mri_field->type == MRI_FLOAT) {
+      for (n = 0; n < mri_field->ncmds; n++) {
+        if (!strcmp(mri_field->cmdlines[n], id)) {
+          return (mri_field);
+        }
+      }
+    }
+    printf("GCAMmorphToAtlasField: %s was not written from this morph, recomputing it\n", cache_fname);
+    if (mri_field) {
+      MRIfree(&mri_field);
+    }
+  }
+
+  mri_field = MRIallocSequence(width, height, depth, MRI_FLOAT, 3);
+  if (!mri_field) {
+    ErrorExit(ERROR_NOMEMORY, "GCAMmorphToAtlasField: could not allocate %dx%dx%d field", width, height, depth);
+  }
+  useVolGeomToMRI(&gcam->atlas, mri_field);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+    int y, z;
+    float xd, yd, zd;
+
+    for (y = 0; y < height; y++) {
+      for (z = 0; z < depth; z++) {
+        if (GCAMsampleMorph(gcam, (float)x, (float)y, (float)z, &xd, &yd, &zd)) {
+          MRIFseq_vox(mri_field, x, y, z, 0) = GCAM_FIELD_INVALID;
+          continue;
+        }
+        xd += xoff;
+        yd += yoff;
+        zd += zoff;
+        MRIFseq_vox(mri_field, x, y, z, 0) = xd;
+        MRIFseq_vox(mri_field, x, y, z, 1) = yd;
+        MRIFseq_vox(mri_field, x, y, z, 2) = zd;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (cache_fname) {
+    MRIaddCommandLine(mri_field, id);
+    if (MRIwrite(mri_field, cache_fname) != NO_ERROR) {
+      printf("GCAMmorphToAtlasField: could not write cache %s\n", cache_fname);
+    }
+  }
+  return (mri_field);
+}
+
+/*
+  GCAMmorphFieldApply() - GCAMmorphToAtlas() through a field from
+  GCAMmorphToAtlasField(), which gives the same volume without sampling
+  the morph again. The voxels are resampled in parallel.
+*/
+MRI *GCAMmorphFieldApply(MRI *mri_src, MRI *mri_field, MRI *mri_morphed, int frame, int sample_type)
+{
+  int width, height, depth, x, start_frame, end_frame;
+  VOL_GEOM atlas;
+
+  if (frame >= 0 && frame < mri_src->nframes) {
+    start_frame = end_frame = frame;
+  }
+  else {
+    start_frame = 0;
+    end_frame = mri_src->nframes - 1;
+  }
+
+  width = mri_field->width;
+  height = mri_field->height;
+  depth = mri_field->depth;
+
+  if (mri_morphed) {
+    if ((mri_src->xsize != mri_src->ysize) || (mri_src->xsize != mri_src->zsize) ||
+        (mri_src->ysize != mri_src->zsize)) {
+      ErrorExit(ERROR_BADPARM, "non-uniform volumes cannot be used for GCAMmorphFieldApply()\n");
+    }
+  }
+  if (!mri_morphed) {
+    mri_morphed = MRIallocSequence(width, height, depth, mri_src->type, frame < 0 ? mri_src->nframes : 1);
+    MRIcopyHeader(mri_src, mri_morphed);
+  }
+
+  MRI_BSPLINE *bspline = NULL;
+  if (sample_type == SAMPLE_CUBIC_BSPLINE) {
+    bspline = MRItoBSpline(mri_src, NULL, 3);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+    int y, z, f;
+    float xd, yd, zd;
+    double val;
+
+    for (y = 0; y < height; y++) {
+      for (z = 0; z < depth; z++) {
+        xd = MRIFseq_vox(mri_field, x, y, z, 0);
+        if (xd == GCAM_FIELD_INVALID) {
+          continue;
+        }
+        yd = MRIFseq_vox(mri_field, x, y, z, 1);
+        zd = MRIFseq_vox(mri_field, x, y, z, 2);
+        for (f = start_frame; f <= end_frame; f++) {
+          if (xd > -1 && yd > -1 && zd > 0 && xd < mri_src->width && yd < mri_src->height && zd < mri_src->depth) {
+            if (sample_type == SAMPLE_CUBIC_BSPLINE) {
+              MRIsampleBSpline(bspline, xd, yd, zd, f, &val);
+            }
+            else
+              MRIsampleVolumeFrameType(mri_src, xd, yd, zd, f, sample_type, &val);
+          }
+          else {
+            val = 0.0;
+          }
+          MRIsetVoxVal(mri_morphed, x, y, z, f - start_frame, val);
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  if (bspline) {
+    MRIfreeBSpline(&bspline);
   }
 
+  getVolGeom(mri_field, &atlas);
+  gcamSetMorphedGeometry(mri_morphed, &atlas);
   return (mri_morphed);
 }
 MRI *GCAMmorphToAtlasWithDensityCorrection(MRI *mri_src, GCA_MORPH *gcam, MRI *mri_morphed, int frame)
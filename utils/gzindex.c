@@ -0,0 +1,494 @@
+/**
+ * @file  gzindex.c
+ * @brief random access into gzip files (eg, .mgz) through a seek index
+ *
+ * See gzindex.h. Index building follows zran.c from the zlib distribution,
+ * extended to files made of several concatenated gzip members (as written
+ * by pigz-style block compressors).
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "zlib.h"
+
+#include "const.h"
+#include "diag.h"
+#include "error.h"
+#include "fio.h"
+#include "romp_support.h"
+
+#include "gzindex.h"
+
+#define GZI_CHUNK   (256 * 1024)  // compressed bytes read at a time
+#define GZI_MAGIC   0x475a4931    // "GZI1"
+#define GZI_VERSION 1
+
+static int gziAddPoint(GZ_INDEX *gzi, int bits, long long in, long long out, unsigned left, unsigned char *window)
+{
+  GZI_POINT *p;
+
+  if (gzi->npoints == gzi->max_points) {
+    gzi->max_points = gzi->max_points ? 2 * gzi->max_points : 64;
+    gzi->points = (GZI_POINT *)realloc(gzi->points, gzi->max_points * sizeof(GZI_POINT));
+    if (gzi->points == NULL) return (ERROR_NOMEMORY);
+  }
+  p = &gzi->points[gzi->npoints];
+  p->bits = bits;
+  p->in = in;
+  p->out = out;
+  p->window = (unsigned char *)malloc(GZI_WINSIZE);
+  if (p->window == NULL) return (ERROR_NOMEMORY);
+  // the window is circular: the oldest output starts at window+(WINSIZE-left)
+  if (left) memcpy(p->window, window + GZI_WINSIZE - left, left);
+  if (left < GZI_WINSIZE) memcpy(p->window + left, window, GZI_WINSIZE - left);
+  gzi->npoints++;
+  return (NO_ERROR);
+}
+
+static int gziStat(const char *fname, long long *psize, long long *pmtime)
+{
+  struct stat st;
+  if (stat(fname, &st) != 0) return (ERROR_NOFILE);
+  *psize = (long long)st.st_size;
+  *pmtime = (long long)st.st_mtime;
+  return (NO_ERROR);
+}
+
+/*!
+  \fn GZ_INDEX *GZindexBuild(const char *gzfname, long long span)
+  \brief Decompresses the whole file once, recording an access point at
+  the first deflate block boundary after every span bytes of output.
+  Returns NULL if the file is not a valid gzip file.
+*/
+GZ_INDEX *GZindexBuild(const char *gzfname, long long span)
+{
+  FILE *fp;
+  GZ_INDEX *gzi;
+  z_stream strm;
+  unsigned char *input, *window;
+  long long totin, totout, last;
+  int ret, err = 0;
+
+  if (span <= 0) span = GZI_DEFAULT_SPAN;
+  fp = fopen(gzfname, "rb");
+  if (fp == NULL) ErrorReturn(NULL, (ERROR_NOFILE, "GZindexBuild(%s): could not open file", gzfname));
+
+  gzi = (GZ_INDEX *)calloc(1, sizeof(GZ_INDEX));
+  input = (unsigned char *)malloc(GZI_CHUNK);
+  window = (unsigned char *)calloc(GZI_WINSIZE, 1);
+  if (gzi == NULL || input == NULL || window == NULL) ErrorExit(ERROR_NOMEMORY, "GZindexBuild: out of memory");
+  gzi->span = span;
+  gziStat(gzfname, &gzi->file_size, &gzi->file_mtime);
+
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, 47) != Z_OK)  // 47: detect the gzip/zlib header
+    ErrorExit(ERROR_NOMEMORY, "GZindexBuild: inflateInit2 failed");
+
+  totin = totout = last = 0;
+  ret = Z_OK;
+  for (;;) {
+    if (strm.avail_in == 0) {
+      strm.avail_in = fread(input, 1, GZI_CHUNK, fp);
+      strm.next_in = input;
+      if (ferror(fp)) {
+        err = ERROR_BADFILE;
+        break;
+      }
+      if (strm.avail_in == 0) {
+        if (ret != Z_STREAM_END) err = ERROR_BADFILE;  // truncated
+        break;
+      }
+    }
+    if (ret == Z_STREAM_END) {
+      // another gzip member may follow; anything else is trailing junk
+      if (strm.next_in[0] != 0x1f) break;
+      inflateReset(&strm);
+    }
+    if (strm.avail_out == 0) {
+      strm.avail_out = GZI_WINSIZE;
+      strm.next_out = window;
+    }
+
+    // stop at the end of every deflate block so access points can be recorded
+    totin += strm.avail_in;
+    totout += strm.avail_out;
+    ret = inflate(&strm, Z_BLOCK);
+    totin -= strm.avail_in;
+    totout -= strm.avail_out;
+    if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+      err = ERROR_BADFILE;
+      break;
+    }
+
+    // bit 7 of data_type: at a block boundary; bit 6: it was the last block
+    if (ret != Z_STREAM_END && (strm.data_type & 128) && !(strm.data_type & 64) &&
+        (gzi->npoints == 0 || totout - last > span)) {
+      if (gziAddPoint(gzi, strm.data_type & 7, totin, totout, strm.avail_out, window) != NO_ERROR) {
+        err = ERROR_NOMEMORY;
+        break;
+      }
+      last = totout;
+    }
+  }
+
+  inflateEnd(&strm);
+  fclose(fp);
+  free(input);
+  free(window);
+  gzi->length = totout;
+  if (err || gzi->npoints == 0) {
+    GZindexFree(&gzi);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GZindexBuild(%s): not a valid gzip file", gzfname));
+  }
+  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
+    printf("GZindexBuild(%s): %d access points over %lld bytes\n", gzfname, gzi->npoints, gzi->length);
+  return (gzi);
+}
+
+int GZindexFree(GZ_INDEX **pgzi)
+{
+  GZ_INDEX *gzi = *pgzi;
+  int n;
+
+  if (gzi == NULL) return (NO_ERROR);
+  for (n = 0; n < gzi->npoints; n++) free(gzi->points[n].window);
+  free(gzi->points);
+  free(gzi);
+  *pgzi = NULL;
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int GZindexWrite(const GZ_INDEX *gzi, const char *idxfname)
+  \brief Saves the index. Big-endian like the other FreeSurfer binary formats.
+*/
+int GZindexWrite(const GZ_INDEX *gzi, const char *idxfname)
+{
+  FILE *fp;
+  int n;
+
+  fp = fopen(idxfname, "wb");
+  if (fp == NULL) ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "GZindexWrite(%s): could not open file", idxfname));
+
+  fwriteInt(GZI_MAGIC, fp);
+  fwriteInt(GZI_VERSION, fp);
+  fwriteLong(gzi->file_size, fp);
+  fwriteLong(gzi->file_mtime, fp);
+  fwriteLong(gzi->length, fp);
+  fwriteLong(gzi->span, fp);
+  fwriteInt(gzi->npoints, fp);
+  for (n = 0; n < gzi->npoints; n++) {
+    fwriteLong(gzi->points[n].in, fp);
+    fwriteLong(gzi->points[n].out, fp);
+    fwriteInt(gzi->points[n].bits, fp);
+    if (fwrite(gzi->points[n].window, 1, GZI_WINSIZE, fp) != GZI_WINSIZE) {
+      fclose(fp);
+      unlink(idxfname);
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GZindexWrite(%s): write failed", idxfname));
+    }
+  }
+  if (fclose(fp) != 0) {
+    unlink(idxfname);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GZindexWrite(%s): write failed", idxfname));
+  }
+  return (NO_ERROR);
+}
+
+GZ_INDEX *GZindexRead(const char *idxfname)
+{
+  FILE *fp;
+  GZ_INDEX *gzi;
+  int n, magic, version, npoints;
+
+  fp = fopen(idxfname, "rb");
+  if (fp == NULL) return (NULL);
+
+  magic = freadInt(fp);
+  version = freadInt(fp);
+  if (magic != GZI_MAGIC || version != GZI_VERSION) {
+    fclose(fp);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GZindexRead(%s): not a gzip index file", idxfname));
+  }
+  gzi = (GZ_INDEX *)calloc(1, sizeof(GZ_INDEX));
+  gzi->file_size = freadLong(fp);
+  gzi->file_mtime = freadLong(fp);
+  gzi->length = freadLong(fp);
+  gzi->span = freadLong(fp);
+  npoints = freadInt(fp);
+  if (npoints <= 0) {
+    fclose(fp);
+    free(gzi);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GZindexRead(%s): bad # of access points %d", idxfname, npoints));
+  }
+  gzi->points = (GZI_POINT *)calloc(npoints, sizeof(GZI_POINT));
+  gzi->max_points = npoints;
+  for (n = 0; n < npoints; n++) {
+    GZI_POINT *p = &gzi->points[n];
+    p->in = freadLong(fp);
+    p->out = freadLong(fp);
+    p->bits = freadInt(fp);
+    p->window = (unsigned char *)malloc(GZI_WINSIZE);
+    gzi->npoints++;
+    if (p->window == NULL || fread(p->window, 1, GZI_WINSIZE, fp) != GZI_WINSIZE) {
+      fclose(fp);
+      GZindexFree(&gzi);
+      ErrorReturn(NULL, (ERROR_BADFILE, "GZindexRead(%s): truncated file", idxfname));
+    }
+  }
+  fclose(fp);
+  return (gzi);
+}
+
+/*!
+  \fn int GZindexIsCurrent(const GZ_INDEX *gzi, const char *gzfname)
+  \brief Returns 1 if the index was built from the file as it is now
+  (same size and modification time), 0 otherwise.
+*/
+int GZindexIsCurrent(const GZ_INDEX *gzi, const char *gzfname)
+{
+  long long size, mtime;
+  if (gziStat(gzfname, &size, &mtime) != NO_ERROR) return (0);
+  return (size == gzi->file_size && mtime == gzi->file_mtime);
+}
+
+/*!
+  \fn GZ_INDEX *GZindexGet(const char *gzfname, int cache)
+  \brief Returns the index of gzfname, loading it from <gzfname>.gzidx if
+  that is up to date, otherwise building it. If cache is set, a newly built
+  index is saved next to the file; not being able to write it (eg, a read
+  only directory) is not an error.
+*/
+GZ_INDEX *GZindexGet(const char *gzfname, int cache)
+{
+  char idxfname[STRLEN];
+  GZ_INDEX *gzi = NULL;
+
+  snprintf(idxfname, sizeof(idxfname), "%s%s", gzfname, GZI_EXTENSION);
+  if (fio_FileExistsReadable(idxfname)) {
+    gzi = GZindexRead(idxfname);
+    if (gzi && !GZindexIsCurrent(gzi, gzfname)) GZindexFree(&gzi);
+  }
+  if (gzi) return (gzi);
+
+  gzi = GZindexBuild(gzfname, GZI_DEFAULT_SPAN);
+  if (gzi && cache) {
+    int old_errno = errno;
+    if (GZindexWrite(gzi, idxfname) != NO_ERROR && Gdiag_no >= 0)
+      printf("INFO: GZindexGet(): could not cache index of %s\n", gzfname);
+    errno = old_errno;
+  }
+  return (gzi);
+}
+
+/* Inflates the len bytes of uncompressed data starting at offset, which
+   must lie between access point p and the next one. Reads through the
+   thread-safe pread() so several segments can be decoded at once. */
+static int gziExtractSegment(int fd, const GZI_POINT *p, long long offset, unsigned char *buf, long long len)
+{
+  z_stream strm;
+  unsigned char *input, *discard;
+  long long pos, skip;
+  int ret, trailer = 0, gzip_mode = 0, err = 0;
+  ssize_t n;
+
+  input = (unsigned char *)malloc(GZI_CHUNK);
+  discard = (unsigned char *)malloc(GZI_WINSIZE);
+  if (input == NULL || discard == NULL) ErrorExit(ERROR_NOMEMORY, "GZindexExtract: out of memory");
+
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, -15) != Z_OK)  // raw deflate from the access point
+    ErrorExit(ERROR_NOMEMORY, "GZindexExtract: inflateInit2 failed");
+
+  pos = p->in - (p->bits ? 1 : 0);
+  if (p->bits) {
+    unsigned char c;
+    if (pread(fd, &c, 1, pos) != 1) err = 1;
+    pos++;
+    inflatePrime(&strm, p->bits, c >> (8 - p->bits));
+  }
+  inflateSetDictionary(&strm, p->window, GZI_WINSIZE);
+
+  skip = offset - p->out;
+  while (!err && len > 0) {
+    if (strm.avail_in == 0) {
+      n = pread(fd, input, GZI_CHUNK, pos);
+      if (n <= 0) {
+        err = 1;
+        break;
+      }
+      pos += n;
+      strm.next_in = input;
+      strm.avail_in = n;
+    }
+    if (trailer) {
+      // skip the 8-byte crc/size trailer of a member decoded in raw mode,
+      // then let zlib parse the header of the next member
+      unsigned k = strm.avail_in < (unsigned)trailer ? strm.avail_in : (unsigned)trailer;
+      strm.next_in += k;
+      strm.avail_in -= k;
+      trailer -= k;
+      if (trailer == 0) inflateReset2(&strm, 31);
+      continue;
+    }
+
+    unsigned want;
+    if (skip > 0) {
+      want = skip < GZI_WINSIZE ? (unsigned)skip : GZI_WINSIZE;
+      strm.next_out = discard;
+    }
+    else {
+      want = len < (1 << 30) ? (unsigned)len : (1 << 30);
+      strm.next_out = buf;
+    }
+    strm.avail_out = want;
+    ret = inflate(&strm, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+      err = 1;
+      break;
+    }
+    want -= strm.avail_out;
+    if (skip > 0)
+      skip -= want;
+    else {
+      buf += want;
+      len -= want;
+    }
+    if (ret == Z_STREAM_END) {
+      if (gzip_mode)
+        inflateReset(&strm);
+      else {
+        trailer = 8;
+        gzip_mode = 1;
+      }
+    }
+  }
+
+  inflateEnd(&strm);
+  free(input);
+  free(discard);
+  return (err);
+}
+
+/*!
+  \fn long long GZindexExtract(const GZ_INDEX *gzi, const char *gzfname,
+                               long long offset, void *buf, long long len)
+  \brief Copies len bytes of uncompressed data starting at offset into
+  buf. The segments between access points are inflated in parallel.
+  Returns the number of bytes copied (less than len if the data ends
+  first), or -1 on error.
+*/
+long long GZindexExtract(const GZ_INDEX *gzi, const char *gzfname, long long offset, void *buf, long long len)
+{
+  int fd, first, last, lo, hi, mid, k, nerrs = 0;
+  long long end;
+
+  if (offset < 0 || offset >= gzi->length) return (0);
+  if (offset + len > gzi->length) len = gzi->length - offset;
+  if (len <= 0) return (0);
+  end = offset + len;
+
+  fd = open(gzfname, O_RDONLY);
+  if (fd < 0) ErrorReturn(-1, (ERROR_NOFILE, "GZindexExtract(%s): could not open file", gzfname));
+
+  // last access point at or before offset, and the last one before end
+  lo = 0;
+  hi = gzi->npoints - 1;
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (gzi->points[mid].out <= offset)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  first = lo;
+  for (last = first; last + 1 < gzi->npoints && gzi->points[last + 1].out < end; last++)
+    ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1) reduction(+ : nerrs)
+#endif
+  for (k = first; k <= last; k++) {
+    ROMP_PFLB_begin
+    long long seg_start, seg_end;
+
+    seg_start = gzi->points[k].out > offset ? gzi->points[k].out : offset;
+    seg_end = k + 1 < gzi->npoints && gzi->points[k + 1].out < end ? gzi->points[k + 1].out : end;
+    if (seg_end > seg_start &&
+        gziExtractSegment(fd, &gzi->points[k], seg_start, (unsigned char *)buf + (seg_start - offset), seg_end - seg_start))
+      nerrs++;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  close(fd);
+  if (nerrs) ErrorReturn(-1, (ERROR_BADFILE, "GZindexExtract(%s): %d segments failed to decompress", gzfname, nerrs));
+  return (len);
+}
+
+/*
+  GZmemberCompress() - compresses len bytes at buf into a complete gzip
+  member at level (Z_DEFAULT_COMPRESSION for what gzopen(..., "wb")
+  gives). Members compressed independently (eg, in parallel) and
+  written one after the other form a valid gzip file. The result
+  (*pout) must be freed. len must be under 1GB. Returns the length
+  of the member, or -1 on error.
+*/
+long long GZmemberCompress(const void *buf, long long len, int level, unsigned char **pout)
+{
+  z_stream strm;
+  uLong bound;
+  unsigned char *out;
+  long long outlen;
+  int ret;
+
+  *pout = NULL;
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, level, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK)  // 31: gzip wrapper
+    ErrorReturn(-1, (ERROR_NOMEMORY, "GZmemberCompress: deflateInit2 failed"));
+
+  if (len < 0 || len >= (1LL << 30)) {
+    deflateEnd(&strm);
+    ErrorReturn(-1, (ERROR_BADPARM, "GZmemberCompress: %lld bytes is too many for one member", len));
+  }
+  bound = deflateBound(&strm, (uLong)len);
+  out = (unsigned char *)malloc(bound);
+  if (out == NULL) {
+    deflateEnd(&strm);
+    ErrorReturn(-1, (ERROR_NOMEMORY, "GZmemberCompress: could not alloc %lu bytes", (unsigned long)bound));
+  }
+
+  strm.next_in = (Bytef *)buf;
+  strm.avail_in = (uInt)len;
+  strm.next_out = out;
+  strm.avail_out = (uInt)bound;
+  ret = deflate(&strm, Z_FINISH);
+  outlen = (long long)strm.total_out;
+  deflateEnd(&strm);
+  if (ret != Z_STREAM_END) {
+    free(out);
+    ErrorReturn(-1, (ERROR_BADPARM, "GZmemberCompress: deflate failed (%d)", ret));
+  }
+
+  *pout = out;
+  return (outlen);
+}
@@ -52,7 +52,17 @@ static int update_vertex_indices(LABEL *area);
 ;
 static LABEL_VERTEX *labelFindVertexNumber(LABEL *area, int vno);
 static Transform *labelLoadTransform(const char *subject_name, const char *sdir, General_transform *transform);
+static int labelParsePoint(char *cp, int *pvno, float *px, float *py, float *pz, float *pstat);
+static int labelReadBinaryFrom(LABEL *area, FILE *fp);
+static int labelWrite(LABEL *area, const char *label_name, int binary);
+static unsigned char *labelVertexBits(LABEL *area, int max_vno, unsigned char *bits);
+static int labelMaxVertexNumber(LABEL *area);
+static LABEL *labelStartSetResult(LABEL *area1, LABEL *area2, LABEL *ldst, const char *fn);
 #define MAX_VERTICES 500000
+
+// bitsets of vertex numbers, see labelVertexBits()
+#define LABEL_VBIT_ISSET(bits, vno) ((bits)[(vno) >> 3] & (1 << ((vno)&7)))
+#define LABEL_VBIT_SET(bits, vno) ((bits)[(vno) >> 3] |= (1 << ((vno)&7)))
 /*-----------------------------------------------------
 ------------------------------------------------------*/
 LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
@@ -66,8 +76,29 @@ LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
   if (!area) {
     ErrorExit(ERROR_NOMEMORY, "%s: could not allocate LABEL struct.", Progname);
   }
+
+  // binary labels start with a byte that can't begin a line of text
+  vno = getc(fp);
+  if (vno == EOF) {
+    free(area);
+    return (NULL);
+  }
+  ungetc(vno, fp);
+  if (vno == ((LABEL_BINARY_MAGIC >> 24) & 0xff)) {
+    if (labelReadBinaryFrom(area, fp) != NO_ERROR) {
+      free(area->lv);
+      free(area);
+      return (NULL);
+    }
+    nlines = area->n_points;
+    goto done;
+  }
+
   cp = fgets(line, STRLEN, fp);  // read comment line
-  if (cp == NULL) return (NULL);
+  if (cp == NULL) {
+    free(area);
+    return (NULL);
+  }
   str = strstr(cp, "vox2ras=");
   if (str) {
     if (*(cp + strlen(cp) - 1) == '\n') *(cp + strlen(cp) - 1) = 0;
@@ -94,7 +125,7 @@ LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
           ERROR_NOMEMORY, "%s: LabelReadFrom could not allocate %d-sized vector", Progname, sizeof(LV) * area->n_points);
   nlines = 0;
   while ((cp = fgetl(line, STRLEN, fp)) != NULL) {
-    if (sscanf(cp, "%d %f %f %f %f", &vno, &x, &y, &z, &stat) != 5)
+    if (labelParsePoint(cp, &vno, &x, &y, &z, &stat) != 5)
       ErrorReturn(NULL, (ERROR_BADFILE, "%s: could not parse %dth line '%s' in label file", Progname, nlines + 1, cp));
     area->lv[nlines].x = x;
     area->lv[nlines].y = y;
@@ -105,6 +136,7 @@ LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
     if (nlines == area->n_points) break;
   }
 
+done:
   if (!nlines) ErrorReturn(NULL, (ERROR_BADFILE, "%s: no data in label file", Progname));
   if (subject_name) {
     cp = getenv("SUBJECTS_DIR");
@@ -185,6 +217,82 @@ LABEL *LabelRead(const char *subject_name, const char *label_name)
   fclose(fp);
   return (area);
 }
+
+/*-----------------------------------------------------
+  labelParsePoint() - reads "vno x y z stat" from a line of an ascii
+  label, and returns how many of them it read, as sscanf() would.
+  Reading big labels is mostly the parsing of these lines, which
+  strtol() and strtof() do several times faster than sscanf().
+------------------------------------------------------*/
+static int labelParsePoint(char *cp, int *pvno, float *px, float *py, float *pz, float *pstat)
+{
+  char *end;
+  float *pf[4];
+  int n;
+
+  *pvno = (int)strtol(cp, &end, 10);
+  if (end == cp) return (0);
+  pf[0] = px;
+  pf[1] = py;
+  pf[2] = pz;
+  pf[3] = pstat;
+  for (n = 0; n < 4; n++) {
+    cp = end;
+    *pf[n] = strtof(cp, &end);
+    if (end == cp) return (n + 1);
+  }
+  return (5);
+}
+
+/*-----------------------------------------------------
+  labelReadBinaryFrom() - reads a binary label (see
+  LABEL_BINARY_MAGIC in label.h) into area.
+------------------------------------------------------*/
+static int labelReadBinaryFrom(LABEL *area, FILE *fp)
+{
+  int magic, version, len, n;
+  unsigned char *buf, *b;
+  unsigned int u[5];
+
+  magic = freadInt(fp);
+  version = freadInt(fp);
+  if (magic != (int)LABEL_BINARY_MAGIC)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "%s: not a binary label file", Progname));
+  if (version != LABEL_BINARY_VERSION)
+    ErrorReturn(ERROR_BADFILE,
+                (ERROR_BADFILE, "%s: binary label version %d is not supported", Progname, version));
+  area->coords = freadInt(fp);
+  area->n_points = freadInt(fp);
+  len = freadInt(fp);
+  if (feof(fp) || ferror(fp) || area->n_points < 0 || len < 0 || len >= (int)sizeof(area->space))
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "%s: bad binary label header", Progname));
+  if (fread(area->space, 1, len, fp) != (size_t)len)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "%s: truncated binary label", Progname));
+  area->space[len] = 0;
+
+  area->max_points = area->n_points;
+  area->lv = (LABEL_VERTEX *)calloc(area->n_points, sizeof(LABEL_VERTEX));
+  buf = (unsigned char *)malloc(20 * (size_t)area->n_points + 1);
+  if (!area->lv || !buf)
+    ErrorExit(ERROR_NOMEMORY, "%s: labelReadBinaryFrom could not allocate %d points", Progname, area->n_points);
+  if (fread(buf, 20, area->n_points, fp) != (size_t)area->n_points) {
+    free(buf);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "%s: truncated binary label", Progname));
+  }
+
+  // big-endian vno, x, y, z, stat
+  for (b = buf, n = 0; n < area->n_points; n++) {
+    for (len = 0; len < 5; len++, b += 4)
+      u[len] = ((unsigned int)b[0] << 24) | ((unsigned int)b[1] << 16) | ((unsigned int)b[2] << 8) | b[3];
+    area->lv[n].vno = (int)u[0];
+    memmove(&area->lv[n].x, &u[1], sizeof(float));
+    memmove(&area->lv[n].y, &u[2], sizeof(float));
+    memmove(&area->lv[n].z, &u[3], sizeof(float));
+    memmove(&area->lv[n].stat, &u[4], sizeof(float));
+  }
+  free(buf);
+  return (NO_ERROR);
+}
 /*-----------------------------------------------------
         Parameters:
 
@@ -568,13 +676,68 @@ int LabelWriteInto(LABEL *area, FILE *fp)
   return (NO_ERROR);
 }
 /*-----------------------------------------------------
-        Parameters:
+  LabelWriteBinaryInto() - writes the undeleted points of area as a
+  binary label (see LABEL_BINARY_MAGIC in label.h).
+------------------------------------------------------*/
+int LabelWriteBinaryInto(LABEL *area, FILE *fp)
+{
+  int n, num, len, k;
+  unsigned char *buf, *b;
+  unsigned int u[5];
 
-        Returns value:
+  for (num = n = 0; n < area->n_points; n++)
+    if (!area->lv[n].deleted) {
+      num++;
+    }
 
-        Description
+  len = strlen(area->space);
+  fwriteInt((int)LABEL_BINARY_MAGIC, fp);
+  fwriteInt(LABEL_BINARY_VERSION, fp);
+  fwriteInt(area->coords, fp);
+  fwriteInt(num, fp);
+  fwriteInt(len, fp);
+  fwrite(area->space, 1, len, fp);
+
+  buf = (unsigned char *)malloc(20 * (size_t)num + 1);
+  if (!buf) ErrorExit(ERROR_NOMEMORY, "%s: LabelWriteBinaryInto could not allocate %d points", Progname, num);
+  for (b = buf, n = 0; n < area->n_points; n++) {
+    if (area->lv[n].deleted) continue;
+    u[0] = (unsigned int)area->lv[n].vno;
+    memmove(&u[1], &area->lv[n].x, sizeof(float));
+    memmove(&u[2], &area->lv[n].y, sizeof(float));
+    memmove(&u[3], &area->lv[n].z, sizeof(float));
+    memmove(&u[4], &area->lv[n].stat, sizeof(float));
+    for (k = 0; k < 5; k++, b += 4) {
+      b[0] = u[k] >> 24;
+      b[1] = u[k] >> 16;
+      b[2] = u[k] >> 8;
+      b[3] = u[k];
+    }
+  }
+  n = fwrite(buf, 20, num, fp);
+  free(buf);
+  if (n != num || ferror(fp)) {
+    printf("ERROR: writing to binary label file\n");
+    return (1);
+  }
+  return (NO_ERROR);
+}
+/*-----------------------------------------------------
+  LabelWrite() - writes an ascii label, or a binary one if the
+  FS_LABEL_BINARY environment variable is set.
 ------------------------------------------------------*/
 int LabelWrite(LABEL *area, const char *label_name)
+{
+  return (labelWrite(area, label_name, getenv("FS_LABEL_BINARY") != NULL));
+}
+/*-----------------------------------------------------
+  LabelWriteBinary() - writes a binary label, named as LabelWrite() would
+------------------------------------------------------*/
+int LabelWriteBinary(LABEL *area, const char *label_name)
+{
+  return (labelWrite(area, label_name, 1));
+}
+static int labelWrite(LABEL *area, const char *label_name, int binary)
 {
   char fname[STRLEN], *cp, subjects_dir[STRLEN], lname[STRLEN];
   FILE *fp;
@@ -610,7 +773,10 @@ int LabelWrite(LABEL *area, const char *label_name)
   fp = fopen(fname, "w");
   if (!fp) ErrorReturn(ERROR_NOFILE, (ERROR_NO_FILE, "%s: could not open label file %s", Progname, fname));
 
-  ret = LabelWriteInto(area, fp);
+  if (binary)
+    ret = LabelWriteBinaryInto(area, fp);
+  else
+    ret = LabelWriteInto(area, fp);
   fclose(fp);
   return (ret);
 }
@@ -690,10 +856,22 @@ int LabelRipRestOfSurfaceWithThreshold(LABEL *area, MRI_SURFACE *mris, float thr
 ------------------------------------------------------*/
 int LabelRemoveOverlap(LABEL *area1, LABEL *area2)
 {
-  int n1, n2, vno;
+  int n1, n2, vno, max_vno;
+  unsigned char *bits;
+
+  // all of area2's vertices (deleted or not) in a bitset
+  max_vno = labelMaxVertexNumber(area2);
+  bits = (unsigned char *)calloc(max_vno / 8 + 1, 1);
+  if (!bits) ErrorExit(ERROR_NOMEMORY, "%s: LabelRemoveOverlap could not allocate bitset", Progname);
+  for (n2 = 0; n2 < area2->n_points; n2++)
+    if (area2->lv[n2].vno >= 0) LABEL_VBIT_SET(bits, area2->lv[n2].vno);
 
   for (n1 = 0; n1 < area1->n_points; n1++) {
     vno = area1->lv[n1].vno;
+    if (vno >= 0) {
+      if (vno <= max_vno && LABEL_VBIT_ISSET(bits, vno)) area1->lv[n1].deleted = 1;
+      continue;
+    }
     for (n2 = 0; n2 < area2->n_points; n2++) {
       if (vno == area2->lv[n2].vno) {
         area1->lv[n1].deleted = 1;
@@ -701,6 +879,7 @@ int LabelRemoveOverlap(LABEL *area1, LABEL *area2)
       }
     }
   }
+  free(bits);
   return (NO_ERROR);
 }
 /*-----------------------------------------------------
@@ -740,7 +919,7 @@ int LabelIntersect(LABEL *area1, LABEL *area2)
       vmax = vno;
     }
   }
-  vnum = vmax - vmin;
+  vnum = vmax - vmin + 1;
   isec = (int *)calloc(vnum, sizeof(int));
   if (!isec) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate LabelIntersect struct.", Progname);
   for (n = 0; n < vnum; n++) {
@@ -759,6 +938,7 @@ int LabelIntersect(LABEL *area1, LABEL *area2)
     }
   }
 
+  free(isec);
   return (NO_ERROR);
 }
 /*-----------------------------------------------------
@@ -1202,6 +1382,152 @@ LABEL *LabelCombine(LABEL *asrc, LABEL *adst)
   adst->n_points += asrc->n_points;
   return (adst);
 }
+
+/*-----------------------------------------------------
+  labelMaxVertexNumber() - the largest vertex number in area, or 0
+------------------------------------------------------*/
+static int labelMaxVertexNumber(LABEL *area)
+{
+  int n, max_vno = 0;
+
+  for (n = 0; n < area->n_points; n++)
+    if (area->lv[n].vno > max_vno) max_vno = area->lv[n].vno;
+  return (max_vno);
+}
+
+/*-----------------------------------------------------
+  labelVertexBits() - sets the bits of the vertices of the undeleted
+  points in area in bits, which must hold max_vno+1 bits (allocated
+  if bits is NULL)
+------------------------------------------------------*/
+static unsigned char *labelVertexBits(LABEL *area, int max_vno, unsigned char *bits)
+{
+  int n, vno;
+
+  if (!bits) {
+    bits = (unsigned char *)calloc(max_vno / 8 + 1, 1);
+    if (!bits) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d vertex bitset", Progname, max_vno + 1);
+  }
+  for (n = 0; n < area->n_points; n++) {
+    vno = area->lv[n].vno;
+    if (!area->lv[n].deleted && vno >= 0 && vno <= max_vno) LABEL_VBIT_SET(bits, vno);
+  }
+  return (bits);
+}
+
+/*-----------------------------------------------------
+  labelStartSetResult() - an empty ldst with room for the points of
+  area1 and area2, and otherwise like area1
+------------------------------------------------------*/
+static LABEL *labelStartSetResult(LABEL *area1, LABEL *area2, LABEL *ldst, const char *fn)
+{
+  int max_points = area1->n_points + (area2 ? area2->n_points : 0);
+
+  if (ldst && (ldst == area1 || ldst == area2))
+    ErrorReturn(NULL, (ERROR_BADPARM, "%s: the result can't be one of the inputs", fn));
+  if (!ldst) {
+    ldst = LabelAlloc(MAX(max_points, 1), NULL, area1->name);
+    strcpy(ldst->subject_name, area1->subject_name);
+  }
+  else
+    ldst = LabelRealloc(ldst, max_points);
+  ldst->n_points = 0;
+  ldst->coords = area1->coords;
+  strcpy(ldst->space, area1->space);
+  return (ldst);
+}
+
+/*-----------------------------------------------------
+  LabelVertexUnion() - the vertices in either area1 or area2 (see
+  label.h). ldst can be NULL; it can't be area1 or area2.
+------------------------------------------------------*/
+LABEL *LabelVertexUnion(LABEL *area1, LABEL *area2, LABEL *ldst)
+{
+  int n, k, max_vno;
+  unsigned char *seen;
+  LABEL *areas[2];
+
+  ldst = labelStartSetResult(area1, area2, ldst, "LabelVertexUnion");
+  if (!ldst) return (NULL);
+  max_vno = MAX(labelMaxVertexNumber(area1), labelMaxVertexNumber(area2));
+  seen = (unsigned char *)calloc(max_vno / 8 + 1, 1);
+  if (!seen) ErrorExit(ERROR_NOMEMORY, "%s: LabelVertexUnion could not allocate bitset", Progname);
+
+  areas[0] = area1;
+  areas[1] = area2;
+  for (k = 0; k < 2; k++)
+    for (n = 0; n < areas[k]->n_points; n++) {
+      LV *lv = &areas[k]->lv[n];
+      if (lv->deleted || lv->vno < 0 || LABEL_VBIT_ISSET(seen, lv->vno)) continue;
+      LABEL_VBIT_SET(seen, lv->vno);
+      ldst->lv[ldst->n_points++] = *lv;
+    }
+
+  free(seen);
+  update_vertex_indices(ldst);
+  return (ldst);
+}
+
+/*-----------------------------------------------------
+  LabelVertexIntersection() - the vertices in both area1 and area2 (see
+  label.h). ldst can be NULL; it can't be area1 or area2.
+------------------------------------------------------*/
+LABEL *LabelVertexIntersection(LABEL *area1, LABEL *area2, LABEL *ldst)
+{
+  int n, max_vno;
+  unsigned char *in2, *seen;
+
+  ldst = labelStartSetResult(area1, area2, ldst, "LabelVertexIntersection");
+  if (!ldst) return (NULL);
+  max_vno = labelMaxVertexNumber(area1);
+  in2 = labelVertexBits(area2, max_vno, NULL);
+  seen = (unsigned char *)calloc(max_vno / 8 + 1, 1);
+  if (!seen) ErrorExit(ERROR_NOMEMORY, "%s: LabelVertexIntersection could not allocate bitset", Progname);
+
+  for (n = 0; n < area1->n_points; n++) {
+    LV *lv = &area1->lv[n];
+    if (lv->deleted || lv->vno < 0 || !LABEL_VBIT_ISSET(in2, lv->vno) || LABEL_VBIT_ISSET(seen, lv->vno)) continue;
+    LABEL_VBIT_SET(seen, lv->vno);
+    ldst->lv[ldst->n_points++] = *lv;
+  }
+
+  free(in2);
+  free(seen);
+  update_vertex_indices(ldst);
+  return (ldst);
+}
+
+/*-----------------------------------------------------
+  LabelVertexDifference() - the vertices in area1 that aren't in area2
+  (see label.h). ldst can be NULL; it can't be area1 or area2.
+------------------------------------------------------*/
+LABEL *LabelVertexDifference(LABEL *area1, LABEL *area2, LABEL *ldst)
+{
+  int n, max_vno;
+  unsigned char *in2, *seen;
+
+  // area2 isn't copied into the result, but it can't be the result either
+  if (ldst && ldst == area2)
+    ErrorReturn(NULL, (ERROR_BADPARM, "LabelVertexDifference: the result can't be one of the inputs"));
+  ldst = labelStartSetResult(area1, NULL, ldst, "LabelVertexDifference");
+  if (!ldst) return (NULL);
+  max_vno = labelMaxVertexNumber(area1);
+  in2 = labelVertexBits(area2, max_vno, NULL);
+  seen = (unsigned char *)calloc(max_vno / 8 + 1, 1);
+  if (!seen) ErrorExit(ERROR_NOMEMORY, "%s: LabelVertexDifference could not allocate bitset", Progname);
+
+  for (n = 0; n < area1->n_points; n++) {
+    LV *lv = &area1->lv[n];
+    if (lv->deleted || lv->vno < 0 || LABEL_VBIT_ISSET(in2, lv->vno) || LABEL_VBIT_ISSET(seen, lv->vno)) continue;
+    LABEL_VBIT_SET(seen, lv->vno);
+    ldst->lv[ldst->n_points++] = *lv;
+  }
+
+  free(in2);
+  free(seen);
+  update_vertex_indices(ldst);
+  return (ldst);
+}
 /*-----------------------------------------------------
         Parameters:
 
@@ -1241,30 +1567,47 @@ LABEL *LabelCopy(LABEL *asrc, LABEL *adst)
   ------------------------------------------------------*/
 int LabelRemoveDuplicates(LABEL *area)
 {
-  int n1, n2, deleted = 0;
+  int n1, n2, deleted = 0, max_vno, nnovertex, *novertex;
   LV *lv1, *lv2;
-
-  // loop thru each label point
-  for (n1 = 0; n1 < area->n_points; n1++) {
+  unsigned char *seen;
+
+  // Points with a vertex are duplicates if a point before them that
+  // wasn't deleted has the same vertex, which a bitset finds in one pass
+  max_vno = labelMaxVertexNumber(area);
+  seen = (unsigned char *)calloc(max_vno / 8 + 1, 1);
+  novertex = (int *)calloc(area->n_points + 1, sizeof(int));
+  if (!seen || !novertex) ErrorExit(ERROR_NOMEMORY, "%s: LabelRemoveDuplicates could not allocate", Progname);
+  for (nnovertex = n1 = 0; n1 < area->n_points; n1++) {
     lv1 = &area->lv[n1];
+    if (lv1->vno < 0) {
+      novertex[nnovertex++] = n1;
+    }
+    else if (LABEL_VBIT_ISSET(seen, lv1->vno)) {
+      deleted++;
+      lv1->deleted = 1;
+    }
+    else if (!lv1->deleted) {
+      LABEL_VBIT_SET(seen, lv1->vno);
+    }
+  }
+  free(seen);
+
+  // the points without one are compared by their coordinates
+  for (n1 = 0; n1 < nnovertex; n1++) {
+    lv1 = &area->lv[novertex[n1]];
     if (lv1->deleted) {
       continue;
     }
     // loop thru the remaining looking for duplicates
-    for (n2 = n1 + 1; n2 < area->n_points; n2++) {
-      lv2 = &area->lv[n2];
-      if (lv1->vno >= 0 && lv2->vno >= 0 && lv1->vno == lv2->vno) {
+    for (n2 = n1 + 1; n2 < nnovertex; n2++) {
+      lv2 = &area->lv[novertex[n2]];
+      if (FEQUAL(lv1->x, lv2->x) && FEQUAL(lv1->y, lv2->y) && FEQUAL(lv1->z, lv2->z)) {
         deleted++;
         lv2->deleted = 1;
       }
-      else if (lv1->vno < 0 && lv2->vno < 0) {
-        if (FEQUAL(lv1->x, lv2->x) && FEQUAL(lv1->y, lv2->y) && FEQUAL(lv1->z, lv2->z)) {
-          deleted++;
-          lv2->deleted = 1;
-        }
-      }
     }
   }
+  free(novertex);
 
   if (Gdiag & DIAG_SHOW) fprintf(stderr, "%d duplicate vertices removed from label %s.\n", deleted, area->name);
   return (NO_ERROR);
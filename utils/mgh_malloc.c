@@ -395,6 +395,7 @@ void *__wrap_malloc(size_t size) {
     
     noteMallocAction(MA_insert, r, size, padding);
     wrapper_lock_rel();
+    ROMP_profile_noteAlloc(size);
     return r;
 }
 
@@ -407,6 +408,7 @@ void *__wrap_calloc(size_t nmemb, size_t size) {
     void* r = NULL; if (!doMallocAction(MA_insert|MA_clear, &r, size))              r = __real_calloc(1, size);
     noteMallocAction(MA_insert, r, size, padding);
     wrapper_lock_rel();
+    ROMP_profile_noteAlloc(size);
     return r;
 }
 
@@ -419,6 +421,8 @@ void *__wrap_realloc(void *ptr, size_t size) {
     void* r = ptr;  if (!doMallocAction(MA_insert|MA_copy|MA_remove, &r, size))    r = __real_realloc(ptr, size);
     noteMallocAction(MA_insert, r, size, padding);
     wrapper_lock_rel();
+    ROMP_profile_noteFree();
+    ROMP_profile_noteAlloc(size);
     return r;
 }
 
@@ -428,6 +432,7 @@ void  __wrap_free(void *ptr) {
     noteMallocAction(MA_remove, ptr, 0, 0);
     if (!doMallocAction(MA_remove, &ptr, 0))                                           __real_free(ptr);
     wrapper_lock_rel();
+    ROMP_profile_noteFree();
 }
 
 int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size) {
@@ -439,6 +444,7 @@ int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size) {
 
     noteMallocAction(MA_insert, *memptr, size, padding);
     wrapper_lock_rel();
+    ROMP_profile_noteAlloc(size);
     return r;
 }
 
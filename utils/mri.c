@@ -37,6 +37,7 @@ const char *MRI_C_VERSION = "$Revision: 1.575 $";
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -1197,8 +1198,7 @@ float MRIgetVoxVal(const MRI *mri, int c, int r, int s, int f)
 
   if (mri->ischunked) {
     void *p;
-    p = mri->chunk + c * mri->bytes_per_vox + r * mri->bytes_per_row + s * mri->bytes_per_slice +
-        f * mri->bytes_per_vol;
+    p = MRIchunk_ptr(mri, c, r, s, f);
     switch (mri->type) {
       case MRI_UCHAR:
         return ((float)*(unsigned char *)p);
@@ -1272,25 +1272,26 @@ int MRIsetVoxVal(MRI *mri, int c, int r, int s, int f, float voxval)
   }
 
   if (mri->ischunked) {
+    // the row table points into the chunk, so there is no need
+    // to also go through the slices below
     void *p;
-    p = mri->chunk + c * mri->bytes_per_vox + r * mri->bytes_per_row + s * mri->bytes_per_slice +
-        f * mri->bytes_per_vol;
+    p = MRIchunk_ptr(mri, c, r, s, f);
     switch (mri->type) {
       case MRI_UCHAR:
         *((unsigned char *)p) = nint(voxval);
-        break;
+        return (0);
       case MRI_SHORT:
         *((short *)p) = nint(voxval);
-        break;
+        return (0);
       case MRI_INT:
         *((int *)p) = nint(voxval);
-        break;
+        return (0);
       case MRI_LONG:
         *((long *)p) = nint(voxval);
-        break;
+        return (0);
       case MRI_FLOAT:
         *((float *)p) = voxval;
-        break;
+        return (0);
     }
   }
 
@@ -5208,6 +5209,37 @@ int MRIchunk(MRI **pmri)
   *pmri = mritmp;
   return (0);
 }
+/*----------------------------------------------------------*/
+/*!
+  \fn int MRIisContiguous(const MRI *mri)
+  \brief Returns 1 if all frames of the volume live in one
+  contiguous block (see MRIallocChunk()), 0 otherwise.
+*/
+int MRIisContiguous(const MRI *mri) { return (mri->ischunked && mri->chunk != NULL); }
+/*----------------------------------------------------------*/
+/*!
+  \fn void *MRIframeChunk(const MRI *mri, int frame)
+  \brief Returns a pointer to the first voxel of the given frame
+  of a chunked volume, or NULL if the volume is not chunked or the
+  frame is out of range. The voxels of the frame follow in
+  column-major order (column fastest), see MRIstride_row() etc.
+*/
+void *MRIframeChunk(const MRI *mri, int frame)
+{
+  if (!MRIisContiguous(mri) || frame < 0 || frame >= mri->nframes) return (NULL);
+  return ((char *)mri->chunk + (size_t)frame * mri->bytes_per_vol);
+}
+/*----------------------------------------------------------*/
+/*!
+  \fn float *MRIFframeChunk(const MRI *mri, int frame)
+  \brief Same as MRIframeChunk() but also returns NULL unless
+  the volume is of type MRI_FLOAT.
+*/
+float *MRIFframeChunk(const MRI *mri, int frame)
+{
+  if (mri->type != MRI_FLOAT) return (NULL);
+  return ((float *)MRIframeChunk(mri, frame));
+}
 
 /*----------------------------------------------------------
   Copy one MRI into another (including header info and data)
@@ -5239,6 +5271,14 @@ MRI *MRIcopy(MRI *mri_src, MRI *mri_dst)
 
   if (!mri_src->slices) return (mri_dst);
 
+  // both contiguous with the same layout: one block copy
+  if (MRIisContiguous(mri_src) && MRIisContiguous(mri_dst) && mri_src->type == mri_dst->type &&
+      mri_dst->nframes >= mri_src->nframes && mri_src->bytes_per_vol == mri_dst->bytes_per_vol &&
+      mri_src->bytes_per_row == mri_dst->bytes_per_row && mri_src->bytes_per_slice == mri_dst->bytes_per_slice) {
+    memmove(mri_dst->chunk, mri_src->chunk, mri_src->bytes_per_vol * mri_src->nframes);
+    return (mri_dst);
+  }
+
   if (mri_src->type == mri_dst->type) {
     bytes = width;
     switch (mri_src->type) {
@@ -5457,7 +5497,6 @@ int MRIallocIndices(MRI *mri)
 MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
 {
   MRI *mri;
-  int slice, row;
   void *p;
 
   if (sizeof(mri->bytes_total) != sizeof(size_t)) {
@@ -5473,44 +5512,68 @@ MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
   MRIinitHeader(mri);
 
   // Allocate a big chunk of memory
+  mri->bytes_total = mri->bytes_per_vox * mri->width * mri->height * mri->depth * mri->nframes;
+  // align the block so that rows of float volumes can be loaded with
+  // aligned vector instructions and frames start on a cache line
+  if (posix_memalign(&p, MRI_CHUNK_ALIGNMENT, mri->bytes_total) != 0) p = NULL;
+  if (p == NULL) {
+    printf("ERROR: MRIallocChunk(): could not alloc %lu\n", (unsigned long)mri->bytes_total);
+    return (NULL);
+  }
+  memset(p, 0, mri->bytes_total);
+  // printf("Allocing MRI with Chunk\n");
+
+  MRIattachChunk(mri, p);
+  return (mri);
+}
+/*-----------------------------------------------------*/
+/*!
+\fn int MRIattachChunk(MRI *mri, void *chunk)
+\brief Makes chunk (which must hold width*height*depth*nframes
+voxels of mri->type, column fastest) the pixel buffer of a header-only
+MRI, setting the strides and pointing the rows of mri->slices into it.
+MRIfree() will free() the chunk unless mri->map_base is set, in which
+case the mapping is munmap()ed instead.
+*/
+int MRIattachChunk(MRI *mri, void *chunk)
+{
+  int slice, row;
+  char *p;
+
   mri->ischunked = 1;
+  mri->chunk = chunk;
+  mri->bytes_per_vox = MRIsizeof(mri->type);
   mri->bytes_per_row = mri->bytes_per_vox * mri->width;
   mri->bytes_per_slice = mri->bytes_per_row * mri->height;
   mri->bytes_per_vol = mri->bytes_per_slice * mri->depth;
   mri->bytes_total = mri->bytes_per_vol * mri->nframes;
-  mri->chunk = calloc(mri->bytes_total, 1);
-  if (mri->chunk == NULL) {
-    printf("ERROR: MRIallocChunk(): could not alloc %lu\n", (unsigned long)mri->bytes_total);
-    return (NULL);
-  }
-  // printf("Allocing MRI with Chunk\n");
 
   MRIallocIndices(mri);  // not sure what this does
   mri->outside_val = 0;
-  mri->slices = (BUFTYPE ***)calloc(depth * nframes, sizeof(BUFTYPE **));
-  if (!mri->slices) ErrorExit(ERROR_NO_MEMORY, "MRIalloc: could not allocate %d slices\n", mri->depth);
+  mri->slices = (BUFTYPE ***)calloc(mri->depth * mri->nframes, sizeof(BUFTYPE **));
+  if (!mri->slices) ErrorExit(ERROR_NO_MEMORY, "MRIattachChunk: could not allocate %d slices\n", mri->depth);
 
-  p = mri->chunk;
-  for (slice = 0; slice < depth * nframes; slice++) {
+  p = (char *)chunk;
+  for (slice = 0; slice < mri->depth * mri->nframes; slice++) {
     /* allocate pointer to array of rows */
     mri->slices[slice] = (BUFTYPE **)calloc(mri->height, sizeof(BUFTYPE *));
     if (!mri->slices[slice])
       ErrorExit(ERROR_NO_MEMORY,
-                "MRIallocChunk(%d, %d, %d): could not allocate "
+                "MRIattachChunk(%d, %d, %d): could not allocate "
                 "%d bytes for %dth slice\n",
-                height,
-                width,
-                depth,
+                mri->height,
+                mri->width,
+                mri->depth,
                 mri->height * sizeof(BUFTYPE *),
                 slice);
     /* Instead of allocating each row, just point to the
        correct location in the chunk. */
     for (row = 0; row < mri->height; row++) {
-      mri->slices[slice][row] = p;
+      mri->slices[slice][row] = (BUFTYPE *)p;
       p += mri->bytes_per_row;
     }
   }
-  return (mri);
+  return (NO_ERROR);
 }
 /*-------------------------------------------------------------*/
 /*!
@@ -5525,10 +5588,21 @@ MRI *MRIallocSequence(int width, int height, int depth, int type, int nframes)
   int slice, row, bpp;
   BUFTYPE *buf;
 
-  mris_alloced++;
-
   if ((width <= 0) || (height <= 0) || (depth <= 0))
     ErrorReturn(NULL, (ERROR_BADPARM, "MRIallocSequence(%d, %d, %d, %d): bad parm", width, height, depth, nframes));
+
+  // To allocate all volumes as one contiguous chunk setenv FS_USE_MRI_CHUNK 1
+  // to deactivate: unsetenv FS_USE_MRI_CHUNK or setenv FS_USE_MRI_CHUNK 0
+  // Set it to anything other than 1. Bitmaps and tensors have no fixed voxel
+  // size and are always allocated row by row.
+  if (type != MRI_BITMAP && type != MRI_TENSOR && getenv("FS_USE_MRI_CHUNK") != NULL &&
+      strcmp(getenv("FS_USE_MRI_CHUNK"), "1") == 0) {
+    if (Gdiag_no > 0) printf("Chunking\n");
+    return (MRIallocChunk(width, height, depth, type, nframes));
+  }
+
+  mris_alloced++;
+
   mri = MRIallocHeader(width, height, depth, type, nframes);
   MRIinitHeader(mri);
   mri->nframes = nframes;
@@ -5636,17 +5710,6 @@ MRI *MRIallocSequence(int width, int height, int depth, int type, int nframes)
 #endif
   }
 
-  // Create chunked volume here. Not super efficient because
-  // must create a new volume, copy the old volume, the dealloc
-  // the old. But it assure that all the above is done.
-  // To activate chunking setenv FS_USE_MRI_CHUNK 1
-  // to deactivate: unsetenv FS_USE_MRI_CHUNK or setenv FS_USE_MRI_CHUNK 0
-  // Set it to anything other than 1
-  if (getenv("FS_USE_MRI_CHUNK") != NULL && strcmp(getenv("FS_USE_MRI_CHUNK"), "1") == 0) {
-    if (Gdiag_no > 0) printf("Chunking\n");
-    MRIchunk(&mri);
-  }
-
   return (mri);
 }
 /*-----------------------------------------------------*/
@@ -5793,7 +5856,12 @@ int MRIfree(MRI **pmri)
   }
   else {
     // printf("Freeing MRI Chunk\n");
-    free(mri->chunk);
+    if (mri->map_base) {
+      munmap(mri->map_base, mri->map_len);
+      if (mri->map_ready) free(mri->map_ready);
+    }
+    else
+      free(mri->chunk);
     mri->chunk = NULL;
     for (slice = 0; slice < mri->depth * mri->nframes; slice++)
       if (mri->slices[slice]) free(mri->slices[slice]);
@@ -11282,10 +11350,8 @@ MRI *MRIlinearTransform(MRI *mri_src, MRI *mri_dst, MATRIX *mA)
   ------------------------------------------------------------------*/
 MRI *MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA, int InterpMethod)
 {
-  int y1, y2, y3, width, height, depth, frame;
-  VECTOR *v_X, *v_Y; /* original and transformed coordinate systems */
-  MATRIX *mAinv;     /* inverse of mA */
-  double val, x1, x2, x3;
+  int y3, width, height, depth;
+  MATRIX *mAinv; /* inverse of mA */
 
   if (InterpMethod != SAMPLE_NEAREST && InterpMethod != SAMPLE_TRILINEAR && InterpMethod != SAMPLE_CUBIC_BSPLINE) {
     printf(
@@ -11313,35 +11379,45 @@ MRI *MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA, int Interp
   width = mri_dst->width;
   height = mri_dst->height;
   depth = mri_dst->depth;
-  v_X = VectorAlloc(4, MATRIX_REAL); /* input (src) coordinates */
-  v_Y = VectorAlloc(4, MATRIX_REAL); /* transformed (dst) coordinates */
 
-  v_Y->rptr[4][1] = 1.0f;
+  /* The dst->src map is applied to every voxel, so pull the 3x4 part of
+     the inverse out of the MATRIX once instead of doing a MatrixMultiply
+     per voxel. The accumulation below is done in the same order and
+     precision as MatrixMultiply() so the sample locations are unchanged. */
+  float A[3][4];
+  {
+    int r, c;
+    for (r = 0; r < 3; r++)
+      for (c = 0; c < 4; c++) A[r][c] = mAinv->rptr[r + 1][c + 1];
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) shared(A, bspline)
+#endif
   for (y3 = 0; y3 < depth; y3++) {
-    V3_Z(v_Y) = y3;
+    ROMP_PFLB_begin
+    int y1, y2, frame, r;
+    double val, x1, x2, x3;
+    float v[3];
+
     for (y2 = 0; y2 < height; y2++) {
-      V3_Y(v_Y) = y2;
       for (y1 = 0; y1 < width; y1++) {
-        V3_X(v_Y) = y1;
-        MatrixMultiply(mAinv, v_Y, v_X);
-
-        x1 = V3_X(v_X);
-        x2 = V3_Y(v_X);
-        x3 = V3_Z(v_X);
+        for (r = 0; r < 3; r++) {
+          float acc = 0.0;
+          acc += A[r][0] * (float)y1;
+          acc += A[r][1] * (float)y2;
+          acc += A[r][2] * (float)y3;
+          acc += A[r][3] * 1.0f;
+          v[r] = acc;
+        }
+        x1 = v[0];
+        x2 = v[1];
+        x3 = v[2];
 
         if (nint(y1) == Gx && nint(y2) == Gy && nint(y3) == Gz) DiagBreak();
-        if (nint(x1) == Gx && nint(x2) == Gy && nint(x3) == Gz) {
-#if 0
-          fprintf
-          (stderr,
-           "(%2.1f, %2.1f, %2.1f) --> (%2.1f, %2.1f, %2.1f)\n",
-           (float)x1, (float)x2, (float)x3,
-           (float)y1, (float)y2, (float)y3) ;
-#endif
-          DiagBreak();
-        }
+        if (nint(x1) == Gx && nint(x2) == Gy && nint(x3) == Gz) DiagBreak();
 
-        // MRIsampleVolume(mri_src, x1, x2, x3, &val);
         for (frame = 0; frame < mri_src->nframes; frame++) {
           if (InterpMethod == SAMPLE_CUBIC_BSPLINE)
             // recommended to externally call this and keep mri_coeff
@@ -11352,39 +11428,15 @@ MRI *MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA, int Interp
 
           // will clip the val according to mri_dst type:
           MRIsetVoxVal(mri_dst, y1, y2, y3, frame, val);
-
-#if 0
-          // if this gets ever enabled, don't forget to clip val to type...
-          switch (mri_dst->type)
-          {
-          case MRI_UCHAR:
-            MRIvox(mri_dst,y1,y2,y3) = (BUFTYPE)nint(val) ;
-          break ;
-          case MRI_SHORT:
-            MRISvox(mri_dst,y1,y2,y3) = (short)nint(val) ;
-            break ;
-          case MRI_FLOAT:
-            MRIFvox(mri_dst,y1,y2,y3) = (float)(val) ;
-            break ;
-          case MRI_INT:
-            MRIIvox(mri_dst,y1,y2,y3) = nint(val) ;
-            break ;
-          default:
-            ErrorReturn(NULL,
-                        (ERROR_UNSUPPORTED,
-                         "MRIlinearTransform: unsupported dst type %d",
-                         mri_dst->type)) ;
-            break ;
-          }
-#endif
         }
       }
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
+
   if (bspline) MRIfreeBSpline(&bspline);
-  MatrixFree(&v_X);
   MatrixFree(&mAinv);
-  MatrixFree(&v_Y);
 
   mri_dst->ras_good_flag = 1;
 
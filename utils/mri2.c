@@ -3728,6 +3728,401 @@ int MRIsegFrameAvg(MRI *seg, int segid, MRI *mri, double *favg)
   return (nvoxels);
 }
 
+/* Copies row (r,s) of frame f of mri into buf as floats. Matches what
+   MRIgetVoxVal() returns, without the per-voxel type switch. */
+static void segStatsLoadRow(MRI *mri, int r, int s, int f, float *buf)
+{
+  int c;
+
+  switch (mri->type) {
+    case MRI_UCHAR: {
+      BUFTYPE *p = &MRIseq_vox(mri, 0, r, s, f);
+      for (c = 0; c < mri->width; c++) buf[c] = p[c];
+      break;
+    }
+    case MRI_SHORT: {
+      short *p = &MRISseq_vox(mri, 0, r, s, f);
+      for (c = 0; c < mri->width; c++) buf[c] = p[c];
+      break;
+    }
+    case MRI_INT: {
+      int *p = &MRIIseq_vox(mri, 0, r, s, f);
+      for (c = 0; c < mri->width; c++) buf[c] = p[c];
+      break;
+    }
+    case MRI_LONG: {
+      long32 *p = &MRILseq_vox(mri, 0, r, s, f);
+      for (c = 0; c < mri->width; c++) buf[c] = p[c];
+      break;
+    }
+    case MRI_FLOAT:
+      memcpy(buf, &MRIFseq_vox(mri, 0, r, s, f), mri->width * sizeof(float));
+      break;
+    default:
+      for (c = 0; c < mri->width; c++) buf[c] = MRIgetVoxVal(mri, c, r, s, f);
+      break;
+  }
+}
+
+// the slices are split into this many blocks, each accumulated on its own
+// and then merged in order, so the result does not depend on the # of threads.
+// With more than one frame the blocks would need nblocks*nsegs*nframes of each
+// accumulator, so then the frames are split among the threads instead.
+#define SEGSTATS_MAX_BLOCKS 32
+
+/*------------------------------------------------------------*/
+/*!
+  \fn SEGSTAT_TABLE *MRIsegStatsTable(MRI *seg, MRI *mri, int frame,
+                        const int *segidlist, int nsegs, float Pct)
+  \brief Computes the voxel count and, if mri is non-NULL, the same
+  min, max, range, mean and std as MRIsegStats() for every id in
+  segidlist in a single pass over the volume (instead of one pass per
+  id). If frame < 0 the stats are computed for all frames of mri,
+  otherwise just for the given frame. If segidlist is NULL, all the ids
+  in seg (including 0) are used. If Pct > 0 the stats are computed
+  after trimming Pct percent off each end of the sorted values, as in
+  MRIsegStatsRobust(). For a single frame, threads accumulate separate
+  blocks of slices that are merged in a fixed order; for several frames
+  each thread accumulates whole frames into the one table.
+*/
+SEGSTAT_TABLE *MRIsegStatsTable(MRI *seg, MRI *mri, int frame, const int *segidlist, int nsegs, float Pct)
+{
+  SEGSTAT_TABLE *st;
+  int *ids, *lut, *count, n, m, b, f, nblocks, nframes, minid, maxid;
+  long long nlut, ntot, *offset, *segstart;
+  double *bsum, *bsum2, *bmin, *bmax;
+  float *vals = NULL;
+
+  if (mri != NULL && MRIdimMismatch(seg, mri, 0))
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIsegStatsTable: seg and input dimension mismatch"));
+  if (mri != NULL && frame >= mri->nframes)
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIsegStatsTable: frame %d >= nframes %d", frame, mri->nframes));
+
+  st = (SEGSTAT_TABLE *)calloc(1, sizeof(SEGSTAT_TABLE));
+  if (segidlist == NULL) {
+    ids = MRIsegIdList(seg, &nsegs, 0);
+    st->segids = ids;
+  }
+  else {
+    st->segids = (int *)calloc(nsegs, sizeof(int));
+    memcpy(st->segids, segidlist, nsegs * sizeof(int));
+  }
+  st->nsegs = nsegs;
+  if (mri == NULL)
+    nframes = 0;
+  else if (frame < 0) {
+    st->frame0 = 0;
+    nframes = mri->nframes;
+  }
+  else {
+    st->frame0 = frame;
+    nframes = 1;
+  }
+  st->nframes = nframes;
+  st->nvoxels = (int *)calloc(nsegs, sizeof(int));
+  st->min = (double *)calloc((size_t)nsegs * nframes + 1, sizeof(double));
+  st->max = (double *)calloc((size_t)nsegs * nframes + 1, sizeof(double));
+  st->range = (double *)calloc((size_t)nsegs * nframes + 1, sizeof(double));
+  st->mean = (double *)calloc((size_t)nsegs * nframes + 1, sizeof(double));
+  st->std = (double *)calloc((size_t)nsegs * nframes + 1, sizeof(double));
+  st->sum = (double *)calloc((size_t)nsegs * nframes + 1, sizeof(double));
+  if (nsegs == 0) return (st);
+
+  // lookup table from seg id to the (first) index in the list
+  minid = maxid = st->segids[0];
+  for (n = 1; n < nsegs; n++) {
+    if (minid > st->segids[n]) minid = st->segids[n];
+    if (maxid < st->segids[n]) maxid = st->segids[n];
+  }
+  nlut = (long long)maxid - minid + 1;
+  lut = (int *)malloc(nlut * sizeof(int));
+  for (n = 0; n < nlut; n++) lut[n] = -1;
+  for (n = nsegs - 1; n >= 0; n--) lut[st->segids[n] - minid] = n;
+
+  nblocks = (nframes > 1) ? 1 : MIN(seg->depth, SEGSTATS_MAX_BLOCKS);
+  count = (int *)calloc((size_t)nblocks * nsegs, sizeof(int));
+  bsum = (double *)calloc((size_t)nblocks * nsegs * nframes + 1, sizeof(double));
+  bsum2 = (double *)calloc((size_t)nblocks * nsegs * nframes + 1, sizeof(double));
+  bmin = (double *)calloc((size_t)nblocks * nsegs * nframes + 1, sizeof(double));
+  bmax = (double *)calloc((size_t)nblocks * nsegs * nframes + 1, sizeof(double));
+  if (!lut || !count || !bsum || !bsum2 || !bmin || !bmax)
+    ErrorExit(ERROR_NOMEMORY, "MRIsegStatsTable: could not allocate accumulators for %d segs\n", nsegs);
+
+  if (nframes > 1) {
+    // map the seg to list indices once, then give each thread whole frames
+    int s, r, c, idx, *vidx;
+    size_t nvox = (size_t)seg->width * seg->height * seg->depth;
+    float *rowbuf = (float *)calloc(seg->width, sizeof(float));
+
+    vidx = (int *)malloc(nvox * sizeof(int));
+    if (!vidx) ErrorExit(ERROR_NOMEMORY, "MRIsegStatsTable: could not allocate %ld indices\n", (long)nvox);
+    for (s = 0; s < seg->depth; s++)
+      for (r = 0; r < seg->height; r++) {
+        int *rowidx = &vidx[((size_t)s * seg->height + r) * seg->width];
+        segStatsLoadRow(seg, r, s, 0, rowbuf);
+        for (c = 0; c < seg->width; c++) {
+          long long id = (long long)(int)rowbuf[c] - minid;
+          idx = (id >= 0 && id < nlut) ? lut[id] : -1;
+          rowidx[c] = idx;
+          if (idx >= 0) count[idx]++;
+        }
+      }
+    free(rowbuf);
+    for (m = 0; m < nsegs * nframes; m++) {
+      bmin[m] = HUGE_VAL;
+      bmax[m] = -HUGE_VAL;
+    }
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+    for (f = 0; f < nframes; f++) {
+      ROMP_PFLB_begin
+      int s, r, c, *rowidx = vidx;
+      float *rowbuf = (float *)calloc(seg->width, sizeof(float));
+      double v;
+
+      for (s = 0; s < seg->depth; s++) {
+        for (r = 0; r < seg->height; r++, rowidx += seg->width) {
+          segStatsLoadRow(mri, r, s, st->frame0 + f, rowbuf);
+          for (c = 0; c < seg->width; c++) {
+            size_t a;
+            if (rowidx[c] < 0) continue;
+            a = (size_t)rowidx[c] * nframes + f;
+            v = rowbuf[c];
+            bsum[a] += v;
+            bsum2[a] += v * v;
+            if (bmin[a] > v) bmin[a] = v;
+            if (bmax[a] < v) bmax[a] = v;
+          }
+        }
+      }
+      free(rowbuf);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    free(vidx);
+  }
+  else {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+    for (b = 0; b < nblocks; b++) {
+      ROMP_PFLB_begin
+      int s, r, c, k, idx, *bcount = &count[(size_t)b * nsegs];
+      int *rowidx = (int *)calloc(seg->width, sizeof(int));
+      float *rowbuf = (float *)calloc(seg->width, sizeof(float));
+      size_t boff = (size_t)b * nsegs * nframes;
+      double v;
+
+      for (s = b * seg->depth / nblocks; s < (b + 1) * seg->depth / nblocks; s++) {
+        for (r = 0; r < seg->height; r++) {
+          // map the seg row to list indices once for all frames
+          segStatsLoadRow(seg, r, s, 0, rowbuf);
+          for (c = 0; c < seg->width; c++) {
+            long long id = (long long)(int)rowbuf[c] - minid;
+            idx = (id >= 0 && id < nlut) ? lut[id] : -1;
+            rowidx[c] = idx;
+            if (idx < 0) continue;
+            if (bcount[idx] == 0) {
+              for (k = 0; k < nframes; k++) {
+                bmin[boff + (size_t)idx * nframes + k] = HUGE_VAL;
+                bmax[boff + (size_t)idx * nframes + k] = -HUGE_VAL;
+              }
+            }
+            bcount[idx]++;
+          }
+          for (k = 0; k < nframes; k++) {
+            segStatsLoadRow(mri, r, s, st->frame0 + k, rowbuf);
+            for (c = 0; c < seg->width; c++) {
+              size_t a;
+              if (rowidx[c] < 0) continue;
+              a = boff + (size_t)rowidx[c] * nframes + k;
+              v = rowbuf[c];
+              bsum[a] += v;
+              bsum2[a] += v * v;
+              if (bmin[a] > v) bmin[a] = v;
+              if (bmax[a] < v) bmax[a] = v;
+            }
+          }
+        }
+      }
+      free(rowidx);
+      free(rowbuf);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+
+  // merge the blocks in order
+  for (n = 0; n < nsegs; n++) {
+    for (f = 0; f < nframes; f++) {
+      size_t a = (size_t)n * nframes + f;
+      double sum = 0, sum2 = 0, vmin = HUGE_VAL, vmax = -HUGE_VAL, mean, var;
+      int nv = 0;
+      for (b = 0; b < nblocks; b++) {
+        size_t ba = (size_t)b * nsegs * nframes + a;
+        if (count[(size_t)b * nsegs + n] == 0) continue;
+        nv += count[(size_t)b * nsegs + n];
+        sum += bsum[ba];
+        sum2 += bsum2[ba];
+        if (vmin > bmin[ba]) vmin = bmin[ba];
+        if (vmax < bmax[ba]) vmax = bmax[ba];
+      }
+      if (nv == 0) continue;
+      mean = sum / nv;
+      st->min[a] = vmin;
+      st->max[a] = vmax;
+      st->range[a] = vmax - vmin;
+      st->mean[a] = mean;
+      st->sum[a] = sum;
+      if (nv > 1) {
+        var = (nv * mean * mean - 2 * mean * sum + sum2) / (nv - 1);
+        st->std[a] = var > 0 ? sqrt(var) : 0;
+      }
+    }
+    for (b = 0; b < nblocks; b++) st->nvoxels[n] += count[(size_t)b * nsegs + n];
+  }
+  free(bsum);
+  free(bsum2);
+  free(bmin);
+  free(bmax);
+
+  if (Pct > 0 && nframes > 0) {
+    // Robust stats need the sorted values of each seg. Gather them with
+    // each block writing to its own (precomputed) place in the list so
+    // the order is the same as in a serial scan.
+    offset = (long long *)calloc((size_t)nblocks * nsegs, sizeof(long long));
+    segstart = (long long *)calloc(nsegs, sizeof(long long));
+    ntot = 0;
+    for (n = 0; n < nsegs; n++)
+      for (b = 0; b < nblocks; b++) {
+        if (b == 0) segstart[n] = ntot;
+        offset[(size_t)b * nsegs + n] = ntot;
+        ntot += count[(size_t)b * nsegs + n];
+      }
+    vals = (float *)malloc((ntot * nframes + 1) * sizeof(float));
+    if (!vals) ErrorExit(ERROR_NOMEMORY, "MRIsegStatsTable: could not allocate %lld values\n", ntot * nframes);
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+    for (b = 0; b < nblocks; b++) {
+      ROMP_PFLB_begin
+      int s, r, c, k, idx;
+      long long *pos = &offset[(size_t)b * nsegs];
+      long long *rowpos = (long long *)calloc(seg->width, sizeof(long long));
+      float *rowbuf = (float *)calloc(seg->width, sizeof(float));
+
+      for (s = b * seg->depth / nblocks; s < (b + 1) * seg->depth / nblocks; s++) {
+        for (r = 0; r < seg->height; r++) {
+          segStatsLoadRow(seg, r, s, 0, rowbuf);
+          for (c = 0; c < seg->width; c++) {
+            long long id = (long long)(int)rowbuf[c] - minid;
+            idx = (id >= 0 && id < nlut) ? lut[id] : -1;
+            rowpos[c] = (idx >= 0) ? pos[idx]++ : -1;
+          }
+          for (k = 0; k < nframes; k++) {
+            segStatsLoadRow(mri, r, s, st->frame0 + k, rowbuf);
+            for (c = 0; c < seg->width; c++)
+              if (rowpos[c] >= 0) vals[(size_t)k * ntot + rowpos[c]] = rowbuf[c];
+          }
+        }
+      }
+      free(rowpos);
+      free(rowbuf);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    free(offset);
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic)
+#endif
+    for (m = 0; m < nsegs * nframes; m++) {
+      ROMP_PFLB_begin
+      int nv, k, j, a = m;
+      double val, sum = 0, sum2 = 0, mean;
+      float *v;
+
+      nv = st->nvoxels[m / nframes];
+      st->min[a] = st->max[a] = st->range[a] = st->mean[a] = st->std[a] = st->sum[a] = 0;
+      if (nv == 0) ROMP_PFLB_continue;
+      v = &vals[(size_t)(m % nframes) * ntot + segstart[m / nframes]];
+      qsort((void *)v, nv, sizeof(float), compare_floats);
+      // same trimming as MRIsegStatsRobust()
+      j = 0;
+      for (k = 0; k < nv; k++) {
+        if (k < Pct * nv / 100.0) continue;
+        if (k > (100 - Pct) * nv / 100.0) continue;
+        val = v[k];
+        if (j == 0) st->min[a] = st->max[a] = val;
+        if (st->min[a] > val) st->min[a] = val;
+        if (st->max[a] < val) st->max[a] = val;
+        sum += val;
+        sum2 += val * val;
+        j++;
+      }
+      if (j == 0) ROMP_PFLB_continue;
+      mean = sum / j;
+      st->range[a] = st->max[a] - st->min[a];
+      st->mean[a] = mean;
+      st->sum[a] = sum;
+      if (j > 1) st->std[a] = sqrt(((j)*mean * mean - 2 * mean * sum + sum2) / (j - 1));
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    free(vals);
+    free(segstart);
+  }
+
+  // ids listed more than once were only accumulated into their first entry
+  for (n = 0; n < nsegs; n++) {
+    m = lut[st->segids[n] - minid];
+    if (m == n) continue;
+    st->nvoxels[n] = st->nvoxels[m];
+    for (f = 0; f < nframes; f++) {
+      st->min[n * nframes + f] = st->min[m * nframes + f];
+      st->max[n * nframes + f] = st->max[m * nframes + f];
+      st->range[n * nframes + f] = st->range[m * nframes + f];
+      st->mean[n * nframes + f] = st->mean[m * nframes + f];
+      st->std[n * nframes + f] = st->std[m * nframes + f];
+      st->sum[n * nframes + f] = st->sum[m * nframes + f];
+    }
+  }
+
+  free(count);
+  free(lut);
+  return (st);
+}
+
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegStatsTableFree(SEGSTAT_TABLE **ptable)
+  \brief Frees a table from MRIsegStatsTable().
+*/
+int MRIsegStatsTableFree(SEGSTAT_TABLE **ptable)
+{
+  SEGSTAT_TABLE *st = *ptable;
+
+  if (st == NULL) return (0);
+  free(st->segids);
+  free(st->nvoxels);
+  free(st->min);
+  free(st->max);
+  free(st->range);
+  free(st->mean);
+  free(st->std);
+  free(st->sum);
+  free(st);
+  *ptable = NULL;
+  return (0);
+}
+
 MRI *MRImask_with_T2_and_aparc_aseg(
     MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior)
 {
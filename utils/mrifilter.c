@@ -2074,6 +2074,37 @@ MRI *MRImean(MRI *mri_src, MRI *mri_dst, int wsize)
         int x, y, x0, y0, z0;
         float val, num;
 
+        if (mri_src->type == MRI_FLOAT) {
+          // Same window and summation order as the general case below, but
+          // reading whole rows instead of going through MRIgetVoxVal()
+          for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+              for (num = 0, val = 0.0, z0 = -whalf; z0 <= whalf; z0++) {
+                if (z + z0 < 0 || z + z0 >= mri_src->depth) continue;
+
+                for (y0 = -whalf; y0 <= whalf; y0++) {
+                  const float *row;
+                  if (y + y0 < 0 || y + y0 >= mri_src->height) continue;
+
+                  row = &MRIFseq_vox(mri_src, 0, y + y0, z + z0, frame);
+                  for (x0 = -whalf; x0 <= whalf; x0++) {
+                    if (x + x0 < 0 || x + x0 >= mri_src->width) continue;
+
+                    val += row[x + x0];
+                    num++;
+                  }
+                }
+              }
+              if (FZERO(num) == 0) {
+                val /= num;
+                MRIsetVoxVal(mri_dst, x, y, z, frame, val);
+              }
+            }
+          }
+          exec_progress_callback(frame * depth + z, mri_src->nframes * depth, 0, 1);
+          ROMP_PFLB_continue;
+        }
+
         for (y = 0; y < height; y++) {
           for (x = 0; x < width; x++) {
             for (num = 0, val = 0.0, z0 = -whalf; z0 <= whalf; z0++) {
@@ -3181,8 +3212,15 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
                 }
                 total = 0.0f;
 
-                for (ki = k, i = 0; i < len; i++) {
-                  total += *ki++ * (*(inBase_f + xi[x + i - halflen]));
+                if (x >= halflen && x + len - halflen <= width) {
+                  // interior: taps are contiguous, no boundary index table needed
+                  const float *in = inBase_f + x - halflen;
+                  for (i = 0; i < len; i++) total += k[i] * in[i];
+                }
+                else {
+                  for (ki = k, i = 0; i < len; i++) {
+                    total += *ki++ * (*(inBase_f + xi[x + i - halflen]));
+                  }
                 }
 
                 *foutPix++ = total;
@@ -3204,6 +3242,17 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
 	    ROMP_PFLB_begin
             for (y = 0; y < height; y++) {
               foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
+              if (mri_src != mri_dst || src_frame != dst_frame) {
+                // stream whole source rows through the kernel so the inner
+                // loop is unit stride; same summation order as below
+                for (x = 0; x < width; x++) foutPix[x] = 0.0f;
+                for (i = 0; i < len; i++) {
+                  const float kval = k[i];
+                  const float *inRow = &MRIFseq_vox(mri_src, 0, yi[y + i - halflen], z, src_frame);
+                  for (x = 0; x < width; x++) foutPix[x] += kval * inRow[x];
+                }
+                continue;
+              }
               for (x = 0; x < width; x++) {
                 total = 0.0f;
 
@@ -3232,6 +3281,15 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
 	    ROMP_PFLB_begin
             for (y = 0; y < height; y++) {
               foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
+              if (mri_src != mri_dst || src_frame != dst_frame) {
+                for (x = 0; x < width; x++) foutPix[x] = 0.0f;
+                for (i = 0; i < len; i++) {
+                  const float kval = k[i];
+                  const float *inRow = &MRIFseq_vox(mri_src, 0, y, zi[z + i - halflen], src_frame);
+                  for (x = 0; x < width; x++) foutPix[x] += kval * inRow[x];
+                }
+                continue;
+              }
               for (x = 0; x < width; x++) {
                 total = 0.0f;
 
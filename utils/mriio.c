@@ -39,6 +39,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -59,6 +60,7 @@
 #include "error.h"
 #include "fio.h"
 #include "gcamorph.h"
+#include "gzindex.h"
 #include "gifti_local.h"
 #include "imautils.h"
 #include "machine.h"
@@ -183,6 +185,8 @@ static MRI *sdtRead(const char *fname, int read_volume);
 static MRI *mghRead(const char *fname, int read_volume, int frame);
 static int mghWrite(MRI *mri, const char *fname, int frame);
 static int mghAppend(MRI *mri, const char *fname, int frame);
+static MRI *mriMapVolume(const char *fname, int type, int flags);
+static int mriMapWanted(int *pflags);
 
 /********************************************/
 
@@ -190,6 +194,10 @@ extern int errno;
 
 extern const char *Progname;
 
+/* flags for the mapped read being done through MRIreadMapped(), or -1
+   when mri_read() should look at FS_MRI_MMAP */
+static int mri_map_flags = -1;
+
 static char *command_line;
 static char *subject_name;
 static int gdf_crop_flag = FALSE;
@@ -537,6 +545,7 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
   char *ep;
   int i, j, k, t;
   int volume_frames;
+  int map_flags;
 
   // sanity-checks
   if (fname == NULL) {
@@ -693,7 +702,9 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
     mri = sdtRead(fname_copy, volume_flag);
   }
   else if (type == MRI_MGH_FILE) {
-    mri = mghRead(fname_copy, volume_flag, -1);
+    mri = NULL;
+    if (volume_flag && start_frame < 0 && mriMapWanted(&map_flags)) mri = mriMapVolume(fname_copy, type, map_flags);
+    if (mri == NULL) mri = mghRead(fname_copy, volume_flag, -1);
   }
   else if (type == MGH_MORPH) {
     int which = start_frame ;
@@ -763,7 +774,9 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
     mri = nifti1Read(fname_copy, volume_flag);
   }
   else if (type == NII_FILE) {
-    mri = niiRead(fname_copy, volume_flag);
+    mri = NULL;
+    if (volume_flag && start_frame < 0 && mriMapWanted(&map_flags)) mri = mriMapVolume(fname_copy, type, map_flags);
+    if (mri == NULL) mri = niiRead(fname_copy, volume_flag);
   }
   else if (type == NRRD_FILE) {
     mri = mriNrrdRead(fname_copy, volume_flag);
@@ -1062,6 +1075,108 @@ MRI *MRIreadHeader(const char *fname, int type)
 
 } /* end MRIreadInfo() */
 
+/*---------------------------------------------------------------
+  MRIreadMapped() - like MRIread(), but uncompressed .mgh and .nii
+  volumes are mmap()ed instead of read, so only the pages that are
+  actually touched are ever loaded (and they can be dropped again by
+  the kernel). The mapping is private: changes to the voxels are
+  never written back to the file. If the file byte order differs from
+  the host (eg, any non-uchar .mgh on x86) the frames are swapped in
+  place; with MRI_MAP_LAZY in flags this is left to MRImapFrame(), which
+  must then be called before a frame is accessed. NaNs are not removed.
+  Other formats (and frame selections) are read normally.
+  ---------------------------------------------------------------*/
+MRI *MRIreadMapped(const char *fname, int flags)
+{
+  char buf[STRLEN];
+  MRI *mri;
+
+  chklc();
+
+  FileNameFromWildcard(fname, buf);
+  mri_map_flags = flags;
+  mri = mri_read(buf, MRI_VOLUME_TYPE_UNKNOWN, TRUE, -1, -1);
+  mri_map_flags = -1;
+
+  return (mri);
+
+} /* end MRIreadMapped() */
+
+/*---------------------------------------------------------------
+  MRIisMapped() - returns 1 if the voxels of mri live in a file
+  mapping made by MRIreadMapped(), 0 otherwise.
+  ---------------------------------------------------------------*/
+int MRIisMapped(const MRI *mri) { return (mri->ischunked && mri->map_base != NULL); }
+
+/*---------------------------------------------------------------
+  MRImapFrame() - makes sure that the given frame of a mapped volume
+  holds voxels in host byte order, swapping it in place the first
+  time it is called. A no-op for volumes that are not mapped or
+  do not need swapping. Not thread-safe for the same frame.
+  ---------------------------------------------------------------*/
+int MRImapFrame(MRI *mri, int frame)
+{
+  void *p;
+
+  if (!MRIisMapped(mri)) return (NO_ERROR);
+  if (frame < 0 || frame >= mri->nframes)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRImapFrame: frame %d out of range (%d)", frame, mri->nframes));
+  if (mri->map_ready[frame]) return (NO_ERROR);
+
+  p = MRIframeChunk(mri, frame);
+  if (mri->map_swap == 2)
+    byteswapbufshort(p, mri->bytes_per_vol);
+  else if (mri->map_swap == 4)
+    byteswapbuffloat(p, mri->bytes_per_vol);
+  mri->map_ready[frame] = 1;
+
+  return (NO_ERROR);
+
+} /* end MRImapFrame() */
+
+/*---------------------------------------------------------------
+  MRIunmapFrame() - gives the memory behind one frame of a mapped
+  volume back to the kernel, eg after a tool is done with it when
+  streaming through a 4D file that is larger than RAM. Any changes
+  made to the frame are lost; a swapped frame reverts to file byte
+  order and has to go through MRImapFrame() again before it is used.
+  ---------------------------------------------------------------*/
+int MRIunmapFrame(MRI *mri, int frame)
+{
+  char *start, *end, *page_start, *page_end;
+  long pagesize;
+
+  if (!MRIisMapped(mri)) return (NO_ERROR);
+  if (frame < 0 || frame >= mri->nframes)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRIunmapFrame: frame %d out of range (%d)", frame, mri->nframes));
+
+  // only whole pages can be dropped. The pieces of the frame that share
+  // a page with its neighbours stay resident, so swap them back to file
+  // order to keep the frame consistent with the pages that revert.
+  pagesize = sysconf(_SC_PAGESIZE);
+  start = (char *)MRIframeChunk(mri, frame);
+  end = start + mri->bytes_per_vol;
+  page_start = (char *)(((size_t)start + pagesize - 1) / pagesize * pagesize);
+  page_end = (char *)((size_t)end / pagesize * pagesize);
+  if (page_end <= page_start) page_start = page_end = end;
+
+  if (mri->map_swap && mri->map_ready[frame]) {
+    if (mri->map_swap == 2) {
+      byteswapbufshort(start, page_start - start);
+      byteswapbufshort(page_end, end - page_end);
+    }
+    else {
+      byteswapbuffloat(start, page_start - start);
+      byteswapbuffloat(page_end, end - page_end);
+    }
+    mri->map_ready[frame] = 0;
+  }
+  if (page_end > page_start) madvise(page_start, page_end - page_start, MADV_DONTNEED);
+
+  return (NO_ERROR);
+
+} /* end MRIunmapFrame() */
+
 int MRIwriteType(MRI *mri, const char *fname, int type)
 {
   struct stat stat_buf;
@@ -11203,16 +11318,58 @@ int znzTAGreadMRIframes(znzFile fp, MRI *mri, long len)
 // declare function pointer
 // static int (*myclose)(FILE *stream);
 
+/*-------------------------------------------------------------------
+  Seek-index support for .mgz. With FS_MGZ_INDEX set (to anything but
+  0), compressed volumes are read through a gzip access-point index
+  (see gzindex.h), so single frames can be read without inflating the
+  frames before them and multi-frame reads inflate in parallel. The
+  index is cached in <fname>.gzidx unless FS_MGZ_INDEX is "nocache".
+  -------------------------------------------------------------------*/
+static int mghUseGzIndex(void)
+{
+  const char *env = getenv("FS_MGZ_INDEX");
+  return (env != NULL && strcmp(env, "0") != 0);
+}
+static int mghCacheGzIndex(void)
+{
+  const char *env = getenv("FS_MGZ_INDEX");
+  return (env == NULL || strcmp(env, "nocache") != 0);
+}
+
+/* Converts one big-endian slice from an mgh file to host byte order in
+   place (as a whole buffer, which the compiler can vectorize, rather
+   than voxel by voxel) and copies its rows into the volume. */
+static void mghUnpackSlice(BUFTYPE *buf, MRI *mri, int slice, int frame)
+{
+  int y;
+  size_t bpv, row_bytes;
+
+  bpv = (mri->type == MRI_UCHAR) ? 1 : (mri->type == MRI_SHORT) ? sizeof(short) : sizeof(float);
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  size_t n, nvox = (size_t)mri->width * mri->height;
+  if (bpv == 2) {
+    unsigned short *p = (unsigned short *)buf;
+    for (n = 0; n < nvox; n++) p[n] = (unsigned short)((p[n] >> 8) | (p[n] << 8));
+  }
+  else if (bpv == 4) {
+    unsigned int *p = (unsigned int *)buf;
+    for (n = 0; n < nvox; n++) p[n] = __builtin_bswap32(p[n]);
+  }
+#endif
+  row_bytes = mri->width * bpv;
+  for (y = 0; y < mri->height; y++) memmove(mri->slices[slice + frame * mri->depth][y], buf + y * row_bytes, row_bytes);
+}
+
 static MRI *mghRead(const char *fname, int read_volume, int frame)
 {
   MRI *mri;
   znzFile fp;
-  int start_frame, end_frame, width, height, depth, nframes, type, x, y, z, bpv, dof, bytes, version, ival,
-      unused_space_size, good_ras_flag, i;
+  int start_frame, end_frame, width, height, depth, nframes, type, z, bpv, dof, bytes, version,
+      unused_space_size, good_ras_flag;
   BUFTYPE *buf;
   char unused_buf[UNUSED_SPACE_SIZE + 1];
   float fval, xsize, ysize, zsize, x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s, xfov, yfov, zfov;
-  short sval;
+  char *tail = NULL;  // in-memory copy of the tags when read via a gzip index
   //  int tag_data_size;
   char *ext;
   int gzipped = 0;
@@ -11328,14 +11485,12 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       znzseek(fp, (long)mri->nframes * width * height * depth * bpv, SEEK_CUR);
   }
   else {
+    long long bytes_per_frame = (long long)bytes * depth;
+    int file_nframes = nframes;
+    GZ_INDEX *gzi = NULL;
+
     if (frame >= 0) {
       start_frame = end_frame = frame;
-      if (gzipped) {  // pipe cannot seek
-        long count;
-        for (count = 0; count < (long)frame * width * height * depth * bpv; count++) znzgetc(fp);
-      }
-      else
-        znzseek(fp, (long)frame * width * height * depth * bpv, SEEK_CUR);
       nframes = 1;
     }
     else { /* hack - # of frames < -1 means to only read in that
@@ -11348,55 +11503,70 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       end_frame = nframes - 1;
       if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "read %d frames\n", nframes);
     }
-    buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
+    if (type != MRI_INT && type != MRI_SHORT && type != MRI_FLOAT && type != MRI_TENSOR && type != MRI_UCHAR) {
+      znzclose(fp);
+      errno = 0;
+      ErrorReturn(NULL, (ERROR_UNSUPPORTED, "mghRead: unsupported type %d", type));
+    }
     mri = MRIallocSequence(width, height, depth, type, nframes);
     mri->dof = dof;
-    for (frame = start_frame; frame <= end_frame; frame++) {
-      for (z = 0; z < depth; z++) {
-        if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
-          // fclose(fp) ;
-          znzclose(fp);
-          free(buf);
-          ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z));
-        }
-        switch (type) {
-          case MRI_INT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                ival = orderIntBytes(((int *)buf)[i]);
-                MRIIseq_vox(mri, x, y, z, frame - start_frame) = ival;
-              }
-            }
-            break;
-          case MRI_SHORT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                sval = orderShortBytes(((short *)buf)[i]);
-                MRISseq_vox(mri, x, y, z, frame - start_frame) = sval;
-              }
-            }
-            break;
-          case MRI_TENSOR:
-          case MRI_FLOAT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                fval = orderFloatBytes(((float *)buf)[i]);
-                MRIFseq_vox(mri, x, y, z, frame - start_frame) = fval;
-              }
-            }
-            break;
-          case MRI_UCHAR:
-            local_buffer_to_image(buf, mri, z, frame - start_frame);
-            break;
-          default:
-            errno = 0;
-            ErrorReturn(NULL, (ERROR_UNSUPPORTED, "mghRead: unsupported type %d", mri->type));
-            break;
+
+    // with a seek index the requested frames are inflated directly (and in
+    // parallel) instead of decompressing everything in front of them
+    if (gzipped && mghUseGzIndex()) gzi = GZindexGet(fname, mghCacheGzIndex());
+    if (gzi) {
+      long long data_offset, tail_offset, tail_len, nbytes;
+
+      data_offset = znztell(fp);
+      nbytes = (long long)nframes * bytes_per_frame;
+      buf = (BUFTYPE *)malloc(nbytes);
+      if (buf == NULL) ErrorExit(ERROR_NOMEMORY, "mghRead(%s): could not allocate %lld bytes", fname, nbytes);
+      if (GZindexExtract(gzi, fname, data_offset + start_frame * bytes_per_frame, buf, nbytes) != nbytes) {
+        znzclose(fp);
+        free(buf);
+        GZindexFree(&gzi);
+        MRIfree(&mri);
+        ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %lld bytes of voxel data", fname, nbytes));
+      }
+      for (frame = start_frame; frame <= end_frame; frame++) {
+        for (z = 0; z < depth; z++)
+          mghUnpackSlice(buf + ((long long)(frame - start_frame) * depth + z) * bytes, mri, z, frame - start_frame);
+        exec_progress_callback(frame - start_frame, end_frame - start_frame + 1, 0, 1);
+      }
+      free(buf);
+
+      // the optional parameters and tags follow the last frame in the file;
+      // pull them into memory and parse them from there
+      tail_offset = data_offset + file_nframes * bytes_per_frame;
+      tail_len = gzi->length > tail_offset ? gzi->length - tail_offset : 0;
+      tail = (char *)malloc(tail_len + 1);
+      if (tail_len > 0 && GZindexExtract(gzi, fname, tail_offset, tail, tail_len) != tail_len) tail_len = 0;
+      GZindexFree(&gzi);
+      znzclose(fp);
+      fp = znzmemopen(tail, tail_len);
+      if (znz_isnull(fp)) {
+        free(tail);
+        MRIfree(&mri);
+        ErrorReturn(NULL, (ERROR_NOMEMORY, "mghRead(%s): could not open tags", fname));
+      }
+    }
+    else {
+      if (start_frame > 0) znzseek(fp, start_frame * bytes_per_frame, SEEK_CUR);
+      buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
+      for (frame = start_frame; frame <= end_frame; frame++) {
+        for (z = 0; z < depth; z++) {
+          if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
+            // fclose(fp) ;
+            znzclose(fp);
+            free(buf);
+            ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z));
+          }
+          mghUnpackSlice(buf, mri, z, frame - start_frame);
+          exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
         }
-        exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
       }
+      if (buf) free(buf);
     }
-    if (buf) free(buf);
   }
 
   if (good_ras_flag > 0) {
@@ -11534,6 +11704,7 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
 
   // fclose(fp) ;
   znzclose(fp);
+  if (tail) free(tail);
 
   // xstart, xend, ystart, yend, zstart, zend are not stored
   mri->xstart = -mri->width / 2. * mri->xsize;
@@ -11551,13 +11722,249 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   return (mri);
 }
 
+/* Returns 1 if mri_read() should try to map the volume it reads, setting
+   the MRI_MAP_* flags to use. */
+static int mriMapWanted(int *pflags)
+{
+  const char *env;
+
+  if (mri_map_flags >= 0) {
+    *pflags = mri_map_flags;
+    return (1);
+  }
+  *pflags = 0;
+  env = getenv("FS_MRI_MMAP");
+  return (env != NULL && strcmp(env, "1") == 0);
+}
+
+/* Reads the header of an uncompressed .mgh or .nii and maps the file
+   behind its voxels (see MRIreadMapped()). Returns NULL, without an
+   error, when the file cannot be used in place (compressed, scaled or
+   converted voxel types, short file, ...) so that the caller can fall
+   back to a normal read. */
+static MRI *mriMapVolume(const char *fname, int type, int flags)
+{
+  MRI *mri;
+  struct stat stat_buf;
+  struct nifti_1_header hdr;
+  long long offset;
+  int fd, len, swap, slice, frame;
+  char *base;
+
+  len = strlen(fname);
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) return (NULL);
+  if (fstat(fd, &stat_buf) != 0) {
+    close(fd);
+    return (NULL);
+  }
+
+  mri = NULL;
+  swap = 0;
+  offset = 0;
+  if (type == MRI_MGH_FILE) {
+    // .mgz and .mgh.gz have to be inflated
+    if (len < 4 || stricmp(fname + len - 4, ".mgh") != 0) {
+      close(fd);
+      return (NULL);
+    }
+    mri = mghRead(fname, FALSE, -1);
+    offset = 7 * sizeof(int) + UNUSED_SPACE_SIZE;
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    swap = 1;  // .mgh is always big-endian
+#endif
+  }
+  else if (type == NII_FILE) {
+    if (fname[len - 1] == 'z' || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+      close(fd);
+      return (NULL);
+    }
+    if (hdr.dim[0] < 1 || hdr.dim[0] > 7) {
+      swap = 1;
+      swap_nifti_1_header(&hdr);
+    }
+    // scaled and double voxels are converted to float by niiRead()
+    if (hdr.scl_slope == 0 && (hdr.datatype == DT_UNSIGNED_CHAR || hdr.datatype == DT_SIGNED_SHORT ||
+                               hdr.datatype == DT_UINT16 || hdr.datatype == DT_SIGNED_INT || hdr.datatype == DT_FLOAT)) {
+      mri = niiRead(fname, FALSE);
+      offset = (long long)hdr.vox_offset;
+    }
+  }
+  if (mri == NULL) {
+    close(fd);
+    return (NULL);
+  }
+
+  if ((mri->type != MRI_UCHAR && mri->type != MRI_SHORT && mri->type != MRI_INT && mri->type != MRI_FLOAT) ||
+      offset % MRIsizeof(mri->type) != 0 ||
+      offset + (long long)MRIsizeof(mri->type) * mri->width * mri->height * mri->depth * mri->nframes >
+          (long long)stat_buf.st_size) {
+    close(fd);
+    MRIfree(&mri);
+    return (NULL);
+  }
+
+  base = (char *)mmap(NULL, stat_buf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    MRIfree(&mri);
+    return (NULL);
+  }
+  if (Gdiag_no > 0) printf("mriMapVolume(): mapped %lld bytes of %s\n", (long long)stat_buf.st_size, fname);
+
+  MRIattachChunk(mri, base + offset);
+  mri->map_base = base;
+  mri->map_len = stat_buf.st_size;
+  mri->map_swap = (swap && mri->bytes_per_vox > 1) ? mri->bytes_per_vox : 0;
+  mri->map_ready = (unsigned char *)calloc(mri->nframes, sizeof(unsigned char));
+  for (frame = 0; frame < mri->nframes; frame++) mri->map_ready[frame] = (mri->map_swap == 0);
+
+  if (mri->map_swap && !(flags & MRI_MAP_LAZY)) {
+    // swap everything now, a slice at a time so the page faults are
+    // taken in parallel
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+    for (slice = 0; slice < mri->depth * mri->nframes; slice++) {
+      ROMP_PFLB_begin
+      char *p = (char *)mri->chunk + (size_t)slice * mri->bytes_per_slice;
+      if (mri->map_swap == 2)
+        byteswapbufshort(p, mri->bytes_per_slice);
+      else
+        byteswapbuffloat(p, mri->bytes_per_slice);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    for (frame = 0; frame < mri->nframes; frame++) mri->map_ready[frame] = 1;
+  }
+
+  return (mri);
+}
+
+/*------------------------------------------------------------------
+  mghWriteVoxels() - writes frames start_frame..end_frame of mri as
+  big-endian voxels, either to zfp or, for .mgz, as gzip members
+  appended to gzfp (exactly one of them is non-NULL). The volume is
+  cut into slabs of whole slices that all the threads convert (and
+  compress) at once; each slab is written, in order, as soon as it
+  and the ones before it are done, so compression overlaps output.
+  Only one slab per thread is held at a time, and slabs are sized
+  so that they fit in FS_MGZ_WRITE_MB megabytes (default 256)
+  whatever the size of the volume. Members are compressed at the
+  FS_GZIP_LEVEL level, as znzopen() does.
+  ------------------------------------------------------------------*/
+static int mghWriteVoxels(MRI *mri, int start_frame, int end_frame, znzFile zfp, FILE *gzfp, const char *fname)
+{
+  int bytes_per_voxel, nthreads, slices_per_slab, nslices, nslabs, slab, nerrs = 0;
+  long long bytes_per_slice, budget, slab_bytes;
+  const char *env;
+
+  switch (mri->type) {
+    case MRI_UCHAR:
+      bytes_per_voxel = 1;
+      break;
+    case MRI_SHORT:
+      bytes_per_voxel = 2;
+      break;
+    case MRI_INT:
+    case MRI_FLOAT:
+      bytes_per_voxel = 4;
+      break;
+    default:
+      errno = 0;
+      ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mghWrite: unsupported type %d", mri->type));
+  }
+
+  nthreads = 1;
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  budget = 256;
+  env = getenv("FS_MGZ_WRITE_MB");
+  if (env != NULL && atoi(env) > 0) budget = atoi(env);
+  budget *= 1024 * 1024;
+
+  // a slab and its compressed copy per thread, and no slab bigger than
+  // 64MB so that there are enough of them to go around
+  bytes_per_slice = (long long)mri->width * mri->height * bytes_per_voxel;
+  slab_bytes = budget / (2 * nthreads);
+  if (slab_bytes > 64LL * 1024 * 1024) slab_bytes = 64LL * 1024 * 1024;
+  slices_per_slab = (int)(slab_bytes / bytes_per_slice);
+  if (slices_per_slab < 1) slices_per_slab = 1;
+  nslices = (end_frame - start_frame + 1) * mri->depth;
+  nslabs = (nslices + slices_per_slab - 1) / slices_per_slab;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) ordered schedule(static, 1)
+#endif
+  for (slab = 0; slab < nslabs; slab++) {
+    ROMP_PFLB_begin
+    int first = slab * slices_per_slab;
+    int last = first + slices_per_slab < nslices ? first + slices_per_slab : nslices;
+    size_t row_bytes = (size_t)mri->width * bytes_per_voxel;
+    size_t nbytes = (size_t)(last - first) * bytes_per_slice;
+    unsigned char *raw, *out = NULL, *p;
+    long long outlen = -1;
+    int s, y, frame = start_frame, z = 0;
+
+    raw = (unsigned char *)malloc(nbytes);
+    if (raw != NULL) {
+      p = raw;
+      for (s = first; s < last; s++) {
+        frame = start_frame + s / mri->depth;
+        z = s % mri->depth;
+        for (y = 0; y < mri->height; y++) {
+          memmove(p, &MRIseq_vox(mri, 0, y, z, frame), row_bytes);
+          p += row_bytes;
+        }
+      }
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+      if (bytes_per_voxel == 2)
+        byteswapbufshort(raw, nbytes);
+      else if (bytes_per_voxel == 4)
+        byteswapbuffloat(raw, nbytes);
+#endif
+      if (gzfp != NULL)
+        outlen = GZmemberCompress(raw, nbytes, znz_gzip_level(), &out);
+    }
+
+#ifdef HAVE_OPENMP
+    #pragma omp ordered
+#endif
+    {
+      if (nerrs == 0) {
+        if (raw == NULL)
+          nerrs++;
+        else if (gzfp != NULL) {
+          if (outlen < 0 || fwrite(out, 1, outlen, gzfp) != (size_t)outlen) nerrs++;
+        }
+        else if (znzwrite(raw, 1, nbytes, zfp) != nbytes)
+          nerrs++;
+      }
+      exec_progress_callback(z, mri->depth, frame - start_frame, end_frame - start_frame + 1);
+    }
+
+    if (raw) free(raw);
+    if (out) free(out);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (nerrs) {
+    errno = 0;
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write voxels to %s", fname));
+  }
+  return (NO_ERROR);
+}
+
 static int mghWrite(MRI *mri, const char *fname, int frame)
 {
   znzFile fp;
-  int ival, start_frame, end_frame, x, y, z, width, height, depth, unused_space_size, flen;
+  FILE *gzfp;
+  int start_frame, end_frame, unused_space_size, flen, err;
   char buf[UNUSED_SPACE_SIZE + 1];
-  float fval;
-  short sval;
   int gzipped = 0;
   char *ext;
 
@@ -11600,10 +12007,6 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
   /* WARNING - adding or removing anything before nframes will
      cause mghAppend to fail.
   */
-  width = mri->width;
-  height = mri->height;
-  depth = mri->depth;
-  // printf("(w,h,d) = (%d,%d,%d)\n", width, height, depth);
   znzwriteInt(MGH_VERSION, fp);
   znzwriteInt(mri->width, fp);
   znzwriteInt(mri->height, fp);
@@ -11640,47 +12043,33 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
   memset(buf, 0, UNUSED_SPACE_SIZE * sizeof(char));
   znzwrite(buf, sizeof(char), unused_space_size, fp);
 
-  for (frame = start_frame; frame <= end_frame; frame++) {
-    for (z = 0; z < depth; z++) {
-      for (y = 0; y < height; y++) {
-        switch (mri->type) {
-          case MRI_SHORT:
-            for (x = 0; x < width; x++) {
-              if (z == 74 && y == 16 && x == 53) DiagBreak();
-              sval = MRISseq_vox(mri, x, y, z, frame);
-              znzwriteShort(sval, fp);
-            }
-            break;
-          case MRI_INT:
-            for (x = 0; x < width; x++) {
-              if (z == 74 && y == 16 && x == 53) DiagBreak();
-              ival = MRIIseq_vox(mri, x, y, z, frame);
-              znzwriteInt(ival, fp);
-            }
-            break;
-          case MRI_FLOAT:
-            for (x = 0; x < width; x++) {
-              if (z == 74 && y == 16 && x == 53) DiagBreak();
-              // printf("mghWrite: MRI_FLOAT: curr (x, y, z, frame) = (%d, %d, %d, %d)\n", x, y, z, frame);
-              fval = MRIFseq_vox(mri, x, y, z, frame);
-              // if(x==10 && y == 0 && z == 0 && frame == 67)
-              // printf("MRIIO: %g\n",fval);
-              znzwriteFloat(fval, fp);
-            }
-            break;
-          case MRI_UCHAR:
-            if ((int)znzwrite(&MRIseq_vox(mri, 0, y, z, frame), sizeof(BUFTYPE), width, fp) != width) {
-              errno = 0;
-              ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write %d bytes to %s", width, fname));
-            }
-            break;
-          default:
-            errno = 0;
-            ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mghWrite: unsupported type %d", mri->type));
-            break;
-        }
-      }
-      exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
+  if (gzipped) {
+    // The voxels are appended to the file as gzip members of their
+    // own (see mghWriteVoxels()), and the rest as another one.
+    // Concatenated members make a valid gzip file.
+    znzclose(fp);
+    gzfp = fopen(fname, "ab");
+    if (gzfp == NULL) {
+      errno = 0;
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite(%s, %d): could not open file", fname, frame));
+    }
+    err = mghWriteVoxels(mri, start_frame, end_frame, NULL, gzfp, fname);
+    if (fclose(gzfp) != 0 && err == NO_ERROR) {
+      errno = 0;
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write voxels to %s", fname));
+    }
+    if (err != NO_ERROR) return (err);
+    fp = znzopen(fname, "ab", gzipped);
+    if (znz_isnull(fp)) {
+      errno = 0;
+      ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "mghWrite(%s, %d): could not open file", fname, frame));
+    }
+  }
+  else {
+    err = mghWriteVoxels(mri, start_frame, end_frame, fp, NULL, fname);
+    if (err != NO_ERROR) {
+      znzclose(fp);
+      return (err);
     }
   }
 
@@ -0,0 +1,507 @@
+/**
+ * @file  mrisbvh.c
+ * @brief bounding volume hierarchy over the vertices or faces of a surface
+ *
+ * See mrisbvh.h.  The tree is built top down by splitting the items at the
+ * median of their centroids along the widest axis, so it is balanced and
+ * its depth is about log2(n/BVH_LEAF_SIZE).  Each node holds the bounding
+ * box of its items, which is all the searches need to prune it.
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "mrisbvh.h"
+
+#include "error.h"
+#include "romp_support.h"
+
+#define BVH_LEAF_SIZE 8
+#define BVH_STACK_SIZE 128
+
+typedef struct BVH_NODE
+{
+  float lo[3], hi[3];
+  int first;  // leaf: first item, else the left child (the right child follows it)
+  int count;  // leaf: number of items, else 0
+} BVH_NODE;
+
+struct MRIS_BVH
+{
+  int faces;       // 1 if the items are faces
+  int nitems;
+  int *id;         // vertex or face number of each item, in tree order
+  float *coords;   // 3 per vertex or 9 per face, in tree order
+  int nnodes;
+  BVH_NODE *nodes;
+};
+
+
+static void bvhVertexXYZ(VERTEX const *v, int which, float *xyz)
+{
+  switch (which) {
+    case ORIGINAL_VERTICES:
+      xyz[0] = v->origx;
+      xyz[1] = v->origy;
+      xyz[2] = v->origz;
+      break;
+    case CANONICAL_VERTICES:
+      xyz[0] = v->cx;
+      xyz[1] = v->cy;
+      xyz[2] = v->cz;
+      break;
+    case WHITE_VERTICES:
+      xyz[0] = v->whitex;
+      xyz[1] = v->whitey;
+      xyz[2] = v->whitez;
+      break;
+    case PIAL_VERTICES:
+      xyz[0] = v->pialx;
+      xyz[1] = v->pialy;
+      xyz[2] = v->pialz;
+      break;
+    case FLATTENED_VERTICES:
+      xyz[0] = v->fx;
+      xyz[1] = v->fy;
+      xyz[2] = 0;
+      break;
+    case CURRENT_VERTICES:
+      xyz[0] = v->x;
+      xyz[1] = v->y;
+      xyz[2] = v->z;
+      break;
+    default:
+      ErrorExit(ERROR_UNSUPPORTED, "bvhVertexXYZ: unsupported vertex set %d", which);
+  }
+}
+
+
+/*-----------------------------------------------------
+  Building
+  -----------------------------------------------------*/
+typedef struct BVH_BUILD
+{
+  MRIS_BVH *bvh;
+  int coordsPerItem;
+  float const *coords;    // in the original order
+  float *centroid;        // in the original order
+  int *order;             // tree order -> original order
+} BVH_BUILD;
+
+static void bvhSelect(BVH_BUILD *b, int axis, int lo, int hi, int k)
+{
+  // Leaves order[k] holding the item whose centroid is k'th along the axis,
+  // with the smaller ones before it and the larger ones after it
+  int *order = b->order;
+  while (hi - lo > 1) {
+    float const pivot = b->centroid[3 * order[(lo + hi) / 2] + axis];
+    int lt = lo, i = lo, gt = hi;
+    while (i < gt) {
+      float const key = b->centroid[3 * order[i] + axis];
+      int tmp;
+      if (key < pivot) {
+        tmp = order[lt]; order[lt] = order[i]; order[i] = tmp;
+        lt++; i++;
+      }
+      else if (key > pivot) {
+        gt--;
+        tmp = order[gt]; order[gt] = order[i]; order[i] = tmp;
+      }
+      else {
+        i++;
+      }
+    }
+    if (k < lt) {
+      hi = lt;
+    }
+    else if (k >= gt) {
+      lo = gt;
+    }
+    else {
+      return;
+    }
+  }
+}
+
+static void bvhBuild(BVH_BUILD *b, int nodeIndex, int start, int end)
+{
+  MRIS_BVH *bvh = b->bvh;
+  BVH_NODE *node = &bvh->nodes[nodeIndex];
+  float clo[3], chi[3];
+  int i, j, axis, mid, left;
+
+  for (j = 0; j < 3; j++) {
+    node->lo[j] = clo[j] = FLT_MAX;
+    node->hi[j] = chi[j] = -FLT_MAX;
+  }
+  for (i = start; i < end; i++) {
+    float const *c = &b->coords[b->coordsPerItem * b->order[i]];
+    float const *centroid = &b->centroid[3 * b->order[i]];
+    int k;
+    for (k = 0; k < b->coordsPerItem; k++) {
+      j = k % 3;
+      if (c[k] < node->lo[j]) node->lo[j] = c[k];
+      if (c[k] > node->hi[j]) node->hi[j] = c[k];
+    }
+    for (j = 0; j < 3; j++) {
+      if (centroid[j] < clo[j]) clo[j] = centroid[j];
+      if (centroid[j] > chi[j]) chi[j] = centroid[j];
+    }
+  }
+
+  if (end - start <= BVH_LEAF_SIZE) {
+    node->first = start;
+    node->count = end - start;
+    return;
+  }
+
+  axis = 0;
+  for (j = 1; j < 3; j++) {
+    if (chi[j] - clo[j] > chi[axis] - clo[axis]) axis = j;
+  }
+  mid = (start + end) / 2;
+  bvhSelect(b, axis, start, end, mid);
+
+  left = bvh->nnodes;
+  bvh->nnodes += 2;
+  node->first = left;
+  node->count = 0;
+  bvhBuild(b, left, start, mid);
+  bvhBuild(b, left + 1, mid, end);
+}
+
+static MRIS_BVH *bvhCreate(int faces, int nitems, int *ids, float *coords)
+{
+  int const coordsPerItem = faces ? 9 : 3;
+  MRIS_BVH *bvh = (MRIS_BVH *)calloc(1, sizeof(MRIS_BVH));
+  BVH_BUILD b;
+  int i, k;
+
+  bvh->faces = faces;
+  bvh->nitems = nitems;
+  bvh->id = (int *)malloc((nitems + 1) * sizeof(int));
+  bvh->coords = (float *)malloc((nitems + 1) * coordsPerItem * sizeof(float));
+  bvh->nodes = (BVH_NODE *)malloc(2 * (nitems + 1) * sizeof(BVH_NODE));
+  if (!bvh->id || !bvh->coords || !bvh->nodes) {
+    ErrorExit(ERROR_NOMEMORY, "bvhCreate: could not allocate a tree of %d items", nitems);
+  }
+  if (nitems == 0) {
+    return (bvh);
+  }
+
+  b.bvh = bvh;
+  b.coordsPerItem = coordsPerItem;
+  b.coords = coords;
+  b.centroid = (float *)malloc(3 * nitems * sizeof(float));
+  b.order = (int *)malloc(nitems * sizeof(int));
+  for (i = 0; i < nitems; i++) {
+    float const *c = &coords[coordsPerItem * i];
+    b.order[i] = i;
+    for (k = 0; k < 3; k++) {
+      b.centroid[3 * i + k] = faces ? (c[k] + c[k + 3] + c[k + 6]) / 3 : c[k];
+    }
+  }
+
+  bvh->nnodes = 1;
+  bvhBuild(&b, 0, 0, nitems);
+
+  for (i = 0; i < nitems; i++) {
+    bvh->id[i] = ids[b.order[i]];
+    for (k = 0; k < coordsPerItem; k++) {
+      bvh->coords[coordsPerItem * i + k] = coords[coordsPerItem * b.order[i] + k];
+    }
+  }
+
+  free(b.centroid);
+  free(b.order);
+  return (bvh);
+}
+
+MRIS_BVH *BVHcreateVertexTree(MRI_SURFACE const *mris, int which)
+{
+  int *ids = (int *)malloc((mris->nvertices + 1) * sizeof(int));
+  float *coords = (float *)malloc((mris->nvertices + 1) * 3 * sizeof(float));
+  int vno, nitems = 0;
+  MRIS_BVH *bvh;
+
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    if (v->ripflag) continue;
+    ids[nitems] = vno;
+    bvhVertexXYZ(v, which, &coords[3 * nitems]);
+    nitems++;
+  }
+  bvh = bvhCreate(0, nitems, ids, coords);
+  free(ids);
+  free(coords);
+  return (bvh);
+}
+
+MRIS_BVH *BVHcreateFaceTree(MRI_SURFACE const *mris, int which)
+{
+  int *ids = (int *)malloc((mris->nfaces + 1) * sizeof(int));
+  float *coords = (float *)malloc((mris->nfaces + 1) * 9 * sizeof(float));
+  int fno, n, nitems = 0;
+  MRIS_BVH *bvh;
+
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    FACE const *f = &mris->faces[fno];
+    if (f->ripflag) continue;
+    ids[nitems] = fno;
+    for (n = 0; n < VERTICES_PER_FACE; n++) {
+      bvhVertexXYZ(&mris->vertices[f->v[n]], which, &coords[9 * nitems + 3 * n]);
+    }
+    nitems++;
+  }
+  bvh = bvhCreate(1, nitems, ids, coords);
+  free(ids);
+  free(coords);
+  return (bvh);
+}
+
+void BVHfree(MRIS_BVH **pbvh)
+{
+  MRIS_BVH *bvh = *pbvh;
+  if (!bvh) return;
+  free(bvh->id);
+  free(bvh->coords);
+  free(bvh->nodes);
+  free(bvh);
+  *pbvh = NULL;
+}
+
+
+/*-----------------------------------------------------
+  Searching
+  -----------------------------------------------------*/
+static double bvhBoxDist2(BVH_NODE const *node, double const *p)
+{
+  double d2 = 0;
+  int j;
+  for (j = 0; j < 3; j++) {
+    double d = 0;
+    if (p[j] < node->lo[j]) d = node->lo[j] - p[j];
+    else if (p[j] > node->hi[j]) d = p[j] - node->hi[j];
+    d2 += d * d;
+  }
+  return (d2);
+}
+
+// The squared distance from p to the closest point of the triangle abc.
+// See Ericson, Real-Time Collision Detection, 5.1.5
+//
+static double bvhTriangleDist2(float const *t, double const *p)
+{
+  double ab[3], ac[3], ap[3], bp[3], cp[3], q[3];
+  double d1, d2, d3, d4, d5, d6, va, vb, vc, v, w, denom;
+  int j;
+
+  for (j = 0; j < 3; j++) {
+    ab[j] = t[3 + j] - t[j];
+    ac[j] = t[6 + j] - t[j];
+    ap[j] = p[j] - t[j];
+  }
+  d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+  d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+  if (d1 <= 0 && d2 <= 0) {
+    for (j = 0; j < 3; j++) q[j] = t[j];
+    goto Done;
+  }
+
+  for (j = 0; j < 3; j++) bp[j] = p[j] - t[3 + j];
+  d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+  d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+  if (d3 >= 0 && d4 <= d3) {
+    for (j = 0; j < 3; j++) q[j] = t[3 + j];
+    goto Done;
+  }
+
+  vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    v = d1 / (d1 - d3);
+    for (j = 0; j < 3; j++) q[j] = t[j] + v * ab[j];
+    goto Done;
+  }
+
+  for (j = 0; j < 3; j++) cp[j] = p[j] - t[6 + j];
+  d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+  d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+  if (d6 >= 0 && d5 <= d6) {
+    for (j = 0; j < 3; j++) q[j] = t[6 + j];
+    goto Done;
+  }
+
+  vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    w = d2 / (d2 - d6);
+    for (j = 0; j < 3; j++) q[j] = t[j] + w * ac[j];
+    goto Done;
+  }
+
+  va = d3 * d6 - d5 * d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+    w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    for (j = 0; j < 3; j++) q[j] = t[3 + j] + w * (t[6 + j] - t[3 + j]);
+    goto Done;
+  }
+
+  denom = va + vb + vc;
+  if (denom == 0) {  // degenerate triangle, use its first corner
+    for (j = 0; j < 3; j++) q[j] = t[j];
+    goto Done;
+  }
+  v = vb / denom;
+  w = vc / denom;
+  for (j = 0; j < 3; j++) q[j] = t[j] + ab[j] * v + ac[j] * w;
+
+Done:
+  return ((p[0] - q[0]) * (p[0] - q[0]) + (p[1] - q[1]) * (p[1] - q[1]) + (p[2] - q[2]) * (p[2] - q[2]));
+}
+
+static double bvhItemDist2(MRIS_BVH const *bvh, int i, double const *p)
+{
+  if (bvh->faces) {
+    return (bvhTriangleDist2(&bvh->coords[9 * i], p));
+  }
+  else {
+    float const *c = &bvh->coords[3 * i];
+    double dx = c[0] - p[0], dy = c[1] - p[1], dz = c[2] - p[2];
+    return (dx * dx + dy * dy + dz * dz);
+  }
+}
+
+static int bvhFindClosest(MRIS_BVH const *bvh, double x, double y, double z, float *min_dist)
+{
+  double const p[3] = {x, y, z};
+  double bestDist2 = DBL_MAX;
+  int bestId = -1;
+  int stack[BVH_STACK_SIZE], sp = 0;
+
+  if (bvh->nitems > 0) stack[sp++] = 0;
+  while (sp > 0) {
+    BVH_NODE const *node = &bvh->nodes[stack[--sp]];
+    if (bvhBoxDist2(node, p) > bestDist2) continue;
+
+    if (node->count) {
+      int i;
+      for (i = node->first; i < node->first + node->count; i++) {
+        double d2 = bvhItemDist2(bvh, i, p);
+        int id = bvh->id[i];
+        if (d2 < bestDist2 || (d2 == bestDist2 && id < bestId)) {
+          bestDist2 = d2;
+          bestId = id;
+        }
+      }
+    }
+    else {
+      // Push the farther child first, so the nearer is searched first and prunes more
+      double dl = bvhBoxDist2(&bvh->nodes[node->first], p);
+      double dr = bvhBoxDist2(&bvh->nodes[node->first + 1], p);
+      int nearer = node->first, farther = node->first + 1;
+      if (dr < dl) {
+        double tmp = dl; dl = dr; dr = tmp;
+        nearer = node->first + 1;
+        farther = node->first;
+      }
+      if (dr <= bestDist2) stack[sp++] = farther;
+      if (dl <= bestDist2) stack[sp++] = nearer;
+    }
+  }
+
+  if (min_dist) *min_dist = (bestId < 0) ? FLT_MAX : sqrt(bestDist2);
+  return (bestId);
+}
+
+int BVHfindClosestVertexNo(MRIS_BVH const *bvh, double x, double y, double z, float *min_dist)
+{
+  if (bvh->faces) ErrorExit(ERROR_BADPARM, "BVHfindClosestVertexNo: tree is of faces");
+  return (bvhFindClosest(bvh, x, y, z, min_dist));
+}
+
+int BVHfindClosestFaceNo(MRIS_BVH const *bvh, double x, double y, double z, float *min_dist)
+{
+  if (!bvh->faces) ErrorExit(ERROR_BADPARM, "BVHfindClosestFaceNo: tree is of vertices");
+  return (bvhFindClosest(bvh, x, y, z, min_dist));
+}
+
+static void bvhFindClosests(MRIS_BVH const *bvh, int npoints, float const *xyz, int *ids, float *min_dist)
+{
+  int n;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(guided)
+#endif
+  for (n = 0; n < npoints; n++) {
+    ROMP_PFLB_begin
+    ids[n] = bvhFindClosest(bvh, xyz[3 * n], xyz[3 * n + 1], xyz[3 * n + 2], min_dist ? &min_dist[n] : NULL);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+void BVHfindClosestVertexNos(MRIS_BVH const *bvh, int npoints, float const *xyz, int *vno, float *min_dist)
+{
+  if (bvh->faces) ErrorExit(ERROR_BADPARM, "BVHfindClosestVertexNos: tree is of faces");
+  bvhFindClosests(bvh, npoints, xyz, vno, min_dist);
+}
+
+void BVHfindClosestFaceNos(MRIS_BVH const *bvh, int npoints, float const *xyz, int *fno, float *min_dist)
+{
+  if (!bvh->faces) ErrorExit(ERROR_BADPARM, "BVHfindClosestFaceNos: tree is of vertices");
+  bvhFindClosests(bvh, npoints, xyz, fno, min_dist);
+}
+
+static int bvhCompareInt(const void *a, const void *b)
+{
+  int ia = *(const int *)a, ib = *(const int *)b;
+  return (ia < ib) ? -1 : (ia > ib);
+}
+
+int *BVHgetAllWithinDistance(MRIS_BVH const *bvh, double x, double y, double z, double max_dist, int *pnum)
+{
+  double const p[3] = {x, y, z};
+  double const maxDist2 = max_dist * max_dist;
+  int *list = NULL, num = 0, capacity = 0;
+  int stack[BVH_STACK_SIZE], sp = 0;
+
+  if (bvh->nitems > 0) stack[sp++] = 0;
+  while (sp > 0) {
+    BVH_NODE const *node = &bvh->nodes[stack[--sp]];
+    if (bvhBoxDist2(node, p) > maxDist2) continue;
+
+    if (node->count) {
+      int i;
+      for (i = node->first; i < node->first + node->count; i++) {
+        if (bvhItemDist2(bvh, i, p) > maxDist2) continue;
+        if (num == capacity) {
+          capacity = capacity ? 2 * capacity : 64;
+          list = (int *)realloc(list, capacity * sizeof(int));
+        }
+        list[num++] = bvh->id[i];
+      }
+    }
+    else {
+      stack[sp++] = node->first;
+      stack[sp++] = node->first + 1;
+    }
+  }
+
+  if (list) qsort(list, num, sizeof(int), bvhCompareInt);
+  *pnum = num;
+  return (list);
+}
@@ -8222,6 +8222,7 @@ MRI_SURFACE *MRIScorrectTopology(
   HISTOGRAM *h_k1, *h_k2, *h_gray, *h_white, *h_dot, *h_border, *h_grad;
   MRI *mri_gray_white, *mri_k1_k2;
   MRIS *mris_corrected_final;
+  long seed;
 
 #if ADD_EXTRA_VERTICES
   int retessellation_error = -1;
@@ -8783,11 +8784,20 @@ MRI_SURFACE *MRIScorrectTopology(
     mrisComputeSurfaceStatistics(mris, mri, h_k1, h_k2, mri_k1_k2, mri_gray_white, h_dot);
 
   mrisMarkAllDefects(mris, dl, 0);
+  seed = getRandomSeed();
   for (i = 0; i < dl->ndefects; i++) {
     if (parms->correct_defect >= 0 && i != parms->correct_defect) {
       continue;
     }
 
+    /* Seed the search for each defect from its number, so that its
+       retessellation does not depend on how many random numbers the
+       defects before it used: correcting one defect on its own
+       (correct_defect) gives what the whole run gives for it. */
+    if (seed != 0L) {
+      setRandomSeed(seed + i);
+    }
+
     defect = &dl->defects[i];
     if (i == Gdiag_no) {
       DiagBreak();
@@ -9136,6 +9146,9 @@ MRI_SURFACE *MRIScorrectTopology(
     if (parms->correct_defect >= 0 && i == parms->correct_defect)
       ErrorExit(ERROR_BADPARM, "TERMINATING PROGRAM AFTER CORRECTED DEFECT\n");
   }
+  if (seed != 0L) {
+    setRandomSeed(seed);  // restore
+  }
 #if ADD_EXTRA_VERTICES
   if (retessellation_error >= 0) {
     fprintf(WHICH_OUTPUT,
@@ -12516,28 +12529,59 @@ static int mrisTessellateDefect_wkr(MRI_SURFACE *mris,
 
   ROMP_SCOPE_begin
   /* find and discard all edges that intersect one that is already in the
-     tessellation.
+     tessellation.  The tessellation edges are never discarded, so an edge
+     goes iff it intersects a tessellation edge that precedes it in the table.
+     Mark those in parallel, then compact the table keeping its order.
   */
-  for (ndiscarded = i = 0; i < nedges; i++) {
-    if (et[i].used != USED_IN_TESSELLATION) {
-      continue;
-    }
+  {
+    int *tess_edges, ntess_edges;
+    char *discard;
 
-    for (j = i + 1; j < nedges; j++) {
-      if (et[j].used == USED_IN_TESSELLATION) {
-        continue;
+    tess_edges = (int *)calloc(MAX(nedges, 1), sizeof(int));
+    discard = (char *)calloc(MAX(nedges, 1), sizeof(char));
+    if (!tess_edges || !discard)
+      ErrorExit(ERROR_NOMEMORY,
+                "Excessive topologic defect encountered: "
+                "could not allocate %d edge flags",
+                nedges);
+    for (ntess_edges = i = 0; i < nedges; i++)
+      if (et[i].used == USED_IN_TESSELLATION) {
+        tess_edges[ntess_edges++] = i;
       }
 
-      if (edgesIntersect(mris_corrected, &et[i], &et[j])) {
-        ndiscarded++;
-        if (j < nedges - 1) {
-          memmove(&et[j], &et[j + 1], (nedges - j - 1) * sizeof(EDGE));
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 256)
+#endif
+    for (j = 0; j < nedges; j++) {
+      ROMP_PFLB_begin
+      
+      int k;
+      if (et[j].used != USED_IN_TESSELLATION) {
+        for (k = 0; k < ntess_edges && tess_edges[k] < j; k++) {
+          if (edgesIntersect(mris_corrected, &et[tess_edges[k]], &et[j])) {
+            discard[j] = 1;
+            break;
+          }
         }
+      }
+      
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
 
-        nedges--;
-        j--;
+    for (ndiscarded = i = 0; i < nedges; i++) {
+      if (discard[i]) {
+        ndiscarded++;
+      }
+      else if (ndiscarded) {
+        et[i - ndiscarded] = et[i];
       }
     }
+    nedges -= ndiscarded;
+
+    free(discard);
+    free(tess_edges);
   }
   ROMP_SCOPE_end
   
@@ -13290,8 +13334,8 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
 {
   DEFECT_VERTEX_STATE *dvs;
   DEFECT_PATCH dps1[MAX_PATCHES], dps2[MAX_PATCHES], *dps, *dp, *dps_next_generation;
-  int i, best_i, j, g, nselected, nreplacements, rank, nunchanged = 0, nelite, ncrossovers, k, l, noverlap;
-  int *overlap, ngenerations, nbests, last_euthanasia, nremovedvertices, nfinalvertices;
+  int i, best_i, j, g, nselected, nreplacements, rank, nunchanged = 0, nelite, ncrossovers, k, l;
+  int ngenerations, nbests, last_euthanasia, nremovedvertices, nfinalvertices;
   double fitness, best_fitness, last_best, fitness_mean, fitness_sigma, fitness_norm, pfitness, two_sigma_sq,
       last_fitness;
   static int dno = 0;     /* for debugging */
@@ -13416,20 +13460,27 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
     etable.overlapping_edges = (int **)calloc(nedges, sizeof(int *));
     etable.noverlap = (int *)calloc(nedges, sizeof(int));
     etable.flags = (unsigned char *)calloc(nedges, sizeof(unsigned char));
-    overlap = (int *)calloc(nedges, sizeof(int));
-    if (!etable.edges || !etable.overlapping_edges || !etable.noverlap || !overlap)
+    if (!etable.edges || !etable.overlapping_edges || !etable.noverlap || !etable.flags)
       ErrorExit(ERROR_NOMEMORY,
                 "mrisComputeOptimalRetessellation: Excessive "
                 "topologic defect encountered: could not allocate %d "
                 "edge table",
                 nedges);
 
-    for (nzero = i = 0; i < nedges; i++) /* compute overlapping
-                                                        for each edge */
-    {
-      if (nedges > 50000 && !(i % 25000)) {
-        fprintf(WHICH_OUTPUT, "%d of %d edges processed\n", i, nedges);
-      }
+    /* compute overlapping for each edge - the lists are independent of each
+       other and edgesIntersect only reads mris_corrected, so do them in parallel */
+    if (nedges > 50000) {
+      fprintf(WHICH_OUTPUT, "computing the overlapping edges of %d edges\n", nedges);
+    }
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 64)
+#endif
+    for (i = 0; i < nedges; i++) {
+      ROMP_PFLB_begin
+      
+      int overlap[MAX_EDGES + 1], noverlap, j;
+
       etable.noverlap[i] = 0;
       for (noverlap = j = 0; j < nedges; j++) {
         if (j == i) {
@@ -13463,12 +13514,16 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
                     etable.noverlap[i]);
         memmove(etable.overlapping_edges[i], overlap, etable.noverlap[i] * sizeof(int));
       }
-      else {
+      
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    for (nzero = i = 0; i < nedges; i++) {
+      if (!etable.noverlap[i]) {
         nzero++;
       }
     }
-
-    free(overlap);
   }
 
   ROMP_SCOPE_end
@@ -14426,20 +14426,18 @@ int MRIStaubinSmooth(MRI_SURFACE *mris, int niters, double lambda, double mu, in
 /*-------------------------------------------------------------------
   MRISgaussianSmooth() - perform gaussian smoothing on a spherical
   surface. The gaussian is defined by stddev GStd and is truncated
-  at TruncFactor stddevs. Note: this will change the val2bak of all
-  the vertices. See also MRISspatialFilter() and MRISgaussianWeights().
+  at TruncFactor stddevs. The weights are held in an MRIS_SMOOTH_OP
+  (see MRISgaussianSmoothOp()) so that smoothing many inputs on the
+  same surface only builds them once. See also MRISspatialFilter()
+  and MRISgaussianWeights().
   -------------------------------------------------------------------*/
 MRI *MRISgaussianSmooth(MRIS *Surf, MRI *Src, double GStd, MRI *Targ, double TruncFactor)
 {
-  int vtxno1, vtxno2;
-  float val;
-  MRI *SrcTmp, *GSum, *GSum2, *nXNbrsMRI;
   VERTEX *vtx1;
-  double Radius, Radius2, dmax, GVar2, f, d, costheta, theta, g, dotprod;
-  int n, err, nXNbrs, *XNbrVtxNo, frame;
-  double *XNbrDotProd, DotProdThresh;
+  double Radius, Radius2, dmax, GVar2, f, DotProdThresh;
   double InterVertexDistAvg, InterVertexDistStdDev;
   double VertexRadiusAvg, VertexRadiusStdDev;
+  MRIS_SMOOTH_OP *op;
 
   if (Surf->nvertices != Src->width) {
     printf("ERROR: MRISgaussianSmooth: Surf/Src dimension mismatch\n");
@@ -14465,24 +14463,7 @@ MRI *MRISgaussianSmooth(MRIS *Surf, MRI *Src, double GStd, MRI *Targ, double Tru
     }
   }
 
-  /* Make a copy in case it's done in place */
-  SrcTmp = MRIcopy(Src, NULL);
-
-  /* This is for normalizing */
-  GSum = MRIallocSequence(Src->width, Src->height, Src->depth, MRI_FLOAT, 1);
-  if (GSum == NULL) {
-    printf("ERROR: MRISgaussianSmooth: could not alloc GSum\n");
-    return (NULL);
-  }
-
-  GSum2 = MRIallocSequence(Src->width, Src->height, Src->depth, MRI_FLOAT, 1);
-  if (GSum2 == NULL) {
-    printf("ERROR: MRISgaussianSmooth: could not alloc GSum2\n");
-    return (NULL);
-  }
-
   MRIScomputeMetricProperties(Surf);
-  nXNbrsMRI = MRIallocSequence(Src->width, Src->height, Src->depth, MRI_FLOAT, 1);
 
   vtx1 = &Surf->vertices[0];
   Radius2 = (vtx1->x * vtx1->x) + (vtx1->y * vtx1->y) + (vtx1->z * vtx1->z);
@@ -14502,37 +14483,166 @@ MRI *MRISgaussianSmooth(MRIS *Surf, MRI *Src, double GStd, MRI *Targ, double Tru
   printf("Total Area = %g \n", Surf->total_area);
   printf("Dist   = %g +/- %g\n", InterVertexDistAvg, InterVertexDistStdDev);
   printf("Radius = %g +/- %g\n", VertexRadiusAvg, VertexRadiusStdDev);
+  printf("nvertices = %d\n", Surf->nvertices);
 
-  /* Initialize */
-  for (vtxno1 = 0; vtxno1 < Surf->nvertices; vtxno1++) {
-    MRIFseq_vox(GSum, vtxno1, 0, 0, 0) = 0;
-    MRIFseq_vox(GSum2, vtxno1, 0, 0, 0) = 0;
-    for (frame = 0; frame < Targ->nframes; frame++) {
-      MRIFseq_vox(Targ, vtxno1, 0, 0, frame) = 0;
-    }
-    Surf->vertices[vtxno1].val2bak = -1;
+  op = MRISgaussianSmoothOp(Surf, GStd, TruncFactor);
+  if (op == NULL) {
+    printf("ERROR: MRISgaussianSmooth: could not build the smoothing operator\n");
+    return (NULL);
   }
 
-  /* These are needed by MRISextendedNeighbors()*/
-  XNbrVtxNo = (int *)calloc(Surf->nvertices, sizeof(int));
-  XNbrDotProd = (double *)calloc(Surf->nvertices, sizeof(double));
+  return (MRISsmoothOpApply(op, Src, Targ));
+}
 
-  printf("nvertices = %d\n", Surf->nvertices);
-  for (vtxno1 = 0; vtxno1 < Surf->nvertices; vtxno1++) {
-    nXNbrs = 0;
-    err =
-        MRISextendedNeighbors(Surf, vtxno1, vtxno1, DotProdThresh, XNbrVtxNo, XNbrDotProd, &nXNbrs, Surf->nvertices, 1);
-    MRIFseq_vox(nXNbrsMRI, vtxno1, 0, 0, 0) = nXNbrs;
-
-    if (vtxno1 % 10000 == 0 && Gdiag_no > 0) {
-      printf("vtxno1 = %d, nXNbrs = %d\n", vtxno1, nXNbrs);
-      fflush(stdout);
+
+/*-------------------------------------------------------------------
+  MRISsmoothOpChecksum() - checksum of the parts of the surface that
+  the gaussian smoothing operator depends on: the vertex coordinates,
+  the ripflags and the faces.
+  -------------------------------------------------------------------*/
+unsigned long long MRISsmoothOpChecksum(MRIS *Surf)
+{
+  unsigned long hash = fnv_init();
+  int vno, fno;
+
+  hash = fnv_add(hash, (const unsigned char *)&Surf->nvertices, sizeof(Surf->nvertices));
+  hash = fnv_add(hash, (const unsigned char *)&Surf->nfaces, sizeof(Surf->nfaces));
+  for (vno = 0; vno < Surf->nvertices; vno++) {
+    VERTEX const *v = &Surf->vertices[vno];
+    float xyz[3];
+    int ripflag = v->ripflag;
+    xyz[0] = v->x;
+    xyz[1] = v->y;
+    xyz[2] = v->z;
+    hash = fnv_add(hash, (const unsigned char *)xyz, sizeof(xyz));
+    hash = fnv_add(hash, (const unsigned char *)&ripflag, sizeof(ripflag));
+  }
+  for (fno = 0; fno < Surf->nfaces; fno++) {
+    hash = fnv_add(hash, (const unsigned char *)Surf->faces[fno].v, sizeof(Surf->faces[fno].v));
+  }
+  return ((unsigned long long)hash);
+}
+
+
+/*-------------------------------------------------------------------
+  mrisSmoothOpNbrs() - the same search as MRISextendedNeighbors()
+  with DistType=1, finding the vertices in the same order, but using
+  the caller's hit[] array instead of vertex->val2bak and an explicit
+  stack instead of recursion so that it can be run for many target
+  vertices at once. hit[] must be initialized to -1.
+  -------------------------------------------------------------------*/
+static void mrisSmoothOpNbrs(MRIS *Surf, int TargVtxNo, double DotProdThresh, int *hit, int *stackVno,
+                             int *stackNbr, int *XNbrVtxNo, double *XNbrDotProd, int *nXNbrs, int nXNbrsMax)
+{
+  VERTEX const *vtarg = &Surf->vertices[TargVtxNo];
+  int depth = 0, CurVtxNo = TargVtxNo;
+
+  *nXNbrs = 0;
+  for (;;) {
+    VERTEX const *vcur = &Surf->vertices[CurVtxNo];
+    if (hit[CurVtxNo] != TargVtxNo && !vcur->ripflag) {
+      double DotProd = fabs((vtarg->x * vcur->x) + (vtarg->y * vcur->y) + (vtarg->z * vcur->z));
+      if (DotProd > DotProdThresh) {
+        if (*nXNbrs >= nXNbrsMax - 1) {
+          return;
+        }
+        XNbrVtxNo[*nXNbrs] = CurVtxNo;
+        XNbrDotProd[*nXNbrs] = DotProd;
+        (*nXNbrs)++;
+        hit[CurVtxNo] = TargVtxNo;
+        stackVno[depth] = CurVtxNo;
+        stackNbr[depth] = 0;
+        depth++;
+      }
     }
 
+    // Move on to the next unvisited nearest neighbor of the deepest vertex that has one
+    while (depth > 0) {
+      VERTEX_TOPOLOGY const *vt = &Surf->vertices_topology[stackVno[depth - 1]];
+      if (stackNbr[depth - 1] < vt->vnum) {
+        CurVtxNo = vt->v[stackNbr[depth - 1]++];
+        break;
+      }
+      depth--;
+    }
+    if (depth == 0) {
+      return;
+    }
+  }
+}
+
+
+/*-------------------------------------------------------------------
+  MRISgaussianSmoothOpBuild() - build the operator applied by
+  MRISgaussianSmooth(). Each row holds the gaussian weights of the
+  extended neighbors of a vertex, in the order MRISextendedNeighbors()
+  finds them, so applying it gives the same results as computing the
+  weights on the fly did.
+  -------------------------------------------------------------------*/
+MRIS_SMOOTH_OP *MRISgaussianSmoothOpBuild(MRIS *Surf, double GStd, double TruncFactor)
+{
+  VERTEX *vtx1;
+  double Radius, Radius2, dmax, GVar2, f, DotProdThresh;
+  int **rowCol, *rowN, vno, tid;
+  double **rowWeight;
+  MRIS_SMOOTH_OP *op;
+  long long nnz;
+
+  vtx1 = &Surf->vertices[0];
+  Radius2 = (vtx1->x * vtx1->x) + (vtx1->y * vtx1->y) + (vtx1->z * vtx1->z);
+  Radius = sqrt(Radius2);
+  dmax = TruncFactor * GStd;
+  GVar2 = 2 * (GStd * GStd);
+  f = pow(1 / (sqrt(2 * M_PI) * GStd), 2.0);
+  DotProdThresh = Radius2 * cos(dmax / Radius) * (1.0001);
+
+#ifdef HAVE_OPENMP
+  int const maxThreads = omp_get_max_threads();
+#else
+  int const maxThreads = 1;
+#endif
+  typedef struct {
+    int *hit, *stackVno, *stackNbr, *XNbrVtxNo;
+    double *XNbrDotProd;
+  } Buffers;
+  Buffers *buffersByThread = (Buffers *)calloc(maxThreads, sizeof(Buffers));
+  for (tid = 0; tid < maxThreads; tid++) {
+    Buffers *b = &buffersByThread[tid];
+    b->hit = (int *)malloc(Surf->nvertices * sizeof(int));
+    b->stackVno = (int *)malloc(Surf->nvertices * sizeof(int));
+    b->stackNbr = (int *)malloc(Surf->nvertices * sizeof(int));
+    b->XNbrVtxNo = (int *)malloc(Surf->nvertices * sizeof(int));
+    b->XNbrDotProd = (double *)malloc(Surf->nvertices * sizeof(double));
+    for (vno = 0; vno < Surf->nvertices; vno++) b->hit[vno] = -1;
+  }
+
+  rowN = (int *)calloc(Surf->nvertices, sizeof(int));
+  rowCol = (int **)calloc(Surf->nvertices, sizeof(int *));
+  rowWeight = (double **)calloc(Surf->nvertices, sizeof(double *));
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 256)
+#endif
+  for (vno = 0; vno < Surf->nvertices; vno++) {
+    ROMP_PFLB_begin
+
+#ifdef HAVE_OPENMP
+    int const tid = omp_get_thread_num();
+#else
+    int const tid = 0;
+#endif
+    Buffers *b = &buffersByThread[tid];
+    int n, nXNbrs = 0;
+
+    mrisSmoothOpNbrs(Surf, vno, DotProdThresh, b->hit, b->stackVno, b->stackNbr, b->XNbrVtxNo, b->XNbrDotProd,
+                     &nXNbrs, Surf->nvertices);
+
+    rowN[vno] = nXNbrs;
+    rowCol[vno] = (int *)malloc((nXNbrs + 1) * sizeof(int));
+    rowWeight[vno] = (double *)malloc((nXNbrs + 1) * sizeof(double));
     for (n = 0; n < nXNbrs; n++) {
-      vtxno2 = XNbrVtxNo[n];
-      dotprod = XNbrDotProd[n];
-      costheta = dotprod / Radius2;
+      double costheta = b->XNbrDotProd[n] / Radius2;
 
       // cos theta might be slightly > 1 due to precision
       if (costheta > +1.0) {
@@ -14542,59 +14652,318 @@ MRI *MRISgaussianSmooth(MRIS *Surf, MRI *Src, double GStd, MRI *Targ, double Tru
         costheta = -1.0;
       }
 
-      // Compute the angle between the vertices
-      theta = acos(costheta);
-
       /* Compute the distance bet vertices along the surface of the sphere */
-      d = Radius * theta;
+      double d = Radius * acos(costheta);
 
-      /* Compute weighting factor for this distance */
-      g = f * exp(-(d * d) / (GVar2)); /* f not really nec */
-      // ga = g * Surf->vertices[vtxno2].area;
+      rowCol[vno][n] = b->XNbrVtxNo[n];
+      rowWeight[vno][n] = f * exp(-(d * d) / (GVar2)); /* f not really nec */
+    }
 
-      if (vtxno1 == 10000 && 1) {
-        printf("%d %d %g %g %g %g %g\n", vtxno1, vtxno2, dotprod, costheta, theta, d, g);
-        fflush(stdout);
-      }
+    if (vno % 10000 == 0 && Gdiag_no > 0) {
+      printf("vtxno1 = %d, nXNbrs = %d\n", vno, nXNbrs);
+      fflush(stdout);
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (tid = 0; tid < maxThreads; tid++) {
+    Buffers *b = &buffersByThread[tid];
+    free(b->hit);
+    free(b->stackVno);
+    free(b->stackNbr);
+    free(b->XNbrVtxNo);
+    free(b->XNbrDotProd);
+  }
+  free(buffersByThread);
+
+  op = (MRIS_SMOOTH_OP *)calloc(1, sizeof(MRIS_SMOOTH_OP));
+  op->nvertices = Surf->nvertices;
+  op->checksum = MRISsmoothOpChecksum(Surf);
+  op->gstd = GStd;
+  op->truncFactor = TruncFactor;
+  op->rowStart = (long long *)malloc((Surf->nvertices + 1) * sizeof(long long));
+  nnz = 0;
+  for (vno = 0; vno < Surf->nvertices; vno++) {
+    op->rowStart[vno] = nnz;
+    nnz += rowN[vno];
+  }
+  op->rowStart[Surf->nvertices] = nnz;
+  op->nnz = nnz;
+  op->col = (int *)malloc((nnz + 1) * sizeof(int));
+  op->weight = (double *)malloc((nnz + 1) * sizeof(double));
+  if (!op->col || !op->weight) {
+    ErrorExit(ERROR_NOMEMORY, "MRISgaussianSmoothOpBuild: could not allocate %lld weights", nnz);
+  }
+  for (vno = 0; vno < Surf->nvertices; vno++) {
+    memcpy(&op->col[op->rowStart[vno]], rowCol[vno], rowN[vno] * sizeof(int));
+    memcpy(&op->weight[op->rowStart[vno]], rowWeight[vno], rowN[vno] * sizeof(double));
+    free(rowCol[vno]);
+    free(rowWeight[vno]);
+  }
+  free(rowCol);
+  free(rowWeight);
+  free(rowN);
+
+  return (op);
+}
 
-      // MRIFseq_vox(GSum,vtxno1,0,0,0)  += g;
-      // MRIFseq_vox(GSum2,vtxno1,0,0,0) += (g*g);
 
-      for (frame = 0; frame < Targ->nframes; frame++) {
-        val = g * MRIFseq_vox(SrcTmp, vtxno2, 0, 0, frame);
-        MRIFseq_vox(Targ, vtxno1, 0, 0, frame) += val;
-      }
+void MRISsmoothOpFree(MRIS_SMOOTH_OP **pop)
+{
+  MRIS_SMOOTH_OP *op = *pop;
+  if (op == NULL) {
+    return;
+  }
+  free(op->rowStart);
+  free(op->col);
+  free(op->weight);
+  free(op);
+  *pop = NULL;
+}
 
-    } /* end loop over vertex2 */
 
-  } /* end loop over vertex1 */
+/*-------------------------------------------------------------------
+  The on-disk form of an MRIS_SMOOTH_OP: the header followed by
+  rowStart[nvertices+1], col[nnz] and weight[nnz], all in the byte
+  order of the machine that wrote it. A file written on a machine
+  with the other byte order is not read, so is simply rebuilt.
+  -------------------------------------------------------------------*/
+#define MRIS_SMOOTH_OP_MAGIC "FSSMOP1"
+#define MRIS_SMOOTH_OP_ENDIAN 0x01020304
 
-  /* Normalize */
-  if (0) {
-    for (vtxno1 = 0; vtxno1 < Surf->nvertices; vtxno1++) {
-      vtx1 = &Surf->vertices[vtxno1];
-      g = MRIFseq_vox(GSum, vtxno1, 0, 0, 0);
-      MRIFseq_vox(GSum2, vtxno1, 0, 0, 0) /= (g * g);
+typedef struct
+{
+  char magic[8];
+  int endian;
+  int nvertices;
+  unsigned long long checksum;
+  double gstd;
+  double truncFactor;
+  long long nnz;
+} MRIS_SMOOTH_OP_HEADER;
+
+int MRISsmoothOpWrite(MRIS_SMOOTH_OP *op, const char *fname)
+{
+  MRIS_SMOOTH_OP_HEADER header;
+  char tmpname[STRLEN + 32];
+  FILE *fp;
+  int ok;
+
+  memset(&header, 0, sizeof(header));
+  strcpy(header.magic, MRIS_SMOOTH_OP_MAGIC);
+  header.endian = MRIS_SMOOTH_OP_ENDIAN;
+  header.nvertices = op->nvertices;
+  header.checksum = op->checksum;
+  header.gstd = op->gstd;
+  header.truncFactor = op->truncFactor;
+  header.nnz = op->nnz;
+
+  // Written to a temporary and renamed, so that other processes sharing the cache never see half a file
+  sprintf(tmpname, "%s.tmp.%d", fname, (int)getpid());
+  fp = fopen(tmpname, "wb");
+  if (fp == NULL) {
+    ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "MRISsmoothOpWrite: could not open %s", tmpname));
+  }
+  ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+       fwrite(op->rowStart, sizeof(long long), op->nvertices + 1, fp) == (size_t)(op->nvertices + 1) &&
+       fwrite(op->col, sizeof(int), op->nnz, fp) == (size_t)op->nnz &&
+       fwrite(op->weight, sizeof(double), op->nnz, fp) == (size_t)op->nnz;
+  if (fclose(fp) != 0) {
+    ok = 0;
+  }
+  if (!ok || rename(tmpname, fname) != 0) {
+    unlink(tmpname);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MRISsmoothOpWrite: could not write %s", fname));
+  }
+  return (NO_ERROR);
+}
 
-      for (frame = 0; frame < Targ->nframes; frame++) {
-        val = MRIFseq_vox(Targ, vtxno1, 0, 0, frame);
-        MRIFseq_vox(Targ, vtxno1, 0, 0, frame) = val / g;
-      }
+MRIS_SMOOTH_OP *MRISsmoothOpRead(const char *fname)
+{
+  MRIS_SMOOTH_OP_HEADER header;
+  MRIS_SMOOTH_OP *op;
+  FILE *fp;
+  int ok;
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    ErrorReturn(NULL, (ERROR_NOFILE, "MRISsmoothOpRead: could not open %s", fname));
+  }
+  if (fread(&header, sizeof(header), 1, fp) != 1 || strcmp(header.magic, MRIS_SMOOTH_OP_MAGIC) ||
+      header.endian != MRIS_SMOOTH_OP_ENDIAN || header.nvertices <= 0 || header.nnz < 0) {
+    fclose(fp);
+    ErrorReturn(NULL, (ERROR_BADFILE, "MRISsmoothOpRead: %s is not a smoothing operator file", fname));
+  }
+
+  op = (MRIS_SMOOTH_OP *)calloc(1, sizeof(MRIS_SMOOTH_OP));
+  op->nvertices = header.nvertices;
+  op->checksum = header.checksum;
+  op->gstd = header.gstd;
+  op->truncFactor = header.truncFactor;
+  op->nnz = header.nnz;
+  op->rowStart = (long long *)malloc((op->nvertices + 1) * sizeof(long long));
+  op->col = (int *)malloc((op->nnz + 1) * sizeof(int));
+  op->weight = (double *)malloc((op->nnz + 1) * sizeof(double));
+  ok = op->rowStart && op->col && op->weight &&
+       fread(op->rowStart, sizeof(long long), op->nvertices + 1, fp) == (size_t)(op->nvertices + 1) &&
+       fread(op->col, sizeof(int), op->nnz, fp) == (size_t)op->nnz &&
+       fread(op->weight, sizeof(double), op->nnz, fp) == (size_t)op->nnz;
+  fclose(fp);
+  if (!ok || op->rowStart[op->nvertices] != op->nnz) {
+    MRISsmoothOpFree(&op);
+    ErrorReturn(NULL, (ERROR_BADFILE, "MRISsmoothOpRead: could not read %s", fname));
+  }
+  return (op);
+}
+
+
+/*-------------------------------------------------------------------
+  mrisSmoothOpCacheName() - the file in the FS_SURF_SMOOTH_CACHE
+  cache for the operator of this surface, gstd and truncation, or 0
+  if the cache is not in use.
+  -------------------------------------------------------------------*/
+static int mrisSmoothOpCacheName(MRIS *Surf, double GStd, double TruncFactor, unsigned long long checksum, char *fname)
+{
+  char const *cache = getenv("FS_SURF_SMOOTH_CACHE");
+  char dir[STRLEN];
+  char const *base;
+  struct stat st;
+
+  if (cache == NULL || cache[0] == 0 || !strcmp(cache, "0")) {
+    return (0);
+  }
+
+  base = strrchr(Surf->fname, '/');
+  base = base ? base + 1 : Surf->fname;
+  if (base[0] == 0) {
+    base = "surface";
+  }
+
+  if (stat(cache, &st) == 0 && S_ISDIR(st.st_mode)) {
+    strncpy(dir, cache, STRLEN - 1);
+    dir[STRLEN - 1] = 0;
+  }
+  else if (base != Surf->fname) {
+    int len = base - Surf->fname - 1;
+    if (len >= STRLEN) len = STRLEN - 1;
+    memcpy(dir, Surf->fname, len);
+    dir[len] = 0;
+  }
+  else {
+    strcpy(dir, ".");
+  }
+
+  snprintf(fname, STRLEN, "%s/%s.gstd%.4f.trunc%.2f.%016llx.smop", dir, base, GStd, TruncFactor, checksum);
+  return (1);
+}
+
+
+/*-------------------------------------------------------------------
+  MRISgaussianSmoothOp() - the operator for MRISgaussianSmooth(),
+  reusing the one from the previous call if the surface, gstd and
+  truncation match, else reading it from the FS_SURF_SMOOTH_CACHE
+  cache, else building it (and adding it to the cache). The operator
+  belongs to this function, so the caller must not free it.
+  -------------------------------------------------------------------*/
+MRIS_SMOOTH_OP *MRISgaussianSmoothOp(MRIS *Surf, double GStd, double TruncFactor)
+{
+  static MRIS_SMOOTH_OP *lastOp = NULL;
+  unsigned long long checksum = MRISsmoothOpChecksum(Surf);
+  char fname[STRLEN];
+  int useCache;
+
+  if (lastOp && lastOp->nvertices == Surf->nvertices && lastOp->checksum == checksum && lastOp->gstd == GStd &&
+      lastOp->truncFactor == TruncFactor) {
+    return (lastOp);
+  }
+  MRISsmoothOpFree(&lastOp);
+
+  useCache = mrisSmoothOpCacheName(Surf, GStd, TruncFactor, checksum, fname);
+  if (useCache && access(fname, R_OK) == 0) {
+    lastOp = MRISsmoothOpRead(fname);
+    if (lastOp && (lastOp->nvertices != Surf->nvertices || lastOp->checksum != checksum)) {
+      MRISsmoothOpFree(&lastOp);
+    }
+    if (lastOp) {
+      printf("Read smoothing operator from %s\n", fname);
+      return (lastOp);
     }
   }
 
-  // MRIwrite(GSum,"gsum.mgh");
-  // MRIwrite(GSum2,"gsum2.mgh");
-  // MRIwrite(nXNbrsMRI,"nxnbrs.mgh");
+  lastOp = MRISgaussianSmoothOpBuild(Surf, GStd, TruncFactor);
+  if (lastOp && useCache) {
+    if (MRISsmoothOpWrite(lastOp, fname) == NO_ERROR) {
+      printf("Wrote smoothing operator to %s\n", fname);
+    }
+  }
+  return (lastOp);
+}
 
-  MRIfree(&SrcTmp);
-  MRIfree(&GSum);
-  MRIfree(&GSum2);
-  MRIfree(&nXNbrsMRI);
 
-  free(XNbrVtxNo);
-  free(XNbrDotProd);
+/*-------------------------------------------------------------------
+  MRISsmoothOpApply() - Targ = op * Src for every frame. Src is
+  gathered vertex-major so each row of the operator is applied to all
+  the frames of a neighbor at once. Can be done in place.
+  -------------------------------------------------------------------*/
+MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP *op, MRI *Src, MRI *Targ)
+{
+  int const nframes = Src->nframes;
+  float *srcBlock, *trgBlock;
+  int vno, frame;
+
+  if (op->nvertices != Src->width) {
+    printf("ERROR: MRISsmoothOpApply: operator/Src dimension mismatch\n");
+    return (NULL);
+  }
+  if (Targ == NULL) {
+    Targ = MRIallocSequence(Src->width, Src->height, Src->depth, MRI_FLOAT, Src->nframes);
+    if (Targ == NULL) {
+      printf("ERROR: MRISsmoothOpApply: could not alloc\n");
+      return (NULL);
+    }
+  }
+
+  srcBlock = (float *)malloc((size_t)op->nvertices * nframes * sizeof(float));
+  trgBlock = (float *)calloc((size_t)op->nvertices * nframes, sizeof(float));
+  if (!srcBlock || !trgBlock) {
+    ErrorExit(ERROR_NOMEMORY, "MRISsmoothOpApply: could not allocate %d x %d", op->nvertices, nframes);
+  }
+  for (frame = 0; frame < nframes; frame++) {
+    for (vno = 0; vno < op->nvertices; vno++) {
+      srcBlock[(size_t)vno * nframes + frame] = MRIFseq_vox(Src, vno, 0, 0, frame);
+    }
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 256)
+#endif
+  for (vno = 0; vno < op->nvertices; vno++) {
+    ROMP_PFLB_begin
+    float *trg = &trgBlock[(size_t)vno * nframes];
+    long long k;
+    int frame;
+    for (k = op->rowStart[vno]; k < op->rowStart[vno + 1]; k++) {
+      double const g = op->weight[k];
+      float const *src = &srcBlock[(size_t)op->col[k] * nframes];
+      for (frame = 0; frame < nframes; frame++) {
+        float val = g * src[frame];
+        trg[frame] += val;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (frame = 0; frame < nframes; frame++) {
+    for (vno = 0; vno < op->nvertices; vno++) {
+      MRIFseq_vox(Targ, vno, 0, 0, frame) = trgBlock[(size_t)vno * nframes + frame];
+    }
+  }
 
+  free(srcBlock);
+  free(trgBlock);
   return (Targ);
 }
 
@@ -74,6 +74,7 @@
 #include "mri.h"
 #include "mri2.h"
 #include "mrimorph.h"
+#include "mrisbvh.h"
 #include "mrishash.h"
 #include "mrisurf.h"
 #include "proto.h"  // nint
@@ -871,7 +872,8 @@ trg1 and src2 are from the same anatomy.
 \param int nsurfs - total number of surfs in SurfReg
 \param int ReverseMapFlag - perform reverse mapping
 \param int DoJac - perform jacobian correction (conserves sum(SrcVals))
-\param int UseHash - use hash table (no reason not to, much faster).
+\param int UseHash - use search trees (no reason not to, much faster).
+The closest vertex searches of the forward loop are done in parallel.
 */
 MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int ReverseMapFlag, int DoJac, int UseHash)
 {
@@ -882,7 +884,8 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
   // int nunmapped;
   VERTEX *v;
   float dmin;
-  MHT **Hash = NULL;
+  MRIS_BVH **Bvh = NULL;
+  int *TrgToSrc;
   MRI *SrcHits, *TrgHits;
 
   npairs = nsurfs / 2;
@@ -923,30 +926,73 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
   MRIcopyHeader(SrcSurfVals, SrcHits);
 
   if (UseHash) {
-    printf("MRISapplyReg: building hash tables (res=16).\n");
-    Hash = (MHT **)calloc(sizeof(MHT *), nsurfs);
+    printf("MRISapplyReg: building search trees.\n");
+    Bvh = (MRIS_BVH **)calloc(sizeof(MRIS_BVH *), nsurfs);
     for (n = 0; n < nsurfs; n++) {
-      Hash[n] = MHTcreateVertexTable_Resolution(SurfReg[n], CURRENT_VERTICES, 16);
+      Bvh[n] = BVHcreateVertexTree(SurfReg[n], CURRENT_VERTICES);
     }
   }
 
-  if (DoJac) {
-    // If using jacobian correction, get a list of the number of times
-    // that a give source vertex gets sampled.
+  /* Compute the source vertex that corresponds to each target vertex.
+  The searches are independent, so with the trees they are done in parallel;
+  the accumulation below stays serial and in order. */
+  TrgToSrc = (int *)calloc(TrgSurfReg->nvertices, sizeof(int));
+  if (UseHash) {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(guided)
+#endif
+    for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
+      ROMP_PFLB_begin
+      int n, tvtxN = tvtx;
+      for (n = npairs - 1; n >= 0 && tvtxN >= 0; n--) {
+        VERTEX const *v = &(SurfReg[2 * n + 1]->vertices[tvtxN]);
+        tvtxN = BVHfindClosestVertexNo(Bvh[2 * n], v->x, v->y, v->z, NULL);
+      }
+      TrgToSrc[tvtx] = tvtxN;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+  else {
     for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-      // Compute the source vertex that corresponds to this target vertex
+      if (tvtx % 100 == 0) {
+        printf("%5d ", tvtx);
+        fflush(stdout);
+      }
+      if (tvtx % 1000 == 999) {
+        printf("\n");
+        fflush(stdout);
+      }
       tvtxN = tvtx;
-      for (n = npairs - 1; n >= 0; n--) {
+      for (n = npairs - 1; n >= 0 && tvtxN >= 0; n--) {
         kS = 2 * n;
         kT = kS + 1;
         v = &(SurfReg[kT]->vertices[tvtxN]);
-        /* find closest source vertex */
-        if (UseHash)
-          svtx = MHTfindClosestVertexNo(Hash[kS], SurfReg[kS], v, &dmin);
-        else
-          svtx = MRISfindClosestVertex(SurfReg[kS], v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-        tvtxN = svtx;
+        tvtxN = MRISfindClosestVertex(SurfReg[kS], v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
       }
+      TrgToSrc[tvtx] = tvtxN;
+    }
+  }
+  for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
+    if (TrgToSrc[tvtx] < 0) {
+      printf("ERROR: MRISapplyReg: target vertex %d could not be mapped, all source vertices are ripped\n", tvtx);
+      free(TrgToSrc);
+      MRIfree(&SrcHits);
+      MRIfree(&TrgHits);
+      MRIfree(&TrgSurfVals);
+      if (UseHash)
+        for (n = 0; n < nsurfs; n++) BVHfree(&Bvh[n]);
+      free(Bvh);
+      return (NULL);
+    }
+  }
+
+  if (DoJac) {
+    // If using jacobian correction, get a list of the number of times
+    // that a give source vertex gets sampled.
+    for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
+      svtx = TrgToSrc[tvtx];
       /* update the number of hits and distance */
       MRIFseq_vox((SrcHits), svtx, 0, 0, 0)++;
       MRIFseq_vox((TrgHits), tvtx, 0, 0, 0)++;
@@ -958,32 +1004,7 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
   printf("MRISapplyReg: Forward Loop (%d)\n", TrgSurfReg->nvertices);
   // nunmapped = 0;
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-    if (!UseHash) {
-      if (tvtx % 100 == 0) {
-        printf("%5d ", tvtx);
-        fflush(stdout);
-      }
-      if (tvtx % 1000 == 999) {
-        printf("\n");
-        fflush(stdout);
-      }
-    }
-
-    // Compute the source vertex that corresponds to this target vertex
-    tvtxN = tvtx;
-    for (n = npairs - 1; n >= 0; n--) {
-      kS = 2 * n;
-      kT = kS + 1;
-      // printf("%5d %5d %d %d %d\n",tvtx,tvtxN,n,kS,kT);
-      v = &(SurfReg[kT]->vertices[tvtxN]);
-      /* find closest source vertex */
-      if (UseHash) svtx = MHTfindClosestVertexNo(Hash[kS], SurfReg[kS], v, &dmin);
-      if (!UseHash || svtx < 0) {
-        if (svtx < 0) printf("Target vertex %d of pair %d unmapped in hash, using brute force\n", tvtxN, n);
-        svtx = MRISfindClosestVertex(SurfReg[kS], v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-      }
-      tvtxN = svtx;
-    }
+    svtx = TrgToSrc[tvtx];
 
     if (!DoJac) {
       /* update the number of hits */
@@ -1018,11 +1039,10 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
         // printf("%5d %5d %d %d %d\n",svtx,svtxN,n,kS,kT);
         v = &(SurfReg[kS]->vertices[svtxN]);
         /* find closest target vertex */
-        if (UseHash) tvtx = MHTfindClosestVertexNo(Hash[kT], SurfReg[kT], v, &dmin);
-        if (!UseHash || tvtx < 0) {
-          if (tvtx < 0) printf("Source vertex %d of pair %d unmapped in hash, using brute force\n", svtxN, n);
+        if (UseHash)
+          tvtx = BVHfindClosestVertexNo(Bvh[kT], v->x, v->y, v->z, &dmin);
+        else
           tvtx = MRISfindClosestVertex(SurfReg[kT], v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-        }
         svtxN = tvtx;
       }
 
@@ -1057,13 +1077,33 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
   }
   printf("MRISapplyReg: nSrcLost = %d\n", nSrcLost);
 
+  free(TrgToSrc);
   MRIfree(&SrcHits);
   MRIfree(&TrgHits);
   if (UseHash)
-    for (n = 0; n < nsurfs; n++) MHTfree(&Hash[n]);
+    for (n = 0; n < nsurfs; n++) BVHfree(&Bvh[n]);
+  free(Bvh);
   return (TrgSurfVals);
 }
 
+/*----------------------------------------------------------------
+  resampleClosestVertexNos() - finds the closest vertex in the tree
+  to each (current) vertex of surf, in parallel.
+  ----------------------------------------------------------------*/
+static void resampleClosestVertexNos(MRIS_BVH const *bvh, MRI_SURFACE const *surf, int *vno, float *dmin)
+{
+  float *xyz = (float *)malloc(3 * (surf->nvertices + 1) * sizeof(float));
+  int n;
+  for (n = 0; n < surf->nvertices; n++) {
+    VERTEX const *v = &surf->vertices[n];
+    xyz[3 * n + 0] = v->x;
+    xyz[3 * n + 1] = v->y;
+    xyz[3 * n + 2] = v->z;
+  }
+  BVHfindClosestVertexNos(bvh, surf->nvertices, xyz, vno, dmin);
+  free(xyz);
+}
+
 /*----------------------------------------------------------------
   MRI *surf2surf_nnfr() - NOTE: use MRISapplyReg instead!
 
@@ -1102,8 +1142,9 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
   MRI *TrgSurfVals = NULL;
   int svtx, tvtx, f, n, nrevhits, nSrcLost;
   VERTEX *v;
-  MHT *SrcHash, *TrgHash;
-  float dmin;
+  MRIS_BVH *SrcBvh = NULL, *TrgBvh = NULL;
+  int *TrgToSrc = NULL;
+  float dmin, *TrgToSrcDist = NULL;
   extern char *ResampleVtxMapFile;
   FILE *fp = NULL;
 
@@ -1139,10 +1180,14 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
   if (*SrcDist == NULL) return (NULL);
   MRIcopyHeader(SrcSurfVals, *SrcDist);
 
-  /* build hash tables */
+  /* build the source tree and do the forward searches in parallel */
   if (UseHash) {
-    printf("surf2surf_nnfr: building source hash (res=16).\n");
-    SrcHash = MHTcreateVertexTable_Resolution(SrcSurfReg, CURRENT_VERTICES, 16);
+    printf("surf2surf_nnfr: building source search tree.\n");
+    SrcBvh = BVHcreateVertexTree(SrcSurfReg, CURRENT_VERTICES);
+    TrgToSrc = (int *)malloc((TrgSurfReg->nvertices + 1) * sizeof(int));
+    TrgToSrcDist = (float *)malloc((TrgSurfReg->nvertices + 1) * sizeof(float));
+    resampleClosestVertexNos(SrcBvh, TrgSurfReg, TrgToSrc, TrgToSrcDist);
+    BVHfree(&SrcBvh);
   }
 
   /* Open vertex map file */
@@ -1171,14 +1216,13 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
     }
     /* find closest source vertex */
     v = &(TrgSurfReg->vertices[tvtx]);
-    if (UseHash)
-      svtx = MHTfindClosestVertexNo(SrcHash, SrcSurfReg, v, &dmin);
+    if (UseHash) {
+      svtx = TrgToSrc[tvtx];
+      dmin = TrgToSrcDist[tvtx];
+    }
     else
       svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
 
-    /* hash table failed, so use brute force */
-    if (svtx < 0) svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-
     /* update the number of hits and distance */
     MRIFseq_vox((*SrcHits), svtx, 0, 0, 0)++;
     MRIFseq_vox((*TrgHits), tvtx, 0, 0, 0)++;
@@ -1197,7 +1241,8 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
     }
   }
   printf("\n");
-  if (UseHash) MHTfree(&SrcHash);
+  free(TrgToSrc);
+  free(TrgToSrcDist);
 
   if (ResampleVtxMapFile != NULL) fclose(fp);
 
@@ -1207,9 +1252,8 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
     is represented in the map */
   if (ReverseMapFlag) {
     if (UseHash) {
-      MHTfree(&SrcHash);
-      printf("surf2surf_nnfr: building target hash (res=16).\n");
-      TrgHash = MHTcreateVertexTable_Resolution(TrgSurfReg, CURRENT_VERTICES, 16);
+      printf("surf2surf_nnfr: building target search tree.\n");
+      TrgBvh = BVHcreateVertexTree(TrgSurfReg, CURRENT_VERTICES);
     }
     printf("Surf2Surf: Reverse Loop (%d)\n", SrcSurfReg->nvertices);
     nrevhits = 0;
@@ -1219,11 +1263,9 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
         /* find closest target vertex */
         v = &(SrcSurfReg->vertices[svtx]);
         if (UseHash)
-          tvtx = MHTfindClosestVertexNo(TrgHash, TrgSurfReg, v, &dmin);
+          tvtx = BVHfindClosestVertexNo(TrgBvh, v->x, v->y, v->z, &dmin);
         else
           tvtx = MRISfindClosestVertex(TrgSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-        /* Hash table failed, so use brute force */
-        if (tvtx < 0) tvtx = MRISfindClosestVertex(TrgSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
 
         /* update the number of hits and distance */
         MRIFseq_vox((*SrcHits), svtx, 0, 0, 0)++;
@@ -1235,7 +1277,7 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
           MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f);
       }
     }
-    if (UseHash) MHTfree(&TrgHash);
+    if (UseHash) BVHfree(&TrgBvh);
     printf("Reverse Loop had %d hits\n", nrevhits);
   }
 
@@ -1291,8 +1333,9 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
   int svtx, tvtx, f, n, nrevhits, nSrcLost, nhits;
   // int nunmapped;
   VERTEX *v;
-  MHT *SrcHash, *TrgHash;
-  float dmin, srcval;
+  MRIS_BVH *SrcBvh = NULL, *TrgBvh = NULL;
+  int *TrgToSrc = NULL;
+  float dmin, srcval, *TrgToSrcDist = NULL;
 
   /* check dimension consistency */
   if (SrcSurfVals->width != SrcSurfReg->nvertices) {
@@ -1322,10 +1365,15 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
   *SrcDist = MRIallocSequence(SrcSurfReg->nvertices, 1, 1, MRI_FLOAT, 1);
   if (*SrcDist == NULL) return (NULL);
 
-  /* build hash tables */
+  /* build the source tree and do the forward searches, which both
+     forward loops use, once and in parallel */
   if (UseHash) {
-    printf("surf2surf_nnfr_jac: building source hash (res=16).\n");
-    SrcHash = MHTcreateVertexTable_Resolution(SrcSurfReg, CURRENT_VERTICES, 16);
+    printf("surf2surf_nnfr_jac: building source search tree.\n");
+    SrcBvh = BVHcreateVertexTree(SrcSurfReg, CURRENT_VERTICES);
+    TrgToSrc = (int *)malloc((TrgSurfReg->nvertices + 1) * sizeof(int));
+    TrgToSrcDist = (float *)malloc((TrgSurfReg->nvertices + 1) * sizeof(float));
+    resampleClosestVertexNos(SrcBvh, TrgSurfReg, TrgToSrc, TrgToSrcDist);
+    BVHfree(&SrcBvh);
   }
 
   // First forward loop just counts the number of hits for each src
@@ -1334,12 +1382,12 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
     /* find closest source vertex */
     v = &(TrgSurfReg->vertices[tvtx]);
-    if (UseHash)
-      svtx = MHTfindClosestVertexNo(SrcHash, SrcSurfReg, v, &dmin);
+    if (UseHash) {
+      svtx = TrgToSrc[tvtx];
+      dmin = TrgToSrcDist[tvtx];
+    }
     else
       svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-    /* hash table failed, so use brute force */
-    if (svtx < 0) svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
 
     /* update the number of hits and distance */
     MRIFseq_vox((*SrcHits), svtx, 0, 0, 0)++;  // This is what this loop is for
@@ -1354,11 +1402,9 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
     /* find closest source vertex */
     v = &(TrgSurfReg->vertices[tvtx]);
     if (UseHash)
-      svtx = MHTfindClosestVertexNo(SrcHash, SrcSurfReg, v, &dmin);
+      svtx = TrgToSrc[tvtx];
     else
       svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-    /* hash table failed, so use bruce force */
-    if (svtx < 0) svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
 
     nhits = MRIFseq_vox((*SrcHits), svtx, 0, 0, 0);
     /* Now accumulate mapped values for each frame */
@@ -1368,6 +1414,8 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
       MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += srcval;
     }
   }
+  free(TrgToSrc);
+  free(TrgToSrcDist);
 
   /*---------------------------------------------------------------
     Go through the reverse loop (finding closest trgvtx to each srcvtx
@@ -1375,9 +1423,8 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
     is represented in the map */
   if (ReverseMapFlag) {
     if (UseHash) {
-      MHTfree(&SrcHash);
-      printf("surf2surf_nnfr: building target hash (res=16).\n");
-      TrgHash = MHTcreateVertexTable_Resolution(TrgSurfReg, CURRENT_VERTICES, 16);
+      printf("surf2surf_nnfr: building target search tree.\n");
+      TrgBvh = BVHcreateVertexTree(TrgSurfReg, CURRENT_VERTICES);
     }
     printf("Surf2SurfJac: Reverse Loop (%d)\n", SrcSurfReg->nvertices);
     nrevhits = 0;
@@ -1387,11 +1434,9 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
         /* find closest target vertex */
         v = &(SrcSurfReg->vertices[svtx]);
         if (UseHash)
-          tvtx = MHTfindClosestVertexNo(TrgHash, TrgSurfReg, v, &dmin);
+          tvtx = BVHfindClosestVertexNo(TrgBvh, v->x, v->y, v->z, &dmin);
         else
           tvtx = MRISfindClosestVertex(TrgSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-        /* Hash table failed, so use brute force */
-        if (tvtx < 0) tvtx = MRISfindClosestVertex(TrgSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
         /* update the number of hits and distance */
         MRIFseq_vox((*SrcHits), svtx, 0, 0, 0)++;
         MRIFseq_vox((*TrgHits), tvtx, 0, 0, 0)++;
@@ -1402,7 +1447,7 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
           MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f);
       }
     }
-    if (UseHash) MHTfree(&TrgHash);
+    if (UseHash) BVHfree(&TrgBvh);
     printf("Reverse Loop had %d hits\n", nrevhits);
   }
 
@@ -0,0 +1,464 @@
+/**
+ * @file  romp_profile.c
+ * @brief always-compiled, runtime-enabled hierarchical profiling of named scopes
+ *
+ * See romp_profile.h for how to turn this on and what it writes.
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+#include "romp_profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#include "base.h"
+#include "timer.h"
+
+
+// The per-thread data.  Nothing here is shared between threads, so the only locking
+// needed is when the profiling is first turned on.
+//
+typedef struct ProfileCounter {
+    const char*            name;
+    long                   value;
+    struct ProfileCounter* next;
+} ProfileCounter;
+
+typedef struct ProfileNode {
+    ROMP_profile_site*  site;
+    struct ProfileNode* parent;
+    struct ProfileNode* first_child;
+    struct ProfileNode* next_sibling;
+    size_t              calls;
+    long                ns;                     // includes the children
+    size_t              allocs;                 // excludes the children
+    size_t              allocBytes;
+    size_t              frees;
+    ProfileCounter*     counters;
+} ProfileNode;
+
+typedef struct ProfileEvent {
+    ROMP_profile_site*  site;
+    long                beginNs;
+    long                durationNs;
+    size_t              allocs;
+} ProfileEvent;
+
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_MAX_THREADS 1024                // more than _MAX_FS_THREADS, since non-OpenMP threads come and go
+
+typedef struct ProfileOpen {
+    ProfileNode*        node;
+    long                beginNs;
+    size_t              allocsAtBegin;
+} ProfileOpen;
+
+typedef struct ProfileThread {
+    ProfileNode         root;
+    ProfileOpen         open[PROFILE_MAX_DEPTH+1];  // open[0] is the root
+    int                 depth;
+    size_t              allocs;
+    ProfileEvent*       events;
+    size_t              eventsSize;
+    size_t              eventsCapacity;
+    size_t              eventsDropped;
+} ProfileThread;
+
+// Each thread finds its own tree through a thread-local pointer rather than its OpenMP thread
+// number, which is 0 in every thread not started by OpenMP (pthreads, ITK threads, ...).
+// The trees are also listed in profileThreads, in the order the threads first recorded
+// something, for the reports; normally the main thread is first.
+//
+static ProfileThread* volatile profileThreads[PROFILE_MAX_THREADS];
+static volatile int profileThreadsUsed;
+static __thread ProfileThread* profileThreadLocal;
+
+static volatile int profileState;               // 0 not yet looked, 1 off, 2 on
+static NanosecsTimer profileStart;
+static size_t        profileMaxEvents = 1000000;
+static const char*   profileSetting;
+
+
+static long profileNow() {
+    return TimerElapsedNanosecs(&profileStart).ns;
+}
+
+static const char* profileProgramName() {
+    static char name[256];
+    if (!name[0]) {
+        FILE* commFile = fopen("/proc/self/comm", "r");
+        size_t size = 0;
+        if (commFile) {
+            size = fread(name, 1, sizeof(name)-1, commFile);
+            fclose(commFile);
+        }
+        while (size > 0 && (name[size-1] == '\n' || name[size-1] == '\r')) size--;
+        name[size] = 0;
+        if (!size) strcpy(name, "program");
+    }
+    return name;
+}
+
+static int profileSettingIsDirectory() {
+    struct stat st;
+    return profileSetting && !stat(profileSetting, &st) && S_ISDIR(st.st_mode);
+}
+
+
+static void profileExitHandler(void);
+
+static void profileInit() {
+#ifdef HAVE_OPENMP
+    #pragma omp critical(ROMP_profile_init)
+#endif
+    if (profileState == 0) {
+        const char* setting = getenv("FS_PROFILE");
+        if (!setting || !setting[0] || !strcmp(setting, "0")) {
+            profileState = 1;
+        } else {
+            const char* maxEvents = getenv("FS_PROFILE_MAX_EVENTS");
+            if (maxEvents) profileMaxEvents = strtoul(maxEvents, NULL, 10);
+            profileSetting = strcmp(setting, "1") ? setting : NULL;
+            TimerStartNanosecs(&profileStart);
+            atexit(profileExitHandler);
+            profileState = 2;
+        }
+    }
+}
+
+int ROMP_profile_enabled(void) {
+    if (profileState == 0) profileInit();
+    return profileState == 2;
+}
+
+static ProfileThread* profileThread(int create) {
+    ProfileThread* pt = profileThreadLocal;
+    if (!pt && create) {
+        int tid = __sync_fetch_and_add(&profileThreadsUsed, 1);
+        if (tid >= PROFILE_MAX_THREADS) return NULL;
+        pt = (ProfileThread*)calloc(1, sizeof(ProfileThread));
+        pt->open[0].node = &pt->root;
+        profileThreads[tid] = pt;
+        profileThreadLocal  = pt;
+    }
+    return pt;
+}
+
+static ProfileNode* enterNode(ProfileNode* parent, ROMP_profile_site* site) {
+    ProfileNode** prev = &parent->first_child;
+    while (*prev && (*prev)->site != site) prev = &(*prev)->next_sibling;
+    if (!*prev) {
+        ProfileNode* node = (ProfileNode*)calloc(1, sizeof(ProfileNode));
+        node->site   = site;
+        node->parent = parent;
+        *prev = node;
+    }
+    return *prev;
+}
+
+
+void ROMP_profile_begin(ROMP_profile_site* site, ROMP_profile_frame* frame) {
+    frame->depth = -1;
+    if (!ROMP_profile_enabled()) return;
+
+    ProfileThread* pt = profileThread(1);
+    if (!pt || pt->depth == PROFILE_MAX_DEPTH) return;
+
+    // Find or make the node before opening it, so that a new node's calloc is charged to the parent
+    //
+    ProfileNode* node   = enterNode(pt->open[pt->depth].node, site);
+    ProfileOpen* open   = &pt->open[++pt->depth];
+    open->node          = node;
+    open->allocsAtBegin = pt->allocs;
+    open->beginNs       = profileNow();
+    frame->depth        = pt->depth;
+}
+
+static void closeTop(ProfileThread* pt, long now) {
+    ProfileOpen* open = &pt->open[pt->depth--];
+    ProfileNode* node = open->node;
+    long duration = now - open->beginNs;
+    node->calls++;
+    node->ns += duration;
+
+    if (pt->eventsSize == pt->eventsCapacity) {
+        size_t capacity = pt->eventsCapacity ? 2*pt->eventsCapacity : 1024;
+        if (capacity > profileMaxEvents) capacity = profileMaxEvents;
+        if (capacity > pt->eventsCapacity) {
+            ProfileEvent* events = (ProfileEvent*)realloc(pt->events, capacity*sizeof(ProfileEvent));
+            if (events) { pt->events = events; pt->eventsCapacity = capacity; }
+        }
+    }
+    if (pt->eventsSize == pt->eventsCapacity) { pt->eventsDropped++; return; }
+
+    ProfileEvent* event = &pt->events[pt->eventsSize++];
+    event->site       = node->site;
+    event->beginNs    = open->beginNs;
+    event->durationNs = duration;
+    event->allocs     = pt->allocs - open->allocsAtBegin;
+}
+
+void ROMP_profile_end(ROMP_profile_frame* frame) {
+    if (frame->depth < 0) return;
+    ProfileThread* pt = profileThread(0);
+    if (!pt) return;
+
+    // Scopes left open inside this one are closed now, so a missed end only distorts the inner scope
+    //
+    long now = profileNow();
+    while (pt->depth >= frame->depth) closeTop(pt, now);
+}
+
+void ROMP_profile_count(const char* name, long delta) {
+    if (!ROMP_profile_enabled()) return;
+    ProfileThread* pt = profileThread(1);
+    if (!pt) return;
+
+    ProfileNode* node = pt->open[pt->depth].node;
+    ProfileCounter* counter = node->counters;
+    while (counter && counter->name != name && strcmp(counter->name, name)) counter = counter->next;
+    if (!counter) {
+        counter = (ProfileCounter*)calloc(1, sizeof(ProfileCounter));
+        counter->name  = name;
+        counter->next  = node->counters;
+        node->counters = counter;
+    }
+    counter->value += delta;
+}
+
+
+// These get called from inside the malloc wrappers, so must not allocate nor start the profiling
+//
+void ROMP_profile_noteAlloc(size_t size) {
+    if (profileState != 2) return;
+    ProfileThread* pt = profileThread(0);
+    if (!pt) return;
+    ProfileNode* node = pt->open[pt->depth].node;
+    pt->allocs++;
+    node->allocs++;
+    node->allocBytes += size;
+}
+
+void ROMP_profile_noteFree(void) {
+    if (profileState != 2) return;
+    ProfileThread* pt = profileThread(0);
+    if (!pt) return;
+    pt->open[pt->depth].node->frees++;
+}
+
+
+// The text tree
+//
+static const char* siteName(ROMP_profile_site* site) {
+    return site->name ? site->name : site->func;
+}
+
+static const char* siteFile(ROMP_profile_site* site) {
+    const char* slash = strrchr(site->file, '/');
+    return slash ? slash + 1 : site->file;
+}
+
+static size_t nodeAllocsInclusive(ProfileNode* node) {
+    size_t sum = node->allocs;
+    ProfileNode* child;
+    for (child = node->first_child; child; child = child->next_sibling) sum += nodeAllocsInclusive(child);
+    return sum;
+}
+
+static int nodeCompare(const void* lhs_ptr, const void* rhs_ptr) {
+    long lhs = (*(ProfileNode**)lhs_ptr)->ns;
+    long rhs = (*(ProfileNode**)rhs_ptr)->ns;
+    if (lhs < rhs) return +1;           // descending order
+    if (lhs > rhs) return -1;
+    return 0;
+}
+
+static void showNode(FILE* file, ProfileNode* node, const char* rootName, long parentNs, int depth) {
+    long   childrenNs = 0;
+    size_t count = 0;
+    ProfileNode* child;
+    for (child = node->first_child; child; child = child->next_sibling) { childrenNs += child->ns; count++; }
+
+    fprintf(file, "%10zu %12.3f %12.3f %7.1f%% %10zu %10zu  ",
+        node->calls, node->ns*1e-6, (node->ns - childrenNs)*1e-6,
+        parentNs > 0 ? 100.0*node->ns/parentNs : 100.0,
+        nodeAllocsInclusive(node), node->frees);
+    int d;
+    for (d = 0; d < depth; d++) fprintf(file, "  ");
+    if (node->site) fprintf(file, "%s (%s:%d)", siteName(node->site), siteFile(node->site), node->site->line);
+    else            fprintf(file, "%s", rootName);
+
+    ProfileCounter* counter;
+    for (counter = node->counters; counter; counter = counter->next) fprintf(file, " %s=%ld", counter->name, counter->value);
+    fprintf(file, "\n");
+
+    if (!count) return;
+    ProfileNode** children = (ProfileNode**)malloc(count*sizeof(ProfileNode*));
+    count = 0;
+    for (child = node->first_child; child; child = child->next_sibling) children[count++] = child;
+    qsort(children, count, sizeof(ProfileNode*), nodeCompare);
+    size_t i;
+    for (i = 0; i < count; i++) showNode(file, children[i], rootName, node->ns, depth+1);
+    free(children);
+}
+
+static void profileRootTimes(long now) {
+    int tid;
+    for (tid = 0; tid < PROFILE_MAX_THREADS; tid++) {
+        ProfileThread* pt = profileThreads[tid];
+        if (!pt) continue;
+        pt->root.calls = 1;
+        if (tid == 0) { pt->root.ns = now; continue; }
+        pt->root.ns = 0;
+        ProfileNode* child;
+        for (child = pt->root.first_child; child; child = child->next_sibling) pt->root.ns += child->ns;
+    }
+}
+
+void ROMP_profile_show_tree(FILE* file) {
+    if (profileState != 2) return;
+    profileRootTimes(profileNow());
+
+    fprintf(file, "ROMP_profile %s pid %d %s", profileProgramName(), (int)getpid(), current_date_time_noOverride());
+    fprintf(file, "     calls     total ms      self ms  %%parent     allocs      frees  scope\n");
+    int tid;
+    for (tid = 0; tid < PROFILE_MAX_THREADS; tid++) {
+        ProfileThread* pt = profileThreads[tid];
+        if (!pt) continue;
+        char rootName[32];
+        snprintf(rootName, sizeof(rootName), "<thread %d>", tid);
+        showNode(file, &pt->root, rootName, 0, 0);
+        if (pt->eventsDropped) fprintf(file, "    %zu trace events dropped, see FS_PROFILE_MAX_EVENTS\n", pt->eventsDropped);
+    }
+    fprintf(file, "ROMP_profile end\n");
+}
+
+
+// The Chrome trace event format
+//
+static void jsonString(FILE* file, const char* s) {
+    fputc('"', file);
+    for (; *s; s++) {
+        if      (*s == '"' || *s == '\\')   fprintf(file, "\\%c", *s);
+        else if ((unsigned char)*s < ' ')   fprintf(file, "\\u%04x", (unsigned char)*s);
+        else                                fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+static void sumCounters(ProfileNode* node, ProfileCounter** sums) {
+    ProfileCounter* counter;
+    for (counter = node->counters; counter; counter = counter->next) {
+        ProfileCounter* sum = *sums;
+        while (sum && strcmp(sum->name, counter->name)) sum = sum->next;
+        if (!sum) {
+            sum = (ProfileCounter*)calloc(1, sizeof(ProfileCounter));
+            sum->name = counter->name;
+            sum->next = *sums;
+            *sums = sum;
+        }
+        sum->value += counter->value;
+    }
+    ProfileNode* child;
+    for (child = node->first_child; child; child = child->next_sibling) sumCounters(child, sums);
+}
+
+int ROMP_profile_write_trace(const char* filename) {
+    if (profileState != 2) return 0;
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "ROMP_profile could not create %s\n", filename);
+        return 0;
+    }
+
+    long now = profileNow();
+    int  pid = (int)getpid();
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":", pid);
+    jsonString(file, profileProgramName());
+    fprintf(file, "}}");
+
+    int tid;
+    for (tid = 0; tid < PROFILE_MAX_THREADS; tid++) {
+        ProfileThread* pt = profileThreads[tid];
+        if (!pt) continue;
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+            pid, tid, tid);
+
+        size_t i;
+        for (i = 0; i < pt->eventsSize; i++) {
+            ProfileEvent* event = &pt->events[i];
+            char where[1024];
+            snprintf(where, sizeof(where), "%s:%d", siteFile(event->site), event->site->line);
+            fprintf(file, ",\n{\"name\":");
+            jsonString(file, siteName(event->site));
+            fprintf(file, ",\"cat\":\"scope\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"at\":",
+                event->beginNs*1e-3, event->durationNs*1e-3, pid, tid);
+            jsonString(file, where);
+            fprintf(file, ",\"allocs\":%zu}}", event->allocs);
+        }
+
+        ProfileCounter* sums = NULL;
+        sumCounters(&pt->root, &sums);
+        while (sums) {
+            ProfileCounter* sum = sums;
+            fprintf(file, ",\n{\"name\":");
+            jsonString(file, sum->name);
+            fprintf(file, ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"value\":%ld}}",
+                now*1e-3, pid, tid, sum->value);
+            sums = sum->next;
+            free(sum);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return 1;
+}
+
+
+static void profileExitHandler(void) {
+    static int once;
+    if (once++ > 0) return;
+
+    // Anything still open is closed at exit, which is where it would have been anyway
+    //
+    long now = profileNow();
+    int tid;
+    for (tid = 0; tid < PROFILE_MAX_THREADS; tid++) {
+        ProfileThread* pt = profileThreads[tid];
+        if (pt) while (pt->depth > 0) closeTop(pt, now);
+    }
+
+    if (profileSettingIsDirectory()) {
+        char filename[4096];
+        snprintf(filename, sizeof(filename), "%s/%s.%d.txt", profileSetting, profileProgramName(), (int)getpid());
+        FILE* file = fopen(filename, "w");
+        if (!file) {
+            fprintf(stderr, "ROMP_profile could not create %s\n", filename);
+        } else {
+            ROMP_profile_show_tree(file);
+            fclose(file);
+        }
+        snprintf(filename, sizeof(filename), "%s/%s.%d.json", profileSetting, profileProgramName(), (int)getpid());
+        ROMP_profile_write_trace(filename);
+    } else {
+        ROMP_profile_show_tree(stderr);
+        if (profileSetting) ROMP_profile_write_trace(profileSetting);
+    }
+}
@@ -0,0 +1,150 @@
+/**
+ * @file  gcas_soa_test.c
+ * @brief check GCASsoaLogProbability() against GCAcomputeLogSampleProbability()
+ *
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "error.h"
+#include "gca.h"
+#include "matrix.h"
+#include "mri.h"
+#include "transform.h"
+#include "utils.h"
+
+const char *Progname = "gcas_soa_test";
+
+#define WIDTH    64
+#define NSAMPLES 5000
+#define CLAMP    6.0
+
+static int nfailed = 0;
+
+static void check(const char *what, double expected, double actual)
+{
+  double tol = 1e-5 * fabs(expected) + 1e-6;
+
+  if (fabs(expected - actual) > tol) {
+    printf("FAILED %s: expected %g, got %g\n", what, expected, actual);
+    nfailed++;
+  }
+  else {
+    printf("ok     %s: %g\n", what, actual);
+  }
+}
+
+static void test_inputs(int ninputs)
+{
+  GCA *gca;
+  GCA_SAMPLE *gcas;
+  GCAS_SOA *soa;
+  MRI *mri;
+  MATRIX *m_L;
+  TRANSFORM *transform;
+  double expected;
+  char what[STRLEN];
+  int i, j, x, y, z, f, stride, n;
+
+  gca = GCAalloc(ninputs, 2.0, 4.0, WIDTH, WIDTH, WIDTH, 0);
+
+  // an image that is roughly what the samples expect, so that the clamp
+  // is not all that is being compared
+  mri = MRIallocSequence(WIDTH, WIDTH, WIDTH, MRI_FLOAT, ninputs);
+  for (f = 0; f < ninputs; f++)
+    for (z = 0; z < WIDTH; z++)
+      for (y = 0; y < WIDTH; y++)
+        for (x = 0; x < WIDTH; x++) {
+          MRIsetVoxVal(mri, x, y, z, f, 100 + 20 * f + randomNumber(-10, 10));
+        }
+
+  gcas = (GCA_SAMPLE *)calloc(NSAMPLES, sizeof(GCA_SAMPLE));
+  for (i = 0; i < NSAMPLES; i++) {
+    gcas[i].xp = (int)randomNumber(2, gca->prior_width - 2.01);
+    gcas[i].yp = (int)randomNumber(2, gca->prior_height - 2.01);
+    gcas[i].zp = (int)randomNumber(2, gca->prior_depth - 2.01);
+    gcas[i].label = 1;
+    gcas_setPrior(gcas[i], randomNumber(.1, 1));
+    gcas[i].means = (float *)calloc(ninputs, sizeof(float));
+    gcas[i].covars = (float *)calloc(ninputs * (ninputs + 1) / 2, sizeof(float));
+    for (j = 0; j < ninputs; j++) {
+      gcas[i].means[j] = 100 + 20 * j + randomNumber(-5, 5);
+    }
+    // upper triangle of a diagonally dominant covariance matrix
+    for (n = j = 0; j < ninputs; j++)
+      for (f = j; f < ninputs; f++, n++) {
+        gcas[i].covars[n] = (f == j) ? randomNumber(20, 40) : randomNumber(-5, 5);
+      }
+  }
+
+  // a little rotation, scaling and a shift; the samples are kept away from
+  // the edge of the priors so that all of them land inside the image and
+  // the densities, not the outside penalty, are what is compared
+  m_L = MatrixIdentity(4, NULL);
+  *MATRIX_RELT(m_L, 1, 1) = 1.02;
+  *MATRIX_RELT(m_L, 1, 2) = 0.05;
+  *MATRIX_RELT(m_L, 2, 1) = -0.05;
+  *MATRIX_RELT(m_L, 3, 3) = 0.98;
+  *MATRIX_RELT(m_L, 1, 4) = 1.5;
+  *MATRIX_RELT(m_L, 3, 4) = -0.5;
+
+  transform = TransformAlloc(LINEAR_VOX_TO_VOX, NULL);
+  MatrixCopy(m_L, ((LTA *)transform->xform)->xforms[0].m_L);
+
+  soa = GCASsoaAlloc(gca, gcas, NSAMPLES);
+
+  // all the samples: the mean GCAcomputeLogSampleProbability() returns
+  expected = GCAcomputeLogSampleProbability(gca, gcas, mri, transform, NSAMPLES, CLAMP);
+  sprintf(what, "%d input(s), all samples", ninputs);
+  check(what, expected, GCASsoaLogProbability(soa, mri, m_L, 1, CLAMP));
+
+  // every stride'th sample: the mean of the log_p of those samples
+  for (stride = 2; stride <= 7; stride += 5) {
+    expected = 0;
+    for (n = 0, i = 0; i < NSAMPLES; i += stride, n++) {
+      expected += gcas[i].log_p;
+    }
+    expected /= n;
+    sprintf(what, "%d input(s), stride %d", ninputs, stride);
+    check(what, expected, GCASsoaLogProbability(soa, mri, m_L, stride, CLAMP));
+  }
+
+  GCASsoaFree(&soa);
+  TransformFree(&transform);
+  MatrixFree(&m_L);
+  for (i = 0; i < NSAMPLES; i++) {
+    free(gcas[i].means);
+    free(gcas[i].covars);
+  }
+  free(gcas);
+  MRIfree(&mri);
+  GCAfree(&gca);
+}
+
+int main(int argc, char *argv[])
+{
+  setRandomSeed(17L);
+
+  test_inputs(1);
+  test_inputs(2);
+
+  if (nfailed) {
+    printf("%d check(s) failed\n", nfailed);
+    exit(1);
+  }
+  exit(0);
+}
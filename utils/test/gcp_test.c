@@ -0,0 +1,192 @@
+/**
+ * @file  gcp_test.c
+ * @brief check that a GCA survives a round trip through a packed .gcp file
+ *
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "gca.h"
+#include "utils.h"
+
+const char *Progname = "gcp_test";
+
+#define WIDTH     32
+#define NINPUTS   2
+#define MAXLABELS 4  // what GCAalloc() allocates per node and prior
+#define TMPGCP    "./gcp_test.gcp"
+#define TMPBAD    "./gcp_test_bad.gcp"
+
+static int nfailed = 0;
+
+static void check(const char *what, int ok)
+{
+  printf("%s %s\n", ok ? "ok    " : "FAILED", what);
+  if (!ok) nfailed++;
+}
+
+// a GCA with a varying number of classifiers, gibbs priors and priors
+static GCA *make_gca(void)
+{
+  GCA *gca;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  int x, y, z, n, i, j;
+
+  gca = GCAalloc(NINPUTS, 2.0, 4.0, WIDTH, WIDTH, WIDTH, 0);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        gcan->nlabels = (x + 2 * y + 3 * z) % (MAXLABELS + 1);
+        gcan->total_training = x + y + z;
+        for (n = 0; n < gcan->nlabels; n++) {
+          gcan->labels[n] = n + x;
+          gc = &gcan->gcs[n];
+          gc->ntraining = n + 1;
+          for (j = 0; j < NINPUTS; j++) gc->means[j] = randomNumber(50, 150);
+          for (j = 0; j < NINPUTS * (NINPUTS + 1) / 2; j++) gc->covars[j] = randomNumber(1, 30);
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            gc->nlabels[i] = (n + i + z) % 3;
+            gc->labels[i] = (unsigned short *)calloc(gc->nlabels[i] + 1, sizeof(unsigned short));
+            gc->label_priors[i] = (float *)calloc(gc->nlabels[i] + 1, sizeof(float));
+            for (j = 0; j < gc->nlabels[i]; j++) {
+              gc->labels[i][j] = i + j + 1;
+              gc->label_priors[i][j] = randomNumber(0, 1);
+            }
+          }
+        }
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        gcap->nlabels = 1 + (x + y + z) % MAXLABELS;
+        gcap->total_training = x * y + z;
+        for (n = 0; n < gcap->nlabels; n++) {
+          gcap->labels[n] = n + y;
+          gcap->priors[n] = randomNumber(0, 1);
+        }
+      }
+  return (gca);
+}
+
+static int same_gca(GCA *a, GCA *b)
+{
+  GCA_NODE *na, *nb;
+  GCA_PRIOR *pa, *pb;
+  GC1D *ga, *gb;
+  int x, y, z, n, i, j;
+
+  if (a->ninputs != b->ninputs || a->node_width != b->node_width || a->prior_width != b->prior_width ||
+      a->flags != b->flags)
+    return (0);
+  for (x = 0; x < a->node_width; x++)
+    for (y = 0; y < a->node_height; y++)
+      for (z = 0; z < a->node_depth; z++) {
+        na = &a->nodes[x][y][z];
+        nb = &b->nodes[x][y][z];
+        if (na->nlabels != nb->nlabels || na->total_training != nb->total_training) return (0);
+        for (n = 0; n < na->nlabels; n++) {
+          ga = &na->gcs[n];
+          gb = &nb->gcs[n];
+          if (na->labels[n] != nb->labels[n]) return (0);
+          for (j = 0; j < a->ninputs; j++)
+            if (ga->means[j] != gb->means[j]) return (0);
+          for (j = 0; j < a->ninputs * (a->ninputs + 1) / 2; j++)
+            if (ga->covars[j] != gb->covars[j]) return (0);
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            if (ga->nlabels[i] != gb->nlabels[i]) return (0);
+            for (j = 0; j < ga->nlabels[i]; j++)
+              if (ga->labels[i][j] != gb->labels[i][j] || ga->label_priors[i][j] != gb->label_priors[i][j]) return (0);
+          }
+        }
+      }
+  for (x = 0; x < a->prior_width; x++)
+    for (y = 0; y < a->prior_height; y++)
+      for (z = 0; z < a->prior_depth; z++) {
+        pa = &a->priors[x][y][z];
+        pb = &b->priors[x][y][z];
+        if (pa->nlabels != pb->nlabels || pa->total_training != pb->total_training) return (0);
+        for (n = 0; n < pa->nlabels; n++)
+          if (pa->labels[n] != pb->labels[n] || pa->priors[n] != pb->priors[n]) return (0);
+      }
+  return (1);
+}
+
+// copies the first len bytes of TMPGCP into TMPBAD
+static void write_truncated(size_t len)
+{
+  FILE *in, *out;
+  char *buf;
+
+  buf = (char *)calloc(len + 1, 1);
+  in = fopen(TMPGCP, "rb");
+  if (fread(buf, 1, len, in) != len) printf("could not read %s\n", TMPGCP);
+  fclose(in);
+  out = fopen(TMPBAD, "wb");
+  fwrite(buf, 1, len, out);
+  fclose(out);
+  free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+  GCA *gca, *back;
+  struct stat st;
+
+  setRandomSeed(17L);
+  gca = make_gca();
+
+  check("write packed GCA", GCAwritePacked(gca, TMPGCP) == NO_ERROR);
+
+  back = GCAreadPacked(TMPGCP);
+  check("mapped .gcp reads back the same GCA", back && same_gca(gca, back));
+  if (back) GCAfree(&back);
+
+  setenv("FS_GCA_NO_MMAP", "1", 1);
+  back = GCAreadPacked(TMPGCP);
+  check("unmapped .gcp reads back the same GCA", back && same_gca(gca, back));
+  if (back) GCAfree(&back);
+  unsetenv("FS_GCA_NO_MMAP");
+
+  back = GCAread(TMPGCP);
+  check("GCAread() recognizes a .gcp", back && same_gca(gca, back));
+  if (back) GCAfree(&back);
+
+  // truncated files have arrays that end past the end of the file
+  stat(TMPGCP, &st);
+  write_truncated(st.st_size / 2);
+  check("half a .gcp is refused", GCAreadPacked(TMPBAD) == NULL);
+  write_truncated(st.st_size - 8);
+  check(".gcp missing its last 8 bytes is refused", GCAreadPacked(TMPBAD) == NULL);
+
+  unlink(TMPGCP);
+  unlink(TMPBAD);
+  GCAfree(&gca);
+
+  if (nfailed) {
+    printf("%d checks FAILED\n", nfailed);
+    exit(1);
+  }
+  printf("all checks passed\n");
+  exit(0);
+}
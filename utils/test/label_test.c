@@ -0,0 +1,218 @@
+/**
+ * @file  label_test.c
+ * @brief check label set algebra, annotation <-> label conversion and
+ *        the text and binary label round trips
+ *
+ */
+/*
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "colortab.h"
+#include "error.h"
+#include "label.h"
+#include "mrisurf.h"
+#include "utils.h"
+
+#include "annotation.h"
+
+const char *Progname = "label_test";
+
+#define NVERTS 100
+#define NANNOTS   4
+#define TMPTEXT   "./label_test_text.label"
+#define TMPBINARY "./label_test_binary.label"
+
+static int nfailed = 0;
+
+static void check(const char *what, int ok)
+{
+  printf("%s %s\n", ok ? "ok    " : "FAILED", what);
+  if (!ok) nfailed++;
+}
+
+// a label with the points for vertices first..last, each with its own
+// coordinates and stat
+static LABEL *make_label(int first, int last)
+{
+  LABEL *area;
+  int vno;
+
+  area = LabelAlloc(last - first + 1, NULL, "test");
+  for (vno = first; vno <= last; vno++) {
+    LV *lv = &area->lv[area->n_points++];
+    lv->vno = vno;
+    lv->x = vno + 0.25;
+    lv->y = -vno;
+    lv->z = vno * 0.5;
+    lv->stat = vno / 7.0;
+  }
+  return (area);
+}
+
+static int has_vertex(LABEL *area, int vno)
+{
+  int n;
+
+  for (n = 0; n < area->n_points; n++)
+    if (area->lv[n].vno == vno && !area->lv[n].deleted) return (1);
+  return (0);
+}
+
+static int same_points(LABEL *a, LABEL *b)
+{
+  int n;
+
+  if (a->n_points != b->n_points) return (0);
+  for (n = 0; n < a->n_points; n++) {
+    if (a->lv[n].vno != b->lv[n].vno) return (0);
+    if (a->lv[n].x != b->lv[n].x || a->lv[n].y != b->lv[n].y || a->lv[n].z != b->lv[n].z) return (0);
+    if (a->lv[n].stat != b->lv[n].stat) return (0);
+  }
+  return (1);
+}
+
+static void test_set_algebra(void)
+{
+  LABEL *area1, *area2, *ldst;
+  int vno, ok, n_points;
+
+  area1 = make_label(0, 59);
+  area2 = make_label(40, 99);
+  area1->lv[10].deleted = 1;  // vertex 10 is not in area1
+
+  ldst = LabelVertexUnion(area1, area2, NULL);
+  for (ok = 1, vno = 0; vno < NVERTS; vno++)
+    if (has_vertex(ldst, vno) != (vno != 10)) ok = 0;
+  check("union has the vertices in either label", ok && ldst->n_points == NVERTS - 1);
+  LabelFree(&ldst);
+
+  ldst = LabelVertexIntersection(area1, area2, NULL);
+  for (ok = 1, vno = 0; vno < NVERTS; vno++)
+    if (has_vertex(ldst, vno) != (vno >= 40 && vno <= 59)) ok = 0;
+  check("intersection has the vertices in both labels", ok && ldst->n_points == 20);
+  LabelFree(&ldst);
+
+  ldst = LabelVertexDifference(area1, area2, NULL);
+  for (ok = 1, vno = 0; vno < NVERTS; vno++)
+    if (has_vertex(ldst, vno) != (vno < 40 && vno != 10)) ok = 0;
+  check("difference has the vertices only in the first label", ok && ldst->n_points == 39);
+  check("difference keeps the points of the first label", ldst->lv[0].x == area1->lv[0].x);
+  LabelFree(&ldst);
+
+  // the result can't be one of the inputs, and the inputs are left alone
+  n_points = area2->n_points;
+  check("difference into area2 is refused", LabelVertexDifference(area1, area2, area2) == NULL);
+  check("difference into area2 leaves area2 alone", area2->n_points == n_points);
+  n_points = area1->n_points;
+  check("union into area1 is refused", LabelVertexUnion(area1, area2, area1) == NULL);
+  check("union into area1 leaves area1 alone", area1->n_points == n_points);
+
+  LabelFree(&area1);
+  LabelFree(&area2);
+}
+
+static void test_annotation(void)
+{
+  MRIS *mris;
+  LABEL **labels;
+  int vno, n, nlabels, annot, ok, *saved;
+
+  mris = MRISalloc(NVERTS, 0);
+  mris->ct = CTABalloc(NANNOTS);
+  saved = (int *)calloc(NVERTS, sizeof(int));
+  for (vno = 0; vno < NVERTS; vno++) {
+    mris->vertices[vno].x = vno;
+    mris->vertices[vno].y = 2 * vno;
+    mris->vertices[vno].z = -vno;
+    CTABannotationAtIndex(mris->ct, (vno / 7) % NANNOTS, &annot);
+    mris->vertices[vno].annotation = saved[vno] = annot;
+  }
+
+  labels = MRISannotation2labels(mris, &nlabels);
+  check("one label per annotation", nlabels == NANNOTS);
+  for (ok = 1, n = 0; n < nlabels; n++) {
+    int k;
+    if (!labels[n]) {
+      ok = 0;
+      continue;
+    }
+    for (k = 0; k < labels[n]->n_points; k++) {
+      vno = labels[n]->lv[k].vno;
+      if ((vno / 7) % NANNOTS != n || labels[n]->lv[k].x != vno) ok = 0;
+    }
+  }
+  check("each label has the vertices of its annotation", ok);
+
+  for (vno = 0; vno < NVERTS; vno++) mris->vertices[vno].annotation = 0;
+  MRISlabels2annotation(mris, labels, nlabels);
+  for (ok = 1, vno = 0; vno < NVERTS; vno++)
+    if (mris->vertices[vno].annotation != saved[vno]) ok = 0;
+  check("labels back to the same annotation", ok);
+
+  for (n = 0; n < nlabels; n++)
+    if (labels[n]) LabelFree(&labels[n]);
+  free(labels);
+  free(saved);
+  MRISfree(&mris);
+}
+
+static void test_round_trip(void)
+{
+  LABEL *area, *back;
+  FILE *fp;
+
+  area = make_label(3, 42);
+  strcpy(area->space, "TkReg");
+
+  check("write text label", LabelWrite(area, TMPTEXT) == NO_ERROR);
+  back = LabelRead(NULL, TMPTEXT);
+  check("text label reads back the same points", back && same_points(area, back));
+  if (back) LabelFree(&back);
+
+  check("write binary label", LabelWriteBinary(area, TMPBINARY) == NO_ERROR);
+  back = LabelRead(NULL, TMPBINARY);
+  check("binary label reads back the same points", back && same_points(area, back));
+  check("binary label keeps the coords", back && back->coords == area->coords);
+  if (back) LabelFree(&back);
+
+  // an empty file is not a label
+  fp = fopen(TMPBINARY, "w");
+  fclose(fp);
+  fp = fopen(TMPBINARY, "r");
+  check("empty file reads as no label", LabelReadFrom(NULL, fp) == NULL);
+  fclose(fp);
+
+  unlink(TMPTEXT);
+  unlink(TMPBINARY);
+  LabelFree(&area);
+}
+
+int main(int argc, char *argv[])
+{
+  setRandomSeed(17L);  // for the colors of the color table
+  test_set_algebra();
+  test_annotation();
+  test_round_trip();
+
+  if (nfailed) {
+    printf("%d checks FAILED\n", nfailed);
+    exit(1);
+  }
+  printf("all checks passed\n");
+  exit(0);
+}
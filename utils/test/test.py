@@ -11,5 +11,8 @@ rt.run('extest')
 rt.run('inftest')
 rt.run('tiff_write_image')
 rt.run('sc_test')
+rt.run('gcas_soa_test')
+rt.run('label_test')
+rt.run('gcp_test')
 
 rt.cleanup()
@@ -1389,6 +1389,7 @@ CLUSTER_SIM_DATA *CSDread(char *csdfile)
       nthrep++;
     }
   }
+  fclose(fp);
   return (csd);
 }
 
@@ -1620,9 +1621,9 @@ CSD *CSDmerge(CSD *csd1, CSD *csd2)
   for (nthrep2 = 0; nthrep2 < csd2->nreps; nthrep2++) {
     csd->nClusters[nthrep] = csd2->nClusters[nthrep2];
     csd->MaxClusterSize[nthrep] = csd2->MaxClusterSize[nthrep2];
-    csd->MaxClusterSizeVtx[nthrep] = csd2->MaxClusterSizeVtx[nthrep1];
-    csd->MaxClusterWeightVtx[nthrep] = csd2->MaxClusterWeightVtx[nthrep1];
-    csd->MaxClusterWeightArea[nthrep] = csd2->MaxClusterWeightArea[nthrep1];
+    csd->MaxClusterSizeVtx[nthrep] = csd2->MaxClusterSizeVtx[nthrep2];
+    csd->MaxClusterWeightVtx[nthrep] = csd2->MaxClusterWeightVtx[nthrep2];
+    csd->MaxClusterWeightArea[nthrep] = csd2->MaxClusterWeightArea[nthrep2];
     csd->MaxSig[nthrep] = csd2->MaxSig[nthrep2];
     csd->MaxStat[nthrep] = csd2->MaxStat[nthrep2];
     nthrep++;
@@ -2007,5 +2008,6 @@ int CSDwrite(char *fname, CSD *csd)
     return (1);
   }
   CSDprint(fp, csd);
+  fclose(fp);
   return (0);
 }
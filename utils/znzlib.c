@@ -43,6 +43,259 @@
 #endif
 #include "znzlib.h"
 
+#ifdef HAVE_ZLIB
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+/* Parallel gzip writing, after Mark Adler's pigz.  The data are cut into
+   ZNZ_PGZ_BLOCK blocks, and each batch of nthreads blocks is deflated at
+   once, every block as a raw deflate stream primed with the 32K that
+   precede it and ended with a sync flush (the last with Z_FINISH), so the
+   pieces join into the one deflate stream of an ordinary gzip member.
+   The crc32s of the blocks are combined in order for the trailer.
+*/
+#define ZNZ_PGZ_BLOCK (1024 * 1024)
+#define ZNZ_PGZ_DICT 32768
+
+struct znz_pgz {
+  int level;
+  int nthreads;
+  int nfull;              /* blocks of the batch that are full     */
+  unsigned char **in;     /* nthreads blocks of uncompressed input  */
+  size_t *inlen;
+  unsigned char **out;    /* and their deflated forms               */
+  size_t *outlen;
+  size_t outsize;
+  uLong *blockcrc;
+  unsigned char dict[ZNZ_PGZ_DICT]; /* the last 32K already written */
+  size_t dictlen;
+  uLong crc;
+  unsigned long long total;
+  int error;
+};
+
+int znz_gzip_level(void)
+{
+  char *s = getenv("FS_GZIP_LEVEL");
+  int level;
+  if (s == NULL) return Z_DEFAULT_COMPRESSION;
+  level = atoi(s);
+  if (level < 1 || level > 9) return Z_DEFAULT_COMPRESSION;
+  return level;
+}
+
+static int znz_gzip_threads(void)
+{
+  char *s = getenv("FS_GZIP_THREADS");
+  if (s != NULL) return atoi(s);
+#ifdef HAVE_OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+static void znz_pgz_free(struct znz_pgz *pgz)
+{
+  int i;
+  if (pgz == NULL) return;
+  for (i = 0; i < pgz->nthreads; i++) {
+    if (pgz->in) free(pgz->in[i]);
+    if (pgz->out) free(pgz->out[i]);
+  }
+  free(pgz->in);
+  free(pgz->inlen);
+  free(pgz->out);
+  free(pgz->outlen);
+  free(pgz->blockcrc);
+  free(pgz);
+}
+
+static struct znz_pgz *znz_pgz_alloc(int nthreads, int level)
+{
+  struct znz_pgz *pgz;
+  int i;
+  pgz = (struct znz_pgz *)calloc(1, sizeof(struct znz_pgz));
+  if (pgz == NULL) return NULL;
+  pgz->level = level;
+  pgz->nthreads = nthreads;
+  /* deflateBound() does not count the 5 byte sync flush marker */
+  pgz->outsize = compressBound(ZNZ_PGZ_BLOCK) + 64;
+  pgz->in = (unsigned char **)calloc(nthreads, sizeof(unsigned char *));
+  pgz->out = (unsigned char **)calloc(nthreads, sizeof(unsigned char *));
+  pgz->inlen = (size_t *)calloc(nthreads, sizeof(size_t));
+  pgz->outlen = (size_t *)calloc(nthreads, sizeof(size_t));
+  pgz->blockcrc = (uLong *)calloc(nthreads, sizeof(uLong));
+  if (!pgz->in || !pgz->out || !pgz->inlen || !pgz->outlen || !pgz->blockcrc) {
+    znz_pgz_free(pgz);
+    return NULL;
+  }
+  for (i = 0; i < nthreads; i++) {
+    pgz->in[i] = (unsigned char *)malloc(ZNZ_PGZ_BLOCK);
+    pgz->out[i] = (unsigned char *)malloc(pgz->outsize);
+    if (!pgz->in[i] || !pgz->out[i]) {
+      znz_pgz_free(pgz);
+      return NULL;
+    }
+  }
+  pgz->crc = crc32(0L, Z_NULL, 0);
+  return pgz;
+}
+
+/* deflate block b of the batch; the last block of the file gets Z_FINISH */
+static int znz_pgz_deflate(struct znz_pgz *pgz, int b, int last)
+{
+  z_stream strm;
+  int ret;
+
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, pgz->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -1;
+  if (b == 0) {
+    if (pgz->dictlen > 0) deflateSetDictionary(&strm, pgz->dict, (uInt)pgz->dictlen);
+  }
+  else {
+    /* every block but the last of the file is full, so longer than 32K */
+    deflateSetDictionary(&strm, pgz->in[b - 1] + pgz->inlen[b - 1] - ZNZ_PGZ_DICT, ZNZ_PGZ_DICT);
+  }
+  strm.next_in = pgz->in[b];
+  strm.avail_in = (uInt)pgz->inlen[b];
+  strm.next_out = pgz->out[b];
+  strm.avail_out = (uInt)pgz->outsize;
+  ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+  pgz->outlen[b] = pgz->outsize - strm.avail_out;
+  deflateEnd(&strm);
+  if (strm.avail_in != 0 || (last ? ret != Z_STREAM_END : ret != Z_OK)) return -1;
+  pgz->blockcrc[b] = crc32(crc32(0L, Z_NULL, 0), pgz->in[b], (uInt)pgz->inlen[b]);
+  return 0;
+}
+
+/* compress and write the full blocks, and at the end the partial one too */
+static int znz_pgz_flush(struct znz_pgz *pgz, FILE *fp, int last)
+{
+  int b, nblocks, nerr = 0;
+
+  nblocks = pgz->nfull;
+  if (last && pgz->nfull < pgz->nthreads && pgz->inlen[pgz->nfull] > 0) nblocks++;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for num_threads(pgz->nthreads) schedule(dynamic, 1) reduction(+ : nerr)
+#endif
+  for (b = 0; b < nblocks; b++) {
+    if (znz_pgz_deflate(pgz, b, last && b == nblocks - 1)) nerr++;
+  }
+  if (nerr) return -1;
+
+  for (b = 0; b < nblocks; b++) {
+    size_t len = pgz->inlen[b];
+    if (fwrite(pgz->out[b], 1, pgz->outlen[b], fp) != pgz->outlen[b]) return -1;
+    pgz->crc = crc32_combine(pgz->crc, pgz->blockcrc[b], (z_off_t)len);
+    pgz->total += len;
+    if (len >= ZNZ_PGZ_DICT) {
+      memcpy(pgz->dict, pgz->in[b] + len - ZNZ_PGZ_DICT, ZNZ_PGZ_DICT);
+      pgz->dictlen = ZNZ_PGZ_DICT;
+    }
+    else if (len > 0) {
+      size_t keep = pgz->dictlen + len > ZNZ_PGZ_DICT ? ZNZ_PGZ_DICT - len : pgz->dictlen;
+      memmove(pgz->dict, pgz->dict + pgz->dictlen - keep, keep);
+      memcpy(pgz->dict + keep, pgz->in[b], len);
+      pgz->dictlen = keep + len;
+    }
+    pgz->inlen[b] = 0;
+  }
+  pgz->nfull = 0;
+
+  /* nothing was left for a final block, so end the stream with an empty one */
+  if (last && nblocks == 0) {
+    static const unsigned char empty[2] = {0x03, 0x00};
+    if (fwrite(empty, 1, 2, fp) != 2) return -1;
+  }
+  return 0;
+}
+
+static size_t znz_pgz_write(struct znz_pgz *pgz, FILE *fp, const void *buf, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)buf;
+  size_t left = len;
+
+  if (pgz->error) return 0;
+  while (left > 0) {
+    int b = pgz->nfull;
+    size_t n = ZNZ_PGZ_BLOCK - pgz->inlen[b];
+    if (n > left) n = left;
+    memcpy(pgz->in[b] + pgz->inlen[b], p, n);
+    pgz->inlen[b] += n;
+    p += n;
+    left -= n;
+    if (pgz->inlen[b] == ZNZ_PGZ_BLOCK && ++pgz->nfull == pgz->nthreads) {
+      if (znz_pgz_flush(pgz, fp, 0)) {
+        fprintf(stderr, "** ERROR: znzwrite failed to compress or write\n");
+        pgz->error = 1;
+        return len - left;
+      }
+    }
+  }
+  return len;
+}
+
+static int znz_pgz_close(struct znz_pgz *pgz, FILE *fp)
+{
+  unsigned char trailer[8];
+  int i;
+  if (pgz->error) return -1;
+  if (znz_pgz_flush(pgz, fp, 1)) return -1;
+  for (i = 0; i < 4; i++) {
+    trailer[i] = (unsigned char)(pgz->crc >> (8 * i));
+    trailer[4 + i] = (unsigned char)(pgz->total >> (8 * i));
+  }
+  if (fwrite(trailer, 1, 8, fp) != 8) return -1;
+  return 0;
+}
+
+static long znz_pgz_tell(struct znz_pgz *pgz)
+{
+  unsigned long long pos = pgz->total;
+  int b;
+  for (b = 0; b <= pgz->nfull && b < pgz->nthreads; b++) pos += pgz->inlen[b];
+  return (long)pos;
+}
+
+/* the parallel writer, when it is wanted for this compressed open */
+static znzFile znz_pgz_open(znzFile file, const char *path, const char *mode)
+{
+  static const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+  int nthreads, level;
+  const char *c;
+
+  if (strchr(mode, 'r') || strchr(mode, '+')) return NULL;
+  if (!strchr(mode, 'w') && !strchr(mode, 'a')) return NULL;
+  nthreads = znz_gzip_threads();
+  if (nthreads <= 1) return NULL;
+
+  level = znz_gzip_level();
+  for (c = mode; *c; c++)
+    if (*c >= '0' && *c <= '9') level = *c - '0';
+
+  file->pgz = znz_pgz_alloc(nthreads, level);
+  if (file->pgz == NULL) return NULL;
+  file->nzfptr = fopen(path, strchr(mode, 'a') ? "ab" : "wb");
+  if (file->nzfptr == NULL || fwrite(header, 1, 10, file->nzfptr) != 10) {
+    if (file->nzfptr) fclose(file->nzfptr);
+    file->nzfptr = NULL;
+    znz_pgz_free(file->pgz);
+    file->pgz = NULL;
+    return NULL;
+  }
+  return file;
+}
+
+#else
+
+int znz_gzip_level(void) { return -1; }
+
+#endif
+
 /* Note extra argument (use_compression) where
    use_compression==0 is no compression
    use_compression!=0 uses zlib (gzip) compression
@@ -62,11 +315,22 @@ znzFile znzopen(const char *path, const char *mode, int use_compression)
 #ifdef HAVE_ZLIB
   file->zfptr = NULL;
 
+  file->pgz = NULL;
+
   if (use_compression) {
     file->withz = 1;
-    if ((file->zfptr = gzopen(path, mode)) == NULL) {
-      free(file);
-      file = NULL;
+    if (znz_pgz_open(file, path, mode) == NULL) {
+      char zmode[32];
+      int level = znz_gzip_level();
+      /* gzopen() takes the level from the mode */
+      if (level >= 1 && strpbrk(mode, "0123456789") == NULL && strlen(mode) < sizeof(zmode) - 2)
+        sprintf(zmode, "%s%d", mode, level);
+      else
+        snprintf(zmode, sizeof(zmode), "%s", mode);
+      if ((file->zfptr = gzopen(path, zmode)) == NULL) {
+        free(file);
+        file = NULL;
+      }
     }
   }
   else {
@@ -112,6 +376,27 @@ znzFile znzdopen(int fd, const char *mode, int use_compression)
   return file;
 }
 
+znzFile znzmemopen(void *buf, size_t size)
+{
+  znzFile file;
+  file = (znzFile)calloc(1, sizeof(struct znzptr));
+  if (file == NULL) {
+    fprintf(stderr, "** ERROR: znzmemopen failed to alloc znzptr\n");
+    return NULL;
+  }
+  file->withz = 0;
+  /* fmemopen() may refuse a zero-length buffer */
+  if (size == 0)
+    file->nzfptr = fopen("/dev/null", "rb");
+  else
+    file->nzfptr = fmemopen(buf, size, "rb");
+  if (file->nzfptr == NULL) {
+    free(file);
+    return NULL;
+  }
+  return file;
+}
+
 int Xznzclose(znzFile *file)
 {
   int retval = 0;
@@ -120,9 +405,13 @@ int Xznzclose(znzFile *file)
     if ((*file)->zfptr != NULL) {
       retval = gzclose((*file)->zfptr);
     }
+    if ((*file)->pgz != NULL) {
+      retval = znz_pgz_close((*file)->pgz, (*file)->nzfptr);
+      znz_pgz_free((*file)->pgz);
+    }
 #endif
     if ((*file)->nzfptr != NULL) {
-      retval = fclose((*file)->nzfptr);
+      if (fclose((*file)->nzfptr) != 0) retval = EOF;
     }
 
     free(*file);
@@ -137,6 +426,7 @@ size_t znzread(void *buf, size_t size, size_t nmemb, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return 0;
   if (file->zfptr != NULL) return (size_t)(gzread(file->zfptr, buf, ((int)size) * ((int)nmemb)) / size);
 #endif
   return fread(buf, size, nmemb, file->nzfptr);
@@ -148,6 +438,7 @@ size_t znzwrite(void *buf, size_t size, size_t nmemb, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return size ? znz_pgz_write(file->pgz, file->nzfptr, buf, size * nmemb) / size : 0;
   if (file->zfptr != NULL) return (size_t)(gzwrite(file->zfptr, buf, size * nmemb) / size);
 #endif
   return fwrite(buf, size, nmemb, file->nzfptr);
@@ -159,6 +450,20 @@ long znzseek(znzFile file, long offset, int whence)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) {
+    /* like gzseek() on a file being written, only forward, filling with zeros */
+    long pos = znz_pgz_tell(file->pgz);
+    if (whence == SEEK_SET) offset -= pos;
+    else if (whence != SEEK_CUR) return -1;
+    if (offset < 0) return -1;
+    while (offset > 0) {
+      static const unsigned char zeros[4096];
+      size_t n = offset > (long)sizeof(zeros) ? sizeof(zeros) : (size_t)offset;
+      if (znz_pgz_write(file->pgz, file->nzfptr, zeros, n) != n) return -1;
+      offset -= n;
+    }
+    return znz_pgz_tell(file->pgz);
+  }
   if (file->zfptr != NULL) return (long)gzseek(file->zfptr, offset, whence);
 #endif
   return fseek(file->nzfptr, offset, whence);
@@ -170,6 +475,7 @@ int znzrewind(znzFile stream)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (stream->pgz != NULL) return -1;
   if (stream->zfptr != NULL) return gzrewind(stream->zfptr);
 #endif
   rewind(stream->nzfptr);
@@ -182,6 +488,7 @@ long znztell(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return znz_pgz_tell(file->pgz);
   if (file->zfptr != NULL) return (long)gztell(file->zfptr);
 #endif
   return ftell(file->nzfptr);
@@ -193,6 +500,10 @@ int znzputs(char *str, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) {
+    size_t len = strlen(str);
+    return znz_pgz_write(file->pgz, file->nzfptr, str, len) == len ? (int)len : -1;
+  }
   if (file->zfptr != NULL) return gzputs(file->zfptr, str);
 #endif
   return fputs(str, file->nzfptr);
@@ -204,6 +515,7 @@ char *znzgets(char *str, int size, znzFile file)
     return NULL;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return NULL;
   if (file->zfptr != NULL) return gzgets(file->zfptr, str, size);
 #endif
   return fgets(str, size, file->nzfptr);
@@ -215,6 +527,7 @@ int znzflush(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return 0; /* blocks are written as they fill */
   if (file->zfptr != NULL) return gzflush(file->zfptr, Z_SYNC_FLUSH);
 #endif
   return fflush(file->nzfptr);
@@ -226,6 +539,7 @@ int znzeof(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return 0;
   if (file->zfptr != NULL) return gzeof(file->zfptr);
 #endif
   return feof(file->nzfptr);
@@ -237,6 +551,10 @@ int znzputc(int c, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) {
+    unsigned char uc = (unsigned char)c;
+    return znz_pgz_write(file->pgz, file->nzfptr, &uc, 1) == 1 ? uc : -1;
+  }
   if (file->zfptr != NULL) return gzputc(file->zfptr, c);
 #endif
   return fputc(c, file->nzfptr);
@@ -248,6 +566,7 @@ int znzgetc(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return EOF;
   if (file->zfptr != NULL) return gzgetc(file->zfptr);
 #endif
   return fgetc(file->nzfptr);
@@ -266,7 +585,7 @@ int znzprintf(znzFile stream, const char *format, ...)
   }
   va_start(va, format);
 #ifdef HAVE_ZLIB
-  if (stream->zfptr != NULL) {
+  if (stream->zfptr != NULL || stream->pgz != NULL) {
     int size;                        /* local to HAVE_ZLIB block */
     size = strlen(format) + 1000000; /* overkill I hope */
     tmpstr = (char *)calloc(1, size);
@@ -275,7 +594,12 @@ int znzprintf(znzFile stream, const char *format, ...)
       return retval;
     }
     vsprintf(tmpstr, format, va);
-    retval = gzprintf(stream->zfptr, "%s", tmpstr);
+    if (stream->pgz != NULL) {
+      size_t len = strlen(tmpstr);
+      retval = znz_pgz_write(stream->pgz, stream->nzfptr, tmpstr, len) == len ? (int)len : -1;
+    }
+    else
+      retval = gzprintf(stream->zfptr, "%s", tmpstr);
     free(tmpstr);
   }
   else